@@ -0,0 +1,97 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    A module which uses the bloom filter index generated by dsextentindex
+    --bloom to pick out the extents that may contain particular values
+*/
+
+#ifndef __DATASERIES_BLOOMINDEXMODULE_H
+#define __DATASERIES_BLOOMINDEXMODULE_H
+
+#include <DataSeries/IndexSourceModule.hpp>
+#include <DataSeries/GeneralField.hpp>
+
+/** \brief Selects Extents that may contain particular values of a field.
+
+ * dsextentindex --bloom adds a DSIndex::Extent::Bloom::<type> extent to
+ * the index file with a bloom filter over the values of each of a set of
+ * fields for each indexed extent.  Unlike the min/max ranges, the
+ * filters work for values that are spread randomly across the extents,
+ * e.g. file handles or client addresses.  This module looks up one or
+ * more values of a field, and returns the extents whose filter may
+ * contain any of them in index order, i.e. sorted by filename and then
+ * extent offset.  A small fraction of the returned extents won't have
+ * the value, so the caller still needs to check each row. */
+class BloomIndexModule : public IndexSourceModule {
+  public:
+    /** selects extents where the filter for fieldname may contain value.
+        Integer values of any width match each other, e.g. an int64 value
+        will find an int32 field. */
+    BloomIndexModule(const std::string &index_filename,
+                     const std::string &index_type,
+                     const std::string &fieldname,
+                     const GeneralValue &value);
+
+    /** selects extents where the filter for fieldname may contain any of
+        values */
+    BloomIndexModule(const std::string &index_filename,
+                     const std::string &index_type,
+                     const std::string &fieldname,
+                     const std::vector<GeneralValue> &values);
+
+    virtual ~BloomIndexModule();
+
+    /** number of extents in the index */
+    size_t getIndexedExtents() const { return indexed_extents; }
+    /** number of extents that this module will return */
+    size_t getKeptExtents() const { return kept_extents.size(); }
+
+    struct kept_extent {
+        std::string filename;
+        ExtentType::int64 extent_offset;
+        kept_extent(const std::string &a, ExtentType::int64 b)
+            : filename(a), extent_offset(b) { }
+    };
+
+    // The filters; these are shared with dsextentindex, which builds them.
+
+    /** bits per distinct value, and bits set per value, used by
+        dsextentindex; gives about 1% false positives */
+    static const unsigned default_bits_per_value = 10;
+    static const unsigned default_nhashes = 7;
+
+    /** calculate the hash of a value that the filter is built from;
+        integers hash the same regardless of their width */
+    static uint64_t hashValue(const GeneralValue &v);
+
+    /** build a filter over the value hashes with bits_per_value bits per
+        distinct hash and nhashes bits set per hash; sorts hashes */
+    static void makeFilter(std::vector<uint64_t> &hashes, unsigned bits_per_value,
+                           unsigned nhashes, std::string &filter);
+
+    /** true if a value with this hash may have been added to filter */
+    static bool mayContain(const std::string &filter, uint64_t hash, unsigned nhashes);
+
+  protected:
+    virtual void lockedResetModule();
+
+    virtual PrefetchExtent *lockedGetCompressedExtent();
+
+  private:
+    void init(const std::string &index_filename, const std::string &fieldname,
+              const std::vector<GeneralValue> &values);
+
+    std::vector<kept_extent> kept_extents;
+    size_t indexed_extents;
+    const std::string index_type;
+    unsigned cur_extent;
+    DataSeriesSource *cur_source;
+    std::string cur_source_filename;
+};
+
+#endif
@@ -103,6 +103,35 @@ class DSExpr : boost::noncopyable {
 
     virtual void dump(std::ostream &) = 0;
 
+    /// Which rows of an extent a predicate selected; bit i is for row i.
+    typedef std::vector<bool> Selection;
+
+    /// Evaluate this expression as a predicate, i.e. valBool(), over every row of the current
+    /// extent of series, setting selected[i] for row i; the position of series is left
+    /// unchanged.  series must be the series the expression's fields are bound to.  The default
+    /// steps series through the extent calling valBool(); expressions made over a single series
+    /// compile the predicate into a flat program over the raw records of each ExtentType and
+    /// evaluate it a block of rows at a time.
+    virtual void selectRows(ExtentSeries &series, Selection &selected);
+
+    /// Evaluate this expression as a number, i.e. valDouble(), over every row of the current
+    /// extent of series, setting values[i] for row i; the position of series is left unchanged.
+    /// As for selectRows, series must be the series the expression's fields are bound to, and
+    /// expressions made over a single series are compiled when possible.
+    virtual void valuesDouble(ExtentSeries &series, std::vector<double> &values);
+
+    /// Looks up the range of values that a field takes over some set of rows, with nulls counted
+    /// as 0; returns false if the range isn't known.
+    typedef boost::function<bool (const std::string &field_name, double &min, double &max)>
+        FieldRange;
+
+    /// Returns false only if this expression, as a predicate, can't be true for any row whose
+    /// fields are within the ranges given by field_range, e.g. to skip whole extents using the
+    /// stats written by DataSeriesSink::setExtentStats.  The default always returns true.
+    virtual bool mayMatch(const FieldRange &field_range) {
+        return true;
+    }
+
     /// Make an expression over a single series.
     static DSExpr *make(ExtentSeries &series, const std::string &expr_string) {
         boost::scoped_ptr<DSExprParser> parser(DSExprParser::MakeDefaultParser());
@@ -17,33 +17,48 @@
 
 #include <DataSeries/DSExpr.hpp>
 #include <DataSeries/GeneralField.hpp>
-#include <DataSeries/RowAnalysisModule.hpp>
+#include <DataSeries/ParallelRowAnalysisModule.hpp>
 
-class DSStatGroupByModule : public RowAnalysisModule {
+/** \brief Calculates a statistic over an expression, grouped by the value of a field.
+
+ * The stattype is basic (count, mean, stddev, min, max), quantile
+ * (StatsQuantile) or approx-quantile (QuantileSketch).  The rows are
+ * split across nthreads worker threads, each of which evaluates the
+ * expression over whole extents and keeps its own table of groups; the
+ * tables are merged once the source is done.  StatsQuantile can't be
+ * merged, so quantile always uses a single worker; approx-quantile gives
+ * the same answer however the rows are split, and uses bounded memory per
+ * group. */
+class DSStatGroupByModule : public ParallelRowAnalysisModule {
   public:
     DSStatGroupByModule(DataSeriesModule &source,
                         const std::string &expression,
                         const std::string &groupby,
                         const std::string &stattype = "basic",
                         const std::string &whereexpr = "",
-                        ExtentSeries::typeCompatibilityT tc = ExtentSeries::typeExact);
+                        ExtentSeries::typeCompatibilityT tc = ExtentSeries::typeExact,
+                        unsigned nthreads = 1);
 
     typedef HashMap<GeneralValue, Stats *> mytableT;
 
     virtual ~DSStatGroupByModule();
     
-    virtual void prepareForProcessing();
-    virtual void processRow();
+    virtual void firstExtent(const Extent &e);
+    virtual Worker *makeWorker();
+    virtual void merge(Worker &worker);
     virtual void printResult();
 
     /// return true if the specified stat_type is valid for constructing a
     /// DSStatGroupByModule.
     static bool validStatType(const std::string &stat_type);
+
+    /// a new, empty statistic of stat_type
+    static Stats *makeStats(const std::string &stat_type);
   private:
     mytableT mystats;
     std::string expression, groupby_name, stattype;
-    GeneralField *groupby;
-    DSExpr *expr;
+    ExtentSeries::typeCompatibilityT type_compatibility;
+    ExtentType::Ptr type;
 };
 
 #endif
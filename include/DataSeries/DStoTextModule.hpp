@@ -12,10 +12,14 @@
 #ifndef __DSTOTEXTMODULE_H
 #define __DSTOTEXTMODULE_H
 
+#include <Lintel/Deque.hpp>
+#include <Lintel/PThread.hpp>
+
 #include <DataSeries/DataSeriesModule.hpp>
 
 class DSExpr;
 class GeneralField;
+class RowTextFormatter;
 
 /** \brief Writes Extents to a file as they go flying past. */
 class DStoTextModule : public DataSeriesModule {
@@ -62,9 +66,18 @@ class DStoTextModule : public DataSeriesModule {
     
     void setHeaderOnlyOnce();
 
+    /** Format the rows of extents on nthreads threads, writing the text
+        in the order of the extents.  The text may lag behind the
+        extents returned by getSharedExtent() until it returns NULL.
+        Types with a field printed relative to the first row are still
+        formatted on the calling thread, as is output to an ostream. */
+    void setFormatThreads(unsigned nthreads);
+
     // need to keep around state because relative printing should be
     // done relative to the first row of the first extent, not the
     // first row of each extent.
+    struct FormatFields;
+
     struct PerTypeState {
         PerTypeState();
         ~PerTypeState();
@@ -76,10 +89,17 @@ class DStoTextModule : public DataSeriesModule {
         std::vector<GeneralField *> fields;
         std::string where_expr_str;
         DSExpr *where_expr;
+        std::vector<bool> selected; // where_expr over the current extent
+        RowTextFormatter *formatter; // for fields, when writing to a FILE
+        std::vector<FormatFields *> thread_fields; // one per format thread, once used
     };
 
     uint64_t processed_rows, ignored_rows;
 
+    /// \cond INTERNAL_ONLY
+    void formatThread(unsigned thread_num);
+    /// \endcond
+
   private:
     static xmlNodePtr parseXML(std::string xml, const std::string &roottype);
 
@@ -91,11 +111,19 @@ class DStoTextModule : public DataSeriesModule {
 
     void getExtentPrintSpecs(PerTypeState &state);
 
-    // Also initializes state.fields if necessary.
-    void getExtentPrintHeaders(PerTypeState &state);
+    // Appends the headers to to.  Also initializes state.fields if necessary.
+    void getExtentPrintHeaders(PerTypeState &state, std::string &to);
 
     // Intiailizes state.where_expr if necessary.
     void getExtentParseWhereExpr(PerTypeState &state);
+
+    struct FormatJob;
+
+    void writeText(const std::string &text);
+    void queueFormatJob(FormatJob *job);
+    // Write out the finished jobs at the front of the queue, and then more until at most
+    // max_jobs are left
+    void writeFormatJobs(PThreadScopedLock &lock, size_t max_jobs);
                                
     DataSeriesModule &source;
     std::ostream *stream_text_dest;
@@ -109,6 +137,13 @@ class DStoTextModule : public DataSeriesModule {
     std::string separator; 
     bool header_only_once;
     bool header_printed;
+
+    unsigned format_threads;
+    std::vector<PThread *> threads;
+    PThreadMutex mutex;
+    PThreadCond format_cond, formatted_cond;
+    Deque<FormatJob *> to_format, in_order;
+    bool stop_formatting;
 };
 
 #endif
@@ -12,7 +12,10 @@
     Class for writing DataSeries files.
 */
 
+#include <algorithm>
+
 #include <Lintel/Deque.hpp>
+#include <Lintel/Double.hpp>
 #include <Lintel/HashUnique.hpp>
 #include <Lintel/PThread.hpp>
 
@@ -128,13 +131,45 @@ class DataSeriesSink : public dataseries::IExtentSink {
         worker_info.setMaxBytesInProgress(mutex, nbytes);
     }
 
+    /** Record the number of rows, number of nulls, and minimum and maximum value of every bool,
+        byte, int32, int64 and double column of each extent written, in a "DataSeries:
+        ExtentStats" extent written just before the index.  TypeIndexModule::setPredicate uses
+        these to skip extents without reading them.  Must be called before writeExtentLibrary,
+        which adds the stats type to the library so older readers can still decode the file. */
+    void setExtentStats(bool enable = true);
+
   private:
+    // The range of one column of an extent; see setExtentStats.
+    struct ColumnStats {
+        ColumnStats(const std::string &column, int32_t rows)
+            : column(column), rows(rows), nulls(0), nan(false), min(Double::Inf),
+              max(-Double::Inf) { }
+        void add(double v) {
+            if (v != v) {
+                nan = true;
+            } else {
+                min = std::min(min, v);
+                max = std::max(max, v);
+            }
+        }
+        bool haveRange() const {
+            return !nan && nulls < rows;
+        }
+
+        std::string column;
+        int32_t rows, nulls;
+        bool nan;
+        double min, max;
+    };
+    static void computeColumnStats(const Extent &e, std::vector<ColumnStats> &column_stats);
+
     struct ToCompress {
         Extent::Ptr extent;
         Stats *to_update;
         bool in_progress;
         uint32_t checksum;
         Extent::ByteArray compressed;
+        std::vector<ColumnStats> column_stats; // empty unless extent stats are enabled
         ToCompress(Extent::Ptr e, Stats *_to_update)
                 : extent(e), to_update(_to_update), in_progress(false), checksum(0) 
         { }
@@ -147,20 +182,40 @@ class DataSeriesSink : public dataseries::IExtentSink {
         }
     };
 
+    // The compression trials of one extent being packed, shared out to idle
+    // compressor threads so that a single extent isn't packed one algorithm
+    // after another.  Protected by the sink mutex.
+    class CompressTrials : public Extent::CompressRunner {
+      public:
+        CompressTrials(DataSeriesSink &sink) 
+            : sink(sink), tasks(), next(0), remaining(0), helper_time(0) { }
+        virtual ~CompressTrials() { }
+        virtual void runAll(const std::vector<Extent::CompressTask *> &tasks);
+        Extent::CompressTask *lockedTakeTask();
+
+        DataSeriesSink &sink;
+        std::vector<Extent::CompressTask *> tasks;
+        size_t next; // next task to start
+        size_t remaining; // tasks not yet finished
+        double helper_time; // cpu time spent on tasks by other threads
+    };
+
     // Structure for shared information among all workers.
     struct WorkerInfo {
         // protected by the standard mutex, users should have separate access to it.
         bool keep_going;
         size_t bytes_in_progress, max_bytes_in_progress;
         Deque<ToCompress *> pending_work;
+        std::vector<CompressTrials *> trials; // ones with tasks left to start
 
         std::vector<PThread *> compressors;
         PThread *writer;
         PThreadCond available_queue_cond, available_work_cond, available_write_cond;
+        PThreadCond trial_done_cond;
         WorkerInfo(size_t max_bytes_in_progress)
         : keep_going(false), bytes_in_progress(0), max_bytes_in_progress(max_bytes_in_progress),
-          pending_work(), compressors(), writer(), available_queue_cond(),
-          available_work_cond(), available_write_cond()
+          pending_work(), trials(), compressors(), writer(), available_queue_cond(),
+          available_work_cond(), available_write_cond(), trial_done_cond()
         { }
 
         bool canQueueWork() {
@@ -177,7 +232,7 @@ class DataSeriesSink : public dataseries::IExtentSink {
 
         bool isQuiesced() {
             return !keep_going && bytes_in_progress == 0 && pending_work.empty()
-                    && compressors.empty() && writer == NULL;
+                    && trials.empty() && compressors.empty() && writer == NULL;
         }
     };
 
@@ -191,19 +246,31 @@ class DataSeriesSink : public dataseries::IExtentSink {
         Int64Field field_extentOffset;
         Variable32Field field_extentType;
         ExtentWriteCallback extent_write_callback;
+        ExtentSeries stats_series; // has an extent once a ToCompress with column_stats is written
+        Int64Field stats_offset;
+        Variable32Field stats_column;
+        Int32Field stats_rows, stats_nulls;
+        DoubleField stats_min, stats_max;
 
         WriterInfo()
                 : fd(-1), wrote_library(false), in_callback(false), cur_offset(-1), chained_checksum(0),
                   index_series(ExtentType::getDataSeriesIndexTypeV0Ptr()), 
                   field_extentOffset(index_series,"offset"),
                   field_extentType(index_series,"extenttype"), 
-                  extent_write_callback()
+                  extent_write_callback(),
+                  stats_series(ExtentType::getDataSeriesExtentStatsTypePtr()),
+                  stats_offset(stats_series, "offset"), stats_column(stats_series, "column"),
+                  stats_rows(stats_series, "rows"), stats_nulls(stats_series, "nulls"),
+                  stats_min(stats_series, "min", Field::flag_nullable),
+                  stats_max(stats_series, "max", Field::flag_nullable)
         { }
+        void addColumnStats(const std::vector<ColumnStats> &column_stats);
         void writeOutPending(PThreadScopedLock &lock, WorkerInfo &worker_info);
         void checkedWrite(const void *buf, int bufsize);
         bool isQuiesced() {
             return fd == -1 && wrote_library == false && cur_offset == -1
-                    && !index_series.hasExtent() && chained_checksum == 0;
+                    && !index_series.hasExtent() && !stats_series.hasExtent()
+                    && chained_checksum == 0;
         }
     };
 
@@ -214,6 +281,7 @@ class DataSeriesSink : public dataseries::IExtentSink {
 
     void queueWriteExtent(Extent::Ptr e, Stats *to_update);
     void lockedProcessToCompress(PThreadScopedLock &lock, ToCompress *work);
+    void lockedHelpCompressTrial(PThreadScopedLock &lock);
 
     static int compressor_count;
 
@@ -223,6 +291,7 @@ class DataSeriesSink : public dataseries::IExtentSink {
                lintel::SharedPointerEqual<const ExtentType> > valid_types;
     const int compression_modes;
     const int compression_level;
+    bool extent_stats;
 
     WriterInfo writer_info;
     WorkerInfo worker_info;
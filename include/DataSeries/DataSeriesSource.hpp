@@ -12,6 +12,9 @@
 #ifndef DATASERIES_SOURCE_H
 #define DATASERIES_SOURCE_H
 
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
 #include <DataSeries/Extent.hpp>
 
 /** \brief Reads Extents from a DataSeries file.
@@ -19,6 +22,30 @@
  **/
 class DataSeriesSource {
   public:
+    typedef ExtentType::byte byte;
+
+    /** \brief A read-only memory mapping of an entire DataSeries file.
+
+        Shared so that compressed extents which point into the mapping can
+        outlive the DataSeriesSource that created it; the file is unmapped
+        when the last reference goes away. */
+    class MappedFile : boost::noncopyable {
+      public:
+        typedef boost::shared_ptr<MappedFile> Ptr;
+
+        MappedFile(int fd, size_t size, const std::string &filename);
+        ~MappedFile();
+
+        byte *begin() const { return data; }
+        size_t size() const { return data_size; }
+
+        /** Tell the kernel that [offset, offset+len) will be read soon. */
+        void adviseWillNeed(off64_t offset, size_t len);
+      private:
+        byte *data;
+        size_t data_size;
+    };
+
     /** Opens the specified file and reads its @c ExtentTypeLibary and
         its index @c Extent. Sets the current offset to the first @c
         Extent in the file.  Optionally does not read extentIndex at
@@ -69,6 +96,35 @@ class DataSeriesSource {
         return Extent::preadExtent(fd,offset, bytes, need_bitflip);
     }
 
+    /** Returns true if mapCompressed() can be used.  Mapped extents are
+        unpacked in place, which is only possible if the file has the same
+        endianness as the host. */
+    bool canMapCompressed() { return !need_bitflip; }
+
+    /** Locates the raw Extent at the specified offset in a memory mapping
+        of the file rather than copying it into a @c ByteArray.  On success
+        sets begin and size to the packed Extent, updates offset to the
+        offset of the next Extent, and returns the mapping, which must be
+        kept alive for as long as begin is in use.  Returns a null pointer
+        at the end of the file.  Each located extent is passed to
+        MappedFile::adviseWillNeed, so readahead follows the order in which
+        the caller visits the extents rather than the order in the file.
+
+        Preconditions:
+        - offset is the offset of an Extent within the file, or is equal
+        to the size of the file.
+        - canMapCompressed()
+        - isactive() */
+    MappedFile::Ptr mapCompressed(off64_t &offset, byte *&begin, size_t &size);
+
+    /** Returns a duplicate of the file descriptor, for reading from the
+        file after this source may have been closed or deleted.  The caller
+        must close the returned descriptor.
+
+        Preconditions:
+        - isactive() */
+    int dupFd();
+
     /** Returns true if the file is currently open. */
     bool isactive() { return fd >= 0; }
 
@@ -120,8 +176,8 @@ class DataSeriesSource {
     ExtentTypeLibrary mylibrary;
 
     const std::string filename;
-    typedef ExtentType::byte byte;
     int fd;
+    MappedFile::Ptr mapping; // NULL until the first mapCompressed()
     off64_t cur_offset;
     bool need_bitflip, read_index, check_tail;
     int64_t mtime_nanosec;
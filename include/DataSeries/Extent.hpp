@@ -22,6 +22,7 @@ extern "C" {
 #include <unistd.h>
 #include <inttypes.h>
 #include <cstring>
+#include <vector>
 
 #if defined(__linux__) && defined(__GNUC__) && __GNUC__ >= 2 
 #  ifdef __i386__
@@ -246,6 +247,23 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     static const int compress_all = ~( INT_MIN >> ( sizeof(INT_MIN)*8 - num_comp_algs ) );
 
 
+    /** One compression algorithm tried on one section of an extent by
+        packData(). */
+    class CompressTask {
+      public:
+        virtual ~CompressTask() { }
+        virtual void run() = 0;
+    };
+
+    /** Lets packData() run its independent compression trials in parallel,
+        e.g. on the threads of a DataSeriesSink.  runAll() has to run each
+        of the tasks exactly once, and return once all of them are done. */
+    class CompressRunner {
+      public:
+        virtual ~CompressRunner() { }
+        virtual void runAll(const std::vector<CompressTask *> &tasks) = 0;
+    };
+
     /** \defgroup Extent_compress Extent::compress
         The compress_flag ints are used to indicate which compression
         algorithms will be tried when converting an Extent
@@ -274,6 +292,8 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
         the pre-compression size in bytes of the fixed size records.
         \arg variable_packed If variable_packed is not null, *variable_packed
         will recieve the pre-compression size of the string pool.
+        \arg runner If runner is not null, the compression trials are handed
+        to it rather than run one after another.
     
         \return a "checksum" calculated from the underlying checksums in the packed extent */
     uint32_t packData(Extent::ByteArray &into, 
@@ -281,7 +301,8 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
                       uint32_t compression_level = 9,
                       uint32_t *header_packed = NULL, 
                       uint32_t *fixed_packed = NULL, 
-                      uint32_t *variable_packed = NULL); 
+                      uint32_t *variable_packed = NULL,
+                      CompressRunner *runner = NULL); 
 
     /** Loads an Extent from the external representation.
 
@@ -295,6 +316,12 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
         input data */
     void unpackData(Extent::ByteArray &from, bool need_bitflip);
 
+    /** Same as above, but unpacks from a raw buffer, for example one that
+        points directly into a memory mapped file.  If need_bitflip is
+        true, the header at from will be modified in place, so the buffer
+        has to be writable in that case. */
+    void unpackData(byte *from, size_t from_size, bool need_bitflip);
+
     /** Returns true if position is inside the fixed data for this extent, otherwise false */
     bool insideExtentFixed(byte *position) const {
         return position >= fixeddata.begin() && position < fixeddata.end();
@@ -317,6 +344,8 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
                                  const ExtentType &type) FUNC_DEPRECATED {
         return unpackedSize(from, need_bitflip, type.shared_from_this());
     }
+    static uint32_t unpackedSize(const byte *from, size_t from_size, bool need_bitflip,
+                                 const ExtentType::Ptr type);
     
     /** Returns the name of the type of the Extent stored in @param from
         
@@ -325,15 +354,16 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
         Preconditions:
         - from must be in the external representation of Extents. */
     static const std::string getPackedExtentType(const Extent::ByteArray &from);
+    static const std::string getPackedExtentType(const byte *from, size_t from_size);
 
     /** All of the pack and unpack functions should be used only through pointers
         which are entered into the compression_alg[] array, and called in
-        compressBytes() or uncompressBytes() */
+        packData() or uncompressBytes() */
 
     /// \cond INTERNAL_ONLY
     // most pack routines return false if packing the data with a 
     // particular compression algorithm wouldn't gain anything over leaving
-    // the data uncompressed (compressBytes does an overall check for this
+    // the data uncompressed (packData does an overall check for this
     // after compression; if into.size > 0, will only code up to that size
     // for the BZ2 and Zlib packing options (LZO doesn't allow this)
     static bool packBZ2(byte *input, int32 inputsize, 
@@ -394,6 +424,19 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     }
     /// \endcond
         
+    // size of the fixed prefix of a packed extent, enough to determine the
+    // size of the entire packed extent via packedExtentSize()
+    static const int packed_prefix_size = 6*4 + 4*1;
+
+    // bits of the flags byte in the packed extent header (the byte after the
+    // type name length); see doc/file-format.txt.  Readers reject unknown bits.
+    static const byte packed_flag_fixed_columns = 1;
+    static const byte packed_flags_known = packed_flag_fixed_columns;
+
+    // returns the total size of the packed extent starting with prefix, or
+    // -1 if prefix is the file tail; aborts if the sizes are corrupt
+    static int64_t packedExtentSize(byte *prefix, bool need_bitflip);
+
     // returns true if it successfully read the extent; returns false 
     // on eof (with into.size() == 0); aborts otherwise
     // updates offset to the end of the extent
@@ -420,6 +463,37 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     // if it hasn't already been called.
     static void setReadChecksFromEnv(bool default_with_env_unset = false);
 
+    /** How packData() chooses among the enabled compression algorithms for
+        the fixed and variable sections of an extent.  Exhaustive tries every
+        enabled algorithm on every extent.  Adaptive remembers, separately for
+        each extent type and section, which algorithm won; it tries all of
+        them on the first extents, every sample_interval extents after that,
+        and whenever the winner starts compressing noticeably worse than it
+        used to, and otherwise only runs the last winner. */
+    enum CompressSelect { CompressSelectExhaustive, CompressSelectAdaptive };
+
+    /** What winning means.  Size picks the smallest result.  TimeSize picks
+        the smallest decompression-seconds * compressed-bytes.  Weighted picks
+        the smallest time_weight * decompression-seconds + size_weight *
+        compressed-bytes; the default weights trade one second against
+        100MB, i.e. a 100MB/s disk.  The time based costs decompress every
+        candidate to time it.  Leaving a section uncompressed is only chosen
+        if no algorithm makes it smaller, whatever the cost function. */
+    enum CompressCost { CompressCostSize, CompressCostTimeSize, CompressCostWeighted };
+
+    /** Set the selection policy for the whole process; defaults to
+        exhaustive with the size cost, as DataSeries always did. */
+    static void setCompressSelect(CompressSelect select, unsigned sample_interval = 32);
+    static void setCompressCost(CompressCost cost, double time_weight = 1.0,
+                                double size_weight = 1.0e-8);
+
+    // set the environment variables to:
+    // DATASERIES_COMPRESS_SELECT=exhaustive|adaptive[:sample-interval]
+    // DATASERIES_COMPRESS_COST=size|time-size|weighted[:time-weight:size-weight]
+    // This function is automatically called before packing the first extent
+    // if neither it nor the set functions have been called.
+    static void setCompressSelectFromEnv();
+
     /// \cond INTERNAL_ONLY
     // be smart before directly accessing these!  here because making
     // them private and using friend class ExtentSeries::iterator
@@ -445,16 +519,18 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
 
   private:
     // you are responsible for deleting the return buffer
-    static Extent::ByteArray *compressBytes(byte *input, int32 input_size,
-                                            int compression_modes,
-                                            int compression_level, byte *mode);
-
     static int32 uncompressBytes(byte *into, byte *from,
                                  byte compression_mode, int32 intosize,
                                  int32 fromsize);
 
     void compactNulls(Extent::ByteArray &fixed_coded);
     void uncompactNulls(Extent::ByteArray &fixed_coded, int32_t &size);
+    // convert between the in memory row layout and the columnar layout of
+    // ExtentType::FixedLayoutColumns
+    static void fixedRowsToColumns(const ExtentType &type, const byte *rows, byte *columns,
+                                   uint32_t nrecords);
+    static void fixedColumnsToRows(const ExtentType &type, const byte *columns, byte *rows,
+                                   uint32_t nrecords);
     friend class ExtentSeries;
     void createRecords(unsigned int nrecords); // will leave iterator pointing at the current record
     void init();
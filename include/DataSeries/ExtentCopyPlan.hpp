@@ -0,0 +1,114 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    A compiled plan for copying fields between the rows of extents of two types
+*/
+
+#ifndef DATASERIES_EXTENTCOPYPLAN_HPP
+#define DATASERIES_EXTENTCOPYPLAN_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <DataSeries/Extent.hpp>
+#include <DataSeries/SEP_RowOffset.hpp>
+
+/** \brief Copies fields between the rows of extents of two types without
+    going through a GeneralField for each value.
+
+ * The plan is compiled once for a source type, a destination type and
+ * the pairs of source and destination fields to copy.  Fixed size values
+ * that are laid out the same way in both types are grouped into runs
+ * copied with one memcpy each, booleans and null flags are copied a bit
+ * at a time, and variable32 values are copied straight into the
+ * destination's variable data, with one resize per batch of rows.  A
+ * field can only be copied this way if it has the same type, size and
+ * double base in both types, and a nullable field can only be copied to
+ * a nullable one; otherwise supported() is false and the caller has to
+ * fall back to GeneralField, which converts between types. */
+class ExtentCopyPlan {
+  public:
+    /** source field name, destination field name */
+    typedef std::vector<std::pair<std::string, std::string> > FieldPairs;
+
+    /** plan copying each of fields from source_type to dest_type */
+    ExtentCopyPlan(const ExtentType::Ptr &source_type, const ExtentType::Ptr &dest_type,
+                   const FieldPairs &fields);
+
+    /** plan copying each field of dest_type from the field of the same
+        name in source_type */
+    ExtentCopyPlan(const ExtentType::Ptr &source_type, const ExtentType::Ptr &dest_type);
+
+    /** true if the plan can copy all of its fields */
+    bool supported() const { return unsupported_field.empty(); }
+
+    /** the first field the plan can not copy, empty if supported() */
+    const std::string &unsupportedField() const { return unsupported_field; }
+
+    /** copy the fields of the row at source_row in source to the
+        existing row at dest_row in dest */
+    void copyRow(const Extent &source, const uint8_t *source_row,
+                 Extent &dest, uint8_t *dest_row) const;
+
+    /** copy the fields of the row at source_row in source to the
+        existing row at dest_row in dest */
+    void copyRow(const Extent &source, const dataseries::SEP_RowOffset &source_row,
+                 Extent &dest, const dataseries::SEP_RowOffset &dest_row) const {
+        copyRow(source, source_row.rowPos(source), dest, dest_row.rowPos(dest));
+    }
+
+    /** append to dest a copy of each row of source for which selected is
+        true, or of every row if selected is NULL; returns the number of
+        rows appended.  Fields of dest that are not copied are zero, as
+        after ExtentSeries::newRecord(), which also means that any
+        ExtentSeries on dest has to be restarted. */
+    size_t appendRows(const Extent &source, const std::vector<bool> *selected,
+                      Extent &dest) const;
+
+  private:
+    struct ByteRun {
+        ByteRun(int32_t source_offset, int32_t dest_offset, int32_t size)
+            : source_offset(source_offset), dest_offset(dest_offset), size(size) { }
+        bool operator <(const ByteRun &rhs) const {
+            return source_offset < rhs.source_offset;
+        }
+        int32_t source_offset, dest_offset, size;
+    };
+
+    struct Bit {
+        Bit(int32_t offset, int bitpos) : offset(offset), mask(1 << bitpos) { }
+        int32_t offset;
+        uint8_t mask;
+    };
+
+    void init(const FieldPairs &fields);
+    void addField(const std::string &source_field, const std::string &dest_field);
+    Bit bit(const ExtentType &type, const std::string &field) const;
+
+    // copy the fixed part of the row; the variable32 offsets are copied as is
+    void copyFixed(const uint8_t *source_row, uint8_t *dest_row) const;
+
+    // bytes of variable data needed for the variable32 values of a row
+    size_t varBytes(const Extent &source, const uint8_t *source_row) const;
+
+    // copy the variable32 values of a row to dest starting at var_pos, which is advanced
+    void copyVars(const Extent &source, const uint8_t *source_row,
+                  Extent &dest, uint8_t *dest_row, size_t &var_pos) const;
+
+    const ExtentType::Ptr source_type, dest_type;
+    std::string unsupported_field;
+    bool whole_row; // same type, every field copied to itself; runs is the whole fixed row
+
+    std::vector<ByteRun> runs;
+    std::vector<std::pair<Bit, Bit> > bits; // source, dest
+    std::vector<Bit> clear_bits; // null flags of nullable dest fields whose source can't be null
+    std::vector<std::pair<int32_t, int32_t> > vars; // source, dest offsets of variable32 fields
+};
+
+#endif
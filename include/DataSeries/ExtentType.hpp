@@ -168,6 +168,23 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         FieldOrderingBigToSmallSepVar32,
     };
 
+    /** \brief Specifies how the fixed size records are laid out when an
+        Extent is packed.
+
+        Set with pack_fixed_layout="columns"; it is recorded in the header of
+        each packed extent, so readers do not depend on the option.  Cannot
+        be combined with pack_null_compact. */
+    enum PackFixedLayout {
+        /** Compress the records one after another, as they are in memory;
+            the default option. */
+        FixedLayoutRows,
+        /** Compress all the values of the first column, then all the values
+            of the second, and so on.  Adjacent values of a column tend to be
+            similar, e.g. timestamps and ids, so this usually compresses
+            better and faster for wide records. */
+        FixedLayoutColumns
+    };
+
     /** Returns the type of the Extent that stores the XML descriptions
         of all the ExtentTypes used in a DataSeries file. */
     static const ExtentType::Ptr getDataSeriesXMLTypePtr() {
@@ -183,6 +200,13 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
     static const ExtentType &getDataSeriesIndexTypeV0() FUNC_DEPRECATED {
         return *dataseries_index_type_v0;
     }
+    /** Returns the type of the optional extent near the end of a
+        DataSeries file that records the range and null count of each
+        numeric column of each extent; see
+        DataSeriesSink::setExtentStats. */
+    static const ExtentType::Ptr getDataSeriesExtentStatsTypePtr() {
+        return dataseries_extent_stats_type;
+    }
 
 
     // we have visible and invisible fields; visible fields are
@@ -344,6 +368,10 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
     PackNullCompact getPackNullCompact() const { 
         return rep.pack_null_compact; 
     }
+    /** Returns how the fixed records are laid out when writing to a file. */
+    PackFixedLayout getPackFixedLayout() const {
+        return rep.fixed_layout;
+    }
     /** Returns the name of the ExtentType. This corresponds the the "name"
         attribute in the XML. */
     const std::string &getName() const { return rep.name; }
@@ -372,6 +400,13 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
                             null_offset(0), null_bitmask(0) { }
     };
 
+    // byte range of one column of the fixed records for columnar packing;
+    // bool fields and padding become single byte columns.
+    struct fixedColumn {
+        int32 offset, size;
+        fixedColumn(int32 offset, int32 size) : offset(offset), size(size) { }
+    };
+
     struct fieldInfo {
         std::string name;
         fieldType type;
@@ -397,6 +432,7 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
   private:
     static const ExtentType::Ptr dataseries_xml_type;
     static const ExtentType::Ptr dataseries_index_type_v0;
+    static const ExtentType::Ptr dataseries_extent_stats_type;
 
     // a compelling case has been made that identifying fields by
     // column number is not necessary (the only use so far is for
@@ -466,6 +502,11 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         PackNullCompact pack_null_compact;
         PackPadRecord pad_record;
         PackFieldOrdering field_ordering;
+        PackFixedLayout fixed_layout;
+        std::vector<fixedColumn> fixed_columns; // in offset order, covering the record
+        // offsets of the 4 and 8 byte values to byte swap when unpacking an
+        // extent written on a machine of the other endianness
+        std::vector<int32> flip4_offsets, flip8_offsets;
         void sortAssignNCI(std::vector<nullCompactInfo> &nci);
 
         ~ParsedRepresentation() {
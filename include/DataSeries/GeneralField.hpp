@@ -303,6 +303,7 @@ class GeneralField {
     }
     ExtentType::fieldType gftype;
     friend class GeneralValue;
+    friend class RowTextFormatter;
     GeneralField(ExtentType::fieldType gftype, Field &typed_field)
             : gftype(gftype), csv_enabled(false), typed_field(typed_field) { }
     bool csv_enabled;
@@ -520,6 +521,8 @@ class GF_FixedWidth : public GeneralField {
     virtual void set(Extent &e, uint8_t *row_pos, const GeneralValue &from);
 };
 
+class ExtentCopyPlan;
+
 /** \brief Copies records from one @c Extent to another.
 
     \todo TODO: add an output module as an optional argument; if it exists, 
@@ -557,6 +560,8 @@ class ExtentRecordCopy {
     ExtentSeries &source, &dest;
     std::vector<GeneralField *> sourcefields, destfields; // all fields here if f_c_s == 0
     std::vector<Variable32Field *> sourcevarfields, destvarfields; // only used if fixed_copy_size >0
+    // if f_c_s == 0 and the fields can be copied without conversion, used instead of *fields
+    ExtentCopyPlan *plan;
 };
 
 #endif
@@ -57,7 +57,11 @@
 // compressed reading would be a good idea.  With large disk subsystem
 // machines, and the really many cores we have now, it is not difficult to need
 // to have multiple threads reading in extents in order to read them fast
-// enough to keep the pipeline full.
+// enough to keep the pipeline full.  setCompressedReaders() and
+// useSharedUnpackPool() are the interim versions of those, see the comments
+// there.
+
+class IndexSourceModuleUnpackPool;
 
 class IndexSourceModule : public SourceModule {
   public:
@@ -70,10 +74,49 @@ class IndexSourceModule : public SourceModule {
         be automatically called when you call getExtent; Max
         compressed may slightly overrun because we don't know the size
         of compressed extents until we read them. nthreads == -1 ==>
-        use # cpus */
+        use # cpus; n_unpack_threads is ignored if the module uses the shared
+        unpack pool. */
     virtual void startPrefetching(unsigned prefetch_max_compressed = 8 * 1024 * 1024,
                                   unsigned prefetch_max_unpacked = 32 * 1024 * 1024,
                                   int n_unpack_threads = -1);
+    /** Read compressed extents through a memory mapping of each file rather
+        than copying them into a buffer with pread.  Unpacking then reads
+        straight out of the page cache, which avoids a copy and an allocation
+        per extent on warm-cache scans.  Files that need a bitflip are still
+        read with pread.  Defaults to true if the environment variable
+        DATASERIES_USE_MMAP is set to 1.  Must be called before prefetching
+        starts. */
+    void setUseMmap(bool use_mmap);
+
+    /** Use n_readers threads to read compressed extents, so that up to
+        n_readers reads can be outstanding at once, for example on striped
+        storage.  The subclass still walks its index one extent at a time
+        under the lock; only the reads of the extent data are done in
+        parallel.  Extents are still returned in index order.  Has no effect
+        on extents read through a memory mapping, since those are read by the
+        kernel asynchronously.  Must be called before prefetching starts. */
+    void setCompressedReaders(unsigned n_readers);
+
+    /** Make every IndexSourceModule that starts prefetching after this call
+        unpack its extents on a single process-wide pool of n_unpack_threads
+        threads (-1 ==> # cpus) rather than starting its own threads, and
+        bound the compressed and unpacked extents buffered across all of
+        those modules by max_compressed and max_unpacked bytes.  The per-module
+        limits from startPrefetching() still apply.  A module with nothing
+        buffered is always allowed one extent so that a consumer reading the
+        modules in turn can not deadlock.  Modules with work are served in
+        priority order, and round robin within a priority.  This is intended
+        for programs that read many modules at once, for which per-module
+        threads would oversubscribe the machine.  Can only be called once. */
+    static void useSharedUnpackPool(uint64_t max_compressed = 64 * 1024 * 1024,
+                                    uint64_t max_unpacked = 256 * 1024 * 1024,
+                                    int n_unpack_threads = -1);
+
+    /** Priority of this module in the shared unpack pool; larger values
+        are served first, default 0.  Must be called before prefetching
+        starts. */
+    void setUnpackPriority(int priority);
+
     /** call this to start the index source module over again from the 
         beginning */
     virtual void resetPos();
@@ -118,25 +161,56 @@ class IndexSourceModule : public SourceModule {
     /** use readCompressed() to create this structure, it will unlock
         the mutex while doing the work to get the compressed data */
     struct PrefetchExtent {
+        /// compressed data, either in bytes or in mapped_begin if mapping != NULL
         Extent::ByteArray bytes;
+        DataSeriesSource::MappedFile::Ptr mapping;
+        Extent::byte *mapped_begin;
+        size_t mapped_size;
+
+        /// >= 0 while the compressed data still has to be read from
+        /// extent_source_offset by one of the compressed reader threads.
+        /// The descriptor is a dup so that it remains valid after the
+        /// subclass deletes the source.
+        int pending_fd;
+
         ExtentType::Ptr type;
         Extent::Ptr unpacked;
         bool need_bitflip;
         std::string uncompressed_type, extent_source;
         int64_t extent_source_offset;
         PrefetchExtent() 
-                : type(), unpacked(), need_bitflip(false), extent_source_offset(-1) { }
+                : mapping(), mapped_begin(NULL), mapped_size(0), pending_fd(-1), type(),
+                  unpacked(), need_bitflip(false), extent_source_offset(-1) { }
+
+        Extent::byte *compressedBegin() {
+            return mapping == NULL ? bytes.begin() : mapped_begin;
+        }
+        size_t compressedSize() {
+            return mapping == NULL ? bytes.size() : mapped_size;
+        }
+        void clearCompressed() {
+            bytes.clear();
+            mapping.reset();
+            mapped_begin = NULL;
+            mapped_size = 0;
+        }
     };
 
   protected:
     bool startedPrefetching() { return prefetch != NULL; }
 
     /** utility function to read compressed data, it will unlock and relock
-        the mutex associated with prefetching */
+        the mutex associated with prefetching.  With more than one compressed
+        reader, the read is deferred to the calling reader thread, after the
+        subclass has returned the extent. */
     PrefetchExtent *readCompressed(DataSeriesSource *dss,
                                    off64_t offset, 
                                    const std::string &uncompressed_type);
 
+    /** utility function to read and unpack the extent at offset in dss; like
+        readCompressed() it unlocks the prefetch mutex around the read */
+    Extent::Ptr readExtent(DataSeriesSource *dss, off64_t offset);
+
     /** function that is called from the prefetch thread to restart; parent
         will clear out any remaining data */
     virtual void lockedResetModule() = 0;
@@ -155,35 +229,82 @@ class IndexSourceModule : public SourceModule {
 
     friend class IndexSourceModuleCompressedPrefetchThread;
     friend class IndexSourceModuleUnpackThread;
+    friend class IndexSourceModuleUnpackPool;
     void compressedPrefetchThread();
     void unpackThread();
-
-    bool getting_extent;
+    bool unpackFromPool();
+    void lockedUnpackFront();
+    void lockedSignalUnpack();
+    void readPending(PrefetchExtent *pe);
+
+    bool getting_extent, use_mmap;
+    unsigned n_compressed_readers;
+    int unpack_priority;
+
+    /// memory limit shared by the queues of all the modules in the shared unpack pool
+    struct SharedBudget {
+        SharedBudget(uint64_t limit) : cur(0), limit(limit), blocked(false) { }
+        PThreadMutex mutex;
+        uint64_t cur, limit;
+        bool blocked; // some module found the budget full since the last release
+        bool can_add(uint32_t amount) {
+            PThreadScopedLock lock(mutex);
+            if (cur + amount < limit) {
+                return true;
+            }
+            blocked = true;
+            return false;
+        }
+        /// returns true if this released budget that another module may be waiting for
+        bool adjust(int64_t amount) {
+            PThreadScopedLock lock(mutex);
+            SINVARIANT(amount >= 0 || cur >= static_cast<uint64_t>(-amount));
+            cur += amount;
+            if (amount < 0 && blocked) {
+                blocked = false;
+                return true;
+            }
+            return false;
+        }
+    };
 
     struct Queue {
-        Queue(unsigned _limit) : cur(0), limit(_limit) { }
+        Queue(unsigned _limit) : cur(0), limit(_limit), budget(NULL) { }
         unsigned cur, limit; // limit is max or target
+        SharedBudget *budget; // NULL unless using the shared unpack pool
         Deque<PrefetchExtent *> data;
         bool can_add(uint32_t amount) {
-            return cur == 0 || cur + amount < limit;
+            if (cur == 0) {
+                return true;
+            }
+            return cur + amount < limit && (budget == NULL || budget->can_add(amount));
         }
         bool can_add(int amount) {
             SINVARIANT(amount >= 0);
             return can_add(static_cast<uint32_t>(amount));
         }
         bool can_add(PrefetchExtent *pe) {
-            return can_add(Extent::unpackedSize(pe->bytes, pe->need_bitflip,pe->type));
+            return can_add(Extent::unpackedSize(pe->compressedBegin(), pe->compressedSize(),
+                                                pe->need_bitflip, pe->type));
         }
         bool empty() { 
             return data.empty();
         }
         void add(PrefetchExtent *pe, unsigned size) {
-            cur += size;
             data.push_back(pe);
+            grow(size);
+        }
+        void grow(unsigned size) {
+            cur += size;
+            if (budget != NULL) {
+                budget->adjust(size);
+            }
         }
-        void subtract(unsigned size) {
+        /// returns true if the other modules sharing the budget should be woken
+        bool subtract(unsigned size) {
             SINVARIANT(cur >= size);
             cur -= size;
+            return budget != NULL && budget->adjust(-static_cast<int64_t>(size));
         }
         PrefetchExtent *front() {
             return data.front();
@@ -202,27 +323,42 @@ class IndexSourceModule : public SourceModule {
     struct PrefetchInfo {
         Queue compressed, unpacked;
         WaitStats stats;
-        PThread *compressed_prefetch_thread;
+        std::vector<PThread *> compressed_prefetch_threads;
         std::vector<PThread *> unpack_threads;
+        IndexSourceModuleUnpackPool *pool; // NULL if using unpack_threads
         PThreadMutex mutex;
         PThreadCond compressed_cond, unpack_cond, ready_cond;
         bool source_done;
+        bool getting_compressed; // a reader is inside lockedGetCompressedExtent()
         uint32_t abort_prefetching; // number of threads remaining to abort 
 
         PrefetchInfo(unsigned cmm, unsigned tum) 
-                : compressed(cmm), unpacked(tum), source_done(false), abort_prefetching(0)
+                : compressed(cmm), unpacked(tum), pool(NULL), source_done(false),
+                  getting_compressed(false), abort_prefetching(0)
         { }
 
         bool allDone() {
             return source_done && compressed.empty() && unpacked.empty();
         }
 
+        /// the front of the compressed queue has been read and can be unpacked
+        bool compressedReady() {
+            return !compressed.empty() && compressed.front()->pending_fd < 0;
+        }
+
+        bool canUnpackFront() {
+            return compressedReady() && unpacked.can_add(compressed.front());
+        }
+
         bool unpackedReady() {
             return unpacked.empty() == false && unpacked.front()->unpacked != NULL;
         }
     };
 
     PrefetchInfo *prefetch; // NULL until startPrefetching() is called
+
+    /// subtract from queue, waking the other modules if that released shared budget
+    void lockedSubtract(Queue &queue, unsigned size);
 };
     
 
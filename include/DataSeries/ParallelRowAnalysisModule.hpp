@@ -0,0 +1,169 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Row analysis split across threads, each with its own state
+*/
+
+#ifndef DATASERIES_PARALLEL_ROW_ANALYSIS_MODULE_HPP
+#define DATASERIES_PARALLEL_ROW_ANALYSIS_MODULE_HPP
+
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include <Lintel/Deque.hpp>
+#include <Lintel/PThread.hpp>
+#include <Lintel/StatsQuantile.hpp>
+
+#include <DataSeries/RowAnalysisModule.hpp>
+
+/** \brief Row analysis with the extents spread across worker threads.
+
+ * Each extent read from the source is processed by one of nthreads
+ * workers, each with its own copy of the analysis state made by
+ * makeWorker().  Once the source is done, merge() is called on the
+ * thread calling getSharedExtent() with each worker in turn to fold its
+ * state into the result, and then completeProcessing() is called.  This
+ * only suits analyses whose result doesn't depend on the order of the
+ * rows, e.g. counts, sums, extremes, distributions and sets.  The
+ * extents are passed on as soon as they are queued for the workers, so
+ * later modules must not modify them.
+
+ * firstExtent(), newExtentHook() and prepareForProcessing() are called
+ * on the module as for a RowAnalysisModule; the workers are made after
+ * prepareForProcessing().  processRow() on the module is never called. */
+class ParallelRowAnalysisModule : public RowAnalysisModule {
+  public:
+    /** \brief The state of the analysis for one worker thread.
+
+        Fields for the analysis should be made on series. */
+    class Worker : boost::noncopyable {
+      public:
+        virtual ~Worker();
+
+        /** Called on the worker's thread with each extent it processes,
+            before the extent is set in the series, e.g. to set field names */
+        virtual void newExtentHook(const Extent &e);
+
+        /** Called on the worker's thread for each row of its extents */
+        virtual void processRow() = 0;
+
+        /** Called on the worker's thread for each extent once it is set in the series, to
+            process the rows that selected is true for, or all of them if selected is NULL.  The
+            default calls processRow() on each of those rows; override it to work on whole
+            extents at a time, e.g. with DSExpr::valuesDouble(). */
+        virtual void processRows(const std::vector<bool> *selected);
+
+      protected:
+        Worker(ExtentSeries::typeCompatibilityT type_compatibility = ExtentSeries::typeExact);
+
+        ExtentSeries series;
+
+      private:
+        friend class ParallelRowAnalysisModule;
+
+        void processExtent(const Extent::Ptr &e);
+
+        uint64_t processed_rows, ignored_rows;
+        // where_expr has its own series so that it can be made before the worker has seen an
+        // extent
+        ExtentSeries where_series;
+        DSExpr *where_expr;
+        std::vector<bool> where_selected;
+    };
+
+    /** nthreads of 0 means one for each cpu.  Reading from source stops while the extents
+        waiting for a worker take more than max_queued_bytes. */
+    ParallelRowAnalysisModule(DataSeriesModule &source, unsigned nthreads = 0,
+                              size_t max_queued_bytes = 64*1024*1024,
+                              ExtentSeries::typeCompatibilityT type_compatibility
+                              = ExtentSeries::typeExact);
+    virtual ~ParallelRowAnalysisModule();
+
+    virtual Extent::Ptr getSharedExtent();
+
+    /** Make the state for one worker; called nthreads times with the first extent */
+    virtual Worker *makeWorker() = 0;
+
+    /** Fold the state of worker into the result of the analysis; called for each worker once
+        all of the rows have been processed, before completeProcessing() */
+    virtual void merge(Worker &worker) = 0;
+
+    /// \cond INTERNAL_ONLY
+    virtual void processRow();
+    void workerThread(Worker &worker);
+    /// \endcond
+
+  private:
+    void startWorkers(const Extent &first);
+    void finishWorkers();
+
+    const unsigned nthreads;
+    const size_t max_queued_bytes;
+    std::vector<Worker *> workers;
+    std::vector<PThread *> threads;
+    bool finished;
+
+    PThreadMutex mutex;
+    PThreadCond work_cond, space_cond;
+    Deque<Extent::Ptr> queue;
+    size_t queued_bytes;
+    bool source_done;
+};
+
+/** \brief A StatsQuantile fed by all of the workers of a parallel analysis.
+
+ * StatsQuantile sketches can't be merged, so rather than keeping one per
+ * worker, each worker adds its values to a Buffer, which passes them on to
+ * the shared sketch a batch at a time under a lock.  Each buffer has to be
+ * flushed, e.g. in ParallelRowAnalysisModule::merge(), before the sketch
+ * is read.  A buffer can't flush when it is destroyed, since the workers
+ * are destroyed after the members of the analysis holding the sketch, so
+ * destroying one that still holds values is an error.  Stats can be merged
+ * directly with Stats::add(const Stats &). */
+class SharedStatsQuantile : boost::noncopyable {
+  public:
+    SharedStatsQuantile(double error = 0.01, long nbound = 1000000000)
+        : stats(error, nbound) { }
+
+    class Buffer : boost::noncopyable {
+      public:
+        Buffer(SharedStatsQuantile &into, size_t batch_size = 4096)
+            : into(into), batch_size(batch_size) {
+            values.reserve(batch_size);
+        }
+
+        ~Buffer() {
+            SINVARIANT(values.empty()); // flush() wasn't called, e.g. from merge()
+        }
+
+        void add(double value) {
+            values.push_back(value);
+            if (values.size() >= batch_size) {
+                flush();
+            }
+        }
+
+        void flush();
+
+      private:
+        SharedStatsQuantile &into;
+        const size_t batch_size;
+        std::vector<double> values;
+    };
+
+    /// all of the values added to flushed buffers
+    StatsQuantile stats;
+
+  private:
+    friend class Buffer;
+
+    PThreadMutex mutex;
+};
+
+#endif
@@ -0,0 +1,83 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Mergeable approximate quantiles with bounded memory
+*/
+
+#ifndef DATASERIES_QUANTILE_SKETCH_HPP
+#define DATASERIES_QUANTILE_SKETCH_HPP
+
+#include <inttypes.h>
+
+#include <iosfwd>
+#include <vector>
+
+#include <Lintel/Stats.hpp>
+
+/** \brief Approximate quantiles that can be merged, e.g. across threads.
+
+ * Values are counted in buckets whose bounds grow geometrically, so any
+ * quantile is returned to within a relative error of relative_error of a
+ * value whose rank is the requested one.  Values of magnitude below
+ * min_magnitude are counted as 0.  Each sign keeps at most max_buckets
+ * buckets; past that, the buckets nearest 0 are combined, which only loses
+ * accuracy for the smallest values.  Unlike StatsQuantile, the result
+ * doesn't depend on the order of the values, and two sketches with the same
+ * relative_error can be merged.  The count, mean, stddev, min and max are
+ * those of Stats.  Infinite and NaN values are left out of the quantiles. */
+class QuantileSketch : public Stats {
+  public:
+    QuantileSketch(double relative_error = 0.01, size_t max_buckets = 2048,
+                   double min_magnitude = 1.0e-9);
+    virtual ~QuantileSketch();
+
+    virtual void add(const double value);
+    virtual void reset();
+
+    /// Add all of the values added to from; from must have the same relative_error
+    void merge(const QuantileSketch &from);
+
+    /// The value at quantile (0 <= quantile <= 1) of the values added so far
+    double getQuantile(double quantile) const;
+
+    /// Print the count, mean, stddev, range and a standard set of quantiles
+    void printQuantiles(std::ostream &to) const;
+
+    /// Number of buckets in use, for checking the memory bound
+    size_t nBuckets() const {
+        return positive.counts.size() + negative.counts.size();
+    }
+
+  private:
+    // Counts for one sign; bucket i covers magnitudes in (gamma^(i-1), gamma^i]
+    struct Buckets {
+        Buckets() : first_index(0), total(0) { }
+
+        void add(int32_t index, uint64_t count, size_t max_buckets);
+        void merge(const Buckets &from, size_t max_buckets);
+        void clear() {
+            counts.clear();
+            first_index = 0;
+            total = 0;
+        }
+
+        std::vector<uint64_t> counts; // counts[i] is for index first_index + i
+        int32_t first_index;
+        uint64_t total;
+    };
+
+    int32_t index(double magnitude) const;
+    double bucketValue(int32_t index) const;
+
+    const double relative_error, gamma, log_gamma, min_magnitude;
+    const size_t max_buckets;
+    Buckets positive, negative;
+    uint64_t zero_count, nonfinite_count;
+};
+
+#endif
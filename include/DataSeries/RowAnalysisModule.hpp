@@ -104,6 +104,7 @@ class RowAnalysisModule : public DataSeriesModule {
 
     std::string where_expr_str;
     DSExpr *where_expr;
+    std::vector<bool> where_selected; // where_expr over the current extent
 };
 
 #endif
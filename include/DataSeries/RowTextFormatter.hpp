@@ -0,0 +1,62 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Formatting of rows as text into a buffer
+*/
+
+#ifndef DATASERIES_ROW_TEXT_FORMATTER_HPP
+#define DATASERIES_ROW_TEXT_FORMATTER_HPP
+
+#include <string>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include <DataSeries/GeneralField.hpp>
+
+/** \brief Formats rows as text the same way as GeneralField::write(FILE *), but into a buffer.
+
+ * The print spec of each field is examined once, when the formatter is
+ * made, rather than for every value.  The common specs (%d, %lld, %s and
+ * %.Ng for whole numbers) are formatted directly; the others fall back to
+ * snprintf with the field's print spec.  Appending all of the rows of an
+ * extent to one string and writing it out at once avoids most of the
+ * per-value cost of going through stdio. */
+class RowTextFormatter : boost::noncopyable {
+  public:
+    /// fields must all be on the same series, and outlive the formatter
+    RowTextFormatter(const std::vector<GeneralField *> &fields, const std::string &separator);
+
+    /// Append the current row of the fields' series and a newline to to
+    void appendRow(std::string &to);
+
+    /** True unless a field is printed relative to the first value it printed, in which case the
+        rows need to be formatted in order with the same fields */
+    bool rowIndependent() const {
+        return row_independent;
+    }
+
+  private:
+    enum Kind { bool_value, byte_decimal, byte_printf, int32_decimal, int32_ipv4, int32_printf,
+                int64_decimal, int64_time, int64_printf, double_whole, double_printf,
+                variable32_raw, variable32_formatted, fixedwidth_hex };
+
+    struct Column {
+        Kind kind;
+        GeneralField *field;
+        double whole_limit; // double_whole: values below this print as integers
+    };
+
+    void appendValue(const Column &column, std::string &to);
+
+    std::vector<Column> columns;
+    const std::string separator;
+    bool row_independent;
+};
+
+#endif
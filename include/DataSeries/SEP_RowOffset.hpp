@@ -21,6 +21,7 @@ class Field;
 class FixedField;
 class Variable32Field;
 class ExtentRecordCopy;
+class ExtentCopyPlan;
 
 namespace dataseries {
     class SEP_RowOffset {
@@ -139,6 +140,7 @@ namespace dataseries {
         friend class ::FixedField;
         friend class ::Variable32Field;
         friend class ::ExtentRecordCopy;
+        friend class ::ExtentCopyPlan;
 
         // should be a multiple of row_size.
         uint32_t row_offset;
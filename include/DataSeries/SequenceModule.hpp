@@ -24,6 +24,12 @@
  * used for running a set of extents through a collection of modules.
  *
  * As shown in: \dotfile "doxygen-figures/sequence-module.dot" "A sequence module with sub-modules"
+ *
+ * By default all of the modules run on the thread calling getSharedExtent().
+ * After \link SequenceModule::enablePipelining enablePipelining \endlink,
+ * tail() puts a PrefetchBufferModule after every group of modules, so each
+ * group runs on its own thread on a different extent, passing the same
+ * shared extents along through the bounded buffers.
  **/
 class SequenceModule : public DataSeriesModule {
   public:
@@ -43,9 +49,19 @@ class SequenceModule : public DataSeriesModule {
     virtual ~SequenceModule();
 
     /** get the last data series module in the sequence for connecting in to the next module
-        in the sequence.  Usually used like seq_mod.addModule(new Module(seq_mod.tail())) */
+        in the sequence.  Usually used like seq_mod.addModule(new Module(seq_mod.tail())).
+        If pipelining is enabled and a full group of modules has been added since the last
+        buffer, adds a buffer for them and returns it. */
     DataSeriesModule &tail();
 
+    /** Run the modules added from now on in a pipeline, modules_per_stage modules to a thread,
+        with up to max_stage_memory bytes of extents buffered after each stage.  The modules
+        in different stages run at the same time, so they must not share unlocked state, and
+        must not modify the extents they pass on.  The last stage runs on the thread calling
+        getSharedExtent(). */
+    void enablePipelining(unsigned modules_per_stage = 1,
+                          unsigned max_stage_memory = 16*1024*1024);
+
     /** mod should be connected to the previous tail, and will become the new
         tail of the series; mod should have been allocated with new.  The
         @c ExtentSeries takes ownership of it.
@@ -89,6 +105,9 @@ class SequenceModule : public DataSeriesModule {
     iterator end() { return modules.end(); }
   private:
     std::vector<DsmPtr> modules;
+    unsigned modules_per_stage; // 0 if not pipelined
+    unsigned max_stage_memory;
+    unsigned unbuffered_modules; // added since the last buffer, not counting the head
 };
 
 #endif
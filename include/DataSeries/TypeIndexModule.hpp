@@ -13,8 +13,14 @@
 #ifndef __DATASERIES_TYPEINDEXMODULE_H
 #define __DATASERIES_TYPEINDEXMODULE_H
 
+#include <map>
+
+#include <boost/scoped_ptr.hpp>
+
 #include <DataSeries/IndexSourceModule.hpp>
 
+class DSExpr;
+
 /** \brief Source module that returns extents matching a particular type
 
  * Each DataSeries file contains an index that tells the type and
@@ -52,6 +58,17 @@ class TypeIndexModule : public IndexSourceModule {
     const ExtentType::Ptr getTypePtr() {
         return my_type;
     }
+
+    /** Skip the extents that the stats written by DataSeriesSink::setExtentStats show can't
+        have any rows where the DSExpr where_expr over the matched type is true.  Extents in
+        files without stats are all returned; the returned extents still have rows that don't
+        match.  Requires a type match. */
+    void setPredicate(const std::string &where_expr);
+
+    /** Returns the number of extents skipped so far because of the predicate. */
+    uint64_t getSkippedExtents() {
+        return skipped_extents;
+    }
   protected:
     std::string type_match, second_type_match;
     ExtentSeries indexSeries;
@@ -64,10 +81,29 @@ class TypeIndexModule : public IndexSourceModule {
   private:
     const ExtentType::Ptr matchType(); // May return NULL
 
+    // The range of one column of one extent, from the file's extent stats
+    struct ColumnRange {
+        std::string column;
+        bool known;
+        double min, max; // including 0 if there were nulls
+    };
+    typedef std::map<int64_t, std::vector<ColumnRange> > ExtentRanges;
+
+    void lockedReadExtentStats();
+    bool lockedMayMatch(int64_t offset);
+    static bool columnRange(const std::vector<ColumnRange> *ranges, const std::string &column,
+                            double &min, double &max);
+
     unsigned int cur_file;
     DataSeriesSource *cur_source;
     std::vector<std::string> inputFiles;
     ExtentType::Ptr my_type;
+
+    std::string predicate_str;
+    ExtentSeries predicate_series;
+    boost::scoped_ptr<DSExpr> predicate;
+    ExtentRanges cur_ranges; // for cur_source
+    uint64_t skipped_extents;
 };
 
 #endif
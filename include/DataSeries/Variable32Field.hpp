@@ -164,6 +164,13 @@ class Variable32Field : public Field {
         }
         return size() == to.size() && memcmp(val(), to.val(), size()) == 0;
     }
+
+    /// Bytes that a value of size bytes takes in the variable data after its 4 byte size,
+    /// padded so that the data of every value stays 8 byte aligned
+    static int32 roundupSize(int32 size) {
+        return size + (12 - (size % 8)) % 8;
+    }
+
     std::string default_value;
   protected:
     friend class Extent;
@@ -229,9 +236,6 @@ class Variable32Field : public Field {
     }
     static void selfcheck(const Extent::ByteArray &varbytes, int32 varoffset);
 
-    static int32 roundupSize(int32 size) {
-        return size + (12 - (size % 8)) % 8;
-    }
     int offset_pos;
     bool unique;
 
@@ -18,10 +18,12 @@ struct commonPackingArgs {
     int compress_level;
     int compress_modes;
     int extent_size;
+    bool extent_stats; // see DataSeriesSink::setExtentStats
     commonPackingArgs() 
             : compress_level(9), 
               compress_modes(Extent::compress_all), 
-              extent_size(-1)
+              extent_size(-1),
+              extent_stats(false)
     { }
 };
 
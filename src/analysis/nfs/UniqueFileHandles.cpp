@@ -3,7 +3,7 @@
 #include <Lintel/HashUnique.hpp>
 #include <Lintel/StatsQuantile.hpp>
 
-#include <DataSeries/RowAnalysisModule.hpp>
+#include <DataSeries/ParallelRowAnalysisModule.hpp>
 
 #include <analysis/nfs/common.hpp>
 
@@ -11,100 +11,123 @@ using namespace std;
 using boost::format;
 using dataseries::TFixedField;
 
-class UniqueFileHandles : public RowAnalysisModule {
+// The filehandles are independent of each other, so each worker keeps the largest size seen for
+// the filehandles in its extents, and the workers' maps are merged at the end.
+class UniqueFileHandles : public ParallelRowAnalysisModule {
   public:
-    UniqueFileHandles(DataSeriesModule &source)
-    : RowAnalysisModule(source),
-      filehandle(series, "filehandle"),
-      lookup_dir_filehandle(series, "", Field::flag_nullable),
-      file_size(series, ""),
-      last_size_report(0)
+    typedef HashMap<uint64_t, int64_t> SizeMap;
+
+    UniqueFileHandles(DataSeriesModule &source, unsigned nthreads)
+    : ParallelRowAnalysisModule(source, nthreads), fh_to_size(NULL)
     {
     }
 
     virtual ~UniqueFileHandles() { }
 
-    void newExtentHook(const Extent &e) {
-        if (fh_to_size.size() > last_size_report + 1000000) {
-            cout << format("UniqueFileHandles interim count: %d\n")
-                    % fh_to_size.size();
-            last_size_report = fh_to_size.size();
-            INVARIANT(last_size_report < 2000000000, 
-                      "HashMap about to overflow");
-        }
-        if (series.getTypePtr() != NULL) {
-            return; // already did this
+    class Worker : public ParallelRowAnalysisModule::Worker {
+      public:
+        Worker()
+        : filehandle(series, "filehandle"),
+          lookup_dir_filehandle(series, "", Field::flag_nullable),
+          file_size(series, "")
+        {
         }
-        const ExtentType::Ptr type = e.getTypePtr();
-        if (type->getName() == "NFS trace: attr-ops") {
-            SINVARIANT(type->getNamespace() == "" &&
-                       type->majorVersion() == 0 &&
-                       type->minorVersion() == 0);
-            lookup_dir_filehandle.setFieldName("lookup-dir-filehandle");
-            file_size.setFieldName("file-size");
-        } else if (type->getName() == "Trace::NFS::attr-ops"
-                   && type->versionCompatible(1,0)) {
-            lookup_dir_filehandle.setFieldName("lookup-dir-filehandle");
-            file_size.setFieldName("file-size");
-        } else if (type->getName() == "Trace::NFS::attr-ops"
-                   && type->versionCompatible(2,0)) {
-            lookup_dir_filehandle.setFieldName("lookup_dir_filehandle");
-            file_size.setFieldName("file_size");
-        } else {
-            FATAL_ERROR("?");
+
+        virtual void newExtentHook(const Extent &e) {
+            INVARIANT(fh_to_size.size() < 2000000000, "HashMap about to overflow");
+            if (series.getTypePtr() != NULL) {
+                return; // already did this
+            }
+            const ExtentType::Ptr type = e.getTypePtr();
+            if (type->getName() == "NFS trace: attr-ops") {
+                SINVARIANT(type->getNamespace() == "" &&
+                           type->majorVersion() == 0 &&
+                           type->minorVersion() == 0);
+                lookup_dir_filehandle.setFieldName("lookup-dir-filehandle");
+                file_size.setFieldName("file-size");
+            } else if (type->getName() == "Trace::NFS::attr-ops"
+                       && type->versionCompatible(1,0)) {
+                lookup_dir_filehandle.setFieldName("lookup-dir-filehandle");
+                file_size.setFieldName("file-size");
+            } else if (type->getName() == "Trace::NFS::attr-ops"
+                       && type->versionCompatible(2,0)) {
+                lookup_dir_filehandle.setFieldName("lookup_dir_filehandle");
+                file_size.setFieldName("file_size");
+            } else {
+                FATAL_ERROR("?");
+            }
         }
-    }
 
 #define USE_MD5 1
 
-    void addEntry(Variable32Field &f) {
+        void addEntry(Variable32Field &f) {
 #if USE_MD5
-        int64_t &size = fh_to_size[md5FileHash(f)];
-        size = max(size, file_size.val());
+            int64_t &size = fh_to_size[md5FileHash(f)];
+            size = max(size, file_size.val());
 #else
 #error "no"
-        ConstantString tmp(f.val(), f.size());
-        unique_filehandles.add(tmp);
+            ConstantString tmp(f.val(), f.size());
+            unique_filehandles.add(tmp);
+#endif
+        }
+
+        virtual void processRow() {
+            addEntry(filehandle);
+            if (!lookup_dir_filehandle.isNull()) {
+                addEntry(lookup_dir_filehandle);
+            }
+        }
+
+        Variable32Field filehandle;
+        Variable32Field lookup_dir_filehandle;
+        TFixedField<int64_t> file_size;
+#if USE_MD5
+        SizeMap fh_to_size;
+#else
+        HashUnique<ConstantString> unique_filehandles;
 #endif
+    };
+
+    virtual Worker *makeWorker() {
+        return new Worker();
     }
 
-    virtual void processRow() {
-        addEntry(filehandle);
-        if (!lookup_dir_filehandle.isNull()) {
-            addEntry(lookup_dir_filehandle);
+    virtual void merge(ParallelRowAnalysisModule::Worker &from) {
+        SizeMap &worker_sizes(static_cast<Worker &>(from).fh_to_size);
+        if (fh_to_size == NULL) { // the workers outlive printResult, so use the first one's map
+            fh_to_size = &worker_sizes;
+            return;
         }
+        for (SizeMap::iterator i = worker_sizes.begin(); i != worker_sizes.end(); ++i) {
+            int64_t &size = (*fh_to_size)[i->first];
+            size = max(size, i->second);
+        }
+        INVARIANT(fh_to_size->size() < 2000000000, "HashMap about to overflow");
     }
 
     virtual void printResult() {
-        StatsQuantile file_size_stat(0.01/2, fh_to_size.size()+1);
-        for (HashMap<uint64_t, int64_t>::iterator i = fh_to_size.begin(); 
-            i != fh_to_size.end(); ++i) {
+        SizeMap no_sizes;
+        SizeMap &sizes(fh_to_size == NULL ? no_sizes : *fh_to_size);
+        StatsQuantile file_size_stat(0.01/2, sizes.size()+1);
+        for (SizeMap::iterator i = sizes.begin(); i != sizes.end(); ++i) {
             file_size_stat.add(i->second);
         }
 
         cout << format("Begin-%s\n") % __PRETTY_FUNCTION__;
         cout << format("found %d unique filehandles\n") 
-                % fh_to_size.size();
+                % sizes.size();
         cout << format("file size quantiles:\n");
         file_size_stat.printTextRanges(cout, 100);
         cout << format("End-%s\n") % __PRETTY_FUNCTION__;
     }
 
   private:
-    Variable32Field filehandle;
-    Variable32Field lookup_dir_filehandle;
-    TFixedField<int64_t> file_size;
-#if USE_MD5
-    HashMap<uint64_t, int64_t> fh_to_size;
-#else
-    HashUnique<ConstantString> unique_filehandles;
-#endif
-    size_t last_size_report;
+    SizeMap *fh_to_size; // merged sizes; NULL until the first merge
 };
 
 namespace NFSDSAnalysisMod {
     RowAnalysisModule *
-    newUniqueFileHandles(DataSeriesModule &prev) {
-        return new UniqueFileHandles(prev);
+    newUniqueFileHandles(DataSeriesModule &prev, unsigned nthreads) {
+        return new UniqueFileHandles(prev, nthreads);
     }
 }
@@ -241,6 +241,18 @@ FHOL: reply-at client server ; operation type filehandle filename; file-size mod
 FHOL: 1063931188.266179000 10.12.11.75 10.110.1.14 ; getattr file 25cccd0040f47d05200000000160929015f77d0578e4003e1630670064637600 '' ; 325880 1023314262.000000000
 FHOL: 1063931190.068588000 10.12.11.77 10.110.1.14 ; getattr directory 0138c000948119052000000000c03801948119050b71002c40000000ffa72e00 '' ; 4096 1050428920.444579000
 
+=head2 -P I<analyses-per-thread> # Run the common analyses in parallel
+
+Run the analyses of the common table that are selected after this option in a pipeline,
+I<analyses-per-thread> of them to a thread, rather than all of them on one thread.  Each group
+works on a different extent at the same time, handing the extents along to the next group.
+
+=head2 -T I<threads> # Threads for each analysis that can split up its rows
+
+Analyses selected after this option that do not depend on the order of the rows spread the
+extents over I<threads> threads, each with its own copy of the analysis state, merging them at
+the end.  Currently only -g does this.  The default is 1.
+
 =head1 DISABLED ANALYSIS
 
 Most of the analysis were writen in early 2003, they do not have
@@ -452,7 +464,7 @@ using dataseries::TFixedField;
 
 namespace NFSDSAnalysisMod {
     RowAnalysisModule *newReadWriteExtentAnalysis(DataSeriesModule &prev);
-    RowAnalysisModule *newUniqueFileHandles(DataSeriesModule &prev);
+    RowAnalysisModule *newUniqueFileHandles(DataSeriesModule &prev, unsigned nthreads);
     RowAnalysisModule *newSequentiality(DataSeriesModule &prev, const string &arg);
     RowAnalysisModule *newServerLatency(DataSeriesModule &prev, const string &arg);
     RowAnalysisModule *newMissingOps(DataSeriesModule &prev);
@@ -1421,6 +1433,7 @@ HashUnique<string> FileHandleOperationLookup::wanted;
 static bool need_mount_by_filehandle = false;
 static bool need_filename_by_filehandle = false;
 static bool late_filename_by_filehandle_ok = true;
+static unsigned analysis_threads = 1; // for the analyses that can split their rows
 
 void
 usage(char *progname) 
@@ -1444,6 +1457,8 @@ usage(char *progname)
     cout << "    -f # Read/Write Extent analysis\n";
     cout << "    -g # Attr-Ops Extent analysis\n";
     cout << "    -i # Sequentiality analysis\n";
+    cout << "    -P <analyses-per-thread> # pipeline the common analyses selected after this\n";
+    cout << "    -T <threads> # threads for each of the analyses that can use them (-g)\n";
     cout << "    -Z <series-to-print> # common, attr-ops, rw, merge12, merge123\n";
 
     //    cerr << "    #-b # Unique bytes in file handles analysis\n";
@@ -1488,7 +1503,7 @@ int parseopts(int argc, char *argv[], SequenceModule &commonSequence,
     bool add_file_handle_operation_lookup = false;
 
     while (1) {
-        int opt = getopt(argc, argv, "hab:c:d:e:fgi:jZ:");
+        int opt = getopt(argc, argv, "hab:c:d:e:fgi:jP:T:Z:");
         if (opt == -1) break;
         any_selected = true;
         switch(opt){
@@ -1522,7 +1537,7 @@ int parseopts(int argc, char *argv[], SequenceModule &commonSequence,
                 break;
             case 'g':
                 attrOpsSequence.addModule
-                        (newUniqueFileHandles(attrOpsSequence.tail()));
+                        (newUniqueFileHandles(attrOpsSequence.tail(), analysis_threads));
                 break;
             case 'i':
 #if 0
@@ -1536,6 +1551,18 @@ int parseopts(int argc, char *argv[], SequenceModule &commonSequence,
             case 'j':
                 commonSequence.addModule(newMissingOps(commonSequence.tail()));
                 break;
+            case 'P': {
+                int per_thread = stringToInteger<int32_t>(optarg);
+                INVARIANT(per_thread > 0, format("invalid analyses per thread '%s'") % optarg);
+                commonSequence.enablePipelining(per_thread);
+                break;
+            }
+            case 'T': {
+                int threads = stringToInteger<int32_t>(optarg);
+                INVARIANT(threads > 0, format("invalid number of threads '%s'") % optarg);
+                analysis_threads = threads;
+                break;
+            }
             case 'Z': {
                 string arg = optarg;
                 if (arg == "common") {
@@ -1631,8 +1658,8 @@ int parseopts(int argc, char *argv[], SequenceModule &commonSequence,
 }
 
 void printResult(SequenceModule::DsmPtr mod) {
-    if (mod == NULL) {
-        return;
+    if (mod == NULL || dynamic_cast<PrefetchBufferModule *>(mod.get()) != NULL) {
+        return; // nothing to print for the buffers between pipeline stages
     }
     NFSDSModule *nfsdsmod = dynamic_cast<NFSDSModule *>(mod.get());
     RowAnalysisModule *rowmod = dynamic_cast<RowAnalysisModule *>(mod.get());
@@ -1641,8 +1668,7 @@ void printResult(SequenceModule::DsmPtr mod) {
     } else if (rowmod != NULL) {
         rowmod->printResult();
     } else {
-        INVARIANT(dynamic_cast<DStoTextModule *>(mod.get()) != NULL
-                  || dynamic_cast<PrefetchBufferModule *>(mod.get()) != NULL,
+        INVARIANT(dynamic_cast<DStoTextModule *>(mod.get()) != NULL,
                   "Found unexpected module in chain");
     }
 
@@ -1701,6 +1727,9 @@ int main(int argc, char *argv[]) {
     registerUnitsEpoch();
 
     LintelLog::parseEnv();
+    // Up to three sources are read at once; share one set of unpack threads
+    // and one memory budget rather than giving each source its own.
+    IndexSourceModule::useSharedUnpackPool(8*32*1024*1024, 8*96*1024*1024);
     // TODO: make sources an array/vector.
     TypeIndexModule *sourcea = new TypeIndexModule("NFS trace: common");
     sourcea->setSecondMatch("Trace::NFS::common");
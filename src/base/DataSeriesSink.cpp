@@ -1,10 +1,13 @@
 #include <DataSeries/DataSeriesSink.hpp>
 
+#include <algorithm>
+
 #include <sys/time.h>
 #include <fcntl.h>
 
 #include <Lintel/LintelLog.hpp>
 #include <Lintel/HashFns.hpp>
+#include <Lintel/StringUtil.hpp>
 
 dataseries::IExtentSink::~IExtentSink() { }
 
@@ -104,14 +107,14 @@ void DataSeriesSink::WorkerInfo::flushPending(PThreadMutex &mutex) {
 
 DataSeriesSink::DataSeriesSink(int compression_modes, int compression_level)
         : stats(), mutex(), valid_types(), compression_modes(compression_modes),
-          compression_level(compression_level), writer_info(), 
+          compression_level(compression_level), extent_stats(false), writer_info(), 
           worker_info(256*1024*1024), filename()
 { }
 
 DataSeriesSink::DataSeriesSink(const string &filename, int compression_modes,
                                int compression_level)
         : stats(), mutex(), valid_types(), compression_modes(compression_modes),
-          compression_level(compression_level), writer_info(),
+          compression_level(compression_level), extent_stats(false), writer_info(),
           worker_info(256*1024*1024), filename()
 {
     open(filename);
@@ -128,6 +131,13 @@ void DataSeriesSink::setExtentWriteCallback(const ExtentWriteCallback &callback)
     writer_info.extent_write_callback = callback;
 }
 
+void DataSeriesSink::setExtentStats(bool enable) {
+    PThreadScopedLock lock(mutex);
+    INVARIANT(!writer_info.wrote_library,
+              "must call setExtentStats before writeExtentLibrary");
+    extent_stats = enable;
+}
+
 void DataSeriesSink::open(const string &in_filename) {
     PThreadScopedLock lock(mutex);
 
@@ -170,6 +180,19 @@ void DataSeriesSink::close(bool do_fsync, Stats *to_update) {
     writer_info.writeOutPending(lock, worker_info);
 
     SINVARIANT(worker_info.pending_work.empty() && worker_info.bytes_in_progress == 0);
+
+    if (writer_info.stats_series.hasExtent()) {
+        // Goes through like any other extent so that it is listed in the index.
+        Extent::Ptr stats_extent(writer_info.stats_series.getSharedExtent());
+        writer_info.stats_series.clearExtent();
+        worker_info.bytes_in_progress += stats_extent->size();
+        worker_info.pending_work.push_back(new ToCompress(stats_extent, NULL));
+        worker_info.pending_work.front()->in_progress = true;
+        lockedProcessToCompress(lock, worker_info.pending_work.front());
+        writer_info.writeOutPending(lock, worker_info);
+        SINVARIANT(worker_info.pending_work.empty() && worker_info.bytes_in_progress == 0);
+    }
+
     ExtentType::int64 index_offset = writer_info.cur_offset;
     
     // Special case handling of record for index series; this will
@@ -279,6 +302,12 @@ void DataSeriesSink::writeExtentLibrary(const ExtentTypeLibrary &lib) {
                     % et->getName() << endl;
         }
     }
+    if (extent_stats) {
+        const ExtentType::Ptr stats_type(ExtentType::getDataSeriesExtentStatsTypePtr());
+        type_extent_series.newRecord();
+        typevar.set(stats_type->getXmlDescriptionString());
+        valid_types.add(stats_type);
+    }
     queueWriteExtent(type_extent_series.getSharedExtent(), NULL);
 
     PThreadScopedLock lock(mutex);
@@ -371,6 +400,100 @@ DataSeriesSink::Stats DataSeriesSink::getStats(Stats *from) {
     return ret;
 }
 
+namespace {
+    template<typename T, typename S> void addColumnValues(const uint8_t *records, size_t record_size,
+                                                          int32_t nrecords, int32_t offset,
+                                                          int32_t null_offset, uint8_t null_mask,
+                                                          S &stats) {
+        for (int32_t i = 0; i < nrecords; ++i, records += record_size) {
+            if (null_offset >= 0 && (records[null_offset] & null_mask) != 0) {
+                ++stats.nulls;
+            } else {
+                stats.add(static_cast<double>(*reinterpret_cast<const T *>(records + offset)));
+            }
+        }
+    }
+}
+
+void DataSeriesSink::computeColumnStats(const Extent &e, vector<ColumnStats> &column_stats) {
+    const ExtentType &type(*e.getTypePtr());
+    size_t record_size = type.fixedrecordsize();
+    int32_t nrecords = e.fixeddata.size() / record_size;
+    const uint8_t *records = e.fixeddata.begin();
+    column_stats.clear();
+    for (uint32_t i = 0; i < type.getNFields(); ++i) {
+        const string &name(type.getFieldName(i));
+        ExtentType::fieldType field_type = type.getFieldType(name);
+        if (field_type == ExtentType::ft_variable32 || field_type == ExtentType::ft_fixedwidth) {
+            continue;
+        }
+        ColumnStats stats(name, nrecords);
+        int32_t offset = type.getOffset(name);
+        int32_t null_offset = -1;
+        uint8_t null_mask = 0;
+        if (type.getNullable(name)) {
+            const string null_name(ExtentType::nullableFieldname(name));
+            null_offset = type.getOffset(null_name);
+            null_mask = 1 << type.getBitPos(null_name);
+        }
+        switch (field_type) 
+            {
+            case ExtentType::ft_bool: {
+                uint8_t mask = 1 << type.getBitPos(name);
+                const uint8_t *record = records;
+                for (int32_t j = 0; j < nrecords; ++j, record += record_size) {
+                    if (null_offset >= 0 && (record[null_offset] & null_mask) != 0) {
+                        ++stats.nulls;
+                    } else {
+                        stats.add((record[offset] & mask) ? 1 : 0);
+                    }
+                }
+                break;
+            }
+            case ExtentType::ft_byte:
+                addColumnValues<uint8_t>(records, record_size, nrecords, offset,
+                                         null_offset, null_mask, stats);
+                break;
+            case ExtentType::ft_int32:
+                addColumnValues<int32_t>(records, record_size, nrecords, offset,
+                                         null_offset, null_mask, stats);
+                break;
+            case ExtentType::ft_int64:
+                addColumnValues<int64_t>(records, record_size, nrecords, offset,
+                                         null_offset, null_mask, stats);
+                break;
+            case ExtentType::ft_double:
+                addColumnValues<double>(records, record_size, nrecords, offset,
+                                        null_offset, null_mask, stats);
+                break;
+            default:
+                FATAL_ERROR(format("internal error, unexpected field type %d") % field_type);
+            }
+        column_stats.push_back(stats);
+    }
+}
+
+void DataSeriesSink::WriterInfo::addColumnStats(const vector<ColumnStats> &column_stats) {
+    if (!stats_series.hasExtent()) {
+        stats_series.newExtent();
+    }
+    for (vector<ColumnStats>::const_iterator i = column_stats.begin(); 
+         i != column_stats.end(); ++i) {
+        stats_series.newRecord();
+        stats_offset.set(cur_offset);
+        stats_column.set(i->column);
+        stats_rows.set(i->rows);
+        stats_nulls.set(i->nulls);
+        if (i->haveRange()) {
+            stats_min.set(i->min);
+            stats_max.set(i->max);
+        } else {
+            stats_min.setNull();
+            stats_max.setNull();
+        }
+    }
+}
+
 void DataSeriesSink::WriterInfo::writeOutPending(PThreadScopedLock &lock, WorkerInfo &worker_info) {
     Deque<ToCompress *> to_write;
     while (worker_info.frontReadyToWrite()) {
@@ -396,6 +519,9 @@ void DataSeriesSink::WriterInfo::writeOutPending(PThreadScopedLock &lock, Worker
             index_series.newRecord();
             field_extentOffset.set(cur_offset);
             field_extentType.set(tc->extent->getTypePtr()->getName());
+            if (!tc->column_stats.empty()) {
+                addColumnStats(tc->column_stats);
+            }
             
             checkedWrite(tc->compressed.begin(), tc->compressed.size());
             cur_offset += tc->compressed.size();
@@ -451,12 +577,75 @@ static void get_thread_cputime(struct timespec &ts) {
     //    return ts.tv_sec + ts.tv_nsec*1.0e-9;
 }
 
+static double cputimeSince(const struct timespec &start) {
+    struct timespec end;
+    get_thread_cputime(end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)*1e-9;
+}
+
+Extent::CompressTask *DataSeriesSink::CompressTrials::lockedTakeTask() {
+    SINVARIANT(next < tasks.size());
+    Extent::CompressTask *ret = tasks[next];
+    ++next;
+    if (next == tasks.size()) {
+        vector<CompressTrials *> &trials(sink.worker_info.trials);
+        trials.erase(find(trials.begin(), trials.end(), this));
+    }
+    return ret;
+}
+
+// Called by the thread packing the extent.  It starts tasks itself too, so
+// nothing waits on the other compressors being idle; they just shorten the
+// time to pack the extent if they are.
+void DataSeriesSink::CompressTrials::runAll(const vector<Extent::CompressTask *> &in_tasks) {
+    PThreadScopedLock lock(sink.mutex);
+    SINVARIANT(tasks.empty() && !in_tasks.empty());
+    tasks = in_tasks;
+    next = 0;
+    remaining = tasks.size();
+    sink.worker_info.trials.push_back(this);
+    sink.worker_info.available_work_cond.broadcast();
+    while (next < tasks.size()) {
+        Extent::CompressTask *task = lockedTakeTask();
+        {
+            PThreadScopedUnlock unlock(lock);
+            task->run();
+        }
+        --remaining;
+    }
+    while (remaining > 0) {
+        sink.worker_info.trial_done_cond.wait(sink.mutex);
+    }
+    tasks.clear();
+}
+
+void DataSeriesSink::lockedHelpCompressTrial(PThreadScopedLock &lock) {
+    SINVARIANT(!worker_info.trials.empty());
+    CompressTrials *trials = worker_info.trials.front();
+    Extent::CompressTask *task = trials->lockedTakeTask();
+    double task_time;
+    {
+        PThreadScopedUnlock unlock(lock);
+        struct timespec start;
+        get_thread_cputime(start);
+        task->run();
+        task_time = cputimeSince(start);
+    }
+    // trials is still valid; the packing thread waits for remaining == 0
+    trials->helper_time += task_time;
+    SINVARIANT(trials->remaining > 0);
+    --trials->remaining;
+    if (trials->remaining == 0) {
+        worker_info.trial_done_cond.broadcast();
+    }
+}
+
 // This function assumes that bytes_in_progress was updated to the
 // uncompressed size prior to calling the function.
 void DataSeriesSink::lockedProcessToCompress(PThreadScopedLock &lock, ToCompress *work) {
     SINVARIANT(worker_info.bytes_in_progress >= work->extent->size());
     size_t uncompressed_size = work->extent->size();
-    worker_info.bytes_in_progress += uncompressed_size; // could temporarily be 2*e.size in worst case if we are trying multiple algorithms
+    worker_info.bytes_in_progress += uncompressed_size; // approximates the candidates held while trying multiple algorithms
     LintelLogDebug("DataSeriesSink", format("compress(%d bytes), in progress %d bytes")
                    % work->extent->size() % worker_info.bytes_in_progress);
 
@@ -464,25 +653,36 @@ void DataSeriesSink::lockedProcessToCompress(PThreadScopedLock &lock, ToCompress
     INVARIANT(writer_info.cur_offset > 0,"Error: processToCompress on closed file\n");
 
     Stats tmp;
+    // Only worth sharing out the trials if there is someone to share with.
+    bool share_trials = worker_info.compressors.size() > 1;
+    bool column_stats = extent_stats 
+        && !prefixequal(work->extent->getTypePtr()->getName(), "DataSeries: ");
     {
         PThreadScopedUnlock unlock(lock);
 
+        if (column_stats) {
+            computeColumnStats(*work->extent, work->column_stats);
+        }
+
         size_t nrecords = work->extent->nRecords();
         struct timespec pack_start, pack_end;
         get_thread_cputime(pack_start);
 
         uint32_t headersize, fixedsize, variablesize;
+        CompressTrials trials(*this);
         work->checksum = work->extent->packData(work->compressed, compression_modes,
                                                 compression_level, &headersize,
-                                                &fixedsize, &variablesize);
+                                                &fixedsize, &variablesize,
+                                                share_trials ? &trials : NULL);
         get_thread_cputime(pack_end);
 
         double pack_extent_time = (pack_end.tv_sec - pack_start.tv_sec) 
                                   + (pack_end.tv_nsec - pack_start.tv_nsec)*1e-9;
-    
         INVARIANT(pack_extent_time >= 0, format("get_thread_cputime broken? %d.%d - %d.%d = %.9g")
                   % pack_end.tv_sec % pack_end.tv_nsec 
                   % pack_start.tv_sec % pack_start.tv_nsec % pack_extent_time);
+        pack_extent_time += trials.helper_time;
+
         // Slightly less efficient than calling update on the two separate stats,
         // but easier to code.
         tmp.update(headersize + fixedsize + variablesize, fixedsize,
@@ -533,6 +733,12 @@ void  DataSeriesSink::compressorThread()  {
 
     PThreadScopedLock lock(mutex);
     while (true) {
+        if (!worker_info.trials.empty()) {
+            // finishing an extent already being packed comes first, the
+            // writer may be waiting on it
+            lockedHelpCompressTrial(lock);
+            continue;
+        }
         ToCompress *work = NULL;
         for (Deque<ToCompress *>::iterator i = worker_info.pending_work.begin();
             i != worker_info.pending_work.end(); ++i) {
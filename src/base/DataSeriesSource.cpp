@@ -10,6 +10,7 @@
 */
 
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -45,6 +46,34 @@ using boost::format;
 #define O_LARGEFILE 0
 #endif
 
+DataSeriesSource::MappedFile::MappedFile(int fd, size_t size, const string &filename)
+        : data(NULL), data_size(size)
+{
+    void *ret = mmap(NULL, data_size, PROT_READ, MAP_SHARED, fd, 0);
+    INVARIANT(ret != MAP_FAILED, format("error mapping %d bytes of file '%s': %s")
+              % data_size % filename % strerror(errno));
+    data = static_cast<byte *>(ret);
+#if defined(MADV_RANDOM)
+    // Readahead is driven explicitly by adviseWillNeed in the order the
+    // extents are visited, e.g. sparse selections from an index, so don't let
+    // the kernel guess based on the file layout.
+    madvise(ret, data_size, MADV_RANDOM);
+#endif
+}
+
+DataSeriesSource::MappedFile::~MappedFile() {
+    CHECKED(munmap(data, data_size) == 0, format("munmap failed: %s") % strerror(errno));
+}
+
+void DataSeriesSource::MappedFile::adviseWillNeed(off64_t offset, size_t len) {
+#if defined(MADV_WILLNEED)
+    static const size_t page_size = getpagesize();
+    // madvise requires a page aligned start address
+    size_t skew = offset % page_size;
+    madvise(data + offset - skew, len + skew, MADV_WILLNEED);
+#endif
+}
+
 DataSeriesSource::DataSeriesSource(const string &filename, bool read_index, bool check_tail)
         : index_extent(), filename(filename), fd(-1), cur_offset(0), read_index(read_index),
           check_tail(check_tail), mtime_nanosec(0)
@@ -65,6 +94,14 @@ DataSeriesSource::~DataSeriesSource() {
 void DataSeriesSource::closefile() {
     CHECKED(close(fd) == 0, format("close failed: %s") % strerror(errno));
     fd = -1;
+    mapping.reset(); // outstanding mapped extents keep their own reference
+}
+
+int DataSeriesSource::dupFd() {
+    SINVARIANT(isactive());
+    int ret = dup(fd);
+    INVARIANT(ret >= 0, format("dup of fd for '%s' failed: %s") % filename % strerror(errno));
+    return ret;
 }
 
 void DataSeriesSource::reopenfile() {
@@ -170,6 +207,37 @@ void DataSeriesSource::readTailIndex() {
     }
 }    
 
+DataSeriesSource::MappedFile::Ptr
+DataSeriesSource::mapCompressed(off64_t &offset, byte *&begin, size_t &size) {
+    INVARIANT(canMapCompressed(), "can not map extents that need a bitflip to be unpacked");
+    SINVARIANT(isactive());
+    if (mapping == NULL) {
+        struct stat stat_buf;
+        INVARIANT(fstat(fd, &stat_buf) == 0,
+                  format("error on file '%s' for stat: %s") % filename % strerror(errno));
+        mapping.reset(new MappedFile(fd, stat_buf.st_size, filename));
+    }
+    SINVARIANT(offset >= 0 && static_cast<size_t>(offset) <= mapping->size());
+    if (static_cast<size_t>(offset) == mapping->size()) {
+        return MappedFile::Ptr();
+    }
+    INVARIANT(offset + Extent::packed_prefix_size <= mapping->size(),
+              format("partial extent header at offset %d in '%s'") % offset % filename);
+    byte *prefix = mapping->begin() + offset;
+    int64_t extentsize = Extent::packedExtentSize(prefix, need_bitflip);
+    if (extentsize < 0) {
+        return MappedFile::Ptr();
+    }
+    INVARIANT(offset + extentsize <= static_cast<int64_t>(mapping->size()),
+              format("extent at offset %d size %d runs off the end of '%s'")
+              % offset % extentsize % filename);
+    mapping->adviseWillNeed(offset, extentsize);
+    begin = prefix;
+    size = extentsize;
+    offset += extentsize;
+    return mapping;
+}
+
 Extent *DataSeriesSource::preadExtent(off64_t &offset, unsigned *compressedSize) {
     Extent::ByteArray extentdata;
     
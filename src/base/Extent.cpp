@@ -19,6 +19,7 @@
 #include <iostream>
 
 #include <boost/limits.hpp>
+#include <boost/static_assert.hpp>
 
 #if (_FILE_OFFSET_BITS == 64 && !defined(_LARGEFILE64_SOURCE)) || defined(__CYGWIN__)
 #define pread64 pread
@@ -63,6 +64,7 @@ extern "C" {
 }
 
 #include <Lintel/Clock.hpp>
+#include <Lintel/HashMap.hpp>
 #include <Lintel/HashTable.hpp>
 #include <Lintel/LintelLog.hpp>
 #include <Lintel/PThread.hpp>
@@ -189,6 +191,113 @@ void Extent::setReadChecksFromEnv(bool defval) {
     did_checks_init = true;
 }
 
+// Compression selection; see Extent::CompressSelect.  The settings are
+// expected to be changed only before extents are packed; the learned
+// choices are shared by all packing threads and protected by the mutex.
+
+struct CompressChoice {
+    CompressChoice() : best_mode(0), nextents(0), since_trial(0), best_ratio(1.0),
+                       retrial(false) { }
+    Extent::byte best_mode;
+    uint32_t nextents, since_trial;
+    double best_ratio; // running packed/unpacked ratio of best_mode
+    bool retrial; // best_mode got worse, try everything on the next extent
+};
+
+static bool did_compress_select_init = false;
+static Extent::CompressSelect compress_select = Extent::CompressSelectExhaustive;
+static unsigned compress_sample_interval = 32;
+static Extent::CompressCost compress_cost = Extent::CompressCostSize;
+static double compress_time_weight = 1.0, compress_size_weight = 1.0e-8;
+static PThreadMutex compress_choice_mutex;
+static HashMap<string, CompressChoice> compress_choices;
+
+// Always trial this many extents before trusting a choice; the first extent
+// of a file is often unrepresentative (headers, mostly-empty tables).
+static const uint32_t compress_warmup_extents = 3;
+
+void Extent::setCompressSelect(CompressSelect select, unsigned sample_interval) {
+    if (!did_compress_select_init) { // pick up the other setting from the environment
+        setCompressSelectFromEnv();
+    }
+    INVARIANT(sample_interval > 0, "sample interval must be positive");
+    PThreadScopedLock lock(compress_choice_mutex);
+    compress_select = select;
+    compress_sample_interval = sample_interval;
+    compress_choices.clear();
+}
+
+void Extent::setCompressCost(CompressCost cost, double time_weight, double size_weight) {
+    if (!did_compress_select_init) { // pick up the other setting from the environment
+        setCompressSelectFromEnv();
+    }
+    INVARIANT(time_weight >= 0 && size_weight >= 0, "cost weights can not be negative");
+    PThreadScopedLock lock(compress_choice_mutex);
+    compress_cost = cost;
+    compress_time_weight = time_weight;
+    compress_size_weight = size_weight;
+    compress_choices.clear();
+}
+
+void Extent::setCompressSelectFromEnv() {
+    did_compress_select_init = true;
+    CompressSelect select = CompressSelectExhaustive;
+    unsigned sample_interval = 32;
+    CompressCost cost = CompressCostSize;
+    double time_weight = 1.0, size_weight = 1.0e-8;
+
+    if (getenv("DATASERIES_COMPRESS_SELECT") != NULL) {
+        vector<string> parts;
+        split(getenv("DATASERIES_COMPRESS_SELECT"), ":", parts);
+        if (parts[0] == "exhaustive" && parts.size() == 1) {
+            select = CompressSelectExhaustive;
+        } else if (parts[0] == "adaptive" && parts.size() <= 2) {
+            select = CompressSelectAdaptive;
+            if (parts.size() == 2) {
+                sample_interval = stringToInteger<uint32_t>(parts[1]);
+            }
+        } else {
+            FATAL_ERROR(format("unrecognized DATASERIES_COMPRESS_SELECT '%s'; expected exhaustive or adaptive[:sample-interval]")
+                        % getenv("DATASERIES_COMPRESS_SELECT"));
+        }
+    }
+    if (getenv("DATASERIES_COMPRESS_COST") != NULL) {
+        vector<string> parts;
+        split(getenv("DATASERIES_COMPRESS_COST"), ":", parts);
+        if (parts[0] == "size" && parts.size() == 1) {
+            cost = CompressCostSize;
+        } else if (parts[0] == "time-size" && parts.size() == 1) {
+            cost = CompressCostTimeSize;
+        } else if (parts[0] == "weighted" && (parts.size() == 1 || parts.size() == 3)) {
+            cost = CompressCostWeighted;
+            if (parts.size() == 3) {
+                time_weight = stringToDouble(parts[1]);
+                size_weight = stringToDouble(parts[2]);
+            }
+        } else {
+            FATAL_ERROR(format("unrecognized DATASERIES_COMPRESS_COST '%s'; expected size, time-size or weighted[:time-weight:size-weight]")
+                        % getenv("DATASERIES_COMPRESS_COST"));
+        }
+    }
+    setCompressSelect(select, sample_interval);
+    setCompressCost(cost, time_weight, size_weight);
+}
+
+static double compressCost(size_t packed_size, double decompress_seconds) {
+    switch(compress_cost) 
+        {
+        case Extent::CompressCostSize: 
+            return packed_size;
+        case Extent::CompressCostTimeSize: 
+            return decompress_seconds * packed_size;
+        case Extent::CompressCostWeighted:
+            return compress_time_weight * decompress_seconds 
+                + compress_size_weight * packed_size;
+        default: FATAL_ERROR("?");
+        }
+    return 0;
+}
+
 #if DATASERIES_ENABLE_LZO
 static int lzo_init = 0;
 #endif
@@ -324,6 +433,65 @@ static bool compactIsNull(const ExtentType::byte *fixed_record,
 }
 
 static const bool debug_compact = false;
+// The columnar layout is each of type.rep.fixed_columns in turn, with the
+// values of that column for every record in record order.  Common column
+// sizes get a fixed size copy so the compiler can turn them into plain loads
+// and stores.
+
+template<int size> static void gatherColumn(const Extent::byte *from, size_t stride,
+                                            Extent::byte *to, uint32_t nrecords) {
+    for (uint32_t i = 0; i < nrecords; ++i, from += stride, to += size) {
+        memcpy(to, from, size);
+    }
+}
+
+template<int size> static void scatterColumn(const Extent::byte *from, Extent::byte *to,
+                                             size_t stride, uint32_t nrecords) {
+    for (uint32_t i = 0; i < nrecords; ++i, from += size, to += stride) {
+        memcpy(to, from, size);
+    }
+}
+
+void Extent::fixedRowsToColumns(const ExtentType &type, const byte *rows, byte *columns,
+                                uint32_t nrecords) {
+    const size_t stride = type.rep.fixed_record_size;
+    for (vector<ExtentType::fixedColumn>::const_iterator i = type.rep.fixed_columns.begin();
+         i != type.rep.fixed_columns.end(); ++i) {
+        const byte *from = rows + i->offset;
+        switch(i->size) 
+            {
+            case 1: gatherColumn<1>(from, stride, columns, nrecords); break;
+            case 4: gatherColumn<4>(from, stride, columns, nrecords); break;
+            case 8: gatherColumn<8>(from, stride, columns, nrecords); break;
+            default:
+                for (uint32_t j = 0; j < nrecords; ++j) {
+                    memcpy(columns + j * i->size, from + j * stride, i->size);
+                }
+            }
+        columns += static_cast<size_t>(i->size) * nrecords;
+    }
+}
+
+void Extent::fixedColumnsToRows(const ExtentType &type, const byte *columns, byte *rows,
+                                uint32_t nrecords) {
+    const size_t stride = type.rep.fixed_record_size;
+    for (vector<ExtentType::fixedColumn>::const_iterator i = type.rep.fixed_columns.begin();
+         i != type.rep.fixed_columns.end(); ++i) {
+        byte *to = rows + i->offset;
+        switch(i->size) 
+            {
+            case 1: scatterColumn<1>(columns, to, stride, nrecords); break;
+            case 4: scatterColumn<4>(columns, to, stride, nrecords); break;
+            case 8: scatterColumn<8>(columns, to, stride, nrecords); break;
+            default:
+                for (uint32_t j = 0; j < nrecords; ++j) {
+                    memcpy(to + j * stride, columns + j * i->size, i->size);
+                }
+            }
+        columns += static_cast<size_t>(i->size) * nrecords;
+    }
+}
+
 void Extent::compactNulls(Extent::ByteArray &fixed_coded) {
     if (debug_compact) {
         cout << format("compacting %s\n")
@@ -575,9 +743,214 @@ static const unsigned variable_sizes_batch_size = 1024;
 // Note: Can't split this into pack fixed and pack variable because 
 // packing the variable data can involve updating the fixed data
 
+// Notes on the order of attempted compression algorithms: the result does
+// not depend on it, ties go to the lowest numbered algorithm as they always
+// have.  The trials are started fastest first so that under the size cost
+// the slow algorithms can be handed the best size so far as their output
+// limit; bz2, zlib and lzf then give up as soon as they can no longer win.
+// (Before the algorithms were table driven, the order was lzo, lzf, bz2,
+// zlib; "lzo coding doesn't understand how to limit the amount of memory
+// used".)
+static const int compress_trial_order[] = {
+    Extent::compress_mode_lzf, Extent::compress_mode_lz4, Extent::compress_mode_snappy,
+    Extent::compress_mode_lzo, Extent::compress_mode_zlib, Extent::compress_mode_lz4hc,
+    Extent::compress_mode_bz2
+};
+
+// Output room beyond the size a trial has to beat; lzf and zlib fail when
+// their output would fill the buffer exactly.
+static const size_t trial_limit_slack = 16;
+
+class SectionCompressor;
+
+// One algorithm tried on one section of an extent being packed.
+class CodecTrial : public Extent::CompressTask {
+  public:
+    CodecTrial(SectionCompressor &section, int alg) 
+        : section(section), alg(alg), packed(NULL), cost(0) { }
+    virtual ~CodecTrial() {
+        delete packed;
+    }
+    virtual void run();
+
+    SectionCompressor &section;
+    const int alg;
+    Extent::ByteArray *packed; // NULL if alg didn't shrink the section or couldn't win
+    double cost;
+};
+
+// Compresses one section (fixed or variable data) of an extent: decides
+// which algorithms to try, runs them (possibly in parallel through an
+// Extent::CompressRunner) and keeps the cheapest result.
+class SectionCompressor : boost::noncopyable {
+  public:
+    SectionCompressor(Extent::byte *input, int32_t input_size, int compression_modes,
+                      int compression_level, const string &select_key)
+        : input(input), input_size(input_size), compression_level(compression_level),
+          trial(true), best_size(input_size), best_alg(Extent::num_comp_algs)
+    {
+        if (input_size == 0) {
+            return;
+        }
+        if (!did_compress_select_init) {
+            Extent::setCompressSelectFromEnv();
+        }
+        // With adaptive selection, try only the remembered winner unless it is
+        // time to sample all of them again.
+        if (compress_select == Extent::CompressSelectAdaptive && !select_key.empty()) {
+            choice_key = (format("%s:%d:%d") % select_key % compression_modes 
+                          % compression_level).str();
+            PThreadScopedLock lock(compress_choice_mutex);
+            CompressChoice &choice(compress_choices[choice_key]);
+            if (choice.nextents >= compress_warmup_extents && !choice.retrial
+                && choice.since_trial < compress_sample_interval) {
+                trial = false;
+                compression_modes = Extent::compression_algs[choice.best_mode].compress_flag;
+            }
+        }
+        // Timing decompression is only needed to choose between candidates.
+        time_candidates = compress_cost != Extent::CompressCostSize && trial;
+        bound_by_size = compress_cost == Extent::CompressCostSize;
+
+        BOOST_STATIC_ASSERT(sizeof(compress_trial_order) / sizeof(int) 
+                            == Extent::num_comp_algs - 1);
+        for (int i = 1; i < Extent::num_comp_algs; ++i) {
+            if (compression_modes & Extent::compression_algs[i].compress_flag) {
+                trials.push_back(new CodecTrial(*this, i));
+            }
+        }
+    }
+
+    ~SectionCompressor() {
+        for (vector<CodecTrial *>::iterator i = trials.begin(); i != trials.end(); ++i) {
+            delete *i;
+        }
+    }
+
+    void addTrials(vector<Extent::CompressTask *> &tasks) {
+        for (unsigned i = 0; i < sizeof(compress_trial_order) / sizeof(int); ++i) {
+            for (vector<CodecTrial *>::iterator j = trials.begin(); j != trials.end(); ++j) {
+                if ((**j).alg == compress_trial_order[i]) {
+                    tasks.push_back(*j);
+                }
+            }
+        }
+    }
+
+    void runTrial(CodecTrial &trial) {
+        Extent::ByteArray *packed = new Extent::ByteArray;
+        if (bound_by_size) {
+            // Ties go to the lower numbered algorithm, so a trial numbered
+            // below the best so far can still win at the same size.  The
+            // codecs give up a few bytes short of a full buffer, hence the slack.
+            PThreadScopedLock lock(mutex);
+            size_t limit = best_size + trial_limit_slack - (trial.alg > best_alg ? 1 : 0);
+            if (limit < static_cast<size_t>(input_size)) {
+                packed->resize(limit, false);
+            }
+        }
+        bool ok = Extent::compression_algs[trial.alg].packFunc(input, input_size, *packed,
+                                                               compression_level);
+        if (!ok || packed->size() >= static_cast<size_t>(input_size)) {
+            delete packed;
+            return;
+        }
+        double decompress_seconds = 0;
+        if (time_candidates) {
+            Extent::ByteArray scratch;
+            scratch.resize(input_size, false);
+            int32_t scratch_size = input_size;
+            Clock::Tdbl start = Clock::tod();
+            ok = Extent::compression_algs[trial.alg].unpackFunc(scratch.begin(), packed->begin(),
+                                                                packed->size(), scratch_size);
+            decompress_seconds = Clock::tod() - start;
+            INVARIANT(ok, format("%s failed to decompress its own output")
+                      % Extent::compression_algs[trial.alg].name);
+        }
+        trial.cost = compressCost(packed->size(), decompress_seconds);
+        trial.packed = packed;
+        if (bound_by_size) {
+            PThreadScopedLock lock(mutex);
+            if (packed->size() < best_size
+                || (packed->size() == best_size && trial.alg < best_alg)) {
+                best_size = packed->size();
+                best_alg = trial.alg;
+            }
+        }
+    }
+
+    // you are responsible for deleting the return buffer
+    Extent::ByteArray *finish(Extent::byte *mode) {
+        Extent::ByteArray *best_packed = NULL;
+        double best_cost = 0;
+        *mode = 0;
+        if (input_size == 0) {
+            return new Extent::ByteArray;
+        }
+        CodecTrial *best = NULL;
+        for (vector<CodecTrial *>::iterator i = trials.begin(); i != trials.end(); ++i) {
+            if ((**i).packed != NULL && (best == NULL || (**i).cost < best_cost)) {
+                best = *i;
+                best_cost = best->cost;
+            }
+        }
+        if (best != NULL) {
+            best_packed = best->packed;
+            best->packed = NULL;
+            *mode = best->alg;
+        } else {
+            // must be no coding, or all compression algorithms worked badly
+            best_packed = new Extent::ByteArray;
+            best_packed->resize(input_size, false);
+            memcpy(best_packed->begin(), input, input_size);
+            *mode = 0; // no compression
+        }
+
+        if (!choice_key.empty()) {
+            PThreadScopedLock lock(compress_choice_mutex);
+            CompressChoice &choice(compress_choices[choice_key]);
+            double ratio = static_cast<double>(best_packed->size()) / input_size;
+            ++choice.nextents;
+            if (trial) {
+                choice.best_mode = *mode;
+                choice.best_ratio = ratio;
+                choice.since_trial = 0;
+                choice.retrial = false;
+            } else {
+                ++choice.since_trial;
+                // a much worse ratio suggests the data changed; re-check the
+                // other algorithms now rather than waiting for the next sample.
+                if (ratio > choice.best_ratio * 1.25 + 0.01) {
+                    choice.retrial = true;
+                } else {
+                    choice.best_ratio = 0.9 * choice.best_ratio + 0.1 * ratio;
+                }
+            }
+        }
+        return best_packed;
+    }
+
+  private:
+    Extent::byte *input;
+    const int32_t input_size;
+    const int compression_level;
+    string choice_key;
+    bool trial, time_candidates, bound_by_size;
+    vector<CodecTrial *> trials; // in algorithm order, which breaks ties
+    PThreadMutex mutex; 
+    // smallest result so far and its algorithm, limits later trials under the size cost
+    size_t best_size;
+    int best_alg;
+};
+
+void CodecTrial::run() {
+    section.runTrial(*this);
+}
+
 uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes, 
                           uint32_t compression_level, uint32_t *header_packed, 
-                          uint32_t *fixed_packed, uint32_t *variable_packed) {
+                          uint32_t *fixed_packed, uint32_t *variable_packed,
+                          CompressRunner *runner) {
     // Don't need to zero the coded arrays as we will be filling them
     // all in.
     Extent::ByteArray fixed_coded;
@@ -805,6 +1178,15 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
 
         compactNulls(fixed_coded);
     }
+    byte flags = 0;
+    if (type->getPackFixedLayout() == ExtentType::FixedLayoutColumns && nrecords > 1) {
+        // also after the hash, the hash is over the in memory layout
+        Extent::ByteArray columns;
+        columns.resize(fixed_coded.size(), false);
+        fixedRowsToColumns(*type, fixed_coded.begin(), columns.begin(), nrecords);
+        fixed_coded.swap(columns);
+        flags |= packed_flag_fixed_columns;
+    }
 
     SINVARIANT(static_cast<size_t>(variable_data_pos - variable_coded.begin()) 
                <= variable_coded.size())
@@ -828,20 +1210,31 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
     bjhash = lintel::bobJenkinsHash(bjhash, &(variable_sizes[0]), 4*variable_sizes.size());
     variable_sizes.resize(0);
 
+    // beginning at 4 bytes into the variable array avoids packing the 0
+    // bytes at the beginning of the variable coded stuff since that is fixed
+    SectionCompressor fixed_compressor(fixed_coded.begin(), fixed_coded.size(),
+                                       compression_modes, compression_level,
+                                       "fixed:" + type->getName());
+    SectionCompressor variable_compressor(variable_coded.begin() + 4, 
+                                          variable_coded.size() - 4,
+                                          compression_modes, compression_level,
+                                          "variable:" + type->getName());
+    vector<CompressTask *> tasks;
+    fixed_compressor.addTrials(tasks);
+    variable_compressor.addTrials(tasks);
+    if (runner != NULL && tasks.size() > 1) {
+        runner->runAll(tasks);
+    } else {
+        for (vector<CompressTask *>::iterator i = tasks.begin(); i != tasks.end(); ++i) {
+            (**i).run();
+        }
+    }
+
     byte compressed_fixed_mode;
-    Extent::ByteArray *compressed_fixed 
-            = compressBytes(fixed_coded.begin(),fixed_coded.size(),
-                            compression_modes, compression_level,
-                            &compressed_fixed_mode);
+    Extent::ByteArray *compressed_fixed = fixed_compressor.finish(&compressed_fixed_mode);
     byte compressed_variable_mode;
-    Extent::ByteArray *compressed_variable;
-    // beginning at 4 bytes into the array avoids packing the 0 bytes at the beginning of the
-    // variable coded stuff since that is fixed
-    compressed_variable 
-            = compressBytes(variable_coded.begin() + 4,
-                            variable_coded.size() - 4,
-                            compression_modes, compression_level,
-                            &compressed_variable_mode);
+    Extent::ByteArray *compressed_variable 
+            = variable_compressor.finish(&compressed_variable_mode);
 
     int headersize = 6*4+4*1+type->getName().size();
     headersize += (4 - headersize % 4) % 4;
@@ -866,7 +1259,7 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
     *l = compressed_fixed_mode; l += 1;
     *l = compressed_variable_mode; l += 1;
     *l = (byte)type->getName().size(); l += 1;
-    *l = 0; l += 1;
+    *l = flags; l += 1;
     memcpy(l, type->getName().data(), type->getName().size()); l += type->getName().size();
     // TODO: verify that aligning speeds up the copy, I'm 90% sure
     // that's why it was done here since we will always copy out the
@@ -1152,78 +1545,6 @@ bool Extent::unpackLZ4(byte* output, byte* input,
 #endif
 }
 
-// TODO: test that this works, but I believe that if we do a resize on
-// the extent that is about to be used when we pass it in to the sub
-// pack functions then the compression algorithms will stop early if
-// they can't compress into the smaller amount of space.
-
-Extent::ByteArray *Extent::compressBytes(byte *input, int32 input_size,
-                                         int compression_modes,
-                                         int compression_level, byte *mode) {
-    if (input_size == 0) {
-        return new Extent::ByteArray;
-    }
-
-    Extent::ByteArray *best_packed = NULL;
-    *mode = 0;
-
-    // Notes on the order of attempted compression algorithms:
-    // On reasonably powerful machines today in 2013, this should not be of
-    // practical relevance.  So, the order in which the algorithms are attempted
-    // here simply follows the order mandated by the numbers assigned to the
-    // formats early on in the DataSeries design, as explained with regards to
-    // the compression_algs[] constant.
-    // However, before changing to this more-flexible approach, there was a
-    // specific order of the algorithms chosen.  The quotes below come from
-    // those old comments.
-    // lzo was done first because "lzo coding doesn't understand how to limit the
-    // amount of memory used"
-    // lzf was done second because it "compresses really fast"
-    // bz2 was third because it "tends to pack the best if used"
-    // zlib was last because, with no reason given
-    // -- DYS and ASB July 2013
-
-    // Loop over all the available compression algorithms.
-    // Starting at 1 because index 0 corresponds to no compression, which is
-    // being treated as a special case, and properly addressed at the bottom
-    // of this function.
-    for (int i = 1 ; i < Extent::num_comp_algs ; ++i) {
-        if (!(compression_modes & compression_algs[i].compress_flag)) {
-            continue;
-            // Skip over this compression algorithm if it's not supposed to be
-            // attempted (according to compression_modes, which is
-            // a bunch of binary flags)
-        }
-
-        Extent::ByteArray* next_pack = new Extent::ByteArray;
-        
-        bool packResult = compression_algs[i].packFunc(input, input_size,
-                                                       *next_pack, 
-                                                       compression_level);
-        
-
-        if ( (packResult && next_pack->size() < (size_t)input_size) &&
-             (best_packed == NULL || next_pack->size() < best_packed->size()) ) { 
-                delete best_packed;
-                best_packed = next_pack;
-                *mode = i;
-        } else {
-            delete next_pack;
-        }
-    }
-    
-    if (best_packed == NULL) { 
-        // must be no coding, or all compression algorithms worked badly
-        delete best_packed;
-        best_packed = new Extent::ByteArray;
-        best_packed->resize(input_size, false);
-        memcpy(best_packed->begin(), input, input_size);
-        *mode = 0; // no compression
-    }
-
-    return best_packed;
-}
-
 /* Compression_mode here refers to the integer assigned to
    the compression algorithm rather than its boolean flag, as
    the compressed data should have a specific compress type. */
@@ -1256,77 +1577,177 @@ int32_t Extent::uncompressBytes(byte *into, byte *from, byte compression_mode,
     return outsize;
 }
 
+// Helpers for the per field passes of unpackData; see the comment there.
+
+// Enough records that the per field loops run for a while, few enough that
+// a block of typical (<100 byte) records stays in the L1/L2 cache.
+static const size_t unpack_block_records = 1024;
+
+static void flipColumn4(Extent::byte *pos, size_t stride, size_t n) {
+    for (size_t i = 0; i < n; ++i, pos += stride) {
+        Extent::flip4bytes(pos);
+    }
+}
+
+static void flipColumn8(Extent::byte *pos, size_t stride, size_t n) {
+    for (size_t i = 0; i < n; ++i, pos += stride) {
+        Extent::flip8bytes(pos);
+    }
+}
+
+static void scaleColumn(Extent::byte *pos, size_t stride, size_t n, double scale) {
+    for (size_t i = 0; i < n; ++i, pos += stride) {
+        *reinterpret_cast<double *>(pos) *= scale;
+    }
+}
+
+// nci is NULL unless the type uses null compaction, in which case null values
+// are skipped since they have to remain 0.
+template<typename T> 
+static void selfRelativeColumn(Extent::byte *pos, size_t stride, size_t n, 
+                               const Extent::byte *record, 
+                               const ExtentType::nullCompactInfo *nci, T &prev_v) {
+    T prev = prev_v;
+    if (nci == NULL) {
+        for (size_t i = 0; i < n; ++i, pos += stride) {
+            prev += *reinterpret_cast<T *>(pos);
+            *reinterpret_cast<T *>(pos) = prev;
+        }
+    } else {
+        for (size_t i = 0; i < n; ++i, pos += stride, record += stride) {
+            if (!compactIsNull(record, *nci)) {
+                prev += *reinterpret_cast<T *>(pos);
+                *reinterpret_cast<T *>(pos) = prev;
+            }
+        }
+    }
+    prev_v = prev;
+}
+
+static void selfRelativeDoubleColumn(Extent::byte *pos, size_t stride, size_t n, 
+                                     const Extent::byte *record, 
+                                     const ExtentType::nullCompactInfo *nci,
+                                     double &prev_v, double multiplier, double scale) {
+    double prev = prev_v;
+    for (size_t i = 0; i < n; ++i, pos += stride, record += stride) {
+        if (nci != NULL && compactIsNull(record, *nci)) {
+            continue;
+        }
+        double v = *reinterpret_cast<double *>(pos) + prev;
+        v = round(v * multiplier) * scale;
+        *reinterpret_cast<double *>(pos) = v;
+        prev = v;
+    }
+    prev_v = prev;
+}
+
+template<typename T> 
+static void otherRelativeColumn(Extent::byte *pos, const Extent::byte *base_pos, 
+                                size_t stride, size_t n, const Extent::byte *record,
+                                const ExtentType::nullCompactInfo *nci) {
+    for (size_t i = 0; i < n; ++i, pos += stride, base_pos += stride, record += stride) {
+        if (nci != NULL && compactIsNull(record, *nci)) {
+            continue;
+        }
+        *reinterpret_cast<T *>(pos) += *reinterpret_cast<const T *>(base_pos);
+    }
+}
+
 #define TIME_UNPACKING(x)
 
 const string Extent::getPackedExtentType(const Extent::ByteArray &from) {
-    INVARIANT(from.size() > (6*4+2), "Invalid extent data, too small.");
+    return getPackedExtentType(from.begin(), from.size());
+}
+
+const string Extent::getPackedExtentType(const byte *from, size_t from_size) {
+    INVARIANT(from_size > (6*4+2), "Invalid extent data, too small.");
 
     byte type_name_len = from[6*4+2];
 
     unsigned header_len = 6*4+4+type_name_len;
     header_len += (4 - (header_len % 4))%4;
-    INVARIANT(from.size() >= header_len, "Invalid extent data, too small");
+    INVARIANT(from_size >= header_len, "Invalid extent data, too small");
 
-    string type_name((char *)from.begin() + (6*4+4), (int)type_name_len);
+    string type_name((const char *)from + (6*4+4), (int)type_name_len);
     return type_name;
 }
 
 void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
+    unpackData(from.begin(), from.size(), fix_endianness);
+}
+
+void Extent::unpackData(byte *from, size_t from_size, bool fix_endianness) {
     if (!did_checks_init) {
         setReadChecksFromEnv();
     }
-    INVARIANT(type->getName() == getPackedExtentType(from), 
+    INVARIANT(type->getName() == getPackedExtentType(from, from_size), 
               "Internal: type mismatch") ;
 
     TIME_UNPACKING(Clock::Tdbl time_start = Clock::tod());
-    INVARIANT(from.size() > (6*4+2), "Invalid extent data, too small.");
+    INVARIANT(from_size > (6*4+2), "Invalid extent data, too small.");
 
     uLong adler32sum = adler32(0L, Z_NULL, 0);
     if (preuncompress_check) {
-        adler32sum = adler32(adler32sum, from.begin(), 4*4);
-        adler32sum = adler32(adler32sum, from.begin() + 5*4, from.size()-5*4);
+        adler32sum = adler32(adler32sum, from, 4*4);
+        adler32sum = adler32(adler32sum, from + 5*4, from_size-5*4);
     }
     if (fix_endianness) {
         for (int i=0 ; i < 6*4 ; i += 4) {
-            Extent::flip4bytes(from.begin() + i);
+            Extent::flip4bytes(from + i);
         }
     }
     if (preuncompress_check) {
-        INVARIANT(*(int32 *)(from.begin() + 4*4) == (int32)adler32sum,
+        INVARIANT(*(int32 *)(from + 4*4) == (int32)adler32sum,
                   format("Invalid extent data, adler32 digest"
                          " mismatch on compressed data %x != %x")
-                  % *(int32 *)(from.begin() + 4*4) % (int32)adler32sum);
+                  % *(int32 *)(from + 4*4) % (int32)adler32sum);
     }
     TIME_UNPACKING(Clock::Tdbl time_upc = Clock::tod());
-    int32 compressed_fixed_size = *(int32 *)from.begin();
-    int32 compressed_variable_size = *(int32 *)(from.begin() + 4);
-    int32 nrecords = *(int32 *)(from.begin() + 8);
-    int32 variable_size = *(int32 *)(from.begin() + 12);
+    int32 compressed_fixed_size = *(int32 *)from;
+    int32 compressed_variable_size = *(int32 *)(from + 4);
+    int32 nrecords = *(int32 *)(from + 8);
+    int32 variable_size = *(int32 *)(from + 12);
     byte compressed_fixed_mode = from[6*4];
     byte compressed_variable_mode = from[6*4+1];
     byte type_name_len = from[6*4+2];
+    byte flags = from[6*4+3];
     
     uint32_t header_len = 6*4+4+type_name_len;
     header_len += (4 - (header_len % 4))%4;
-    INVARIANT(from.size() >= header_len, "Invalid extent data, too small");
+    INVARIANT(from_size >= header_len, "Invalid extent data, too small");
 
-    byte *compressed_fixed_begin = from.begin() + header_len;
+    byte *compressed_fixed_begin = from + header_len;
     int32 rounded_fixed = compressed_fixed_size;
     rounded_fixed += (4- (rounded_fixed %4))%4;
     byte *compressed_variable_begin = compressed_fixed_begin + rounded_fixed;
     int32 rounded_variable = compressed_variable_size;
     rounded_variable += (4-(rounded_variable%4))%4;
 
-    INVARIANT(header_len + rounded_fixed + rounded_variable == from.size(),
+    INVARIANT(header_len + rounded_fixed + rounded_variable == from_size,
               "Invalid extent data");
 
+    INVARIANT((flags & ~packed_flags_known) == 0,
+              format("extent uses unknown encoding flags 0x%x; written by a newer DataSeries?")
+              % static_cast<unsigned>(flags));
     fixeddata.resize(nrecords * type->rep.fixed_record_size, false);
 
-    int32 fixed_uncompressed_size
+    int32 fixed_uncompressed_size;
+    if (flags & packed_flag_fixed_columns) {
+        Extent::ByteArray columns;
+        columns.resize(fixeddata.size(), false);
+        fixed_uncompressed_size
+            = uncompressBytes(columns.begin(), compressed_fixed_begin,
+                              compressed_fixed_mode, columns.size(), compressed_fixed_size);
+        INVARIANT(fixed_uncompressed_size == nrecords * type->rep.fixed_record_size, 
+                  "bad columnar fixed data");
+        fixedColumnsToRows(*type, columns.begin(), fixeddata.begin(), nrecords);
+    } else {
+        fixed_uncompressed_size
             = uncompressBytes(fixeddata.begin(),compressed_fixed_begin,
                               compressed_fixed_mode,
                               nrecords * type->rep.fixed_record_size,
                               compressed_fixed_size);
+    }
     if (type->getPackNullCompact() != ExtentType::CompactNo) {
         uncompactNulls(fixeddata, fixed_uncompressed_size);
     }
@@ -1373,7 +1794,7 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
     variable_sizes.resize(0);
 
     INVARIANT(postuncompress_check == false 
-              || *(int32 *)(from.begin() + 5*4) == (int32)bjhash,
+              || *(int32 *)(from + 5*4) == (int32)bjhash,
               "final partially unpacked hash check failed");
     
     vector<ExtentType::pack_self_relativeT> psr_copy 
@@ -1386,153 +1807,101 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
                    psr_copy[j].int64_prev_v == 0);
     }
     TIME_UNPACKING(Clock::Tdbl time_postuc = Clock::tod());
-    int record_count = 0;
-    // 2004-09-26: each one of these is worth a small speedup, 0.5-1%
-    // or so I'd guess, while not inherently worth it, the fix was
-    // made when profiling accidentally with the debugging library, 
-    // and there is no point in removing the fix.
-    const size_t type_variable32_field_columns_size 
-            = type->rep.variable32_field_columns.size();
-    const size_t type_pack_scale_size = type->rep.pack_scale.size();
-    const size_t type_pack_self_relative_size = psr_copy.size();
-    const size_t type_pack_other_relative_size 
-            = type->rep.pack_other_relative.size();
+    // The transforms are done a block of records at a time, and one field at
+    // a time within the block.  The inner loops are then simple strided loops
+    // over one field that the compiler can unroll and vectorize, rather than
+    // a switch on the field type for every field of every record, and the
+    // block stays in cache across the passes.  Each record still sees the
+    // transforms in the same order as packing reversed, so the result is the
+    // same as doing one record at a time.
+    const ExtentType::ParsedRepresentation &rep(type->rep);
+    const size_t record_size = rep.fixed_record_size;
     const bool null_compact = type->getPackNullCompact() != ExtentType::CompactNo;
-    for (ExtentSeries::iterator pos(this); pos.morerecords(); ++pos) {
-        ++record_count;
+    SINVARIANT(fixeddata.size() == record_size * nrecords);
+    for (size_t block_start = 0; block_start < static_cast<size_t>(nrecords); 
+         block_start += unpack_block_records) {
+        byte *block = fixeddata.begin() + block_start * record_size;
+        const size_t n = min(unpack_block_records, nrecords - block_start);
         if (fix_endianness) {
-            for (unsigned int j=0; j<type->rep.field_info.size(); j++) {
-                switch(type->rep.field_info[j].type)
-                {
-                    case ExtentType::ft_bool: 
-                    case ExtentType::ft_byte:
-                        break;
-                    case ExtentType::ft_int32:
-                    case ExtentType::ft_variable32:
-                        Extent::flip4bytes(pos.record_start() 
-                                           + type->rep.field_info[j].offset);
-                        break;
-                    case ExtentType::ft_int64:
-                    case ExtentType::ft_double:
-                        Extent::flip8bytes(pos.record_start() 
-                                           + type->rep.field_info[j].offset);
-                        break;
-                    default:
-                        FATAL_ERROR(format("unknown field type %d for fix_endianness") % type->rep.field_info[j].type);
-                        break;
-                }
+            for (vector<int32>::const_iterator i = rep.flip4_offsets.begin(); 
+                 i != rep.flip4_offsets.end(); ++i) {
+                flipColumn4(block + *i, record_size, n);
+            }
+            for (vector<int32>::const_iterator i = rep.flip8_offsets.begin(); 
+                 i != rep.flip8_offsets.end(); ++i) {
+                flipColumn8(block + *i, record_size, n);
             }
         }
         // check variable sized fields ...
         if (unpack_variable32_check) {
-            for (unsigned int j=0;j<type_variable32_field_columns_size;j++) {
-                int field = type->rep.variable32_field_columns[j];
-                int32 offset = type->rep.field_info[field].offset;
-                int32 varoffset 
-                        = Variable32Field::getVarOffset(pos.record_start(), 
-                                                        offset);
-                // now check with the standard verification routine
-                Variable32Field::selfcheck(variabledata,varoffset);
+            for (vector<int32>::const_iterator i = rep.variable32_field_columns.begin();
+                 i != rep.variable32_field_columns.end(); ++i) {
+                const byte *pos = block + rep.field_info[*i].offset;
+                for (size_t j = 0; j < n; ++j, pos += record_size) {
+                    // now check with the standard verification routine
+                    Variable32Field::selfcheck(variabledata, *reinterpret_cast<const int32 *>(pos));
+                }
             }
         }     
         // Unpacking is done in the reverse order as packing.
 
         // unpack scaled fields ...
-        for (unsigned int j=0;j<type_pack_scale_size;++j) {
-            int field = type->rep.pack_scale[j].field_num;
-            INVARIANT(type->rep.field_info[field].type == ExtentType::ft_double,
+        for (vector<ExtentType::pack_scaleT>::const_iterator i = rep.pack_scale.begin();
+             i != rep.pack_scale.end(); ++i) {
+            const ExtentType::fieldInfo &field(rep.field_info[i->field_num]);
+            INVARIANT(field.type == ExtentType::ft_double,
                       "internal error, scaled only supported for ft_double");
-            int offset = type->rep.field_info[field].offset;
-            double scale = type->rep.pack_scale[j].scale;
-            double v = *(double *)(pos.record_start() + offset);
-            *(double *)(pos.record_start() + offset) = v * scale;
+            scaleColumn(block + field.offset, record_size, n, i->scale);
         }
 
         // unpack self-relative fields ...
-        for (unsigned int j=0;j<type_pack_self_relative_size;++j) {
-            unsigned field_num = psr_copy[j].field_num;
-            const ExtentType::fieldInfo &field(type->rep.field_info[field_num]);
-            if (null_compact && compactIsNull(pos.record_start(),
-                                              *field.null_compact_info)) {
-                // Don't overwrite nulls, must remain 0 to unpack properly.
-                continue;
-            }
-            int offset = field.offset;
+        for (vector<ExtentType::pack_self_relativeT>::iterator i = psr_copy.begin();
+             i != psr_copy.end(); ++i) {
+            const ExtentType::fieldInfo &field(rep.field_info[i->field_num]);
+            // Don't overwrite nulls, must remain 0 to unpack properly.
+            const ExtentType::nullCompactInfo *nci = null_compact ? field.null_compact_info : NULL;
+            byte *pos = block + field.offset;
             switch(field.type) 
             {
-                case ExtentType::ft_double: {
-                    double v = *(double *)(pos.record_start() + offset) + psr_copy[j].double_prev_v;
-                    double multiplier = psr_copy[j].multiplier;
-                    double scale = psr_copy[j].scale;
-                    v = round(v * multiplier) * scale;
-                    *(double *)(pos.record_start() + offset) = v;
-                    psr_copy[j].double_prev_v = v;
-                }
+                case ExtentType::ft_double: 
+                    selfRelativeDoubleColumn(pos, record_size, n, block, nci, i->double_prev_v, 
+                                             i->multiplier, i->scale);
                     break;
-                case ExtentType::ft_int32: {
-                    int32 v = *(int32 *)(pos.record_start() + offset) + psr_copy[j].int32_prev_v;
-                    *(int32 *)(pos.record_start() + offset) = v;
-                    psr_copy[j].int32_prev_v = v;
-                }                   
+                case ExtentType::ft_int32: 
+                    selfRelativeColumn<int32>(pos, record_size, n, block, nci, i->int32_prev_v);
                     break;
-                case ExtentType::ft_int64: {
-                    int64 v = *(int64 *)(pos.record_start() + offset) + psr_copy[j].int64_prev_v;
-                    *(int64 *)(pos.record_start() + offset) = v;
-                    psr_copy[j].int64_prev_v = v;
-                }                   
+                case ExtentType::ft_int64: 
+                    selfRelativeColumn<int64>(pos, record_size, n, block, nci, i->int64_prev_v);
                     break;
                 default:
-                    INVARIANT(field_num < type->rep.field_info.size(), 
-                              format("bad field number %d > %d") 
-                              % field_num % type->rep.field_info.size());
-
                     FATAL_ERROR(format("Internal Error: unrecognized field type %d for field %s (#%d) offset %d in type %s")
                                 % field.type % field.name
-                                % field_num % offset % type->rep.name);
+                                % i->field_num % field.offset % rep.name);
             }
         }
         // unpack other-relative fields ...
-        for (unsigned int j=0;j<type_pack_other_relative_size;++j) {
-            // 2004-09-26 I cannot believe this is worth a 1% speedup (pulling out v).
-            const ExtentType::pack_other_relativeT &v 
-                    = type->rep.pack_other_relative[j];
-            int field_num = v.field_num;
-            const ExtentType::fieldInfo &field(type->rep.field_info[field_num]);
-            if (null_compact && compactIsNull(pos.record_start(), 
-                                              *field.null_compact_info)) {
-                // Don't overwrite nulls, must remain 0 to unpack properly.
-                continue;
-            }
-            int base_field = v.base_field_num;
-            int field_offset = field.offset;
-            byte *base_ptr = pos.record_start()
-                             + type->rep.field_info[base_field].offset;
+        for (vector<ExtentType::pack_other_relativeT>::const_iterator i 
+                 = rep.pack_other_relative.begin(); i != rep.pack_other_relative.end(); ++i) {
+            const ExtentType::fieldInfo &field(rep.field_info[i->field_num]);
+            const ExtentType::nullCompactInfo *nci = null_compact ? field.null_compact_info : NULL;
+            byte *pos = block + field.offset;
+            const byte *base_pos = block + rep.field_info[i->base_field_num].offset;
             switch(field.type)
             {
-                case ExtentType::ft_double: {
-                    double v = *(double *)(pos.record_start() + field_offset);
-                    double base_v = *reinterpret_cast<double *>(base_ptr);
-                    *(double *)(pos.record_start() + field_offset) = v + base_v;
-                }
+                case ExtentType::ft_double: 
+                    otherRelativeColumn<double>(pos, base_pos, record_size, n, block, nci);
                     break;
-                case ExtentType::ft_int32: {
-                    int32 v = *(int32 *)(pos.record_start() + field_offset);
-                    int32 base_v = *reinterpret_cast<int32 *>(base_ptr);
-                    *(int32 *)(pos.record_start() + field_offset) = v + base_v;
-                }
+                case ExtentType::ft_int32: 
+                    otherRelativeColumn<int32>(pos, base_pos, record_size, n, block, nci);
                     break;
-                case ExtentType::ft_int64: {
-                    int64 v = *(int64 *)(pos.record_start() + field_offset);
-                    int64 base_v = *reinterpret_cast<int64 *>(base_ptr);
-                    *(int64 *)(pos.record_start() + field_offset) = v + base_v;
-                }
+                case ExtentType::ft_int64: 
+                    otherRelativeColumn<int64>(pos, base_pos, record_size, n, block, nci);
                     break;
                 default:
                     FATAL_ERROR("Internal error");
             }
         }
     }   
-    INVARIANT(record_count == nrecords,"internal error");
     TIME_UNPACKING(Clock::Tdbl time_done = Clock::tod();
                    printf("%d records, unpackcheck %.6g; uncompress %.6g; unpack %.6g\n",
                           nrecords,
@@ -1543,9 +1912,14 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
 
 uint32_t
 Extent::unpackedSize(Extent::ByteArray &from, bool fix_endianness, const ExtentType::Ptr type) {
-    SINVARIANT(from.size() > 16);
-    uint32_t nrecords = *reinterpret_cast<uint32_t *>(from.begin() + 8);
-    uint32_t variable_size = *reinterpret_cast<uint32_t *>(from.begin() + 12);
+    return unpackedSize(from.begin(), from.size(), fix_endianness, type);
+}
+
+uint32_t Extent::unpackedSize(const byte *from, size_t from_size, bool fix_endianness,
+                              const ExtentType::Ptr type) {
+    SINVARIANT(from_size > 16);
+    uint32_t nrecords = *reinterpret_cast<const uint32_t *>(from + 8);
+    uint32_t variable_size = *reinterpret_cast<const uint32_t *>(from + 12);
     if (fix_endianness) {
         nrecords = flip4bytes(nrecords);
         variable_size = flip4bytes(variable_size);
@@ -1565,25 +1939,18 @@ bool Extent::checkedPread(int fd, off64_t offset, byte *into, int amount, bool e
     return true;
 }
 
-bool Extent::preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip) {
-    int prefix_size = 6*4 + 4*1;
-    into.resize(prefix_size, false);
-    if (checkedPread(fd,offset,into.begin(),prefix_size, true) == false) {
-        into.resize(0);
-        return false;
-    }
-    offset += prefix_size;
-    byte *l = into.begin();
+int64_t Extent::packedExtentSize(byte *prefix, bool need_bitflip) {
+    byte *l = prefix;
     int32_t compressed_fixed = *(int32_t *)l; l += 4;
     int32_t compressed_variable = *(int32_t *)l; l += 4;
-    int32 typenamelen = into[6*4+2];
+    int32 typenamelen = prefix[6*4+2];
     if (need_bitflip) {
         compressed_fixed = flip4bytes(compressed_fixed);
         compressed_variable = flip4bytes(compressed_variable);
     }
     if (compressed_fixed == -1) {
-        DataSeriesSink::verifyTail(into.begin(), need_bitflip,"*unknown*");
-        return false;
+        DataSeriesSink::verifyTail(prefix, need_bitflip,"*unknown*");
+        return -1;
     }
     INVARIANT(compressed_fixed >= 0 && compressed_variable >= 0
               && typenamelen >= 0, "Error reading extent");
@@ -1591,18 +1958,32 @@ bool Extent::preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool
               && static_cast<uint32_t>(compressed_variable) < max_packed_size,
               format("Excessively large extent is almost definitely corruption sizes=%d/%d")
               % compressed_fixed % compressed_variable);
-    uint64_t extentsize = prefix_size+typenamelen;
+    int64_t extentsize = packed_prefix_size+typenamelen;
     extentsize += (4 - extentsize % 4) % 4;
     extentsize += compressed_fixed;
     extentsize += (4 - extentsize % 4) % 4;
     extentsize += compressed_variable;
     extentsize += (4 - extentsize % 4) % 4;
-    LintelLogDebug("Extent/size", format("%d %d %d %d ~= %d") % prefix_size % typenamelen
+    LintelLogDebug("Extent/size", format("%d %d %d %d ~= %d") % packed_prefix_size % typenamelen
                    % compressed_fixed % compressed_variable % extentsize);
+    return extentsize;
+}
+
+bool Extent::preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip) {
+    into.resize(packed_prefix_size, false);
+    if (checkedPread(fd,offset,into.begin(),packed_prefix_size, true) == false) {
+        into.resize(0);
+        return false;
+    }
+    offset += packed_prefix_size;
+    int64_t extentsize = packedExtentSize(into.begin(), need_bitflip);
+    if (extentsize < 0) {
+        return false;
+    }
     into.resize(extentsize, false);
-    checkedPread(fd, offset, into.begin() + prefix_size, 
-                 extentsize - prefix_size);
-    offset += extentsize - prefix_size;
+    checkedPread(fd, offset, into.begin() + packed_prefix_size, 
+                 extentsize - packed_prefix_size);
+    offset += extentsize - packed_prefix_size;
     return true;
 }
 
@@ -0,0 +1,240 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Compiled copies of fields between extents
+*/
+
+#include <algorithm>
+
+#include <boost/format.hpp>
+
+#include <DataSeries/ExtentCopyPlan.hpp>
+#include <DataSeries/Variable32Field.hpp>
+
+using namespace std;
+using boost::format;
+
+namespace {
+    // bytes taken in the variable data by a variable32 value at var_offset, including its size;
+    // matches the layout written by Variable32Field::allocateSpace
+    size_t varBlockBytes(const Extent::ByteArray &variabledata, int32_t var_offset) {
+        if (var_offset == 0) {
+            return 0;
+        }
+        int32_t size = *reinterpret_cast<const int32_t *>(variabledata.begin(var_offset));
+        DEBUG_SINVARIANT(size > 0);
+        return 4 + Variable32Field::roundupSize(size);
+    }
+}
+
+ExtentCopyPlan::ExtentCopyPlan(const ExtentType::Ptr &source_type,
+                               const ExtentType::Ptr &dest_type, const FieldPairs &fields)
+    : source_type(source_type), dest_type(dest_type), whole_row(false)
+{
+    init(fields);
+}
+
+ExtentCopyPlan::ExtentCopyPlan(const ExtentType::Ptr &source_type,
+                               const ExtentType::Ptr &dest_type)
+    : source_type(source_type), dest_type(dest_type), whole_row(false)
+{
+    FieldPairs fields;
+    fields.reserve(dest_type->getNFields());
+    for (uint32_t i = 0; i < dest_type->getNFields(); ++i) {
+        const string &name(dest_type->getFieldName(i));
+        fields.push_back(make_pair(name, name));
+    }
+    init(fields);
+}
+
+void ExtentCopyPlan::init(const FieldPairs &fields) {
+    SINVARIANT(source_type != NULL && dest_type != NULL);
+    for (FieldPairs::const_iterator i = fields.begin(); i != fields.end(); ++i) {
+        addField(i->first, i->second);
+        if (!supported()) {
+            return;
+        }
+    }
+
+    if (source_type == dest_type && fields.size() == dest_type->getNFields()) {
+        whole_row = true;
+        for (FieldPairs::const_iterator i = fields.begin(); i != fields.end(); ++i) {
+            whole_row = whole_row && i->first == i->second;
+        }
+    }
+    if (whole_row) {
+        // the null flags and the bits of the booleans come along with the rest of the row
+        runs.clear();
+        runs.push_back(ByteRun(0, 0, source_type->fixedrecordsize()));
+        bits.clear();
+        clear_bits.clear();
+        return;
+    }
+
+    // merge fields that are next to each other in both types into one run
+    sort(runs.begin(), runs.end());
+    vector<ByteRun> merged;
+    for (vector<ByteRun>::iterator i = runs.begin(); i != runs.end(); ++i) {
+        if (!merged.empty() && merged.back().source_offset + merged.back().size == i->source_offset
+            && merged.back().dest_offset + merged.back().size == i->dest_offset) {
+            merged.back().size += i->size;
+        } else {
+            merged.push_back(*i);
+        }
+    }
+    runs.swap(merged);
+}
+
+void ExtentCopyPlan::addField(const string &source_field, const string &dest_field) {
+    INVARIANT(source_type->hasColumn(source_field),
+              format("source type %s has no field %s") % source_type->getName() % source_field);
+    INVARIANT(dest_type->hasColumn(dest_field),
+              format("destination type %s has no field %s") % dest_type->getName() % dest_field);
+
+    ExtentType::fieldType type = source_type->getFieldType(source_field);
+    if (type != dest_type->getFieldType(dest_field)
+        || source_type->getSize(source_field) != dest_type->getSize(dest_field)
+        || (type == ExtentType::ft_double && source_type->getDoubleBase(source_field)
+            != dest_type->getDoubleBase(dest_field))) {
+        unsupported_field = dest_field;
+        return;
+    }
+
+    bool source_nullable = source_type->getNullable(source_field);
+    bool dest_nullable = dest_type->getNullable(dest_field);
+    if (source_nullable && !dest_nullable) {
+        unsupported_field = dest_field;
+        return;
+    }
+    if (source_nullable) {
+        bits.push_back(make_pair(bit(*source_type, ExtentType::nullableFieldname(source_field)),
+                                 bit(*dest_type, ExtentType::nullableFieldname(dest_field))));
+    } else if (dest_nullable) {
+        clear_bits.push_back(bit(*dest_type, ExtentType::nullableFieldname(dest_field)));
+    }
+
+    if (type == ExtentType::ft_bool) {
+        bits.push_back(make_pair(bit(*source_type, source_field), bit(*dest_type, dest_field)));
+        return;
+    }
+    int32_t source_offset = source_type->getOffset(source_field);
+    int32_t dest_offset = dest_type->getOffset(dest_field);
+    runs.push_back(ByteRun(source_offset, dest_offset, source_type->getSize(source_field)));
+    if (type == ExtentType::ft_variable32) {
+        vars.push_back(make_pair(source_offset, dest_offset));
+    }
+}
+
+ExtentCopyPlan::Bit ExtentCopyPlan::bit(const ExtentType &type, const string &field) const {
+    return Bit(type.getOffset(field), type.getBitPos(field));
+}
+
+void ExtentCopyPlan::copyRow(const Extent &source, const uint8_t *source_row,
+                             Extent &dest, uint8_t *dest_row) const {
+    INVARIANT(supported(), format("can't copy field %s with a plan") % unsupported_field);
+    DEBUG_SINVARIANT(source.getTypePtr() == source_type && dest.getTypePtr() == dest_type);
+    DEBUG_SINVARIANT(&source != &dest);
+    copyFixed(source_row, dest_row);
+    if (!vars.empty()) {
+        size_t var_pos = dest.variabledata.size();
+        dest.variabledata.resize(var_pos + varBytes(source, source_row), false);
+        copyVars(source, source_row, dest, dest_row, var_pos);
+        DEBUG_SINVARIANT(var_pos == dest.variabledata.size());
+    }
+}
+
+size_t ExtentCopyPlan::appendRows(const Extent &source, const vector<bool> *selected,
+                                  Extent &dest) const {
+    INVARIANT(supported(), format("can't copy field %s with a plan") % unsupported_field);
+    SINVARIANT(source.getTypePtr() == source_type && dest.getTypePtr() == dest_type);
+    SINVARIANT(&source != &dest);
+
+    const size_t source_size = source_type->fixedrecordsize();
+    const size_t dest_size = dest_type->fixedrecordsize();
+    const size_t source_rows = source.fixeddata.size() / source_size;
+    SINVARIANT(selected == NULL || selected->size() == source_rows);
+
+    // size both parts of dest once for the whole batch
+    size_t nrows = 0, var_bytes = 0;
+    for (size_t row = 0; row < source_rows; ++row) {
+        if (selected == NULL || (*selected)[row]) {
+            ++nrows;
+            var_bytes += varBytes(source, source.fixeddata.begin(row * source_size));
+        }
+    }
+    if (nrows == 0) {
+        return 0;
+    }
+    const size_t first_row = dest.fixeddata.size();
+    dest.fixeddata.resize(first_row + nrows * dest_size);
+    size_t var_pos = dest.variabledata.size();
+    dest.variabledata.resize(var_pos + var_bytes, false);
+
+    uint8_t *dest_row = dest.fixeddata.begin(first_row);
+    if (whole_row && selected == NULL) {
+        memcpy(dest_row, source.fixeddata.begin(), source.fixeddata.size());
+        for (size_t row = 0; !vars.empty() && row < source_rows; ++row, dest_row += dest_size) {
+            copyVars(source, source.fixeddata.begin(row * source_size), dest, dest_row, var_pos);
+        }
+    } else {
+        for (size_t row = 0; row < source_rows; ++row) {
+            if (selected == NULL || (*selected)[row]) {
+                const uint8_t *source_row = source.fixeddata.begin(row * source_size);
+                copyFixed(source_row, dest_row);
+                copyVars(source, source_row, dest, dest_row, var_pos);
+                dest_row += dest_size;
+            }
+        }
+    }
+    SINVARIANT(var_pos == dest.variabledata.size());
+    return nrows;
+}
+
+void ExtentCopyPlan::copyFixed(const uint8_t *source_row, uint8_t *dest_row) const {
+    for (vector<ByteRun>::const_iterator i = runs.begin(); i != runs.end(); ++i) {
+        memcpy(dest_row + i->dest_offset, source_row + i->source_offset, i->size);
+    }
+    for (vector<pair<Bit, Bit> >::const_iterator i = bits.begin(); i != bits.end(); ++i) {
+        uint8_t &to(dest_row[i->second.offset]);
+        if (source_row[i->first.offset] & i->first.mask) {
+            to |= i->second.mask;
+        } else {
+            to &= ~i->second.mask;
+        }
+    }
+    for (vector<Bit>::const_iterator i = clear_bits.begin(); i != clear_bits.end(); ++i) {
+        dest_row[i->offset] &= ~i->mask;
+    }
+}
+
+size_t ExtentCopyPlan::varBytes(const Extent &source, const uint8_t *source_row) const {
+    size_t bytes = 0;
+    for (vector<pair<int32_t, int32_t> >::const_iterator i = vars.begin(); i != vars.end(); ++i) {
+        bytes += varBlockBytes(source.variabledata,
+                               *reinterpret_cast<const int32_t *>(source_row + i->first));
+    }
+    return bytes;
+}
+
+void ExtentCopyPlan::copyVars(const Extent &source, const uint8_t *source_row,
+                              Extent &dest, uint8_t *dest_row, size_t &var_pos) const {
+    for (vector<pair<int32_t, int32_t> >::const_iterator i = vars.begin(); i != vars.end(); ++i) {
+        int32_t source_offset = *reinterpret_cast<const int32_t *>(source_row + i->first);
+        int32_t &dest_offset = *reinterpret_cast<int32_t *>(dest_row + i->second);
+        size_t bytes = varBlockBytes(source.variabledata, source_offset);
+        if (bytes == 0) {
+            dest_offset = 0;
+        } else {
+            DEBUG_SINVARIANT(var_pos + bytes <= dest.variabledata.size());
+            memcpy(dest.variabledata.begin(var_pos), source.variabledata.begin(source_offset),
+                   bytes);
+            dest_offset = static_cast<int32_t>(var_pos);
+            var_pos += bytes;
+        }
+    }
+}
@@ -36,6 +36,20 @@ const string dataseries_index_type_v0_xml =
         "  <field type=\"variable32\" name=\"extenttype\" />\n"
         "</ExtentType>\n";
 
+// One row per numeric column of each extent written while the sink had
+// extent stats enabled; min and max are null if the column was all null or
+// had a NaN in it.  Nulls read as 0 in expressions, so readers widen the
+// range to include 0 if nulls > 0.
+const string dataseries_extent_stats_type_xml =
+        "<ExtentType name=\"DataSeries: ExtentStats\" namespace=\"ssd.hpl.hp.com\" version=\"1.0\">\n"
+        "  <field type=\"int64\" name=\"offset\" pack_relative=\"offset\" />\n"
+        "  <field type=\"variable32\" name=\"column\" pack_unique=\"yes\" />\n"
+        "  <field type=\"int32\" name=\"rows\" />\n"
+        "  <field type=\"int32\" name=\"nulls\" />\n"
+        "  <field type=\"double\" name=\"min\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"double\" name=\"max\" opt_nullable=\"yes\" />\n"
+        "</ExtentType>\n";
+
 // The following is here as we are working out what the next version
 // of the extent index should look like; I think we will be able to
 // get away with putting it into the xmltype index and hence be able 
@@ -68,6 +82,7 @@ const string dataseries_index_type_v1_xml =
 
 const ExtentType::Ptr ExtentType::dataseries_xml_type(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_xml_type_xml));
 const ExtentType::Ptr ExtentType::dataseries_index_type_v0(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_index_type_v0_xml));
+const ExtentType::Ptr ExtentType::dataseries_extent_stats_type(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_extent_stats_type_xml));
 
 string ExtentType::strGetXMLProp(xmlNodePtr cur, const string &option_name, bool empty_ok) {
     xmlChar *option = xmlGetProp(cur, reinterpret_cast<const xmlChar *>(option_name.c_str()));
@@ -290,10 +305,24 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
         }
     }
 
+    ret.fixed_layout = FixedLayoutRows;
+    {
+        string fixed_layout_opt = strGetXMLProp(cur, "pack_fixed_layout");
+        if (!fixed_layout_opt.empty()) {
+            if (fixed_layout_opt == "rows") {
+                ret.fixed_layout = FixedLayoutRows;
+            } else if (fixed_layout_opt == "columns") {
+                ret.fixed_layout = FixedLayoutColumns;
+            } else {
+                FATAL_ERROR(format("Unknown pack_fixed_layout value '%s', expect rows or columns") % fixed_layout_opt);
+            }
+        }
+    }
+
     for (xmlAttr *prop = cur->properties; prop != NULL; prop = prop->next) {
         string opt(reinterpret_cast<const char *>(prop->name));
         if (opt == "pack_null_compact" || opt == "pack_pad_record"
-            || opt == "pack_field_ordering") {
+            || opt == "pack_field_ordering" || opt == "pack_fixed_layout") {
             // ok
         } else {
             INVARIANT(!prefixequal(opt, "pack_"),
@@ -594,6 +623,47 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
     // bytes with 1 byte of bools|byte and then a double or int64.
     INVARIANT(ret.pack_null_compact == CompactNo || ret.bool_bytes > 0, 
               "should not enable null compaction with no nullable fields");
+    INVARIANT(ret.pack_null_compact == CompactNo || ret.fixed_layout == FixedLayoutRows,
+              "can not combine pack_null_compact with pack_fixed_layout=\"columns\"");
+
+    // Columns for the columnar layout; every byte of the record has to be in
+    // exactly one of them for the layout to be reversible.
+    vector<int32> column_at(ret.fixed_record_size, -1); // size of column starting at byte
+    vector<bool> covered(ret.fixed_record_size, false);
+    for (unsigned i = 0; i < ret.field_info.size(); ++i) {
+        const fieldInfo &field(ret.field_info[i]);
+        if (field.type == ft_bool || field.offset < 0) {
+            continue;
+        }
+        SINVARIANT(field.size > 0 && field.offset + field.size <= ret.fixed_record_size);
+        column_at[field.offset] = field.size;
+        for (int32 j = field.offset; j < field.offset + field.size; ++j) {
+            SINVARIANT(!covered[j]);
+            covered[j] = true;
+        }
+    }
+    for (int32 j = 0; j < ret.fixed_record_size; ++j) {
+        if (column_at[j] > 0) {
+            ret.fixed_columns.push_back(fixedColumn(j, column_at[j]));
+        } else if (!covered[j]) {
+            ret.fixed_columns.push_back(fixedColumn(j, 1));
+        }
+    }
+
+    for (unsigned i = 0; i < ret.field_info.size(); ++i) {
+        const fieldInfo &field(ret.field_info[i]);
+        switch(field.type) 
+            {
+            case ft_int32: case ft_variable32: 
+                ret.flip4_offsets.push_back(field.offset); 
+                break;
+            case ft_int64: case ft_double: 
+                ret.flip8_offsets.push_back(field.offset); 
+                break;
+            default: 
+                break; // single bytes and byte arrays have no byte order
+            }
+    }
 
     ret.sortAssignNCI(ret.nonbool_compact_info_size1);
     ret.sortAssignNCI(ret.nonbool_compact_info_size4);
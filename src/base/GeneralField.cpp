@@ -16,6 +16,7 @@
 #include <Lintel/Clock.hpp>
 #include <Lintel/StringUtil.hpp>
 
+#include <DataSeries/ExtentCopyPlan.hpp>
 #include <DataSeries/GeneralField.hpp>
 
 using namespace std;
@@ -1395,7 +1396,7 @@ GeneralField::create(xmlNodePtr fieldxml, ExtentSeries &series, const std::strin
 }
 
 ExtentRecordCopy::ExtentRecordCopy(ExtentSeries &_source, ExtentSeries &_dest)
-        : fixed_copy_size(-1), source(_source), dest(_dest)
+        : fixed_copy_size(-1), source(_source), dest(_dest), plan(NULL)
 { }
 
 void ExtentRecordCopy::prepPtr(const ExtentType::Ptr copy_type_in) {
@@ -1424,6 +1425,22 @@ void ExtentRecordCopy::prepPtr(const ExtentType::Ptr copy_type_in) {
         }
     } else {
         fixed_copy_size = 0;
+        if (source.getTypeCompat() == ExtentSeries::typeExact
+            && dest.getTypeCompat() == ExtentSeries::typeExact) {
+            ExtentCopyPlan::FieldPairs fields;
+            for (unsigned i=0; i < copy_type->getNFields(); ++i) {
+                const std::string &fieldname = copy_type->getFieldName(i);
+                INVARIANT(dest.getTypePtr()->hasColumn(fieldname),
+                          format("Destination for copy is missing field %s") % fieldname);
+                fields.push_back(make_pair(fieldname, fieldname));
+            }
+            plan = new ExtentCopyPlan(source.getTypePtr(), dest.getTypePtr(), fields);
+            if (plan->supported()) {
+                return;
+            }
+            delete plan;
+            plan = NULL;
+        }
         for (unsigned i=0; i < copy_type->getNFields(); ++i) {
             const std::string &fieldname = copy_type->getFieldName(i);
             sourcefields.push_back(GeneralField::create(NULL, source, fieldname));
@@ -1435,6 +1452,7 @@ void ExtentRecordCopy::prepPtr(const ExtentType::Ptr copy_type_in) {
 }
 
 ExtentRecordCopy::~ExtentRecordCopy() {
+    delete plan;
     for (unsigned i=0;i < sourcefields.size();++i) {
         delete sourcefields[i];
         delete destfields[i];
@@ -1467,6 +1485,9 @@ void ExtentRecordCopy::copyRecord() {
                 destvarfields[i]->set(*sourcevarfields[i]);
             }
         }
+    } else if (plan != NULL) {
+        plan->copyRow(source.getExtentRef(), source.pos.record_start(),
+                      dest.getExtentRef(), dest.pos.record_start());
     } else {
         SINVARIANT(destfields.size() == sourcefields.size());
         for (unsigned int i=0;i<sourcefields.size();++i) {
@@ -1495,6 +1516,8 @@ void ExtentRecordCopy::copyRecord(const Extent &extent, const dataseries::SEP_Ro
             destvarfields[i]->set(sourcevarfields[i]->val(extent, offset),
                                   sourcevarfields[i]->size(extent, offset));
         }
+    } else if (plan != NULL) {
+        plan->copyRow(extent, offset.rowPos(extent), dest.getExtentRef(), dest.pos.record_start());
     } else {
         SINVARIANT(destfields.size() == sourcefields.size());
         for (unsigned int i=0;i<sourcefields.size();++i) {
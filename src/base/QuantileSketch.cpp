@@ -0,0 +1,175 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    implementation
+*/
+
+#include <math.h>
+
+#include <algorithm>
+#include <ostream>
+
+#include <boost/format.hpp>
+
+#include <Lintel/AssertBoost.hpp>
+
+#include <DataSeries/QuantileSketch.hpp>
+
+using namespace std;
+using boost::format;
+
+namespace {
+    const double print_quantiles[] = { 0.01, 0.05, 0.1, 0.25, 0.5, 0.75, 0.9, 0.95, 0.99, 0.999 };
+    const size_t nprint_quantiles = sizeof(print_quantiles) / sizeof(print_quantiles[0]);
+}
+
+QuantileSketch::QuantileSketch(double relative_error, size_t max_buckets, double min_magnitude)
+    : relative_error(relative_error), gamma((1 + relative_error) / (1 - relative_error)),
+      log_gamma(log(gamma)), min_magnitude(min_magnitude), max_buckets(max_buckets),
+      zero_count(0), nonfinite_count(0)
+{
+    INVARIANT(relative_error > 0 && relative_error < 1,
+              format("relative error %g not in (0,1)") % relative_error);
+    INVARIANT(max_buckets > 0 && min_magnitude > 0, "need a bucket and a positive min_magnitude");
+}
+
+QuantileSketch::~QuantileSketch() { }
+
+void QuantileSketch::add(const double value) {
+    Stats::add(value);
+    double magnitude = fabs(value);
+    if (magnitude != magnitude || magnitude == HUGE_VAL) {
+        ++nonfinite_count;
+    } else if (magnitude < min_magnitude) {
+        ++zero_count;
+    } else if (value > 0) {
+        positive.add(index(magnitude), 1, max_buckets);
+    } else {
+        negative.add(index(magnitude), 1, max_buckets);
+    }
+}
+
+void QuantileSketch::reset() {
+    Stats::reset();
+    positive.clear();
+    negative.clear();
+    zero_count = 0;
+    nonfinite_count = 0;
+}
+
+void QuantileSketch::merge(const QuantileSketch &from) {
+    INVARIANT(from.relative_error == relative_error && from.min_magnitude == min_magnitude,
+              "can only merge sketches with the same relative error and min magnitude");
+    Stats::add(static_cast<const Stats &>(from));
+    positive.merge(from.positive, max_buckets);
+    negative.merge(from.negative, max_buckets);
+    zero_count += from.zero_count;
+    nonfinite_count += from.nonfinite_count;
+}
+
+double QuantileSketch::getQuantile(double quantile) const {
+    INVARIANT(quantile >= 0 && quantile <= 1, format("quantile %g not in [0,1]") % quantile);
+    uint64_t nvalues = negative.total + zero_count + positive.total;
+    INVARIANT(nvalues > 0, "no finite values to take a quantile of");
+    uint64_t rank = static_cast<uint64_t>(quantile * (nvalues - 1));
+
+    double ret = 0;
+    if (rank < negative.total) { // most negative first
+        for (size_t i = negative.counts.size(); i > 0; --i) {
+            if (rank < negative.counts[i - 1]) {
+                ret = -bucketValue(negative.first_index + static_cast<int32_t>(i - 1));
+                break;
+            }
+            rank -= negative.counts[i - 1];
+        }
+    } else if (rank < negative.total + zero_count) {
+        ret = 0;
+    } else {
+        rank -= negative.total + zero_count;
+        for (size_t i = 0; i < positive.counts.size(); ++i) {
+            if (rank < positive.counts[i]) {
+                ret = bucketValue(positive.first_index + static_cast<int32_t>(i));
+                break;
+            }
+            rank -= positive.counts[i];
+        }
+    }
+    // the bucket can stick out past the values in it
+    if (min() > -HUGE_VAL) {
+        ret = std::max(min(), ret);
+    }
+    if (max() < HUGE_VAL) {
+        ret = std::min(max(), ret);
+    }
+    return ret;
+}
+
+void QuantileSketch::printQuantiles(ostream &to) const {
+    to << format("%d data points, mean %.6g +- %.6g [%.6g,%.6g]\n")
+        % count() % mean() % stddev() % min() % max();
+    if (negative.total + zero_count + positive.total > 0) {
+        to << format("    quantiles within %g%%:") % (100 * relative_error);
+        for (size_t i = 0; i < nprint_quantiles; ++i) {
+            to << format("%s %g%%: %.6g") % (i == 0 ? "" : ",")
+                % (100 * print_quantiles[i]) % getQuantile(print_quantiles[i]);
+        }
+        to << "\n";
+    }
+    if (nonfinite_count > 0) {
+        to << format("    %d infinite or NaN values are not in the quantiles\n") % nonfinite_count;
+    }
+}
+
+int32_t QuantileSketch::index(double magnitude) const {
+    return static_cast<int32_t>(ceil(log(magnitude) / log_gamma));
+}
+
+// The estimate for bucket index that is within relative_error of everything in it
+double QuantileSketch::bucketValue(int32_t index) const {
+    return 2 * pow(gamma, index) / (gamma + 1);
+}
+
+void QuantileSketch::Buckets::add(int32_t index, uint64_t count, size_t max_buckets) {
+    total += count;
+    if (counts.empty()) {
+        first_index = index;
+        counts.push_back(count);
+        return;
+    }
+    int64_t last_index = first_index + static_cast<int64_t>(counts.size()) - 1;
+    // Anything that would be more than max_buckets below the top goes in the lowest bucket
+    int64_t lowest = std::max(last_index, static_cast<int64_t>(index))
+        - static_cast<int64_t>(max_buckets) + 1;
+    if (index < lowest) {
+        index = static_cast<int32_t>(lowest);
+    }
+    if (index < first_index) {
+        counts.insert(counts.begin(), first_index - index, 0);
+        first_index = index;
+    } else if (index > last_index) {
+        counts.resize(index - first_index + 1, 0);
+        if (counts.size() > max_buckets) {
+            size_t ncollapse = counts.size() - max_buckets;
+            for (size_t i = 0; i < ncollapse; ++i) {
+                counts[ncollapse] += counts[i];
+            }
+            counts.erase(counts.begin(), counts.begin() + ncollapse);
+            first_index += static_cast<int32_t>(ncollapse);
+        }
+    }
+    counts[index - first_index] += count;
+}
+
+void QuantileSketch::Buckets::merge(const Buckets &from, size_t max_buckets) {
+    // lowest first so that the buckets are only extended downwards once
+    for (size_t i = 0; i < from.counts.size(); ++i) {
+        if (from.counts[i] > 0) {
+            add(from.first_index + static_cast<int32_t>(i), from.counts[i], max_buckets);
+        }
+    }
+}
@@ -0,0 +1,258 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    implementation
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <boost/format.hpp>
+
+#include <Lintel/StringUtil.hpp>
+
+#include <DataSeries/Int64TimeField.hpp>
+#include <DataSeries/RowTextFormatter.hpp>
+
+using namespace std;
+using boost::format;
+
+namespace {
+    const string str_null("null");
+    const string str_ipv4("ipv4");
+
+    void appendDecimal(string &to, int64_t value) {
+        char buf[24];
+        char *end = buf + sizeof(buf), *pos = end;
+        uint64_t left = value < 0 ? -static_cast<uint64_t>(value) : value;
+        do {
+            *--pos = static_cast<char>('0' + left % 10);
+            left /= 10;
+        } while (left != 0);
+        if (value < 0) {
+            *--pos = '-';
+        }
+        to.append(pos, end);
+    }
+
+    // %s stops at the first nul
+    void appendCString(string &to, const void *data, size_t size) {
+        const char *begin = static_cast<const char *>(data);
+        const char *nul = static_cast<const char *>(memchr(begin, '\0', size));
+        to.append(begin, nul == NULL ? size : nul - begin);
+    }
+
+    template<typename T> void appendPrintf(string &to, const char *printspec, T value) {
+        const size_t guess = 64;
+        size_t old_size = to.size();
+        to.resize(old_size + guess);
+        int size = snprintf(&to[old_size], guess, printspec, value);
+        INVARIANT(size >= 0, format("bad printspec '%s'") % printspec);
+        if (static_cast<size_t>(size) >= guess) {
+            to.resize(old_size + size + 1);
+            snprintf(&to[old_size], size + 1, printspec, value);
+        }
+        to.resize(old_size + size);
+    }
+
+    // 10^N if printspec is %.Ng, otherwise 0; whole numbers below that print without exponents
+    // or decimal points
+    double wholeLimit(const char *printspec) {
+        int digits = 0, used = 0;
+        if (sscanf(printspec, "%%.%dg%n", &digits, &used) == 1
+            && static_cast<size_t>(used) == strlen(printspec) && digits > 0 && digits <= 17) {
+            return pow(10.0, digits);
+        } else {
+            return 0;
+        }
+    }
+}
+
+RowTextFormatter::RowTextFormatter(const vector<GeneralField *> &fields, const string &separator)
+    : separator(separator), row_independent(true)
+{
+    columns.reserve(fields.size());
+    for (vector<GeneralField *>::const_iterator i = fields.begin(); i != fields.end(); ++i) {
+        Column column;
+        column.field = *i;
+        column.whole_limit = 0;
+        switch ((**i).getType()) {
+            case ExtentType::ft_bool:
+                column.kind = bool_value;
+                break;
+            case ExtentType::ft_byte: {
+                GF_Byte &field(static_cast<GF_Byte &>(**i));
+                column.kind = strcmp(field.printspec, "%d") == 0 ? byte_decimal : byte_printf;
+                break;
+            }
+            case ExtentType::ft_int32: {
+                GF_Int32 &field(static_cast<GF_Int32 &>(**i));
+                if (field.printspec == str_ipv4) {
+                    SINVARIANT(field.divisor == 1);
+                    column.kind = int32_ipv4;
+                } else {
+                    column.kind = strcmp(field.printspec, "%d") == 0 ? int32_decimal : int32_printf;
+                }
+                break;
+            }
+            case ExtentType::ft_int64: {
+                GF_Int64 &field(static_cast<GF_Int64 &>(**i));
+                if (field.myfield_time != NULL) {
+                    column.kind = int64_time;
+                } else {
+                    column.kind = strcmp(field.printspec, "%lld") == 0 ? int64_decimal
+                        : int64_printf;
+                }
+                row_independent = row_independent && !field.offset_first;
+                break;
+            }
+            case ExtentType::ft_double: {
+                GF_Double &field(static_cast<GF_Double &>(**i));
+                column.whole_limit = wholeLimit(field.printspec);
+                column.kind = column.whole_limit > 0 ? double_whole : double_printf;
+                row_independent = row_independent && field.offset == field.offset; // "first"
+                break;
+            }
+            case ExtentType::ft_variable32: {
+                GF_Variable32 &field(static_cast<GF_Variable32 &>(**i));
+                if (strcmp(field.printspec, "%s") == 0 && !field.csv_enabled
+                    && (field.printstyle == GF_Variable32::printtext
+                        || field.printstyle == GF_Variable32::printnostyle)) {
+                    column.kind = variable32_raw;
+                } else {
+                    column.kind = variable32_formatted;
+                }
+                break;
+            }
+            case ExtentType::ft_fixedwidth:
+                column.kind = fixedwidth_hex;
+                break;
+            default:
+                FATAL_ERROR("internal error, unexpected type");
+        }
+        columns.push_back(column);
+    }
+}
+
+void RowTextFormatter::appendRow(string &to) {
+    for (vector<Column>::iterator i = columns.begin(); i != columns.end(); ++i) {
+        if (i != columns.begin()) {
+            to.append(separator);
+        }
+        if (i->field->isNull()) {
+            to.append(str_null);
+        } else {
+            appendValue(*i, to);
+        }
+    }
+    to.push_back('\n');
+}
+
+// Each case matches the corresponding GF_*::write(FILE *)
+void RowTextFormatter::appendValue(const Column &column, string &to) {
+    switch (column.kind) {
+        case bool_value: {
+            GF_Bool &field(static_cast<GF_Bool &>(*column.field));
+            const string &value(field.myfield.val() ? field.s_true : field.s_false);
+            appendCString(to, value.data(), value.size());
+            break;
+        }
+        case byte_decimal:
+            appendDecimal(to, static_cast<GF_Byte *>(column.field)->myfield.val());
+            break;
+        case byte_printf: {
+            GF_Byte &field(static_cast<GF_Byte &>(*column.field));
+            appendPrintf(to, field.printspec, field.myfield.val());
+            break;
+        }
+        case int32_decimal: {
+            GF_Int32 &field(static_cast<GF_Int32 &>(*column.field));
+            appendDecimal(to, field.myfield.val() / field.divisor);
+            break;
+        }
+        case int32_ipv4: {
+            GF_Int32 &field(static_cast<GF_Int32 &>(*column.field));
+            uint32_t v = static_cast<uint32_t>(field.myfield.val());
+            appendDecimal(to, v >> 24);
+            to.push_back('.');
+            appendDecimal(to, (v >> 16) & 0xFF);
+            to.push_back('.');
+            appendDecimal(to, (v >> 8) & 0xFF);
+            to.push_back('.');
+            appendDecimal(to, v & 0xFF);
+            break;
+        }
+        case int32_printf: {
+            GF_Int32 &field(static_cast<GF_Int32 &>(*column.field));
+            appendPrintf(to, field.printspec, field.myfield.val() / field.divisor);
+            break;
+        }
+        case int64_decimal: case int64_time: case int64_printf: {
+            GF_Int64 &field(static_cast<GF_Int64 &>(*column.field));
+            if (field.offset_first) {
+                field.offset = field.myfield.val();
+                field.offset_first = false;
+            } else if (field.relative_field != NULL) {
+                field.offset = field.relative_field->val();
+            }
+            int64_t v = field.myfield.val() - field.offset;
+            if (column.kind == int64_time) {
+                string time(field.myfield_time->rawToStrSecNano(v));
+                appendCString(to, time.data(), time.size());
+            } else if (column.kind == int64_decimal) {
+                appendDecimal(to, v / field.divisor);
+            } else {
+                appendPrintf(to, field.printspec, v / field.divisor);
+            }
+            break;
+        }
+        case double_whole: case double_printf: {
+            GF_Double &field(static_cast<GF_Double &>(*column.field));
+            if (field.offset != field.offset) {
+                field.offset = field.myfield.val();
+            }
+            if (field.relative_field != NULL) {
+                field.offset = field.relative_field->val()
+                    + (field.relative_field->base_val - field.myfield.base_val);
+            }
+            double v = field.multiplier * (field.myfield.val() - field.offset);
+            // -0 prints as -0, so it doesn't count as whole
+            if (column.kind == double_whole && v > -column.whole_limit && v < column.whole_limit
+                && v == floor(v) && (v != 0 || 1 / v > 0)) {
+                appendDecimal(to, static_cast<int64_t>(v));
+            } else {
+                appendPrintf(to, field.printspec, v);
+            }
+            break;
+        }
+        case variable32_raw: {
+            GF_Variable32 &field(static_cast<GF_Variable32 &>(*column.field));
+            appendCString(to, field.myfield.val(), field.myfield.size());
+            break;
+        }
+        case variable32_formatted: {
+            GF_Variable32 &field(static_cast<GF_Variable32 &>(*column.field));
+            string v(field.valFormatted());
+            if (strcmp(field.printspec, "%s") == 0) {
+                appendCString(to, v.data(), v.size());
+            } else {
+                appendPrintf(to, field.printspec, v.c_str());
+            }
+            break;
+        }
+        case fixedwidth_hex: {
+            GF_FixedWidth &field(static_cast<GF_FixedWidth &>(*column.field));
+            string hex(maybehexstring(field.myfield.val(), field.myfield.size()));
+            appendCString(to, hex.data(), hex.size());
+            break;
+        }
+        default:
+            FATAL_ERROR("internal error, unexpected column kind");
+    }
+}
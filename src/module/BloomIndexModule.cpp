@@ -0,0 +1,172 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    implementation
+*/
+
+#include <algorithm>
+
+#include <Lintel/HashFns.hpp>
+
+#include <DataSeries/BloomIndexModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const unsigned BloomIndexModule::default_bits_per_value;
+const unsigned BloomIndexModule::default_nhashes;
+
+uint64_t BloomIndexModule::hashValue(const GeneralValue &v) {
+    uint32_t a, b;
+    switch (v.getType())
+        {
+        case ExtentType::ft_bool: case ExtentType::ft_byte:
+        case ExtentType::ft_int32: case ExtentType::ft_int64: {
+            uint64_t i = static_cast<uint64_t>(v.valInt64());
+            a = lintel::BobJenkinsHashMixULL(i, 1776);
+            b = lintel::BobJenkinsHashMixULL(i, 1972);
+            break;
+        }
+        case ExtentType::ft_double: {
+            double d = v.valDouble();
+            a = lintel::hashBytes(&d, sizeof(d), 1776);
+            b = lintel::hashBytes(&d, sizeof(d), 1972);
+            break;
+        }
+        case ExtentType::ft_variable32: case ExtentType::ft_fixedwidth: {
+            string s(v.valString());
+            a = lintel::hashBytes(s.data(), s.size(), 1776);
+            b = lintel::hashBytes(s.data(), s.size(), 1972);
+            break;
+        }
+        default:
+            FATAL_ERROR(format("can not hash a value of type %s")
+                        % ExtentType::fieldTypeString(v.getType()));
+        }
+    return (static_cast<uint64_t>(a) << 32) | b;
+}
+
+// the i'th bit for a hash; the two halves of the hash give the start and
+// the step, which is odd so successive bits differ for any filter size.
+static inline uint64_t filterBit(uint64_t hash, unsigned i, uint64_t nbits) {
+    uint64_t start = hash >> 32, step = (hash & 0xFFFFFFFFULL) | 1;
+    return (start + i * step) % nbits;
+}
+
+void BloomIndexModule::makeFilter(vector<uint64_t> &hashes, unsigned bits_per_value,
+                                  unsigned nhashes, string &filter) {
+    SINVARIANT(bits_per_value > 0 && nhashes > 0);
+    sort(hashes.begin(), hashes.end());
+    hashes.erase(unique(hashes.begin(), hashes.end()), hashes.end());
+
+    uint64_t nbits = max(static_cast<uint64_t>(64),
+                         static_cast<uint64_t>(hashes.size()) * bits_per_value);
+    nbits = (nbits + 7) & ~static_cast<uint64_t>(7);
+    filter.assign(nbits / 8, '\0');
+    for (vector<uint64_t>::iterator i = hashes.begin(); i != hashes.end(); ++i) {
+        for (unsigned j = 0; j < nhashes; ++j) {
+            uint64_t bit = filterBit(*i, j, nbits);
+            filter[bit / 8] |= static_cast<char>(1 << (bit % 8));
+        }
+    }
+}
+
+bool BloomIndexModule::mayContain(const string &filter, uint64_t hash, unsigned nhashes) {
+    uint64_t nbits = static_cast<uint64_t>(filter.size()) * 8;
+    if (nbits == 0) {
+        return false;
+    }
+    for (unsigned j = 0; j < nhashes; ++j) {
+        uint64_t bit = filterBit(hash, j, nbits);
+        if ((filter[bit / 8] & (1 << (bit % 8))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BloomIndexModule::init(const string &index_filename, const string &fieldname,
+                            const vector<GeneralValue> &values) {
+    vector<uint64_t> hashes;
+    hashes.reserve(values.size());
+    for (vector<GeneralValue>::const_iterator i = values.begin(); i != values.end(); ++i) {
+        hashes.push_back(hashValue(*i));
+    }
+
+    TypeIndexModule tim("DSIndex::Extent::Bloom::" + index_type);
+    tim.addSource(index_filename);
+
+    ExtentSeries s;
+    Variable32Field filename(s, "filename");
+    Int64Field extent_offset(s, "extent_offset");
+    ByteField nhashes(s, "hashes");
+    Variable32Field filter(s, "bloom:" + fieldname);
+
+    while (true) {
+        Extent::Ptr e = tim.getSharedExtent();
+        if (e == NULL) {
+            break;
+        }
+        for (s.setExtent(e); s.morerecords(); ++s) {
+            ++indexed_extents;
+            string bits(filter.stringval());
+            for (vector<uint64_t>::iterator i = hashes.begin(); i != hashes.end(); ++i) {
+                if (mayContain(bits, *i, nhashes.val())) {
+                    kept_extents.push_back(kept_extent(filename.stringval(),
+                                                       extent_offset.val()));
+                    break;
+                }
+            }
+        }
+    }
+}
+
+BloomIndexModule::BloomIndexModule(const string &index_filename,
+                                   const string &index_type,
+                                   const string &fieldname,
+                                   const GeneralValue &value)
+    : IndexSourceModule(), indexed_extents(0), index_type(index_type),
+      cur_extent(0), cur_source(NULL)
+{
+    init(index_filename, fieldname, vector<GeneralValue>(1, value));
+}
+
+BloomIndexModule::BloomIndexModule(const string &index_filename,
+                                   const string &index_type,
+                                   const string &fieldname,
+                                   const vector<GeneralValue> &values)
+    : IndexSourceModule(), indexed_extents(0), index_type(index_type),
+      cur_extent(0), cur_source(NULL)
+{
+    init(index_filename, fieldname, values);
+}
+
+BloomIndexModule::~BloomIndexModule() { }
+
+void BloomIndexModule::lockedResetModule() {
+    cur_extent = 0;
+}
+
+IndexSourceModule::PrefetchExtent *BloomIndexModule::lockedGetCompressedExtent() {
+    if (cur_extent >= kept_extents.size()) {
+        delete cur_source;
+        cur_source = NULL;
+        cur_source_filename.clear();
+        return NULL;
+    }
+    if (cur_source_filename != kept_extents[cur_extent].filename) {
+        delete cur_source;
+        cur_source_filename = kept_extents[cur_extent].filename;
+        cur_source = new DataSeriesSource(cur_source_filename);
+    }
+    PrefetchExtent *ret = readCompressed(cur_source, kept_extents[cur_extent].extent_offset,
+                                         index_type);
+    ++cur_extent;
+    return ret;
+}
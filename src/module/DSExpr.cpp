@@ -6,6 +6,36 @@ using namespace std;
 
 //////////////////////////////////////////////////////////////////////
 
+void DSExpr::selectRows(ExtentSeries &series, Selection &selected) {
+    selected.clear();
+    if (!series.hasExtent()) {
+        return;
+    }
+    Extent &e(series.getExtentRef());
+    const void *saved_pos = series.getCurPos();
+    selected.reserve(e.nRecords());
+    for (series.setCurPos(e.fixeddata.begin()); series.more(); series.next()) {
+        selected.push_back(valBool());
+    }
+    series.setCurPos(saved_pos);
+}
+
+void DSExpr::valuesDouble(ExtentSeries &series, vector<double> &values) {
+    values.clear();
+    if (!series.hasExtent()) {
+        return;
+    }
+    Extent &e(series.getExtentRef());
+    const void *saved_pos = series.getCurPos();
+    values.reserve(e.nRecords());
+    for (series.setCurPos(e.fixeddata.begin()); series.more(); series.next()) {
+        values.push_back(valDouble());
+    }
+    series.setCurPos(saved_pos);
+}
+
+//////////////////////////////////////////////////////////////////////
+
 class DefaultParser : public DSExprParser {
     DSExpr *parse(ExtentSeries &series, const string &expr) {
         // TODO: DSExprImpl::Driver and the defined factory interface
@@ -13,7 +43,7 @@ class DefaultParser : public DSExprParser {
         // change.
         DSExprImpl::Driver driver(series);
         driver.doit(expr);
-        return driver.expr;
+        return new DSExprImpl::ExprCompiledPredicate(series, driver.expr);
     }
 
     DSExpr *parse(const FieldNameToSelector &field_name_to_selector, const string &expr) {
@@ -5,6 +5,7 @@
 #include <string>
 
 #include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include <Lintel/Double.hpp>
 
@@ -43,6 +44,8 @@ namespace DSExprImpl {
         virtual bool isNull() { 
             return false;
         }
+
+        double getValue() const { return val; }
       private:
         double val;
     };
@@ -81,6 +84,9 @@ namespace DSExprImpl {
 
         virtual void dump(ostream &out);
 
+        const string &getFieldName() const { return fieldname; }
+        ExtentType::fieldType getFieldType() const { return field->getType(); }
+
       private:
         GeneralField *field;
         string fieldname;
@@ -114,6 +120,8 @@ namespace DSExprImpl {
 
         virtual void dump(ostream &out);
 
+        const string &getLiteral() const { return s; }
+
       private:
         string s;
     };
@@ -135,6 +143,8 @@ namespace DSExprImpl {
         virtual bool isNull() {
             return subexpr->isNull();
         }
+
+        DSExpr *getSubExpr() const { return subexpr; }
       protected:
         DSExpr *subexpr;
     };
@@ -163,6 +173,9 @@ namespace DSExprImpl {
         virtual bool isNull() {
             return left->isNull() || right->isNull();
         }
+
+        DSExpr *getLeft() const { return left; }
+        DSExpr *getRight() const { return right; }
       protected:
         DSExpr *left, *right;
     };
@@ -601,6 +614,37 @@ namespace DSExprImpl {
         DSExpr::List args;
     };
 
+    class Program;
+
+    /// The top of an expression parsed over a single series.  Evaluation of single rows is passed
+    /// through to the tree; selectRows and valuesDouble compile the tree into a Program for each
+    /// ExtentType that the series goes through, and use the tree row by row if it can't be
+    /// compiled.
+    class ExprCompiledPredicate : public DSExpr {
+      public:
+        ExprCompiledPredicate(ExtentSeries &series, DSExpr *expr);
+        virtual ~ExprCompiledPredicate();
+
+        virtual expr_type_t getType() { return expr->getType(); }
+        virtual double valDouble() { return expr->valDouble(); }
+        virtual int64_t valInt64() { return expr->valInt64(); }
+        virtual bool valBool() { return expr->valBool(); }
+        virtual const string valString() { return expr->valString(); }
+        virtual bool isNull() { return expr->isNull(); }
+        virtual void dump(ostream &out) { expr->dump(out); }
+
+        virtual void selectRows(ExtentSeries &series, Selection &selected);
+        virtual void valuesDouble(ExtentSeries &series, std::vector<double> &values);
+        virtual bool mayMatch(const FieldRange &field_range);
+
+      private:
+        ExtentSeries &series;
+        DSExpr *expr;
+        // NULL if expr can't be compiled for the type as a predicate or as a number respectively
+        ExtentType::Ptr compiled_type, numeric_compiled_type;
+        boost::scoped_ptr<Program> program, numeric_program;
+    };
+
     class Driver {
       public:
         typedef DSExprParser::Selector Selector;
@@ -0,0 +1,515 @@
+/* -*- C++ -*-
+   (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+   See the file named COPYING for license details
+*/
+
+/** @file
+    Compiled evaluation of predicates and numeric expressions over whole extents.
+
+    The expression tree is flattened into a list of operations, each of which
+    fills a column of doubles (a register) for a block of rows from the raw
+    record bytes or from earlier registers.  Running the list once per block
+    replaces several virtual calls and GeneralValue conversions per row with
+    a handful of tight loops per block.  The operations mirror what the tree
+    does row by row: numeric values are doubles, nulls read as 0, and
+    comparisons use Lintel's Double comparisons.
+*/
+
+#include "DSExprImpl.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <boost/format.hpp>
+
+using namespace std;
+using boost::format;
+
+namespace DSExprImpl {
+
+    class Program {
+      public:
+        /// numeric programs compute valDouble(), the others valBool()
+        static Program *compile(DSExpr *expr, const ExtentType &type, bool numeric);
+
+        void run(const Extent &e, DSExpr::Selection &selected);
+        void run(const Extent &e, vector<double> &values);
+
+      private:
+        // number of rows evaluated by each pass over the operations
+        static const size_t block_rows = 1024;
+
+        enum OpCode {
+            op_constant, op_bool, op_byte, op_int32, op_int64, op_double,
+            op_minus, op_add, op_subtract, op_multiply, op_divide, op_tfrac_to_seconds,
+            op_eq, op_neq, op_gt, op_lt, op_geq, op_leq,
+            op_lor, op_land, op_lnot, op_truth,
+            op_string_compare
+        };
+
+        // a string literal or variable32 field, for op_string_compare
+        struct StringOperand {
+            StringOperand() : offset(-1), null_offset(-1), null_mask(0) { }
+            int32_t offset; // -1 for a literal
+            int32_t null_offset;
+            uint8_t null_mask;
+            string literal;
+        };
+
+        struct Op {
+            Op(OpCode code, unsigned dest)
+                : code(code), dest(dest), a(0), b(0), constant(0), offset(0), mask(0),
+                  null_offset(-1), null_mask(0), compare(op_eq) { }
+
+            OpCode code;
+            unsigned dest, a, b; // registers
+            double constant;
+            int32_t offset; // loads
+            uint8_t mask; // op_bool
+            int32_t null_offset; // loads of nullable fields, -1 otherwise
+            uint8_t null_mask;
+            OpCode compare; // op_string_compare
+            StringOperand left, right;
+        };
+
+        Program(const ExtentType &type) : type(type), nregisters(0) { }
+
+        unsigned newRegister() { return nregisters++; }
+        void setNull(const string &field_name, int32_t &null_offset, uint8_t &null_mask);
+
+        // Each returns the register holding the result, or -1 if the expression has no compiled
+        // form in that context; numeric results are valDouble(), boolean ones valBool() as 0 or 1.
+        int compileNumeric(DSExpr *expr);
+        int compileBool(DSExpr *expr);
+        int compileField(ExprField *field);
+        int compileComparison(ExprBinary *expr, OpCode code);
+        bool compileStringOperand(DSExpr *expr, StringOperand &operand);
+
+        void runOp(const Op &op, const Extent &e, const uint8_t *records, size_t nrows);
+        // runs the operations over nrows rows from first, returning the result column
+        const double *runBlock(const Extent &e, size_t first, size_t nrows);
+
+        const ExtentType &type;
+        vector<Op> ops;
+        unsigned nregisters, result;
+        vector<double> registers;
+    };
+
+    namespace {
+        template<typename T> void loadColumn(double *to, const uint8_t *from, size_t nrows,
+                                             size_t record_size) {
+            for (size_t i = 0; i < nrows; ++i, from += record_size) {
+                to[i] = static_cast<double>(*reinterpret_cast<const T *>(from));
+            }
+        }
+
+        void stringAt(const Extent &e, const uint8_t *record,
+                      int32_t offset, int32_t null_offset, uint8_t null_mask,
+                      const uint8_t *&data, int32_t &size) {
+            if (null_offset >= 0 && (record[null_offset] & null_mask) != 0) {
+                size = 0;
+                return;
+            }
+            int32_t var_offset = *reinterpret_cast<const int32_t *>(record + offset);
+            const uint8_t *var = e.variabledata.begin() + var_offset;
+            size = *reinterpret_cast<const int32_t *>(var);
+            data = var + 4;
+        }
+
+        // same ordering as comparing the two as std::strings
+        int compareBytes(const uint8_t *a, int32_t a_size, const uint8_t *b, int32_t b_size) {
+            int ret = memcmp(a, b, min(a_size, b_size));
+            if (ret == 0) {
+                ret = a_size < b_size ? -1 : (a_size > b_size ? 1 : 0);
+            }
+            return ret;
+        }
+    }
+
+    Program *Program::compile(DSExpr *expr, const ExtentType &type, bool numeric) {
+        Program *ret = new Program(type);
+        int result = numeric ? ret->compileNumeric(expr) : ret->compileBool(expr);
+        if (result < 0) {
+            delete ret;
+            return NULL;
+        }
+        ret->result = result;
+        ret->registers.resize(ret->nregisters * block_rows);
+        return ret;
+    }
+
+    void Program::setNull(const string &field_name, int32_t &null_offset, uint8_t &null_mask) {
+        if (type.getNullable(field_name)) {
+            string null_name(ExtentType::nullableFieldname(field_name));
+            null_offset = type.getOffset(null_name);
+            null_mask = 1 << type.getBitPos(null_name);
+        } else {
+            null_offset = -1;
+        }
+    }
+
+    int Program::compileField(ExprField *field) {
+        const string &name(field->getFieldName());
+        Op op(op_double, newRegister());
+        switch (type.getFieldType(name))
+            {
+            case ExtentType::ft_bool:
+                op.code = op_bool;
+                op.mask = 1 << type.getBitPos(name);
+                break;
+            case ExtentType::ft_byte: op.code = op_byte; break;
+            case ExtentType::ft_int32: op.code = op_int32; break;
+            case ExtentType::ft_int64: op.code = op_int64; break;
+            case ExtentType::ft_double: op.code = op_double; break;
+            default:
+                return -1; // variable32 and fixedwidth need conversions through strings
+            }
+        op.offset = type.getOffset(name);
+        setNull(name, op.null_offset, op.null_mask);
+        ops.push_back(op);
+        return op.dest;
+    }
+
+    int Program::compileNumeric(DSExpr *expr) {
+        if (ExprNumericConstant *constant = dynamic_cast<ExprNumericConstant *>(expr)) {
+            Op op(op_constant, newRegister());
+            op.constant = constant->getValue();
+            ops.push_back(op);
+            return op.dest;
+        } else if (ExprField *field = dynamic_cast<ExprField *>(expr)) {
+            return compileField(field);
+        } else if (ExprFnTfracToSeconds *fn = dynamic_cast<ExprFnTfracToSeconds *>(expr)) {
+            // valInt64() of anything but an integer field would need integer arithmetic or
+            // truncation
+            ExprField *sub = dynamic_cast<ExprField *>(fn->getSubExpr());
+            if (sub == NULL || (type.getFieldType(sub->getFieldName()) != ExtentType::ft_int64
+                                && type.getFieldType(sub->getFieldName()) != ExtentType::ft_int32)) {
+                return -1;
+            }
+            int a = compileField(sub);
+            if (a < 0) {
+                return -1;
+            }
+            Op op(op_tfrac_to_seconds, newRegister());
+            op.a = a;
+            ops.push_back(op);
+            return op.dest;
+        } else if (ExprMinus *minus = dynamic_cast<ExprMinus *>(expr)) {
+            int a = compileNumeric(minus->getSubExpr());
+            if (a < 0) {
+                return -1;
+            }
+            Op op(op_minus, newRegister());
+            op.a = a;
+            ops.push_back(op);
+            return op.dest;
+        }
+
+        OpCode code;
+        if (dynamic_cast<ExprAdd *>(expr) != NULL) {
+            code = op_add;
+        } else if (dynamic_cast<ExprSubtract *>(expr) != NULL) {
+            code = op_subtract;
+        } else if (dynamic_cast<ExprMultiply *>(expr) != NULL) {
+            code = op_multiply;
+        } else if (dynamic_cast<ExprDivide *>(expr) != NULL) {
+            code = op_divide;
+        } else {
+            return -1;
+        }
+        ExprBinary *binary = static_cast<ExprBinary *>(expr);
+        if (binary->either_string()) {
+            return -1; // + is concatenation
+        }
+        int a = compileNumeric(binary->getLeft());
+        int b = a < 0 ? -1 : compileNumeric(binary->getRight());
+        if (b < 0) {
+            return -1;
+        }
+        Op op(code, newRegister());
+        op.a = a;
+        op.b = b;
+        ops.push_back(op);
+        return op.dest;
+    }
+
+    bool Program::compileStringOperand(DSExpr *expr, StringOperand &operand) {
+        if (ExprStrLiteral *literal = dynamic_cast<ExprStrLiteral *>(expr)) {
+            operand.literal = literal->getLiteral();
+            return true;
+        }
+        ExprField *field = dynamic_cast<ExprField *>(expr);
+        if (field == NULL || type.getFieldType(field->getFieldName()) != ExtentType::ft_variable32) {
+            return false;
+        }
+        operand.offset = type.getOffset(field->getFieldName());
+        setNull(field->getFieldName(), operand.null_offset, operand.null_mask);
+        return true;
+    }
+
+    int Program::compileComparison(ExprBinary *expr, OpCode code) {
+        if (expr->either_string()) {
+            Op op(op_string_compare, newRegister());
+            op.compare = code;
+            if (!compileStringOperand(expr->getLeft(), op.left)
+                || !compileStringOperand(expr->getRight(), op.right)) {
+                return -1;
+            }
+            ops.push_back(op);
+            return op.dest;
+        }
+        int a = compileNumeric(expr->getLeft());
+        int b = a < 0 ? -1 : compileNumeric(expr->getRight());
+        if (b < 0) {
+            return -1;
+        }
+        Op op(code, newRegister());
+        op.a = a;
+        op.b = b;
+        ops.push_back(op);
+        return op.dest;
+    }
+
+    int Program::compileBool(DSExpr *expr) {
+        if (ExprNumericConstant *constant = dynamic_cast<ExprNumericConstant *>(expr)) {
+            Op op(op_constant, newRegister());
+            op.constant = constant->getValue() ? 1 : 0;
+            ops.push_back(op);
+            return op.dest;
+        } else if (ExprField *field = dynamic_cast<ExprField *>(expr)) {
+            int a = compileField(field);
+            if (a < 0) {
+                return -1; // strings convert by parsing true/false/on/off/yes/no
+            }
+            Op op(op_truth, newRegister());
+            op.a = a;
+            ops.push_back(op);
+            return op.dest;
+        } else if (ExprLnot *lnot = dynamic_cast<ExprLnot *>(expr)) {
+            int a = compileBool(lnot->getSubExpr());
+            if (a < 0) {
+                return -1;
+            }
+            Op op(op_lnot, newRegister());
+            op.a = a;
+            ops.push_back(op);
+            return op.dest;
+        } else if (dynamic_cast<ExprLor *>(expr) != NULL || dynamic_cast<ExprLand *>(expr) != NULL) {
+            // Both sides are evaluated for every row; that's only safe because nothing that
+            // compiles can fail on a row the tree would have short circuited past.
+            ExprBinary *binary = static_cast<ExprBinary *>(expr);
+            int a = compileBool(binary->getLeft());
+            int b = a < 0 ? -1 : compileBool(binary->getRight());
+            if (b < 0) {
+                return -1;
+            }
+            Op op(dynamic_cast<ExprLor *>(expr) != NULL ? op_lor : op_land, newRegister());
+            op.a = a;
+            op.b = b;
+            ops.push_back(op);
+            return op.dest;
+        } else if (ExprEq *eq = dynamic_cast<ExprEq *>(expr)) {
+            return compileComparison(eq, op_eq);
+        } else if (ExprNeq *neq = dynamic_cast<ExprNeq *>(expr)) {
+            return compileComparison(neq, op_neq);
+        } else if (ExprGt *gt = dynamic_cast<ExprGt *>(expr)) {
+            return compileComparison(gt, op_gt);
+        } else if (ExprLt *lt = dynamic_cast<ExprLt *>(expr)) {
+            return compileComparison(lt, op_lt);
+        } else if (ExprGeq *geq = dynamic_cast<ExprGeq *>(expr)) {
+            return compileComparison(geq, op_geq);
+        } else if (ExprLeq *leq = dynamic_cast<ExprLeq *>(expr)) {
+            return compileComparison(leq, op_leq);
+        } else {
+            // arithmetic fails as a boolean; functions are evaluated by the tree
+            return -1;
+        }
+    }
+
+    void Program::runOp(const Op &op, const Extent &e, const uint8_t *records, size_t nrows) {
+        double *to = &registers[op.dest * block_rows];
+        const double *a = &registers[op.a * block_rows];
+        const double *b = &registers[op.b * block_rows];
+        size_t record_size = type.fixedrecordsize();
+        const uint8_t *from = records + op.offset;
+        switch (op.code)
+            {
+            case op_constant:
+                fill(to, to + nrows, op.constant);
+                break;
+            case op_bool:
+                for (size_t i = 0; i < nrows; ++i, from += record_size) {
+                    to[i] = (*from & op.mask) ? 1 : 0;
+                }
+                break;
+            case op_byte: loadColumn<uint8_t>(to, from, nrows, record_size); break;
+            case op_int32: loadColumn<int32_t>(to, from, nrows, record_size); break;
+            case op_int64: loadColumn<int64_t>(to, from, nrows, record_size); break;
+            case op_double: loadColumn<double>(to, from, nrows, record_size); break;
+            case op_minus:
+                for (size_t i = 0; i < nrows; ++i) to[i] = - a[i];
+                break;
+            case op_add:
+                for (size_t i = 0; i < nrows; ++i) to[i] = a[i] + b[i];
+                break;
+            case op_subtract:
+                for (size_t i = 0; i < nrows; ++i) to[i] = a[i] - b[i];
+                break;
+            case op_multiply:
+                for (size_t i = 0; i < nrows; ++i) to[i] = a[i] * b[i];
+                break;
+            case op_divide:
+                for (size_t i = 0; i < nrows; ++i) to[i] = a[i] / b[i];
+                break;
+            case op_tfrac_to_seconds:
+                for (size_t i = 0; i < nrows; ++i) to[i] = a[i] / 4294967296.0;
+                break;
+            case op_eq:
+                for (size_t i = 0; i < nrows; ++i) to[i] = Double::eq(a[i], b[i]) ? 1 : 0;
+                break;
+            case op_neq:
+                for (size_t i = 0; i < nrows; ++i) to[i] = Double::eq(a[i], b[i]) ? 0 : 1;
+                break;
+            case op_gt:
+                for (size_t i = 0; i < nrows; ++i) to[i] = Double::gt(a[i], b[i]) ? 1 : 0;
+                break;
+            case op_lt:
+                for (size_t i = 0; i < nrows; ++i) to[i] = Double::lt(a[i], b[i]) ? 1 : 0;
+                break;
+            case op_geq:
+                for (size_t i = 0; i < nrows; ++i) to[i] = Double::geq(a[i], b[i]) ? 1 : 0;
+                break;
+            case op_leq:
+                for (size_t i = 0; i < nrows; ++i) to[i] = Double::leq(a[i], b[i]) ? 1 : 0;
+                break;
+            case op_lor:
+                for (size_t i = 0; i < nrows; ++i) to[i] = (a[i] != 0 || b[i] != 0) ? 1 : 0;
+                break;
+            case op_land:
+                for (size_t i = 0; i < nrows; ++i) to[i] = (a[i] != 0 && b[i] != 0) ? 1 : 0;
+                break;
+            case op_lnot:
+                for (size_t i = 0; i < nrows; ++i) to[i] = a[i] != 0 ? 0 : 1;
+                break;
+            case op_truth:
+                for (size_t i = 0; i < nrows; ++i) to[i] = a[i] != 0 ? 1 : 0;
+                break;
+            case op_string_compare: {
+                const uint8_t *left_data = reinterpret_cast<const uint8_t *>(op.left.literal.data());
+                int32_t left_size = op.left.literal.size();
+                const uint8_t *right_data
+                    = reinterpret_cast<const uint8_t *>(op.right.literal.data());
+                int32_t right_size = op.right.literal.size();
+                const uint8_t *record = records;
+                for (size_t i = 0; i < nrows; ++i, record += record_size) {
+                    if (op.left.offset >= 0) {
+                        stringAt(e, record, op.left.offset, op.left.null_offset,
+                                 op.left.null_mask, left_data, left_size);
+                    }
+                    if (op.right.offset >= 0) {
+                        stringAt(e, record, op.right.offset, op.right.null_offset,
+                                 op.right.null_mask, right_data, right_size);
+                    }
+                    int cmp = compareBytes(left_data, left_size, right_data, right_size);
+                    bool val;
+                    switch (op.compare)
+                        {
+                        case op_eq: val = cmp == 0; break;
+                        case op_neq: val = cmp != 0; break;
+                        case op_gt: val = cmp > 0; break;
+                        case op_lt: val = cmp < 0; break;
+                        case op_geq: val = cmp >= 0; break;
+                        case op_leq: val = cmp <= 0; break;
+                        default: FATAL_ERROR(format("internal error, bad comparison %d")
+                                             % op.compare);
+                        }
+                    to[i] = val ? 1 : 0;
+                }
+                break;
+            }
+            default:
+                FATAL_ERROR(format("internal error, unknown op %d") % op.code);
+            }
+        if (op.null_offset >= 0) {
+            const uint8_t *null_byte = records + op.null_offset;
+            for (size_t i = 0; i < nrows; ++i, null_byte += record_size) {
+                if ((*null_byte & op.null_mask) != 0) {
+                    to[i] = 0;
+                }
+            }
+        }
+    }
+
+    const double *Program::runBlock(const Extent &e, size_t first, size_t nrows) {
+        const uint8_t *records = e.fixeddata.begin() + first * type.fixedrecordsize();
+        for (vector<Op>::iterator i = ops.begin(); i != ops.end(); ++i) {
+            runOp(*i, e, records, nrows);
+        }
+        return &registers[result * block_rows];
+    }
+
+    void Program::run(const Extent &e, DSExpr::Selection &selected) {
+        size_t nrecords = e.fixeddata.size() / type.fixedrecordsize();
+        selected.resize(nrecords);
+        for (size_t first = 0; first < nrecords; first += block_rows) {
+            size_t nrows = min(block_rows, nrecords - first);
+            const double *result_column = runBlock(e, first, nrows);
+            for (size_t i = 0; i < nrows; ++i) {
+                selected[first + i] = result_column[i] != 0;
+            }
+        }
+    }
+
+    void Program::run(const Extent &e, vector<double> &values) {
+        size_t nrecords = e.fixeddata.size() / type.fixedrecordsize();
+        values.resize(nrecords);
+        for (size_t first = 0; first < nrecords; first += block_rows) {
+            size_t nrows = min(block_rows, nrecords - first);
+            const double *result_column = runBlock(e, first, nrows);
+            copy(result_column, result_column + nrows, values.begin() + first);
+        }
+    }
+
+    ExprCompiledPredicate::ExprCompiledPredicate(ExtentSeries &series, DSExpr *expr)
+        : series(series), expr(expr) { }
+
+    ExprCompiledPredicate::~ExprCompiledPredicate() {
+        delete expr;
+    }
+
+    void ExprCompiledPredicate::selectRows(ExtentSeries &in_series, Selection &selected) {
+        if (&in_series != &series || !series.hasExtent()) {
+            DSExpr::selectRows(in_series, selected);
+            return;
+        }
+        const Extent &e(series.getExtentRef());
+        if (e.getTypePtr() != compiled_type) {
+            compiled_type = e.getTypePtr();
+            program.reset(Program::compile(expr, *compiled_type, false));
+        }
+        if (program == NULL) {
+            DSExpr::selectRows(series, selected);
+        } else {
+            program->run(e, selected);
+        }
+    }
+
+    void ExprCompiledPredicate::valuesDouble(ExtentSeries &in_series, vector<double> &values) {
+        if (&in_series != &series || !series.hasExtent()) {
+            DSExpr::valuesDouble(in_series, values);
+            return;
+        }
+        const Extent &e(series.getExtentRef());
+        if (e.getTypePtr() != numeric_compiled_type) {
+            numeric_compiled_type = e.getTypePtr();
+            numeric_program.reset(Program::compile(expr, *numeric_compiled_type, true));
+        }
+        if (numeric_program == NULL) {
+            DSExpr::valuesDouble(series, values);
+        } else {
+            numeric_program->run(e, values);
+        }
+    }
+}
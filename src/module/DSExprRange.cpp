@@ -0,0 +1,183 @@
+/* -*- C++ -*-
+   (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+   See the file named COPYING for license details
+*/
+
+/** @file
+    Evaluation of predicates over ranges of field values, to decide whether
+    any row in a set, e.g. an extent, could match without looking at the rows.
+
+    Numeric subexpressions evaluate to an interval that contains every value
+    the subexpression could take, boolean ones to whether they could be true
+    and whether they could be false.  Anything that can't be bounded, e.g.
+    strings and functions, could be anything.  The comparisons are the
+    Lintel Double ones the row evaluation uses, which are monotonic, so
+    comparing interval ends bounds the comparison of any values inside.
+*/
+
+#include "DSExprImpl.hpp"
+
+using namespace std;
+
+namespace DSExprImpl {
+
+    namespace {
+        struct Range {
+            Range() : known(false), min(0), max(0) { }
+            Range(double min, double max) : known(!(min != min || max != max)),
+                                            min(min), max(max) { }
+
+            bool known;
+            double min, max;
+        };
+
+        struct Truth {
+            Truth(bool may_be_true, bool may_be_false)
+                : may_be_true(may_be_true), may_be_false(may_be_false) { }
+
+            bool may_be_true, may_be_false;
+        };
+
+        enum Comparison { cmp_eq, cmp_neq, cmp_gt, cmp_lt, cmp_geq, cmp_leq };
+
+        class RangeEvaluator {
+          public:
+            RangeEvaluator(const DSExpr::FieldRange &field_range) : field_range(field_range) { }
+
+            Range numeric(DSExpr *expr);
+            Truth truth(DSExpr *expr);
+
+          private:
+            Range field(ExprField *field);
+            Truth comparison(ExprBinary *expr, Comparison cmp);
+
+            const DSExpr::FieldRange &field_range;
+        };
+
+        double min4(double a, double b, double c, double d) {
+            return min(min(a, b), min(c, d));
+        }
+
+        double max4(double a, double b, double c, double d) {
+            return max(max(a, b), max(c, d));
+        }
+    }
+
+    Range RangeEvaluator::field(ExprField *field) {
+        double min, max;
+        if (field_range(field->getFieldName(), min, max) && min <= max) {
+            return Range(min, max);
+        } else {
+            return Range();
+        }
+    }
+
+    Range RangeEvaluator::numeric(DSExpr *expr) {
+        if (ExprNumericConstant *constant = dynamic_cast<ExprNumericConstant *>(expr)) {
+            return Range(constant->getValue(), constant->getValue());
+        } else if (ExprField *f = dynamic_cast<ExprField *>(expr)) {
+            return field(f);
+        } else if (ExprFnTfracToSeconds *fn = dynamic_cast<ExprFnTfracToSeconds *>(expr)) {
+            ExprField *sub = dynamic_cast<ExprField *>(fn->getSubExpr());
+            if (sub == NULL) {
+                return Range(); // valInt64() of arithmetic is integer arithmetic
+            }
+            // valInt64() may truncate a double towards zero
+            Range r(field(sub));
+            return r.known ? Range((r.min - 1) / 4294967296.0, (r.max + 1) / 4294967296.0) : r;
+        } else if (ExprMinus *minus = dynamic_cast<ExprMinus *>(expr)) {
+            Range r(numeric(minus->getSubExpr()));
+            return r.known ? Range(-r.max, -r.min) : r;
+        }
+
+        ExprBinary *binary = dynamic_cast<ExprBinary *>(expr);
+        if (binary == NULL || binary->either_string()) {
+            return Range();
+        }
+        Range a(numeric(binary->getLeft())), b(numeric(binary->getRight()));
+        if (!a.known || !b.known) {
+            return Range();
+        }
+        if (dynamic_cast<ExprAdd *>(expr) != NULL) {
+            return Range(a.min + b.min, a.max + b.max);
+        } else if (dynamic_cast<ExprSubtract *>(expr) != NULL) {
+            return Range(a.min - b.max, a.max - b.min);
+        } else if (dynamic_cast<ExprMultiply *>(expr) != NULL) {
+            return Range(min4(a.min * b.min, a.min * b.max, a.max * b.min, a.max * b.max),
+                         max4(a.min * b.min, a.min * b.max, a.max * b.min, a.max * b.max));
+        } else if (dynamic_cast<ExprDivide *>(expr) != NULL) {
+            if (b.min <= 0 && b.max >= 0) {
+                return Range();
+            }
+            return Range(min4(a.min / b.min, a.min / b.max, a.max / b.min, a.max / b.max),
+                         max4(a.min / b.min, a.min / b.max, a.max / b.min, a.max / b.max));
+        } else {
+            return Range();
+        }
+    }
+
+    Truth RangeEvaluator::comparison(ExprBinary *expr, Comparison cmp) {
+        if (expr->either_string()) {
+            return Truth(true, true);
+        }
+        Range a(numeric(expr->getLeft())), b(numeric(expr->getRight()));
+        if (!a.known || !b.known) {
+            return Truth(true, true);
+        }
+        // some pair of values is close enough to be equal; all pairs are
+        bool some_eq = !Double::lt(a.max, b.min) && !Double::gt(a.min, b.max);
+        bool all_eq = Double::eq(a.min, b.max) && Double::eq(a.max, b.min);
+        switch (cmp)
+            {
+            case cmp_eq: return Truth(some_eq, !all_eq);
+            case cmp_neq: return Truth(!all_eq, some_eq);
+            case cmp_gt: return Truth(Double::gt(a.max, b.min), !Double::gt(a.min, b.max));
+            case cmp_lt: return Truth(Double::lt(a.min, b.max), !Double::lt(a.max, b.min));
+            case cmp_geq: return Truth(Double::geq(a.max, b.min), !Double::geq(a.min, b.max));
+            case cmp_leq: return Truth(Double::leq(a.min, b.max), !Double::leq(a.max, b.min));
+            default: FATAL_ERROR("internal error, bad comparison");
+            }
+    }
+
+    Truth RangeEvaluator::truth(DSExpr *expr) {
+        if (ExprNumericConstant *constant = dynamic_cast<ExprNumericConstant *>(expr)) {
+            double v = constant->getValue();
+            return Truth(v != 0, v == 0);
+        } else if (ExprField *f = dynamic_cast<ExprField *>(expr)) {
+            Range r(field(f));
+            if (!r.known) {
+                return Truth(true, true);
+            }
+            return Truth(r.min != 0 || r.max != 0, r.min <= 0 && r.max >= 0);
+        } else if (ExprLnot *lnot = dynamic_cast<ExprLnot *>(expr)) {
+            Truth t(truth(lnot->getSubExpr()));
+            return Truth(t.may_be_false, t.may_be_true);
+        } else if (ExprLor *lor = dynamic_cast<ExprLor *>(expr)) {
+            Truth a(truth(lor->getLeft())), b(truth(lor->getRight()));
+            return Truth(a.may_be_true || b.may_be_true, a.may_be_false && b.may_be_false);
+        } else if (ExprLand *land = dynamic_cast<ExprLand *>(expr)) {
+            Truth a(truth(land->getLeft())), b(truth(land->getRight()));
+            return Truth(a.may_be_true && b.may_be_true, a.may_be_false || b.may_be_false);
+        } else if (ExprEq *eq = dynamic_cast<ExprEq *>(expr)) {
+            return comparison(eq, cmp_eq);
+        } else if (ExprNeq *neq = dynamic_cast<ExprNeq *>(expr)) {
+            return comparison(neq, cmp_neq);
+        } else if (ExprGt *gt = dynamic_cast<ExprGt *>(expr)) {
+            return comparison(gt, cmp_gt);
+        } else if (ExprLt *lt = dynamic_cast<ExprLt *>(expr)) {
+            return comparison(lt, cmp_lt);
+        } else if (ExprGeq *geq = dynamic_cast<ExprGeq *>(expr)) {
+            return comparison(geq, cmp_geq);
+        } else if (ExprLeq *leq = dynamic_cast<ExprLeq *>(expr)) {
+            return comparison(leq, cmp_leq);
+        } else {
+            return Truth(true, true);
+        }
+    }
+
+    bool ExprCompiledPredicate::mayMatch(const FieldRange &field_range) {
+        RangeEvaluator evaluator(field_range);
+        return evaluator.truth(expr).may_be_true;
+    }
+}
@@ -13,12 +13,81 @@
 #include <Lintel/StatsQuantile.hpp>
 
 #include <DataSeries/DSStatGroupByModule.hpp>
+#include <DataSeries/QuantileSketch.hpp>
 
 using namespace std;
 
 namespace {
     const string str_basic("basic");
     const string str_quantile("quantile");
+    const string str_approx_quantile("approx-quantile");
+
+    class StatGroupByWorker : public ParallelRowAnalysisModule::Worker {
+      public:
+        StatGroupByWorker(const ExtentType::Ptr &type, const string &expression,
+                          const string &groupby_name, const string &stattype,
+                          ExtentSeries::typeCompatibilityT type_compatibility)
+            : Worker(type_compatibility), stattype(stattype), groupby(NULL), last_stats(NULL)
+        {
+            series.setType(type);
+            expr = DSExpr::make(series, expression);
+            if (!groupby_name.empty()) {
+                groupby = GeneralField::create(NULL, series, groupby_name);
+            } else {
+                groupby_val.setInt32(1);
+            }
+        }
+
+        virtual ~StatGroupByWorker() {
+            for (DSStatGroupByModule::mytableT::iterator i = stats.begin();
+                 i != stats.end(); ++i) {
+                delete i->second;
+            }
+            delete expr;
+            delete groupby;
+        }
+
+        virtual void processRow() {
+            statsForRow()->add(expr->valDouble());
+        }
+
+        virtual void processRows(const vector<bool> *selected) {
+            expr->valuesDouble(series, values);
+            for (size_t row = 0; series.morerecords(); ++series, ++row) {
+                if (selected == NULL || (*selected)[row]) {
+                    statsForRow()->add(values[row]);
+                }
+            }
+        }
+
+        // Rows of the same group tend to come together, so check the last group before
+        // looking in the table
+        Stats *statsForRow() {
+            if (groupby != NULL) {
+                groupby_val.set(groupby);
+                if (last_stats != NULL && groupby_val.equal(last_val)) {
+                    return last_stats;
+                }
+            } else if (last_stats != NULL) {
+                return last_stats;
+            }
+            Stats *&ret = stats[groupby_val];
+            if (ret == NULL) {
+                ret = DSStatGroupByModule::makeStats(stattype);
+            }
+            last_val = groupby_val;
+            last_stats = ret;
+            return ret;
+        }
+
+        const string stattype;
+        DSExpr *expr;
+        GeneralField *groupby;
+        GeneralValue groupby_val, last_val;
+        Stats *last_stats;
+        vector<double> values;
+        DSStatGroupByModule::mytableT stats;
+    };
 }
 
 DSStatGroupByModule::DSStatGroupByModule(DataSeriesModule &source,
@@ -26,10 +95,12 @@ DSStatGroupByModule::DSStatGroupByModule(DataSeriesModule &source,
                                          const string &_groupby,
                                          const string &_stattype,
                                          const string &where_expr,
-                                         ExtentSeries::typeCompatibilityT tc)
-        : RowAnalysisModule(source, tc), expression(_expression), 
-          groupby_name(_groupby), stattype(_stattype), groupby(NULL),
-          expr(NULL)
+                                         ExtentSeries::typeCompatibilityT tc,
+                                         unsigned nthreads)
+        : ParallelRowAnalysisModule(source, _stattype == str_quantile ? 1 : nthreads,
+                                    64*1024*1024, tc),
+          expression(_expression), groupby_name(_groupby), stattype(_stattype),
+          type_compatibility(tc)
 {
     SINVARIANT(validStatType(stattype));
     if (!where_expr.empty()) {
@@ -38,41 +109,47 @@ DSStatGroupByModule::DSStatGroupByModule(DataSeriesModule &source,
 }
 
 DSStatGroupByModule::~DSStatGroupByModule() {
-    delete expr;
-    expr = NULL;
-    delete groupby;
-    groupby = NULL;
+    for (mytableT::iterator i = mystats.begin(); i != mystats.end(); ++i) {
+        delete i->second;
+    }
 }
 
-void DSStatGroupByModule::prepareForProcessing() {
-    // Have to do this here rather than constructor as we need the XML
-    // from the first extent in order to build the generalfields
+void DSStatGroupByModule::firstExtent(const Extent &e) {
+    // The workers need the type of the first extent in order to build the generalfields
+    type = e.getTypePtr();
+}
 
-    expr = DSExpr::make(series, expression);
-    if (!groupby_name.empty()) {
-        groupby = GeneralField::create(NULL, series, groupby_name);
-    }
+ParallelRowAnalysisModule::Worker *DSStatGroupByModule::makeWorker() {
+    return new StatGroupByWorker(type, expression, groupby_name, stattype, type_compatibility);
 }
 
-void DSStatGroupByModule::processRow() {
-    GeneralValue groupby_val;
-    if (groupby != NULL) {
-        groupby_val.set(groupby);
-    } else {
-        groupby_val.setInt32(1);
-    }
-    Stats *stat = mystats[groupby_val];
-    if (stat == NULL) {
-        if (stattype == str_basic) {
-            stat = new Stats();
-        } else if (stattype == str_quantile) {
-            stat = new StatsQuantile();
+void DSStatGroupByModule::merge(Worker &from) {
+    StatGroupByWorker &worker(static_cast<StatGroupByWorker &>(from));
+    for (mytableT::iterator i = worker.stats.begin(); i != worker.stats.end(); ++i) {
+        Stats *&into = mystats[i->first];
+        if (into == NULL) { // take it over from the worker
+            into = i->second;
+            i->second = NULL;
+        } else if (stattype == str_basic) {
+            into->add(*i->second);
+        } else if (stattype == str_approx_quantile) {
+            static_cast<QuantileSketch *>(into)->merge(*static_cast<QuantileSketch *>(i->second));
         } else {
-            FATAL_ERROR(boost::format("unknown stattype %s") % stattype);
+            FATAL_ERROR(boost::format("can't merge %s stats") % stattype);
         }
-        mystats[groupby_val] = stat;
     }
-    stat->add(expr->valDouble());
+}
+
+Stats *DSStatGroupByModule::makeStats(const string &stat_type) {
+    if (stat_type == str_basic) {
+        return new Stats();
+    } else if (stat_type == str_quantile) {
+        return new StatsQuantile();
+    } else if (stat_type == str_approx_quantile) {
+        return new QuantileSketch();
+    } else {
+        FATAL_ERROR(boost::format("unknown stattype %s") % stat_type);
+    }
 }
 
 void DSStatGroupByModule::printResult() {
@@ -102,7 +179,7 @@ void DSStatGroupByModule::printResult() {
             cout << boost::format("%1%, %2$.6g, %3$.6g, %4$.6g, %5$.6g\n")
                     % v->count() % v->mean() % v->stddev() % v->min() % v->max();
         }
-    } else if (stattype == str_quantile) {
+    } else if (stattype == str_quantile || stattype == str_approx_quantile) {
         if (groupby_name.empty()) {
             cout << boost::format("# %s(%s)\n") % stattype % expression;
         } else {
@@ -114,7 +191,11 @@ void DSStatGroupByModule::printResult() {
             if (!groupby_name.empty()) {
                 cout << boost::format("# group %1%\n") % k;
             }
-            v->printText(cout);
+            if (stattype == str_quantile) {
+                v->printText(cout);
+            } else {
+                static_cast<QuantileSketch *>(v)->printQuantiles(cout);
+            }
         }
     } else {
         FATAL_ERROR("wasn't stat type already checked?");
@@ -123,5 +204,6 @@ void DSStatGroupByModule::printResult() {
 }
 
 bool DSStatGroupByModule::validStatType(const string &stat_type) {
-    return stat_type == str_basic || stat_type == str_quantile;
+    return stat_type == str_basic || stat_type == str_quantile
+        || stat_type == str_approx_quantile;
 }
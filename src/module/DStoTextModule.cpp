@@ -9,15 +9,71 @@
     implementation
 */
 
+#include <algorithm>
+
 #include <DataSeries/DSExpr.hpp>
 #include <DataSeries/DStoTextModule.hpp>
 #include <DataSeries/GeneralField.hpp>
+#include <DataSeries/RowTextFormatter.hpp>
 
 using namespace std;
 using boost::format;
 
 static const string str_star("*");
 
+/// Copies of the fields of a type for one format thread
+struct DStoTextModule::FormatFields {
+    FormatFields(PerTypeState &state, bool csv_enabled, const string &separator)
+        : series(state.series.getTypePtr())
+    {
+        for (vector<string>::iterator i = state.field_names.begin();
+             i != state.field_names.end(); ++i) {
+            fields.push_back(GeneralField::create(state.print_specs[*i], series, *i));
+            if (csv_enabled) {
+                fields.back()->enableCSV();
+            }
+        }
+        formatter = new RowTextFormatter(fields, separator);
+    }
+
+    ~FormatFields() {
+        delete formatter;
+        GeneralField::deleteFields(fields);
+    }
+
+    ExtentSeries series;
+    vector<GeneralField *> fields;
+    RowTextFormatter *formatter;
+};
+
+/// The text for one extent; the rows are added by a format thread unless done starts out true
+struct DStoTextModule::FormatJob {
+    FormatJob() : state(NULL), done(false) { }
+
+    Extent::Ptr extent;
+    PerTypeState *state;
+    vector<bool> selected; // empty if there is no where expression
+    string text;
+    bool done;
+};
+
+namespace {
+    class DStoTextFormatThread : public PThread {
+      public:
+        DStoTextFormatThread(DStoTextModule &module, unsigned thread_num)
+            : module(module), thread_num(thread_num) { }
+
+        virtual void *run() {
+            module.formatThread(thread_num);
+            return NULL;
+        }
+
+      private:
+        DStoTextModule &module;
+        const unsigned thread_num;
+    };
+}
+
 DStoTextModule::DStoTextModule(DataSeriesModule &_source,
                                ostream &text_dest)
         : processed_rows(), ignored_rows(),
@@ -25,7 +81,8 @@ DStoTextModule::DStoTextModule(DataSeriesModule &_source,
           text_dest(NULL), print_index(true),
           print_extent_type(true), print_extent_fieldnames(true), 
           csvEnabled(false), separator(" "), 
-          header_only_once(false), header_printed(false)
+          header_only_once(false), header_printed(false),
+          format_threads(1), stop_formatting(false)
 {
 }
 
@@ -36,13 +93,24 @@ DStoTextModule::DStoTextModule(DataSeriesModule &_source,
           text_dest(_text_dest), print_index(true),
           print_extent_type(true), print_extent_fieldnames(true),
           csvEnabled(false), separator(" "),
-          header_only_once(false), header_printed(false)
+          header_only_once(false), header_printed(false),
+          format_threads(1), stop_formatting(false)
 {
 }
 
 DStoTextModule::~DStoTextModule()
 {
     // TODO: delete all the general fields in PerTypeState.
+    {
+        PThreadScopedLock lock(mutex);
+        writeFormatJobs(lock, 0);
+        stop_formatting = true;
+        format_cond.broadcast();
+    }
+    for (vector<PThread *>::iterator i = threads.begin(); i != threads.end(); ++i) {
+        (**i).join();
+        delete *i;
+    }
 }
 
 void
@@ -150,6 +218,14 @@ DStoTextModule::setHeaderOnlyOnce()
     header_only_once = true;
 }
 
+void
+DStoTextModule::setFormatThreads(unsigned nthreads)
+{
+    INVARIANT(nthreads > 0, "need at least one format thread");
+    INVARIANT(threads.empty(), "format threads have already been started");
+    format_threads = nthreads;
+}
+
 void
 DStoTextModule::getExtentPrintSpecs(PerTypeState &state)
 {
@@ -188,7 +264,7 @@ DStoTextModule::getExtentParseWhereExpr(PerTypeState &state)
 
 
 DStoTextModule::PerTypeState::PerTypeState()
-        : where_expr(NULL)
+        : where_expr(NULL), formatter(NULL)
 {}
 
 DStoTextModule::PerTypeState::~PerTypeState()
@@ -207,38 +283,33 @@ DStoTextModule::PerTypeState::~PerTypeState()
     override_print_specs.clear();
     delete where_expr;
     where_expr = NULL;
+    delete formatter;
+    formatter = NULL;
+    for (vector<FormatFields *>::iterator i = thread_fields.begin();
+         i != thread_fields.end(); ++i) {
+        delete *i;
+    }
+    thread_fields.clear();
 }
 
 void
-DStoTextModule::getExtentPrintHeaders(PerTypeState &state) 
+DStoTextModule::getExtentPrintHeaders(PerTypeState &state, string &to) 
 {
     if (header_only_once && header_printed) return;
     header_printed = true;
 
     const string &type_name = state.series.getTypePtr()->getName();
     if (print_extent_type) {
-        if (text_dest == NULL) {
-            *stream_text_dest << "# Extent, type='" << type_name << "'";
-            if (state.where_expr) {
-                *stream_text_dest << ", where='" << state.where_expr_str << "'";
-            }
-            *stream_text_dest << "\n";
-        } else {
-            fprintf(text_dest,"# Extent, type='%s'", type_name.c_str());
-            if (state.where_expr) {
-                fprintf(text_dest, ", where='%s'", state.where_expr_str.c_str());
-            }
-            fputc('\n', text_dest);
+        to.append("# Extent, type='").append(type_name).append("'");
+        if (state.where_expr) {
+            to.append(", where='").append(state.where_expr_str).append("'");
         }
+        to.push_back('\n');
     }
 
     bool print_default_fieldnames = print_extent_fieldnames;
     if (print_extent_fieldnames && !state.header.empty()) {
-        if (text_dest == NULL) {
-            *stream_text_dest << state.header << "\n";
-        } else {
-            fprintf(text_dest,"%s\n",state.header.c_str());
-        }
+        to.append(state.header).push_back('\n');
         print_default_fieldnames = false;
     }
     if (state.field_names.empty() && !default_fields.empty()) {
@@ -262,43 +333,42 @@ DStoTextModule::getExtentPrintHeaders(PerTypeState &state)
         }
     }
     if (print_default_fieldnames) {
-        bool printed_any = false;
         for (vector<string>::iterator i = state.field_names.begin();
             i != state.field_names.end(); ++i) {
-            if (text_dest == NULL) {
-                if (printed_any)
-                    *stream_text_dest << separator;
-                *stream_text_dest << *i;
-            } else {
-                if (printed_any)
-                    fputs(separator.c_str(), text_dest);
-                fputs(i->c_str(), text_dest);
+            if (i != state.field_names.begin()) {
+                to.append(separator);
             }
-            printed_any = true;
+            to.append(*i);
         }
+        to.push_back('\n');
     }
+}
 
-    if (print_default_fieldnames) {
-        if (text_dest == NULL) {
-            *stream_text_dest << "\n";
-        } else {
-            fputc('\n', text_dest);
-        }
+void
+DStoTextModule::writeText(const string &text)
+{
+    if (text_dest == NULL) {
+        stream_text_dest->write(text.data(), text.size());
+    } else {
+        fwrite(text.data(), 1, text.size(), text_dest);
     }
 }
 
-
-
 Extent::Ptr DStoTextModule::getSharedExtent() {
     Extent::Ptr e = source.getSharedExtent();
     if (e == NULL) {
+        if (format_threads > 1) {
+            PThreadScopedLock lock(mutex);
+            writeFormatJobs(lock, 0);
+        }
         return e;
     }
     if (e->type->getName() == "DataSeries: XmlType") {
         return e; // for now, never print these, that was previous behavior of ds2txt because the default source module skips the type extent at the beginning
     }
 
-    if (print_index == false && e->type->getName() == "DataSeries: ExtentIndex") {
+    if (print_index == false && (e->type->getName() == "DataSeries: ExtentIndex"
+                                 || e->type->getName() == "DataSeries: ExtentStats")) {
         return e;
     }
 
@@ -307,35 +377,137 @@ Extent::Ptr DStoTextModule::getSharedExtent() {
     state.series.setExtent(e);
     getExtentParseWhereExpr(state);
     getExtentPrintSpecs(state);
-    getExtentPrintHeaders(state);
+    string text;
+    getExtentPrintHeaders(state, text);
 
-    for (;state.series.morerecords();++state.series) {
-        if (state.where_expr && !state.where_expr->valBool()) {
-            ++ignored_rows;
-        } else {
-            ++processed_rows;
-            for (unsigned int i=0;i<state.fields.size();i++) {
-                if (text_dest == NULL) {
+    if (state.where_expr) {
+        state.where_expr->selectRows(state.series, state.selected);
+    }
+    if (text_dest == NULL) {
+        // GeneralField's ostream output differs from its FILE output, which is what
+        // RowTextFormatter matches, so keep printing one value at a time
+        writeText(text);
+        for (size_t row = 0; state.series.morerecords(); ++state.series, ++row) {
+            if (state.where_expr && !state.selected[row]) {
+                ++ignored_rows;
+            } else {
+                ++processed_rows;
+                for (unsigned int i=0;i<state.fields.size();i++) {
                     state.fields[i]->write(*stream_text_dest);          
                     if (i != (state.fields.size() - 1)){                  
                         *stream_text_dest << separator;
                     }
-                } else {
-                    state.fields[i]->write(text_dest);
-                    if (i != (state.fields.size() - 1))
-                        fputs(separator.c_str(), text_dest);
                 }
-            }
-            if (text_dest == NULL) {
                 *stream_text_dest << "\n";
-            } else {
-                fputs("\n", text_dest);
             }
         }
+        return e;
+    }
+
+    if (state.formatter == NULL) {
+        state.formatter = new RowTextFormatter(state.fields, separator);
+    }
+    if (format_threads > 1 && state.formatter->rowIndependent()) {
+        if (state.thread_fields.empty()) {
+            for (unsigned i = 0; i < format_threads; ++i) {
+                state.thread_fields.push_back(new FormatFields(state, csvEnabled, separator));
+            }
+        }
+        FormatJob *job = new FormatJob();
+        job->extent = e;
+        job->state = &state;
+        job->text.swap(text);
+        size_t nrows = e->nRecords();
+        if (state.where_expr) {
+            job->selected = state.selected;
+            size_t selected = count(job->selected.begin(), job->selected.end(), true);
+            processed_rows += selected;
+            ignored_rows += nrows - selected;
+        } else {
+            processed_rows += nrows;
+        }
+        queueFormatJob(job);
+        return e;
+    }
+
+    for (size_t row = 0; state.series.morerecords(); ++state.series, ++row) {
+        if (state.where_expr && !state.selected[row]) {
+            ++ignored_rows;
+        } else {
+            ++processed_rows;
+            state.formatter->appendRow(text);
+        }
+    }
+    if (format_threads > 1) { // still has to come out in order
+        FormatJob *job = new FormatJob();
+        job->text.swap(text);
+        job->done = true;
+        queueFormatJob(job);
+    } else {
+        writeText(text);
     }
     return e;
 }
 
+void DStoTextModule::queueFormatJob(FormatJob *job) {
+    PThreadScopedLock lock(mutex);
+    if (threads.empty()) {
+        for (unsigned i = 0; i < format_threads; ++i) {
+            threads.push_back(new DStoTextFormatThread(*this, i));
+            threads.back()->start();
+        }
+    }
+    in_order.push_back(job);
+    if (!job->done) {
+        to_format.push_back(job);
+        format_cond.signal();
+    }
+    writeFormatJobs(lock, 2 * format_threads);
+}
+
+void DStoTextModule::writeFormatJobs(PThreadScopedLock &lock, size_t max_jobs) {
+    while (!in_order.empty() && (in_order.front()->done || in_order.size() > max_jobs)) {
+        FormatJob *job = in_order.front();
+        while (!job->done) {
+            formatted_cond.wait(mutex);
+        }
+        in_order.pop_front();
+
+        PThreadScopedUnlock unlock(lock);
+        writeText(job->text);
+        delete job;
+    }
+}
+
+void DStoTextModule::formatThread(unsigned thread_num) {
+    PThreadScopedLock lock(mutex);
+    while (true) {
+        if (to_format.empty()) {
+            if (stop_formatting) {
+                break;
+            }
+            format_cond.wait(mutex);
+            continue;
+        }
+        FormatJob *job = to_format.front();
+        to_format.pop_front();
+        {
+            PThreadScopedUnlock unlock(lock);
+            FormatFields &fields(*job->state->thread_fields[thread_num]);
+            fields.series.setExtent(job->extent);
+            for (size_t row = 0; fields.series.morerecords(); ++fields.series, ++row) {
+                if (job->selected.empty() || job->selected[row]) {
+                    fields.formatter->appendRow(job->text);
+                }
+            }
+            fields.series.clearExtent();
+            job->extent.reset();
+        }
+        job->done = true;
+        formatted_cond.broadcast();
+    }
+}
+
 // this interface assumes you're just going to leak the document
 xmlNodePtr
 DStoTextModule::parseXML(string xml, const string &roottype)
@@ -11,6 +11,7 @@
 
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include <Lintel/LintelLog.hpp>
@@ -53,9 +54,182 @@ class IndexSourceModuleUnpackThread : public PThread {
     IndexSourceModule &ism;
 };
 
+class IndexSourceModulePoolThread : public PThread {
+  public:
+    IndexSourceModulePoolThread(IndexSourceModuleUnpackPool &pool)
+    : pool(pool) { 
+        setStackSize(256*1024); // shouldn't need much
+    }
+
+    virtual ~IndexSourceModulePoolThread() { }
+
+    virtual void *run();
+    IndexSourceModuleUnpackPool &pool;
+};
+
+/// The process-wide pool behind IndexSourceModule::useSharedUnpackPool.  Lock
+/// ordering is module mutex before pool mutex; a worker never holds the pool
+/// mutex while it is working on a module.
+class IndexSourceModuleUnpackPool {
+  public:
+    IndexSourceModuleUnpackPool(uint64_t max_compressed, uint64_t max_unpacked,
+                                unsigned nthreads)
+        : compressed(max_compressed), unpacked(max_unpacked), next(0)
+    {
+        PThreadScopedLock lock(mutex);
+        threads.resize(nthreads);
+        for (unsigned i = 0; i < nthreads; ++i) {
+            threads[i] = new IndexSourceModulePoolThread(*this);
+            threads[i]->start();
+        }
+    }
+
+    // The pool lives until the process exits, so there is no destructor.
+
+    unsigned nThreads() { return threads.size(); }
+
+    void add(IndexSourceModule *ism, int priority) {
+        PThreadScopedLock lock(mutex);
+        SINVARIANT(find(ism) == NULL);
+        modules.push_back(Entry(ism, priority));
+    }
+
+    /// ism released shared budget; the other modules may be waiting for it
+    void notifyOthers(IndexSourceModule *ism) {
+        PThreadScopedLock lock(mutex);
+        bool any = false;
+        for (vector<Entry>::iterator i = modules.begin(); i != modules.end(); ++i) {
+            if (i->ism != ism && !i->ready) {
+                i->ready = true;
+                any = true;
+            }
+        }
+        if (any) {
+            work_cond.broadcast();
+        }
+    }
+
+    /// waits for any workers to finish with ism; ism's mutex must not be held
+    void remove(IndexSourceModule *ism) {
+        PThreadScopedLock lock(mutex);
+        Entry *e = find(ism);
+        SINVARIANT(e != NULL);
+        e->ready = false;
+        while (e->active > 0) {
+            idle_cond.wait(mutex);
+            e = find(ism);
+        }
+        modules.erase(modules.begin() + (e - &modules[0]));
+        next = 0;
+    }
+
+    /// ism may have an extent to unpack
+    void notify(IndexSourceModule *ism) {
+        PThreadScopedLock lock(mutex);
+        Entry *e = find(ism);
+        if (e != NULL && !e->ready) {
+            e->ready = true;
+            work_cond.signal();
+        }
+    }
+
+    void worker() {
+        PThreadScopedLock lock(mutex);
+        while (true) {
+            Entry *e = pickReady();
+            if (e == NULL) {
+                work_cond.wait(mutex);
+                continue;
+            }
+            // cleared before the work so that a notify during the work is kept
+            e->ready = false; 
+            ++e->active;
+            IndexSourceModule *ism = e->ism;
+            {
+                PThreadScopedUnlock unlock(lock);
+                ism->unpackFromPool();
+            }
+            e = find(ism);
+            SINVARIANT(e != NULL && e->active > 0);
+            --e->active;
+            if (e->active == 0) {
+                idle_cond.broadcast();
+            }
+        }
+    }
+
+    IndexSourceModule::SharedBudget compressed, unpacked;
+
+  private:
+    struct Entry {
+        Entry(IndexSourceModule *ism, int priority)
+            : ism(ism), priority(priority), ready(false), active(0) { }
+        IndexSourceModule *ism;
+        int priority;
+        bool ready;
+        unsigned active;
+    };
+
+    Entry *find(IndexSourceModule *ism) {
+        for (vector<Entry>::iterator i = modules.begin(); i != modules.end(); ++i) {
+            if (i->ism == ism) {
+                return &*i;
+            }
+        }
+        return NULL;
+    }
+
+    /// highest priority ready module, round robin among equal priorities
+    Entry *pickReady() {
+        Entry *ret = NULL;
+        for (unsigned i = 0; i < modules.size(); ++i) {
+            Entry &e(modules[(next + i) % modules.size()]);
+            if (e.ready && (ret == NULL || e.priority > ret->priority)) {
+                ret = &e;
+            }
+        }
+        if (ret != NULL) {
+            next = (ret - &modules[0] + 1) % modules.size();
+        }
+        return ret;
+    }
+
+    PThreadMutex mutex;
+    PThreadCond work_cond, idle_cond;
+    vector<Entry> modules;
+    unsigned next;
+    vector<PThread *> threads;
+};
+
+void *IndexSourceModulePoolThread::run() {
+    pool.worker();
+    return NULL;
+}
+
+static IndexSourceModuleUnpackPool *shared_unpack_pool;
+
+void IndexSourceModule::useSharedUnpackPool(uint64_t max_compressed, uint64_t max_unpacked,
+                                            int n_unpack_threads) {
+    INVARIANT(shared_unpack_pool == NULL, "can only set up the shared unpack pool once");
+    SINVARIANT(max_compressed > 0 && max_unpacked > 0);
+    unsigned nthreads;
+    if (n_unpack_threads == -1) {
+        nthreads = min(PThreadMisc::getNCpus(), MAX_THREADS/2);
+    } else {
+        SINVARIANT(n_unpack_threads > 0);
+        nthreads = static_cast<unsigned>(n_unpack_threads);
+    }
+    shared_unpack_pool = new IndexSourceModuleUnpackPool(max_compressed, max_unpacked, nthreads);
+}
+
 IndexSourceModule::IndexSourceModule()
-        : getting_extent(false), prefetch(NULL)
+        : getting_extent(false), use_mmap(false), n_compressed_readers(1), unpack_priority(0),
+          prefetch(NULL)
 {
+    const char *env = getenv("DATASERIES_USE_MMAP");
+    if (env != NULL && strcmp(env, "1") == 0) {
+        use_mmap = true;
+    }
 }
 
 IndexSourceModule::~IndexSourceModule() {
@@ -80,7 +254,12 @@ IndexSourceModule::startPrefetching(unsigned prefetch_max_compressed,
     prefetch = tmp;
 
     unsigned unpack_count;
-    if (n_unpack_threads == -1) {
+    if (shared_unpack_pool != NULL) {
+        tmp->pool = shared_unpack_pool;
+        tmp->compressed.budget = &shared_unpack_pool->compressed;
+        tmp->unpacked.budget = &shared_unpack_pool->unpacked;
+        unpack_count = 0;
+    } else if (n_unpack_threads == -1) {
         unpack_count = min(PThreadMisc::getNCpus(), MAX_THREADS/2);
     } else {
         // TODO: Add support (and test) for 0 unpack threads which should
@@ -89,7 +268,7 @@ IndexSourceModule::startPrefetching(unsigned prefetch_max_compressed,
         unpack_count = static_cast<unsigned>(n_unpack_threads);
     } 
 
-    INVARIANT(unpack_count > 0, "?");
+    INVARIANT(unpack_count > 0 || tmp->pool != NULL, "?");
     tmp->unpack_threads.resize(unpack_count);
     INVARIANT(prefetch == tmp, "two simulataneous calls to startPrefetching??");
     lockedStartThreads();
@@ -97,14 +276,36 @@ IndexSourceModule::startPrefetching(unsigned prefetch_max_compressed,
     INVARIANT(prefetch == tmp, "two simulataneous calls to startPrefetching??");
 }
 
+void IndexSourceModule::setUseMmap(bool _use_mmap) {
+    INVARIANT(prefetch == NULL, "can't change the read mode after prefetching has started");
+    use_mmap = _use_mmap;
+}
+
+void IndexSourceModule::setCompressedReaders(unsigned n_readers) {
+    INVARIANT(prefetch == NULL, "can't change the reader count after prefetching has started");
+    INVARIANT(n_readers > 0, "need at least one compressed reader");
+    n_compressed_readers = n_readers;
+}
+
+void IndexSourceModule::setUnpackPriority(int priority) {
+    INVARIANT(prefetch == NULL, "can't change the priority after prefetching has started");
+    unpack_priority = priority;
+}
+
 void IndexSourceModule::lockedStartThreads() {
-    prefetch->compressed_prefetch_thread = 
-            new IndexSourceModuleCompressedPrefetchThread(*this);
-    prefetch->compressed_prefetch_thread->start();
+    prefetch->compressed_prefetch_threads.resize(n_compressed_readers);
+    for (unsigned i = 0; i < prefetch->compressed_prefetch_threads.size(); ++i) {
+        prefetch->compressed_prefetch_threads[i]
+                = new IndexSourceModuleCompressedPrefetchThread(*this);
+        prefetch->compressed_prefetch_threads[i]->start();
+    }
     for (unsigned i = 0; i < prefetch->unpack_threads.size(); ++i) {
         prefetch->unpack_threads[i] = new IndexSourceModuleUnpackThread(*this);
         prefetch->unpack_threads[i]->start();
     }
+    if (prefetch->pool != NULL) {
+        prefetch->pool->add(this, unpack_priority);
+    }
 }
 
 static inline double 
@@ -125,6 +326,9 @@ Extent::Ptr IndexSourceModule::getSharedExtent() {
     while (!prefetch->allDone() &&
           !prefetch->unpackedReady()) {
         ++prefetch->stats.consumer;
+        if (prefetch->pool != NULL) {
+            prefetch->pool->notify(this);
+        }
         prefetch->unpack_cond.broadcast();
         prefetch->ready_cond.wait(prefetch->mutex);
     }
@@ -137,11 +341,10 @@ Extent::Ptr IndexSourceModule::getSharedExtent() {
     ++prefetch->stats.nextents;
     SINVARIANT(!prefetch->unpacked.empty());
     PrefetchExtent *buf = prefetch->unpacked.getFront();
-    SINVARIANT(buf->bytes.empty() && buf->unpacked != NULL);
-    prefetch->unpacked.subtract(buf->unpacked->size());
-    if (!prefetch->compressed.empty() &&
-        prefetch->unpacked.can_add(prefetch->compressed.front())) {
-        prefetch->unpack_cond.signal();
+    SINVARIANT(buf->compressedSize() == 0 && buf->unpacked != NULL);
+    lockedSubtract(prefetch->unpacked, buf->unpacked->size());
+    if (prefetch->canUnpackFront()) {
+        lockedSignalUnpack();
     } else {
         ++prefetch->stats.skip_unpack_signal;
     }
@@ -180,8 +383,9 @@ void IndexSourceModule::close() {
         return;
     }
     if (prefetch->abort_prefetching == 0) {
-        //                          me + compressed_prefetch + unpackers
-        prefetch->abort_prefetching = 2 + prefetch->unpack_threads.size();
+        //                    me + compressed_prefetchers + unpackers
+        prefetch->abort_prefetching = 1 + prefetch->compressed_prefetch_threads.size()
+                + prefetch->unpack_threads.size();
         prefetch->compressed_cond.broadcast();
         prefetch->unpack_cond.broadcast();
         prefetch->ready_cond.broadcast();
@@ -190,21 +394,34 @@ void IndexSourceModule::close() {
             prefetch->compressed_cond.wait(prefetch->mutex);
         }
 
-        prefetch->compressed_prefetch_thread->join();
-        delete prefetch->compressed_prefetch_thread;
-        prefetch->compressed_prefetch_thread = NULL;
+        for (vector<PThread *>::iterator i = prefetch->compressed_prefetch_threads.begin();
+            i != prefetch->compressed_prefetch_threads.end(); ++i) {
+            (**i).join();
+            delete *i;
+            *i = NULL;
+        }
         for (vector<PThread *>::iterator i = prefetch->unpack_threads.begin();
             i != prefetch->unpack_threads.end(); ++i) {
             (**i).join();
             delete *i;
             *i = NULL;
         }
+        if (prefetch->pool != NULL) {
+            // pool workers need our mutex to finish; abort_prefetching keeps
+            // them from starting anything new.
+            PThreadScopedUnlock unlock(lock);
+            prefetch->pool->remove(this);
+        }
         while (prefetch->compressed.empty() == false) {
+            // readers finish their pending read before exiting
+            SINVARIANT(prefetch->compressed.front()->pending_fd < 0);
             delete prefetch->compressed.getFront();
         }
+        lockedSubtract(prefetch->compressed, prefetch->compressed.cur);
         while (prefetch->unpacked.empty() == false) {
             delete prefetch->unpacked.getFront();
         }
+        lockedSubtract(prefetch->unpacked, prefetch->unpacked.cur);
         SINVARIANT(prefetch->abort_prefetching == 1);
         prefetch->abort_prefetching = 0;
         prefetch->compressed_cond.broadcast();
@@ -226,9 +443,12 @@ bool IndexSourceModule::isClosed() {
 }
 
 bool IndexSourceModule::lockedIsClosed() {
-    if (prefetch->compressed_prefetch_thread != NULL) {
-        return false;
-    } 
+    for (vector<PThread *>::iterator i = prefetch->compressed_prefetch_threads.begin(); 
+         i != prefetch->compressed_prefetch_threads.end(); ++i) {
+        if (*i != NULL) {
+            return false;
+        }
+    }
 
     for (vector<PThread *>::iterator i = prefetch->unpack_threads.begin(); 
          i != prefetch->unpack_threads.end(); ++i) {
@@ -273,17 +493,33 @@ IndexSourceModule::getWaitStats(WaitStats &stats)
 void IndexSourceModule::compressedPrefetchThread() {
     prefetch->mutex.lock();
     while (prefetch->abort_prefetching == 0) {
-        if (!prefetch->source_done && prefetch->compressed.can_add(0)) {
+        // The subclasses walk their index assuming a single caller, so only
+        // one reader at a time gets the next extent; with multiple readers
+        // the read itself happens below without the lock.
+        if (!prefetch->source_done && !prefetch->getting_compressed
+            && prefetch->compressed.can_add(0)) {
+            prefetch->getting_compressed = true;
             PrefetchExtent *p = lockedGetCompressedExtent();
+            prefetch->getting_compressed = false;
+            prefetch->compressed_cond.signal(); // let another reader continue
             if (p == NULL) {
                 prefetch->source_done = true;
                 prefetch->ready_cond.signal();
+                prefetch->compressed_cond.broadcast();
             } else {
                 SINVARIANT(p->extent_source != Extent::in_memory_str &&
                            p->extent_source_offset > 0);
-                prefetch->compressed.add(p, p->bytes.size());
-                if (prefetch->unpacked.can_add(prefetch->compressed.front())) {
-                    prefetch->unpack_cond.signal();
+                // queue before reading so that the index order is preserved
+                prefetch->compressed.add(p, p->compressedSize());
+                if (p->pending_fd >= 0) {
+                    prefetch->mutex.unlock();
+                    readPending(p);
+                    prefetch->mutex.lock();
+                    p->pending_fd = -1;
+                    prefetch->compressed.grow(p->compressedSize());
+                }
+                if (prefetch->canUnpackFront()) {
+                    lockedSignalUnpack();
                 } else {
                     ++prefetch->stats.skip_unpack_signal;
                 }
@@ -302,10 +538,9 @@ void IndexSourceModule::unpackThread() {
     prefetch->mutex.lock();
     ++prefetch->stats.active_unpackers;
     while (prefetch->abort_prefetching == 0) {
-        if (prefetch->compressed.data.empty() || 
-            !prefetch->unpacked.can_add(prefetch->compressed.front())) {
+        if (!prefetch->canUnpackFront()) {
             --prefetch->stats.active_unpackers;
-            if (prefetch->compressed.data.empty()) {
+            if (!prefetch->compressedReady()) {
                 ++prefetch->stats.unpack_no_upstream;
             } else {
                 ++prefetch->stats.unpack_downstream_full;
@@ -319,52 +554,8 @@ void IndexSourceModule::unpackThread() {
         }
 
         prefetch->stats.lockedUpdateActive();
-        if (!prefetch->compressed.data.empty() &&
-            prefetch->unpacked.can_add(prefetch->compressed.front())) {
-            PrefetchExtent *pe = prefetch->compressed.getFront();
-            prefetch->compressed.subtract(pe->bytes.size());
-            uint32_t unpacked_size 
-                    = Extent::unpackedSize(pe->bytes, pe->need_bitflip,pe->type);
-            prefetch->unpacked.add(pe, unpacked_size);
-            prefetch->compressed_cond.signal();
-            bool should_yield; 
-            if (prefetch->unpackedReady()) {
-                // For small extents, almost equivalent to just having the
-                // next condition, but not equivalent with large extents.
-                // really want a directed yield here to the consumer.
-                ++prefetch->stats.unpack_yield_ready;
-                should_yield = true;
-            } else if (prefetch->unpacked.data.size() > 2*prefetch->unpack_threads.size()) {
-                ++prefetch->stats.unpack_yield_front;
-                // The front of the queue isn't done, but we have a lot of 
-                // things in the queue, this means whatever thread is working
-                // on that element has been preempted.
-                // really want a directed yield to the thread processing the
-                // first extent.
-                should_yield = true;
-            } else {
-                should_yield = false;
-            }
-            prefetch->mutex.unlock();
-            if (should_yield) {
-                sched_yield();
-            }
-            Extent::Ptr e(new Extent(pe->type));
-            e->unpackData(pe->bytes, pe->need_bitflip);
-            e->extent_source = pe->extent_source;
-            e->extent_source_offset = pe->extent_source_offset;
-            SINVARIANT(e->type->getName() == pe->uncompressed_type);
-            SINVARIANT(e->size() == unpacked_size);
-            prefetch->mutex.lock();
-            SINVARIANT(pe->unpacked == NULL && pe->bytes.size() > 0);
-            total_compressed_bytes += pe->bytes.size();
-            total_uncompressed_bytes += e->size();
-            pe->bytes.clear();
-            pe->unpacked = e;
-            SINVARIANT(!prefetch->unpacked.empty());
-            if (prefetch->unpackedReady()) {
-                prefetch->ready_cond.signal();
-            }
+        if (prefetch->canUnpackFront()) {
+            lockedUnpackFront();
         }
     }
     --prefetch->stats.active_unpackers;
@@ -374,20 +565,139 @@ void IndexSourceModule::unpackThread() {
     prefetch->mutex.unlock();
 }
 
+bool IndexSourceModule::unpackFromPool() {
+    PThreadScopedLock lock(prefetch->mutex);
+    if (prefetch->abort_prefetching > 0) {
+        return false;
+    }
+    if (!prefetch->source_done && prefetch->compressed.can_add(0)) {
+        // another module may have released the budget our readers wait for
+        prefetch->compressed_cond.signal();
+    }
+    if (!prefetch->canUnpackFront()) {
+        return false;
+    }
+    lockedUnpackFront();
+    if (prefetch->abort_prefetching == 0 && prefetch->canUnpackFront()) {
+        lockedSignalUnpack(); // get back in line for the next one
+    }
+    return true;
+}
+
+void IndexSourceModule::lockedSignalUnpack() {
+    if (prefetch->pool != NULL) {
+        prefetch->pool->notify(this);
+    } else {
+        prefetch->unpack_cond.signal();
+    }
+}
+
+void IndexSourceModule::lockedSubtract(Queue &queue, unsigned size) {
+    if (queue.subtract(size)) {
+        SINVARIANT(prefetch->pool != NULL);
+        prefetch->pool->notifyOthers(this);
+    }
+}
+
+void IndexSourceModule::lockedUnpackFront() {
+    SINVARIANT(prefetch->canUnpackFront());
+    PrefetchExtent *pe = prefetch->compressed.getFront();
+    lockedSubtract(prefetch->compressed, pe->compressedSize());
+    uint32_t unpacked_size 
+            = Extent::unpackedSize(pe->compressedBegin(), pe->compressedSize(),
+                                   pe->need_bitflip, pe->type);
+    prefetch->unpacked.add(pe, unpacked_size);
+    prefetch->compressed_cond.signal();
+    unsigned n_unpackers = prefetch->pool != NULL ? prefetch->pool->nThreads()
+            : prefetch->unpack_threads.size();
+    bool should_yield; 
+    if (prefetch->unpackedReady()) {
+        // For small extents, almost equivalent to just having the
+        // next condition, but not equivalent with large extents.
+        // really want a directed yield here to the consumer.
+        ++prefetch->stats.unpack_yield_ready;
+        should_yield = true;
+    } else if (prefetch->unpacked.data.size() > 2*n_unpackers) {
+        ++prefetch->stats.unpack_yield_front;
+        // The front of the queue isn't done, but we have a lot of 
+        // things in the queue, this means whatever thread is working
+        // on that element has been preempted.
+        // really want a directed yield to the thread processing the
+        // first extent.
+        should_yield = true;
+    } else {
+        should_yield = false;
+    }
+    prefetch->mutex.unlock();
+    if (should_yield) {
+        sched_yield();
+    }
+    Extent::Ptr e(new Extent(pe->type));
+    e->unpackData(pe->compressedBegin(), pe->compressedSize(), pe->need_bitflip);
+    e->extent_source = pe->extent_source;
+    e->extent_source_offset = pe->extent_source_offset;
+    SINVARIANT(e->type->getName() == pe->uncompressed_type);
+    SINVARIANT(e->size() == unpacked_size);
+    prefetch->mutex.lock();
+    SINVARIANT(pe->unpacked == NULL && pe->compressedSize() > 0);
+    total_compressed_bytes += pe->compressedSize();
+    total_uncompressed_bytes += e->size();
+    pe->clearCompressed();
+    pe->unpacked = e;
+    SINVARIANT(!prefetch->unpacked.empty());
+    if (prefetch->unpackedReady()) {
+        prefetch->ready_cond.signal();
+    }
+}
+
 IndexSourceModule::PrefetchExtent *
 IndexSourceModule::readCompressed(DataSeriesSource *dss,
                                   off64_t offset,
                                   const string &uncompressed_type)
 {
-    prefetch->mutex.unlock();
     PrefetchExtent *p = new PrefetchExtent;
     p->extent_source = dss->getFilename();
     p->extent_source_offset = offset;
-    bool ok = dss->preadCompressed(offset,p->bytes);
-    INVARIANT(ok,"whoa, shouldn't have hit eof!");
-    p->type = dss->getLibrary().getTypeByNamePtr(Extent::getPackedExtentType(p->bytes));
     p->need_bitflip = dss->needBitflip();
     p->uncompressed_type = uncompressed_type;
+    bool map = use_mmap && dss->canMapCompressed();
+    if (!map && prefetch->compressed_prefetch_threads.size() > 1) {
+        // compressedPrefetchThread() does the read once the subclass returns
+        p->pending_fd = dss->dupFd();
+        p->type = dss->getLibrary().getTypeByNamePtr(uncompressed_type);
+        return p;
+    }
+
+    prefetch->mutex.unlock();
+    if (map) {
+        p->mapping = dss->mapCompressed(offset, p->mapped_begin, p->mapped_size);
+        INVARIANT(p->mapping != NULL, "whoa, shouldn't have hit eof!");
+    } else {
+        bool ok = dss->preadCompressed(offset,p->bytes);
+        INVARIANT(ok,"whoa, shouldn't have hit eof!");
+    }
+    p->type = dss->getLibrary().getTypeByNamePtr
+            (Extent::getPackedExtentType(p->compressedBegin(), p->compressedSize()));
     prefetch->mutex.lock();
     return p;
 }
+
+Extent::Ptr IndexSourceModule::readExtent(DataSeriesSource *dss, off64_t offset) {
+    prefetch->mutex.unlock();
+    Extent::Ptr ret(dss->preadExtent(offset));
+    prefetch->mutex.lock();
+    INVARIANT(ret != NULL, "whoa, shouldn't have hit eof!");
+    return ret;
+}
+
+void IndexSourceModule::readPending(PrefetchExtent *pe) {
+    SINVARIANT(pe->pending_fd >= 0 && pe->bytes.empty());
+    off64_t offset = pe->extent_source_offset;
+    bool ok = Extent::preadExtent(pe->pending_fd, offset, pe->bytes, pe->need_bitflip);
+    INVARIANT(ok, "whoa, shouldn't have hit eof!");
+    CHECKED(::close(pe->pending_fd) == 0, format("close failed: %s") % strerror(errno));
+    INVARIANT(Extent::getPackedExtentType(pe->bytes) == pe->type->getName(),
+              format("index error?! %s != %s in %s @ %d")
+              % Extent::getPackedExtentType(pe->bytes) % pe->type->getName()
+              % pe->extent_source % pe->extent_source_offset);
+}
@@ -0,0 +1,197 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    implementation
+*/
+
+#include <algorithm>
+
+#include <DataSeries/DSExpr.hpp>
+#include <DataSeries/ParallelRowAnalysisModule.hpp>
+
+using namespace std;
+
+namespace {
+    class ParallelRowAnalysisThread : public PThread {
+      public:
+        ParallelRowAnalysisThread(ParallelRowAnalysisModule &module,
+                                  ParallelRowAnalysisModule::Worker &worker)
+            : module(module), worker(worker) { }
+
+        virtual void *run() {
+            module.workerThread(worker);
+            return NULL;
+        }
+
+        ParallelRowAnalysisModule &module;
+        ParallelRowAnalysisModule::Worker &worker;
+    };
+}
+
+ParallelRowAnalysisModule::Worker::Worker(ExtentSeries::typeCompatibilityT type_compatibility)
+    : series(type_compatibility), processed_rows(0), ignored_rows(0),
+      where_series(type_compatibility), where_expr(NULL)
+{ }
+
+ParallelRowAnalysisModule::Worker::~Worker() {
+    delete where_expr;
+}
+
+void ParallelRowAnalysisModule::Worker::newExtentHook(const Extent &e) { }
+
+void ParallelRowAnalysisModule::Worker::processRows(const vector<bool> *selected) {
+    for (size_t row = 0; series.morerecords(); ++series, ++row) {
+        if (selected == NULL || (*selected)[row]) {
+            processRow();
+        }
+    }
+}
+
+void ParallelRowAnalysisModule::Worker::processExtent(const Extent::Ptr &e) {
+    newExtentHook(*e);
+    series.setExtent(e);
+    if (where_expr != NULL) {
+        where_series.setExtent(e);
+        where_expr->selectRows(where_series, where_selected);
+        where_series.clearExtent();
+        size_t nselected = count(where_selected.begin(), where_selected.end(), true);
+        processed_rows += nselected;
+        ignored_rows += where_selected.size() - nselected;
+        processRows(&where_selected);
+    } else {
+        processed_rows += e->nRecords();
+        processRows(NULL);
+    }
+    series.clearExtent();
+}
+
+ParallelRowAnalysisModule::ParallelRowAnalysisModule
+(DataSeriesModule &source, unsigned nthreads, size_t max_queued_bytes,
+ ExtentSeries::typeCompatibilityT type_compatibility)
+    : RowAnalysisModule(source, type_compatibility),
+      nthreads(nthreads == 0 ? PThreadMisc::getNCpus() : nthreads),
+      max_queued_bytes(max_queued_bytes), finished(false), queued_bytes(0), source_done(false)
+{
+    SINVARIANT(this->nthreads > 0 && max_queued_bytes > 0);
+}
+
+ParallelRowAnalysisModule::~ParallelRowAnalysisModule() {
+    if (!threads.empty()) { // stopped early; drop the extents nobody is going to look at
+        {
+            PThreadScopedLock lock(mutex);
+            while (!queue.empty()) {
+                queue.pop_front();
+            }
+        }
+        finishWorkers();
+    }
+    for (vector<Worker *>::iterator i = workers.begin(); i != workers.end(); ++i) {
+        delete *i;
+    }
+}
+
+Extent::Ptr ParallelRowAnalysisModule::getSharedExtent() {
+    Extent::Ptr e = source.getSharedExtent();
+    if (e == NULL) {
+        if (!finished) {
+            finished = true;
+            finishWorkers();
+            for (vector<Worker *>::iterator i = workers.begin(); i != workers.end(); ++i) {
+                processed_rows += (**i).processed_rows;
+                ignored_rows += (**i).ignored_rows;
+                merge(**i);
+            }
+            completeProcessing();
+        }
+        return e;
+    }
+    if (!prepared) {
+        firstExtent(*e);
+    }
+    newExtentHook(*e);
+    if (!prepared) {
+        prepareForProcessing();
+        prepared = true;
+        startWorkers(*e);
+    }
+
+    PThreadScopedLock lock(mutex);
+    while (queued_bytes > max_queued_bytes) {
+        space_cond.wait(mutex);
+    }
+    queue.push_back(e);
+    queued_bytes += e->size();
+    work_cond.signal();
+    return e;
+}
+
+void ParallelRowAnalysisModule::processRow() {
+    FATAL_ERROR("ParallelRowAnalysisModule rows are processed by the workers");
+}
+
+void ParallelRowAnalysisModule::startWorkers(const Extent &first) {
+    workers.reserve(nthreads);
+    for (unsigned i = 0; i < nthreads; ++i) {
+        Worker *worker = makeWorker();
+        SINVARIANT(worker != NULL);
+        workers.push_back(worker);
+        if (!where_expr_str.empty()) {
+            worker->where_series.setType(first.getTypePtr());
+            worker->where_expr = DSExpr::make(worker->where_series, where_expr_str);
+        }
+    }
+    threads.reserve(nthreads);
+    for (unsigned i = 0; i < nthreads; ++i) {
+        threads.push_back(new ParallelRowAnalysisThread(*this, *workers[i]));
+        threads.back()->start();
+    }
+}
+
+void ParallelRowAnalysisModule::finishWorkers() {
+    {
+        PThreadScopedLock lock(mutex);
+        source_done = true;
+        work_cond.broadcast();
+    }
+    for (vector<PThread *>::iterator i = threads.begin(); i != threads.end(); ++i) {
+        (**i).join();
+        delete *i;
+    }
+    threads.clear();
+}
+
+void ParallelRowAnalysisModule::workerThread(Worker &worker) {
+    PThreadScopedLock lock(mutex);
+    while (true) {
+        if (queue.empty()) {
+            if (source_done) {
+                break;
+            }
+            work_cond.wait(mutex);
+            continue;
+        }
+        Extent::Ptr e = queue.front();
+        queue.pop_front();
+        queued_bytes -= e->size();
+        space_cond.signal();
+
+        PThreadScopedUnlock unlock(lock);
+        worker.processExtent(e);
+    }
+}
+
+void SharedStatsQuantile::Buffer::flush() {
+    if (values.empty()) {
+        return;
+    }
+    PThreadScopedLock lock(into.mutex);
+    for (vector<double>::iterator i = values.begin(); i != values.end(); ++i) {
+        into.stats.add(*i);
+    }
+    values.clear();
+}
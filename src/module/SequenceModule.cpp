@@ -6,14 +6,18 @@
 */
 
 #define DS_RAW_EXTENT_PTR_DEPRECATED /* allowed */
+#include <DataSeries/PrefetchBufferModule.hpp>
 #include <DataSeries/SequenceModule.hpp>
 
 SequenceModule::SequenceModule(DataSeriesModule *head)
+    : modules_per_stage(0), max_stage_memory(0), unbuffered_modules(0)
 {
-    addModule(head);
+    SINVARIANT(head != NULL);
+    modules.push_back(DsmPtr(head));
 }
 
 SequenceModule::SequenceModule(DsmPtr head)
+    : modules_per_stage(0), max_stage_memory(0), unbuffered_modules(0)
 {
     INVARIANT(head != NULL, "invalid argument");
     modules.push_back(head);
@@ -27,26 +31,38 @@ SequenceModule::~SequenceModule() {
 }
 
 DataSeriesModule &SequenceModule::tail() {
+    if (modules_per_stage > 0 && unbuffered_modules >= modules_per_stage) {
+        // the buffer's thread runs the stage, pulling extents through it
+        modules.push_back(DsmPtr(new PrefetchBufferModule(*modules.back(), max_stage_memory)));
+        unbuffered_modules = 0;
+    }
     DsmPtr tail = modules.back();
     SINVARIANT(tail != NULL);
     return *tail;
 }
 
+void SequenceModule::enablePipelining(unsigned modules_per_stage, unsigned max_stage_memory) {
+    INVARIANT(modules_per_stage > 0 && max_stage_memory > 0, "invalid argument");
+    this->modules_per_stage = modules_per_stage;
+    this->max_stage_memory = max_stage_memory;
+}
+
 void SequenceModule::addModule(DataSeriesModule *mod) {
     SINVARIANT(mod != NULL);
     DsmPtr p_mod(mod);
-    modules.push_back(p_mod);
+    addModule(p_mod);
 }
 
 void SequenceModule::addModule(DsmPtr mod) {
     SINVARIANT(mod != NULL);
     modules.push_back(mod);
+    ++unbuffered_modules;
 }
 
 Extent *SequenceModule::getExtent() {
-    return tail().getExtent();
+    return modules.back()->getExtent();
 }
 
 Extent::Ptr SequenceModule::getSharedExtent() {
-    return tail().getSharedExtent();
+    return modules.back()->getSharedExtent();
 }
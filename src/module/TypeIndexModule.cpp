@@ -5,6 +5,9 @@
   See the file named COPYING for license details
 */
 
+#include <boost/bind.hpp>
+
+#include <DataSeries/DSExpr.hpp>
 #include <DataSeries/TypeIndexModule.hpp>
 
 using namespace std;
@@ -17,7 +20,8 @@ TypeIndexModule::TypeIndexModule(const string &_type_match)
           extentOffset(indexSeries,"offset"), 
           extentType(indexSeries,"extenttype"),
           cur_file(0), cur_source(NULL),
-          my_type()
+          my_type(), predicate_str(), predicate_series(), predicate(), cur_ranges(),
+          skipped_extents(0)
 { }
 
 TypeIndexModule::~TypeIndexModule()
@@ -36,6 +40,13 @@ void TypeIndexModule::setSecondMatch(const std::string &_type_match) {
 }
 
 
+void TypeIndexModule::setPredicate(const string &where_expr) {
+    INVARIANT(startedPrefetching() == false,
+              "invalid to set predicate after we start prefetching");
+    INVARIANT(!type_match.empty(), "a predicate needs a type match to know the fields");
+    predicate_str = where_expr;
+}
+
 void TypeIndexModule::addSource(const std::string &filename) {
     INVARIANT(startedPrefetching() == false, 
               "can't add sources safely after starting prefetching -- could get confused about the end of the entries.");
@@ -72,12 +83,23 @@ TypeIndexModule::PrefetchExtent *TypeIndexModule::lockedGetCompressedExtent() {
             }
 
             indexSeries.setExtent(cur_source->index_extent);
+            if (!predicate_str.empty() && my_type != NULL) {
+                if (predicate == NULL) {
+                    predicate_series.setType(my_type);
+                    predicate.reset(DSExpr::make(predicate_series, predicate_str));
+                }
+                lockedReadExtentStats();
+            }
         }
         for (;indexSeries.morerecords();++indexSeries) {
             if (type_match.empty() ||
                 (my_type != NULL &&
                  extentType.stringval() == my_type->getName())) {
                 off64_t v = extentOffset.val();
+                if (predicate != NULL && !lockedMayMatch(v)) {
+                    ++skipped_extents;
+                    continue;
+                }
                 PrefetchExtent *ret 
                         = readCompressed(cur_source, v, extentType.stringval());
                 ++indexSeries;
@@ -86,6 +108,7 @@ TypeIndexModule::PrefetchExtent *TypeIndexModule::lockedGetCompressedExtent() {
         }
         if (indexSeries.morerecords() == false) {
             indexSeries.clearExtent();
+            cur_ranges.clear();
             delete cur_source;
             cur_source = NULL;
             ++cur_file;
@@ -106,3 +129,66 @@ const ExtentType::Ptr TypeIndexModule::matchType() {
               % t->getName() % u->getName());
     return t != NULL ? t : u;
 }
+
+void TypeIndexModule::lockedReadExtentStats() {
+    cur_ranges.clear();
+    const string &stats_type(ExtentType::getDataSeriesExtentStatsTypePtr()->getName());
+    off64_t stats_offset = -1;
+    for (ExtentSeries s(cur_source->index_extent); s.more(); s.next()) {
+        if (extentType.stringval(s.getExtentRef(), s.getRowOffset()) == stats_type) {
+            stats_offset = extentOffset.val(s.getExtentRef(), s.getRowOffset());
+        }
+    }
+    if (stats_offset < 0) {
+        return; // file written without stats
+    }
+
+    // only the reader with getting_compressed set walks the index, so
+    // cur_source and cur_ranges stay ours while the lock is released
+    Extent::Ptr stats_extent(readExtent(cur_source, stats_offset));
+    ExtentSeries s(stats_extent);
+    Int64Field offset(s, "offset");
+    Variable32Field column(s, "column");
+    Int32Field rows(s, "rows"), nulls(s, "nulls");
+    DoubleField min(s, "min", Field::flag_nullable), max(s, "max", Field::flag_nullable);
+    for (; s.more(); s.next()) {
+        ColumnRange range;
+        range.column = column.stringval();
+        if (rows.val() == nulls.val()) {
+            range.known = true;
+            range.min = range.max = 0;
+        } else if (min.isNull()) {
+            range.known = false; // had a NaN
+        } else {
+            range.known = true;
+            range.min = min.val();
+            range.max = max.val();
+            if (nulls.val() > 0) {
+                range.min = std::min(range.min, 0.0);
+                range.max = std::max(range.max, 0.0);
+            }
+        }
+        cur_ranges[offset.val()].push_back(range);
+    }
+}
+
+bool TypeIndexModule::lockedMayMatch(int64_t offset) {
+    ExtentRanges::iterator ranges = cur_ranges.find(offset);
+    if (ranges == cur_ranges.end()) {
+        return true;
+    }
+    return predicate->mayMatch(boost::bind(&TypeIndexModule::columnRange, &ranges->second,
+                                           _1, _2, _3));
+}
+
+bool TypeIndexModule::columnRange(const vector<ColumnRange> *ranges, const string &column,
+                                  double &min, double &max) {
+    for (vector<ColumnRange>::const_iterator i = ranges->begin(); i != ranges->end(); ++i) {
+        if (i->column == column) {
+            min = i->min;
+            max = i->max;
+            return i->known;
+        }
+    }
+    return false;
+}
@@ -119,11 +119,35 @@ void getPackingArgs(int *argc, char *argv[], commonPackingArgs *commonArgs) {
                       && commonArgs->compress_level < 10,
                       format("compression level %d (%s) invalid, should be 1..9")
                       % commonArgs->compress_level % argv[cur_arg]);
+        } else if (strncmp(argv[cur_arg],"--compress-select=",18) == 0) {
+            std::string select(argv[cur_arg]+18);
+            if (select == "exhaustive") {
+                Extent::setCompressSelect(Extent::CompressSelectExhaustive);
+            } else if (select == "adaptive") {
+                Extent::setCompressSelect(Extent::CompressSelectAdaptive);
+            } else {
+                FATAL_ERROR(format("compression selection '%s' invalid, should be exhaustive or adaptive")
+                            % select);
+            }
+        } else if (strncmp(argv[cur_arg],"--compress-cost=",16) == 0) {
+            std::string cost(argv[cur_arg]+16);
+            if (cost == "size") {
+                Extent::setCompressCost(Extent::CompressCostSize);
+            } else if (cost == "time-size") {
+                Extent::setCompressCost(Extent::CompressCostTimeSize);
+            } else if (cost == "weighted") {
+                Extent::setCompressCost(Extent::CompressCostWeighted);
+            } else {
+                FATAL_ERROR(format("compression cost '%s' invalid, should be size, time-size or weighted")
+                            % cost);
+            }
         } else if (strncmp(argv[cur_arg],"--extent-size=",14) == 0) {
             commonArgs->extent_size = atoi(argv[cur_arg]+14);
             INVARIANT(commonArgs->extent_size >= 1024,
                       format("extent size %d (%s), < 1024 doesn't make sense")
                       % commonArgs->extent_size % argv[cur_arg]);
+        } else if (strcmp(argv[cur_arg],"--extent-stats") == 0) {
+            commonArgs->extent_stats = true;
             // Check for arguments in the old format -- provided for backwards
             // compatability.
         } else if (oldStyle(argv, cur_arg, num_munged_args, commonArgs)) {
@@ -178,8 +202,13 @@ const std::string packingOptions() {
     returnStr += 
             "} (default enables all --- enable does little on its own)\n"
             "    --compress-level=[0-9] (default 9)\n"
+            "    --compress-select={exhaustive,adaptive} (default exhaustive; adaptive\n"
+            "        mostly runs only the algorithm that has been winning)\n"
+            "    --compress-cost={size,time-size,weighted} (default size)\n"
             "    --extent-size=[>=1024] (default 16*1024*1024 if bz2 is "
-            "enabled, 64*1024 otherwise)\n";
+            "enabled, 64*1024 otherwise)\n"
+            "    --extent-stats (record per-extent column ranges so that readers\n"
+            "        with a predicate can skip extents)\n";
 
     return returnStr;
 }
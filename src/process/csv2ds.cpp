@@ -9,18 +9,30 @@
     Convert csv files to DataSeries files
 */
 
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <fstream>
+
 #include <Lintel/AssertBoost.hpp>
+#include <Lintel/Deque.hpp>
 #include <Lintel/LintelLog.hpp>
 #include <Lintel/ProgramOptions.hpp>
+#include <Lintel/PThread.hpp>
 #include <Lintel/StringUtil.hpp>
 
+#include <DataSeries/BoolField.hpp>
+#include <DataSeries/ByteField.hpp>
 #include <DataSeries/commonargs.hpp>
 #include <DataSeries/DataSeriesModule.hpp>
-#include <DataSeries/GeneralField.hpp>
+#include <DataSeries/DoubleField.hpp>
+#include <DataSeries/FixedWidthField.hpp>
+#include <DataSeries/Int32Field.hpp>
+#include <DataSeries/Int64Field.hpp>
+#include <DataSeries/Variable32Field.hpp>
 
 /*
 =pod
@@ -42,6 +54,13 @@ I<string-quote-character> then following characters are read, treating two
 I<string-quote-characters> in a row as a single I<string-quote-character>.  A
 field stops when we reach a I<field-separator-string> or the end of the
 line, which can either be a newline or a a carriage return and a newline.
+Quoted fields may contain newlines, in which case the record continues on the
+following lines.
+
+The input is read in large blocks and cut into chunks of complete records,
+which are converted into extents by several threads at once.  The extents are
+written in the order of the input.  Each chunk ends its last extent early, so
+the extents depend on I<--chunk-size>, but not on the number of threads.
 
 =head1 EXAMPLES
 
@@ -94,6 +113,16 @@ nulls.
 Specifies that any variable32 fields (as indicated by the xml description) are hex encoded, and
 so should be decoded before being added to the dataseries file.
 
+=item --threads=I<count>
+
+Specifies the number of threads converting records into extents; 0, the default, means one for
+each cpu.
+
+=item --chunk-size=I<bytes>
+
+Specifies the approximate number of bytes of csv input that are converted together by one thread.
+The default, 0, uses the larger of 16MiB and twice the extent size.
+
 =back
 
 =head1 TODO
@@ -119,6 +148,580 @@ namespace {
     lintel::ProgramOption<string> po_field_separator("field-separator", "Specify the string that separates fields in the csv file", ",");
     lintel::ProgramOption<bool> po_hex_encoded_variable32("hex-encoded-variable32", "Specify that variable32 fields are hex encoded.");
     lintel::ProgramOption<string> po_null_string("null-string", "Specify the string that will be interpreted as a null field", "null");
+    lintel::ProgramOption<int32_t> po_threads("threads", "Specify the number of threads converting records; 0 for one per cpu", 0);
+    lintel::ProgramOption<int32_t> po_chunk_size("chunk-size", "Specify the approximate number of bytes of csv converted together by one thread; 0 to base it on the extent size", 0);
+
+    const size_t read_size = 4 * 1024 * 1024;
+    const size_t min_chunk_size = 16 * 1024 * 1024;
+}
+
+/// How the records and fields of the csv input are delimited and interpreted
+struct CSVSyntax {
+    string comment_prefix;
+    string field_separator;
+    char string_quote_character;
+    string null_string;
+    bool hex_encoded_variable32;
+};
+
+/// One field of a record, pointing into the csv input; quoted fields exclude the quotes
+struct CSVField {
+    const char *begin, *end;
+    bool doubled_quotes; // quoted field with two quote characters standing for one
+};
+
+/** Split the record starting at pos into fields.  Returns the position just after the record
+    and adds the number of lines it spans to line_num, or returns NULL if the record does not
+    end before end.  Blank lines and comments are records without fields. */
+const char *splitRecord(const CSVSyntax &syntax, const char *pos, const char *end,
+                        uint64_t &line_num, vector<CSVField> &fields) {
+    fields.clear();
+    if (pos == end) {
+        return NULL;
+    }
+    if (*pos == '\n' || *pos == '\r') {
+        if (*pos == '\n') {
+            ++line_num;
+            return pos + 1;
+        } else if (pos + 1 == end) {
+            return NULL;
+        } else if (pos[1] == '\n') {
+            ++line_num;
+            return pos + 2;
+        } // else falls through to the error below for a carriage return in the line
+    }
+    const string &comment_prefix(syntax.comment_prefix);
+    if (!comment_prefix.empty()) {
+        size_t compare_bytes = min(comment_prefix.size(), static_cast<size_t>(end - pos));
+        if (memcmp(pos, comment_prefix.data(), compare_bytes) == 0) {
+            const char *newline = static_cast<const char *>(memchr(pos, '\n', end - pos));
+            if (compare_bytes < comment_prefix.size() || newline == NULL) {
+                return NULL;
+            }
+            ++line_num;
+            return newline + 1;
+        }
+    }
+
+    const char *record_start = pos;
+    const string &separator(syntax.field_separator);
+    const char quote = syntax.string_quote_character;
+    uint64_t quoted_newlines = 0;
+    while (true) {
+        if (pos == end) {
+            return NULL;
+        }
+        CSVField field;
+        field.doubled_quotes = false;
+        if (*pos == quote) {
+            // memchr is much faster than looking at each byte for long strings
+            field.begin = ++pos;
+            while (true) {
+                const char *next = static_cast<const char *>(memchr(pos, quote, end - pos));
+                if (next == NULL || next + 1 == end) {
+                    return NULL;
+                }
+                quoted_newlines += count(pos, next, '\n');
+                if (next[1] != quote) {
+                    field.end = next;
+                    pos = next + 1; // skip terminating string quote char
+                    break;
+                }
+                field.doubled_quotes = true;
+                pos = next + 2;
+            }
+        } else {
+            field.begin = pos;
+            for (; true; ++pos) {
+                if (pos == end) {
+                    return NULL;
+                }
+                if (*pos == '\r' || *pos == '\n') {
+                    break;
+                }
+                if (*pos == separator[0]) {
+                    size_t compare_bytes = min(separator.size(), static_cast<size_t>(end - pos));
+                    if (memcmp(pos, separator.data(), compare_bytes) == 0) {
+                        if (compare_bytes < separator.size()) {
+                            return NULL;
+                        }
+                        break;
+                    }
+                }
+            }
+            field.end = pos;
+        }
+        fields.push_back(field);
+
+        if (*pos == '\r') {
+            if (pos + 1 == end) {
+                return NULL;
+            }
+            INVARIANT(pos[1] == '\n',
+                      format("csv line %d has a carriage return not followed by a newline")
+                      % (line_num + quoted_newlines));
+            pos += 2;
+            break;
+        }
+        if (*pos == '\n') {
+            ++pos;
+            break;
+        }
+        size_t compare_bytes = min(separator.size(), static_cast<size_t>(end - pos));
+        INVARIANT(memcmp(pos, separator.data(), compare_bytes) == 0,
+                  format("csv line %d at pos %d is '%c', not a field separator")
+                  % (line_num + quoted_newlines) % (pos - record_start) % *pos);
+        if (compare_bytes < separator.size()) {
+            return NULL;
+        }
+        pos += separator.size();
+    }
+    line_num += 1 + quoted_newlines;
+    return pos;
+}
+
+/** Find the end of the record starting at pos, like splitRecord but only looking at the quotes
+    that start fields and the newline that ends the record, so that the input can be cut into
+    chunks without splitting every record twice.  Returns NULL if the record does not end before
+    end.  Errors in the record are left for splitRecord to report. */
+const char *findRecordEnd(const CSVSyntax &syntax, const char *pos, const char *end) {
+    const string &comment_prefix(syntax.comment_prefix);
+    if (!comment_prefix.empty()) {
+        size_t compare_bytes = min(comment_prefix.size(), static_cast<size_t>(end - pos));
+        if (memcmp(pos, comment_prefix.data(), compare_bytes) == 0) {
+            const char *newline = static_cast<const char *>(memchr(pos, '\n', end - pos));
+            if (compare_bytes < comment_prefix.size() || newline == NULL) {
+                return NULL;
+            }
+            return newline + 1;
+        }
+    }
+
+    const string &separator(syntax.field_separator);
+    const char quote = syntax.string_quote_character;
+    // the start of the last field found, and the first separator at or after it (NULL if
+    // not searched for yet); fields are split at separators as in splitRecord, so that a
+    // separator that overlaps itself or holds a quote cuts the record in the same place
+    const char *field_start = pos, *next_separator = NULL;
+    while (true) {
+        const char *newline = static_cast<const char *>(memchr(pos, '\n', end - pos));
+        if (newline == NULL) {
+            return NULL;
+        }
+        const char *string_start = static_cast<const char *>(memchr(pos, quote, newline - pos));
+        if (string_start == NULL) {
+            return newline + 1;
+        }
+        while (field_start < string_start) {
+            if (next_separator == NULL || next_separator < field_start) {
+                next_separator = search(field_start, newline, separator.begin(), separator.end());
+            }
+            if (next_separator >= string_start) {
+                break;
+            }
+            field_start = next_separator + separator.size();
+        }
+        pos = string_start + 1;
+        if (field_start != string_start) {
+            continue; // a quote anywhere but at the start of a field is an ordinary character
+        }
+        while (true) { // skip the string, which may hold newlines and doubled quotes
+            const char *next = static_cast<const char *>(memchr(pos, quote, end - pos));
+            if (next == NULL || next + 1 == end) {
+                return NULL;
+            }
+            if (next[1] != quote) {
+                pos = next + 1;
+                break;
+            }
+            pos = next + 2;
+        }
+        // splitRecord requires a separator or the end of the line after the string
+        field_start = pos + separator.size();
+        next_separator = NULL;
+    }
+}
+
+bool textEquals(const char *begin, const char *end, const string &str) {
+    return static_cast<size_t>(end - begin) == str.size() && equal(begin, end, str.begin());
+}
+
+/** Converts the text of one csv field into the matching field of the output series, the same
+    way as GeneralField::set(const string &) would, but without going through a GeneralValue */
+class CSVColumn : boost::noncopyable {
+  public:
+    CSVColumn(ExtentSeries &series, const string &name, const CSVSyntax &syntax)
+        : syntax(syntax), type(series.getTypePtr()->getFieldType(name)),
+          nullable(series.getTypePtr()->getNullable(name)), field(NULL)
+    {
+        switch (type) {
+            case ExtentType::ft_bool:
+                field = new BoolField(series, name, Field::flag_nullable);
+                break;
+            case ExtentType::ft_byte:
+                field = new ByteField(series, name, Field::flag_nullable);
+                break;
+            case ExtentType::ft_int32:
+                field = new Int32Field(series, name, Field::flag_nullable);
+                break;
+            case ExtentType::ft_int64:
+                field = new Int64Field(series, name, Field::flag_nullable);
+                break;
+            case ExtentType::ft_double:
+                field = new DoubleField(series, name, DoubleField::flag_nullable
+                                        | DoubleField::flag_allownonzerobase);
+                break;
+            case ExtentType::ft_variable32:
+                field = new Variable32Field(series, name, Field::flag_nullable);
+                break;
+            case ExtentType::ft_fixedwidth: // only nulls can be set, as with GeneralField
+                field = new FixedWidthField(series, name, Field::flag_nullable);
+                break;
+            default:
+                FATAL_ERROR(format("unimplemented type for field %s") % name);
+        }
+    }
+
+    ~CSVColumn() {
+        delete field;
+    }
+
+    /// text is used for the conversions that need a string
+    void set(const char *begin, const char *end, string &text) {
+        if (nullable && textEquals(begin, end, syntax.null_string)) {
+            field->setNull();
+            return;
+        }
+        switch (type) {
+            case ExtentType::ft_bool:
+                static_cast<BoolField *>(field)->set(parseBool(begin, end));
+                break;
+            case ExtentType::ft_byte:
+                text.assign(begin, end);
+                static_cast<ByteField *>(field)->set(stringToInteger<int32_t>(text));
+                break;
+            case ExtentType::ft_int32:
+                text.assign(begin, end);
+                static_cast<Int32Field *>(field)->set(stringToInteger<int32_t>(text));
+                break;
+            case ExtentType::ft_int64:
+                text.assign(begin, end);
+                static_cast<Int64Field *>(field)->set(stringToInteger<int64_t>(text));
+                break;
+            case ExtentType::ft_double:
+                text.assign(begin, end);
+                static_cast<DoubleField *>(field)->set(stringToDouble(text));
+                break;
+            case ExtentType::ft_variable32:
+                if (syntax.hex_encoded_variable32) {
+                    text.assign(begin, end);
+                    static_cast<Variable32Field *>(field)->set(hex2raw(text));
+                } else {
+                    static_cast<Variable32Field *>(field)->set(begin, end - begin);
+                }
+                break;
+            default:
+                FATAL_ERROR("can't set GF_FixedWidth from non-fixedwidth general value");
+        }
+    }
+
+  private:
+    bool parseBool(const char *begin, const char *end) {
+        static const string s_true("true"), s_on("on"), s_yes("yes");
+        static const string s_false("false"), s_off("off"), s_no("no");
+        if (textEquals(begin, end, s_true) || textEquals(begin, end, s_on)
+            || textEquals(begin, end, s_yes)) {
+            return true;
+        } else if (textEquals(begin, end, s_false) || textEquals(begin, end, s_off)
+                   || textEquals(begin, end, s_no)) {
+            return false;
+        } else {
+            FATAL_ERROR(format("Unable to convert string '%s' to boolean, expecting true, on,"
+                               " yes, false, off, or no") % string(begin, end));
+        }
+    }
+
+    const CSVSyntax &syntax;
+    const ExtentType::fieldType type;
+    const bool nullable;
+    Field *field;
+};
+
+/// A run of complete csv records, converted as a unit by one thread
+struct CSVChunk {
+    CSVChunk(uint64_t first_line) : first_line(first_line), converted(false) { }
+
+    string data;
+    uint64_t first_line;
+    vector<Extent::Ptr> extents;
+    bool converted;
+};
+
+/// Keeps the extents written by an OutputModule so they can be written out in order later
+class CollectingSink : public dataseries::IExtentSink {
+  public:
+    virtual ~CollectingSink() { }
+
+    virtual void writeExtent(Extent &e, Stats *to_update) {
+        Extent::Ptr we(new Extent(e.getTypePtr()));
+        we->swap(e);
+        extents.push_back(we);
+    }
+
+    virtual Stats getStats(Stats *from = NULL) {
+        return Stats();
+    }
+
+    virtual void removeStatsUpdate(Stats *would_update) { }
+
+    vector<Extent::Ptr> extents;
+};
+
+/// The state of one conversion thread
+class CSVConverter : boost::noncopyable {
+  public:
+    CSVConverter(const CSVSyntax &syntax, const ExtentType::Ptr &type, int extent_size)
+        : syntax(syntax), series(type), output(sink, series, type, extent_size)
+    {
+        for (uint32_t i = 0; i < type->getNFields(); ++i) {
+            columns.push_back(new CSVColumn(series, type->getFieldName(i), syntax));
+        }
+    }
+
+    ~CSVConverter() {
+        for (vector<CSVColumn *>::iterator i = columns.begin(); i != columns.end(); ++i) {
+            delete *i;
+        }
+    }
+
+    void convert(CSVChunk &chunk) {
+        const char *pos = chunk.data.data();
+        const char *end = pos + chunk.data.size();
+        uint64_t line_num = chunk.first_line;
+        while (pos < end) {
+            uint64_t record_line = line_num;
+            pos = splitRecord(syntax, pos, end, line_num, fields);
+            // findRecordEnd only cuts chunks at the ends of records, unless it was fooled by a
+            // separator that overlaps itself
+            INVARIANT(pos != NULL, format("csv line %d does not end where expected")
+                      % record_line);
+            if (fields.empty()) {
+                continue;
+            }
+            LintelLogDebug("csv2ds::parse", format("line %d:") % record_line);
+            INVARIANT(fields.size() == columns.size(),
+                      format("csv line %d has %d fields, not %d as in type definition")
+                      % record_line % fields.size() % columns.size());
+            output.newRecord();
+            for (size_t i = 0; i < fields.size(); ++i) {
+                const char *begin = fields[i].begin, *end = fields[i].end;
+                if (fields[i].doubled_quotes) {
+                    unquoted.clear();
+                    for (const char *p = begin; p < end; ++p) {
+                        unquoted.push_back(*p);
+                        if (*p == syntax.string_quote_character) {
+                            ++p; // skip the second of the pair
+                        }
+                    }
+                    begin = unquoted.data();
+                    end = begin + unquoted.size();
+                }
+                LintelLogDebug("csv2ds::parse", format("  field %d: %s") % i
+                               % string(begin, end));
+                columns[i]->set(begin, end, text);
+            }
+        }
+        output.flushExtent();
+        chunk.extents.swap(sink.extents);
+        string().swap(chunk.data);
+    }
+
+  private:
+    const CSVSyntax &syntax;
+    ExtentSeries series;
+    CollectingSink sink;
+    OutputModule output;
+    vector<CSVColumn *> columns;
+    vector<CSVField> fields;
+    string unquoted, text;
+};
+
+/** Converts chunks on a set of threads, and writes their extents to the sink in the order the
+    chunks were added */
+class CSVConversion : boost::noncopyable {
+  public:
+    CSVConversion(DataSeriesSink &sink, const CSVSyntax &syntax, const ExtentType::Ptr &type,
+                  int extent_size, unsigned nthreads);
+    ~CSVConversion();
+
+    /// Returns once there are few enough chunks waiting to be converted or written
+    void add(CSVChunk *chunk);
+
+    /// Write out all of the chunks and stop the threads
+    void finish();
+
+    void converterThread(CSVConverter &converter);
+
+  private:
+    void writeFirst(PThreadScopedLock &lock);
+
+    DataSeriesSink &sink;
+    const size_t max_chunks;
+    vector<CSVConverter *> converters;
+    vector<PThread *> threads;
+
+    PThreadMutex mutex;
+    PThreadCond work_cond, converted_cond;
+    Deque<CSVChunk *> to_convert, in_order;
+    bool input_done;
+};
+
+class CSVConverterThread : public PThread {
+  public:
+    CSVConverterThread(CSVConversion &conversion, CSVConverter &converter)
+        : conversion(conversion), converter(converter) { }
+
+    virtual void *run() {
+        conversion.converterThread(converter);
+        return NULL;
+    }
+
+  private:
+    CSVConversion &conversion;
+    CSVConverter &converter;
+};
+
+CSVConversion::CSVConversion(DataSeriesSink &sink, const CSVSyntax &syntax,
+                             const ExtentType::Ptr &type, int extent_size, unsigned nthreads)
+    : sink(sink), max_chunks(2 * nthreads), input_done(false)
+{
+    SINVARIANT(nthreads > 0);
+    for (unsigned i = 0; i < nthreads; ++i) {
+        converters.push_back(new CSVConverter(syntax, type, extent_size));
+    }
+    for (unsigned i = 0; i < nthreads; ++i) {
+        threads.push_back(new CSVConverterThread(*this, *converters[i]));
+        threads.back()->start();
+    }
+}
+
+CSVConversion::~CSVConversion() {
+    SINVARIANT(threads.empty() && in_order.empty());
+    for (vector<CSVConverter *>::iterator i = converters.begin(); i != converters.end(); ++i) {
+        delete *i;
+    }
+}
+
+void CSVConversion::add(CSVChunk *chunk) {
+    PThreadScopedLock lock(mutex);
+    to_convert.push_back(chunk);
+    in_order.push_back(chunk);
+    work_cond.signal();
+    while (!in_order.empty() && (in_order.front()->converted || in_order.size() > max_chunks)) {
+        writeFirst(lock);
+    }
+}
+
+void CSVConversion::finish() {
+    {
+        PThreadScopedLock lock(mutex);
+        input_done = true;
+        work_cond.broadcast();
+        while (!in_order.empty()) {
+            writeFirst(lock);
+        }
+    }
+    for (vector<PThread *>::iterator i = threads.begin(); i != threads.end(); ++i) {
+        (**i).join();
+        delete *i;
+    }
+    threads.clear();
+}
+
+void CSVConversion::writeFirst(PThreadScopedLock &lock) {
+    CSVChunk *chunk = in_order.front();
+    while (!chunk->converted) {
+        converted_cond.wait(mutex);
+    }
+    in_order.pop_front();
+
+    PThreadScopedUnlock unlock(lock);
+    for (vector<Extent::Ptr>::iterator i = chunk->extents.begin();
+         i != chunk->extents.end(); ++i) {
+        sink.writeExtent(**i, NULL);
+    }
+    delete chunk;
+}
+
+void CSVConversion::converterThread(CSVConverter &converter) {
+    PThreadScopedLock lock(mutex);
+    while (true) {
+        if (to_convert.empty()) {
+            if (input_done) {
+                break;
+            }
+            work_cond.wait(mutex);
+            continue;
+        }
+        CSVChunk *chunk = to_convert.front();
+        to_convert.pop_front();
+        {
+            PThreadScopedUnlock unlock(lock);
+            converter.convert(*chunk);
+        }
+        chunk->converted = true;
+        converted_cond.broadcast();
+    }
+}
+
+/** Read the csv input in large blocks, and cut it into chunks of complete records of about
+    chunk_size bytes.  Where the chunks are cut only depends on the input, so the output does not
+    depend on the number of threads. */
+void readChunks(int fd, const string &filename, const CSVSyntax &syntax, size_t chunk_size,
+                CSVConversion &conversion) {
+    string buffer;
+    size_t scanned = 0; // bytes of complete records at the start of buffer
+    uint64_t chunk_line = 1;
+    bool eof = false;
+    while (true) {
+        while (scanned < chunk_size) {
+            const char *record_end = findRecordEnd(syntax, buffer.data() + scanned,
+                                                   buffer.data() + buffer.size());
+            if (record_end == NULL) {
+                break;
+            }
+            scanned = record_end - buffer.data();
+        }
+        if (scanned >= chunk_size || (eof && scanned == buffer.size())) {
+            if (scanned > 0) {
+                CSVChunk *chunk = new CSVChunk(chunk_line);
+                chunk_line += count(buffer.begin(), buffer.begin() + scanned, '\n');
+                chunk->data.swap(buffer);
+                buffer.assign(chunk->data, scanned, string::npos);
+                chunk->data.resize(scanned);
+                conversion.add(chunk);
+                scanned = 0;
+            }
+            if (eof && buffer.empty()) {
+                return;
+            }
+            continue;
+        }
+        INVARIANT(!eof, format("csv line %d ends in middle of string")
+                  % (chunk_line + count(buffer.begin(), buffer.begin() + scanned, '\n')));
+
+        size_t old_size = buffer.size();
+        buffer.resize(old_size + read_size);
+        ssize_t amount = read(fd, &buffer[old_size], read_size);
+        INVARIANT(amount >= 0, format("error reading %s: %s") % filename % strerror(errno));
+        buffer.resize(old_size + amount);
+        if (amount == 0) {
+            eof = true;
+            if (!buffer.empty() && buffer[buffer.size() - 1] != '\n') {
+                buffer.push_back('\n'); // pretend it was always there, could have been EOF :(
+            }
+        }
+    }
 }
 
 const ExtentType::Ptr getXMLDescFromFile(const string &filename, ExtentTypeLibrary &lib) {
@@ -149,16 +752,6 @@ const ExtentType::Ptr getXMLDescFromFile(const string &filename, ExtentTypeLibra
     return lib.registerTypePtr(xml_desc);
 }
 
-void makeFields(const ExtentType::Ptr type, ExtentSeries &series,
-                vector<GeneralField *> &ret, vector<bool> &is_nullable) {
-    ret.reserve(type->getNFields());
-    is_nullable.reserve(type->getNFields());
-    for (uint32_t i = 0; i < type->getNFields(); ++i) {
-        ret.push_back(GeneralField::create(series, type->getFieldName(i)));
-        is_nullable.push_back(type->getNullable(type->getFieldName(i)));
-    }
-}
-
 const ExtentType::Ptr getType(ExtentTypeLibrary &lib) {
     if (po_xml_desc_file.used()) {
         return getXMLDescFromFile(po_xml_desc_file.get(), lib);
@@ -196,133 +789,46 @@ int main(int argc, char *argv[]) {
 
     DataSeriesSink outds(ds_output_filename, packing_args.compress_modes,
                          packing_args.compress_level);
+    outds.setExtentStats(packing_args.extent_stats);
 
     outds.writeExtentLibrary(lib);
-    ExtentSeries series(type);
-    OutputModule *outmodule = new OutputModule(outds, series, type, packing_args.extent_size);
 
-    vector<bool> is_nullable;
-    vector<GeneralField *> fields;
-    makeFields(type, series, fields, is_nullable);
-    istream *csv_input;
+    CSVSyntax syntax;
+    syntax.comment_prefix = po_comment_prefix.get();
+    syntax.string_quote_character = '"';
+    syntax.field_separator = po_field_separator.get();
+    if (prefixequal(syntax.field_separator, "0x")) {
+        INVARIANT(syntax.field_separator.size() >= 4, 
+                  "--field-separator=0x.. needs to be at least 4 characters long");
+        syntax.field_separator = hex2raw(syntax.field_separator.c_str() + 2,
+                                         syntax.field_separator.size() - 2);
+    }
+    INVARIANT(!syntax.field_separator.empty(), "--field-separator can not be empty");
+    syntax.null_string = po_null_string.get();
+    syntax.hex_encoded_variable32 = po_hex_encoded_variable32.get();
 
+    int fd;
     if (csv_input_filename == "-") {
-        csv_input = &cin;
+        fd = 0;
     } else {
-        csv_input = new ifstream(csv_input_filename.c_str());
-    }
-    INVARIANT(csv_input->good(), 
-              format("error opening %s: %s") % csv_input_filename % strerror(errno));
-    string comment_prefix(po_comment_prefix.get());
-    char string_quote_character('"');
-    string field_separator(po_field_separator.get());
-    if (prefixequal(field_separator, "0x")) {
-        INVARIANT(field_separator.size() >= 4, 
-                  "--field-separator=0x.. needs to be at least 4 characters long");
-        field_separator = hex2raw(field_separator.c_str() + 2, field_separator.size() - 2);
+        fd = open(csv_input_filename.c_str(), O_RDONLY);
+    }
+    INVARIANT(fd >= 0, format("error opening %s: %s") % csv_input_filename % strerror(errno));
+
+    INVARIANT(po_threads.get() >= 0 && po_chunk_size.get() >= 0,
+              "--threads and --chunk-size can not be negative");
+    unsigned nthreads = po_threads.get() == 0 ? PThreadMisc::getNCpus() : po_threads.get();
+    size_t chunk_size = po_chunk_size.get();
+    if (chunk_size == 0) {
+        chunk_size = max(min_chunk_size, 2 * static_cast<size_t>(max(packing_args.extent_size, 0)));
     }
 
-    uint64_t line_num = 0;
-    while (!csv_input->eof()) {
-        ++line_num;
-        string line;
-        
-        getline(*csv_input, line);
-        if (line.empty() || (line.size() == 1 && line[0] == '\r')) {
-            continue;
-        }
-        line.push_back('\n'); // pretend it was always there, could have been EOF :(
-
-        INVARIANT(csv_input->good() || csv_input->eof(),
-                  format("error reading %s: %s") % csv_input_filename % strerror(errno));
-        
-        LintelLogDebug("csv2ds::parse", format("line %d:") % line_num);
-        if (!comment_prefix.empty() && prefixequal(line, comment_prefix)) {
-            LintelLogDebug("csv2ds::parse", "  ... comment ...");
-            continue;
-        }
-        vector<string> str_fields;
-
-        size_t pos = 0;
-
-        while (true) {
-            INVARIANT(pos < line.size(), format("csv line %d does not end in newline") % line_num);
-
-            string field;
-            if (line[pos] == string_quote_character) {
-                for (++pos; true; ++pos) {
-                    INVARIANT(pos < line.size(), format("csv line %d ends in middle of string")
-                              % line_num);
-                    if (line[pos] == string_quote_character) {
-                        INVARIANT(pos + 1 < line.size(), 
-                                  format("csv line %d ends in middle of string") % line_num);
-                        if (line[pos + 1] == string_quote_character) {
-                            ++pos;
-                        } else {
-                            ++pos; // skip terminating string quote char
-                            break;
-                        }
-                    }
-                    field.push_back(line[pos]);
-                }
-            } else {
-                for (; true; ++pos) {
-                    INVARIANT(pos < line.size(), format("csv line %d ends in middle of field")
-                              % line_num);
-                    if (line[pos] == '\r' || line[pos] == '\n' 
-                        || line.compare(pos, field_separator.size(), field_separator) == 0) {
-                        break;
-                    }
-                    field.push_back(line[pos]);
-                }
-            }
-
-            LintelLogDebug("csv2ds::parse", format("  field %d: %s") % str_fields.size() % field);
-            str_fields.push_back(field);
-            
-            INVARIANT(pos < line.size(), format("csv line %d does not terminate properly")
-                      % line_num);
-            if (line[pos] == '\r') {
-                INVARIANT(pos + 1 < line.size() && line[pos + 1] == '\n',
-                          format("csv line %d has a carriage return not followed by a newline")
-                          % line_num);
-                SINVARIANT(pos + 2 == line.size());
-                break;
-            }
-            if (line[pos] == '\n') {
-                INVARIANT(pos + 1 == line.size(), format("csv line %d has stuff after newline")
-                          % line_num);
-                break;
-            }
-
-            INVARIANT(pos + field_separator.size() <= line.size() 
-                      && line.compare(pos, field_separator.size(), field_separator) == 0,
-                      format("csv line %d at pos %d is '%c', not a field separator")
-                      % line_num % pos % line[pos]);
-            pos += field_separator.size();
-        }
-
-        INVARIANT(fields.size() == str_fields.size(),
-                  format("csv line %d has %d fields, not %d as in type definition")
-                  % line_num % str_fields.size() % fields.size());
-        outmodule->newRecord();
-        for (size_t i = 0; i < str_fields.size(); ++i) {
-            SINVARIANT(fields[i] != NULL);
-            if (is_nullable[i] && str_fields[i] == po_null_string.get()) {
-                fields[i]->setNull();
-            } else {
-                if (fields[i]->getType() == ExtentType::ft_variable32 
-                    && po_hex_encoded_variable32.get()) {
-                    str_fields[i] = hex2raw(str_fields[i]);
-                }
-                fields[i]->set(str_fields[i]);
-            }
-        }
+    CSVConversion conversion(outds, syntax, type, packing_args.extent_size, nthreads);
+    readChunks(fd, csv_input_filename, syntax, chunk_size, conversion);
+    conversion.finish();
+    if (fd != 0) {
+        CHECKED(close(fd) == 0, format("error closing %s: %s") % csv_input_filename
+                % strerror(errno));
     }
-    
-    delete outmodule;
-    GeneralField::deleteFields(fields);
     return 0;
 }
- 
-    
@@ -97,6 +97,12 @@ to some of the other options.
 Specify an expression to evaluate for each line.  If the expression returns true then print
 out the matching row/record.
 
+=item --threads=I<n>
+
+Format the rows of up to I<n> extents at the same time on separate threads; the output is
+unchanged and in the same order.  Types with a print_format that prints values relative to the
+first one are always formatted in order on the main thread.  Defaults to 1.
+
 =back
 
 =cut
@@ -190,6 +196,8 @@ main(int argc, char *argv[])
                       "--where type needs to be non-empty");
             where_expr_str = argv[3];
             eat_args(2, argc, argv);
+        } else if (strncmp(argv[1],"--threads=",10)==0) {
+            toText.setFormatThreads(stringToInteger<uint32_t>(argv[1] + 10));
         } else if (strncmp(argv[1],"-",1)==0) {
             FATAL_ERROR(format("Unknown argument %s\n") % argv[1]);
         } else {
@@ -208,7 +216,7 @@ main(int argc, char *argv[])
                      //                     "  [--fields=<fields type=\"...\"><field name=\"...\"/></fields>]\n"
                      "  [--skip-index] [--skip-types] [--skip-extent-type]\n"
                      "  [--skip-extent-fieldnames] [--skip-all]\n"
-                     "  [--where '*'|extent-type-match bool-expr]\n"
+                     "  [--where '*'|extent-type-match bool-expr] [--threads=n]\n"
                      "  <file...>\n"
                      "\n%s\n")
               % argv[0] % DSExpr::usage());
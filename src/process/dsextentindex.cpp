@@ -18,7 +18,7 @@ dsextentindex - calculate a min-max extent index over one or more input files
 
 =head1 SYNOPSIS
 
-% dsextentindex [common-args] [--new type-prefix field[,field...]] index.ds input-filename..."
+% dsextentindex [common-args] [--new type-prefix field[,field...] [--bloom field[,field...]]] index.ds input-filename..."
 
 =head1 DESCRIPTION
 
@@ -30,6 +30,12 @@ and update it, only scanning files that have not yet been read.  If index.ds doe
 the --new option is required to tell dsextentindex what extent to index as well as which fields
 to index within that extent.
 
+With --bloom, dsextentindex also records a bloom filter over the values of each of the bloom
+fields for each extent.  The filters find the few extents that may contain a particular value,
+which the minimum and maximum can not do for values such as file handles or addresses that are
+spread across the whole file.  BloomIndexModule uses the filters to read only those extents.  The
+filters are kept when the index is updated; they can only be added to a new index.
+
 =head1 SEE ALSO
 
 dataseries-utils(7)
@@ -47,6 +53,7 @@ dataseries-utils(7)
 #include <Lintel/LintelLog.hpp>
 #include <Lintel/StringUtil.hpp>
 
+#include <DataSeries/BloomIndexModule.hpp>
 #include <DataSeries/commonargs.hpp>
 #include <DataSeries/DataSeriesFile.hpp>
 #include <DataSeries/GeneralField.hpp>
@@ -65,13 +72,16 @@ struct IndexValues {
     int64_t offset;
     vector<GeneralValue> mins, maxs;
     vector<bool> hasnulls;
+    vector<string> blooms;
+    unsigned bloom_hashes;
     int64_t rowcount;
-    IndexValues() : offset(-1), rowcount(0) { }
+    IndexValues() : offset(-1), bloom_hashes(0), rowcount(0) { }
 
     void reset(int64_t o, int64_t r = 0) {
         mins.clear();
         maxs.clear();
         hasnulls.clear();
+        blooms.clear();
 
         rowcount = r;
         offset = o;
@@ -84,10 +94,12 @@ struct IndexValues {
 };
 
 vector<string> fields;
+vector<string> bloom_fields;
 
 static const string str_min("min:");
 static const string str_max("max:");
 static const string str_hasnull("hasnull:");
+static const string str_bloom("bloom:");
 
 vector<ExtentType::fieldType> infieldtypes;
 
@@ -137,11 +149,15 @@ class ModTimesModule : public RowAnalysisModule {
 class MinMaxOutput {
   public:
     MinMaxOutput(const commonPackingArgs &packing_args)
-    : packing_args(packing_args), is_open(false), is_finished(false), type_namespace(NULL)
+    : packing_args(packing_args), bloommodule(NULL), is_open(false), is_finished(false),
+      type_namespace(NULL)
     { }
 
     ~MinMaxOutput() {
         minmaxmodule->flushExtent();
+        if (bloommodule != NULL) {
+            bloommodule->flushExtent();
+        }
 
         if (!is_finished) {
             finish();
@@ -184,6 +200,18 @@ class MinMaxOutput {
         delete minmaxmodule;
         delete minmaxseries;
 
+        if (bloommodule != NULL) {
+            bloommodule->flushExtent();
+            for (vector<Variable32Field *>::iterator i = blooms.begin(); i != blooms.end(); ++i) {
+                delete *i;
+            }
+            delete bloom_hashes;
+            delete bloom_extent_offset;
+            delete bloom_filename;
+            delete bloommodule;
+            delete bloomseries;
+        }
+
         // fsync() and rename
         if (!old_index.empty()) {
             output->close(true);
@@ -246,6 +274,18 @@ class MinMaxOutput {
         DataSeriesSource source(old_index);
         const ExtentType::Ptr type = source.getLibrary().getTypeByNamePtr(minmax_typename);
         updateNamespaceVersions(type);
+
+        // the bloom fields are the ones in the bloom type, if there is one
+        const ExtentType::Ptr bloom_type 
+            = source.getLibrary().getTypeByNamePtr("DSIndex::Extent::Bloom::" + type_prefix, true);
+        if (bloom_type != NULL) {
+            for (unsigned i = 0; i < bloom_type->getNFields(); ++i) {
+                const string &name = bloom_type->getFieldName(i);
+                if (prefixequal(name, str_bloom)) {
+                    bloom_fields.push_back(name.substr(str_bloom.size()));
+                }
+            }
+        }
     }
 
     void add(IndexValues &v) {
@@ -282,6 +322,21 @@ class MinMaxOutput {
             LintelLogDebug("MinMaxOutput", format("  field %1% min '%2%' max '%3%'\n")
                            % fields[i] % v.mins[i] % v.maxs[i]);
         }
+
+        if (bloommodule != NULL) {
+            SINVARIANT(v.blooms.size() == bloom_fields.size());
+            bloommodule->newRecord();
+            bloom_filename->set(v.filename);
+            bloom_extent_offset->set(v.offset);
+            bloom_hashes->set(v.bloom_hashes);
+            for (unsigned i = 0; i < bloom_fields.size(); ++i) {
+                blooms[i]->set(v.blooms[i]);
+            }
+        }
+    }
+
+    bool hasBlooms() {
+        return !bloom_fields.empty();
     }
 
     // defined below
@@ -339,6 +394,27 @@ class MinMaxOutput {
         return minmaxtype_xml;
     }
 
+    // create the DSIndex::Extent::Bloom::* xml string
+    string generateBloomType(const string &type_prefix) {
+        string bloomtype_xml = "<ExtentType";
+        if (type_namespace != NULL) {
+            bloomtype_xml += (format(" namespace=\"%s\" version=\"%d.%d\"")
+                              % *type_namespace % major_version % minor_version).str();
+        }
+        bloomtype_xml += (format(" name=\"DSIndex::Extent::Bloom::%s\">\n") % type_prefix).str();
+        bloomtype_xml += "  <field type=\"variable32\" name=\"filename\" />\n";
+        bloomtype_xml += "  <field type=\"int64\" name=\"extent_offset\" />\n";
+        bloomtype_xml += "  <field type=\"byte\" name=\"hashes\" />\n";
+        for (unsigned i = 0; i < bloom_fields.size(); ++i) {
+            bloomtype_xml += (format("  <field type=\"variable32\" name=\"bloom:%s\" />\n")
+                              % bloom_fields[i]).str();
+        }
+        bloomtype_xml += "</ExtentType>\n";
+
+        LintelLogDebug("MinMaxOutput", boost::format("final BloomXML\n%s\n") % bloomtype_xml);
+        return bloomtype_xml;
+    }
+
     void setFieldList(const string &fieldlist) {
         // write info extents -- one row
         ExtentSeries infoseries(infotype);
@@ -379,6 +455,19 @@ class MinMaxOutput {
         minmaxmodule = new OutputModule(*output, *minmaxseries, minmaxtype,
                                         packing_args.extent_size);
 
+        if (!bloom_fields.empty()) {
+            bloomtype = library.registerTypePtr(generateBloomType(type_prefix));
+            bloomseries = new ExtentSeries(bloomtype);
+            bloom_filename = new Variable32Field(*bloomseries, "filename");
+            bloom_extent_offset = new Int64Field(*bloomseries, "extent_offset");
+            bloom_hashes = new ByteField(*bloomseries, "hashes");
+            for (unsigned i = 0; i < bloom_fields.size(); ++i) {
+                blooms.push_back(new Variable32Field(*bloomseries, str_bloom + bloom_fields[i]));
+            }
+            bloommodule = new OutputModule(*output, *bloomseries, bloomtype,
+                                           packing_args.extent_size);
+        }
+
         output->writeExtentLibrary(library);
 
         setFieldList(fieldlist);
@@ -402,6 +491,15 @@ class MinMaxOutput {
     Int32Field *rowcount;
 
     OutputModule *minmaxmodule;
+
+    ExtentType::Ptr bloomtype;
+    ExtentSeries *bloomseries;
+    Variable32Field *bloom_filename;
+    Int64Field *bloom_extent_offset;
+    ByteField *bloom_hashes;
+    vector<Variable32Field *> blooms;
+    OutputModule *bloommodule;
+
     bool is_open;
     bool is_finished;
     string index_filename, old_index, type_prefix, fieldlist;
@@ -423,10 +521,11 @@ class IndexFileModule : public RowAnalysisModule {
     virtual ~IndexFileModule() {
         // write the final row
         if (iv.offset >= 0) {
-            minMaxOutput->add(iv);
+            addIndexValues();
         }
 
         GeneralField::deleteFields(infields);
+        GeneralField::deleteFields(bloomfields);
     }
 
     void prepareForProcessing() {
@@ -440,6 +539,10 @@ class IndexFileModule : public RowAnalysisModule {
                 SINVARIANT((infieldtypes[i]) == f->getType());
             }
         }
+        for (unsigned i = 0; i < bloom_fields.size(); ++i) {
+            bloomfields.push_back(GeneralField::create(NULL, series, bloom_fields[i]));
+        }
+        bloom_hashes.resize(bloom_fields.size());
 
         // mark the offset of this extent
         iv.offset = series.getExtentRef().extent_source_offset;
@@ -448,7 +551,7 @@ class IndexFileModule : public RowAnalysisModule {
     virtual void newExtentHook(const Extent &e) {
         // if we have an offset, update the file
         if (iv.offset >= 0) {
-            minMaxOutput->add(iv);
+            addIndexValues();
         }
 
         iv.reset(e.extent_source_offset);
@@ -481,11 +584,30 @@ class IndexFileModule : public RowAnalysisModule {
                 iv.hasnulls.push_back(infields[i]->isNull());
             }
         }
+        for (unsigned i = 0; i < bloomfields.size(); ++i) {
+            if (!bloomfields[i]->isNull()) {
+                bloom_hashes[i].push_back(BloomIndexModule::hashValue(GeneralValue(bloomfields[i])));
+            }
+        }
         ++iv.rowcount;
     }
 
   private:
+    void addIndexValues() {
+        iv.bloom_hashes = BloomIndexModule::default_nhashes;
+        for (unsigned i = 0; i < bloom_hashes.size(); ++i) {
+            string filter;
+            BloomIndexModule::makeFilter(bloom_hashes[i], BloomIndexModule::default_bits_per_value,
+                                         BloomIndexModule::default_nhashes, filter);
+            iv.blooms.push_back(filter);
+            bloom_hashes[i].clear();
+        }
+        minMaxOutput->add(iv);
+    }
+
     vector<GeneralField *> infields;
+    vector<GeneralField *> bloomfields;
+    vector<vector<uint64_t> > bloom_hashes;
     IndexValues iv;
     MinMaxOutput *minMaxOutput;
 };
@@ -493,12 +615,15 @@ class IndexFileModule : public RowAnalysisModule {
 
 class OldIndexModule : public DataSeriesModule {
   public:
-    OldIndexModule(DataSeriesModule *source, MinMaxOutput *minMaxOutput,
-                   ModifyTimesT &modify, const vector<string> &files,
+    OldIndexModule(DataSeriesModule *source, DataSeriesModule *bloom_source,
+                   MinMaxOutput *minMaxOutput, ModifyTimesT &modify, const vector<string> &files,
                    ExtentSeries::typeCompatibilityT type_compatibility = ExtentSeries::typeExact)
-            : source(source), minMaxOutput(minMaxOutput), series(type_compatibility),
-              filename(series, "filename"), extent_offset(series, "extent_offset"),
-              rowcount(series, "rowcount"), modify(modify), filePos(0), files(files)
+            : source(source), bloom_source(bloom_source), minMaxOutput(minMaxOutput),
+              series(type_compatibility), filename(series, "filename"),
+              extent_offset(series, "extent_offset"), rowcount(series, "rowcount"),
+              bloom_series(type_compatibility), bloom_filename(bloom_series, "filename"),
+              bloom_extent_offset(bloom_series, "extent_offset"),
+              bloom_hashes(bloom_series, "hashes"), modify(modify), filePos(0), files(files)
     { }
 
     Extent::Ptr getSharedExtent() {
@@ -522,6 +647,9 @@ class OldIndexModule : public DataSeriesModule {
 
   protected:
     bool nextRow() {
+        if (bloom_source != NULL) {
+            nextBloomRow();
+        }
         ++series;
         if (!series.morerecords()) {
             Extent::Ptr e = source->getSharedExtent();
@@ -534,8 +662,22 @@ class OldIndexModule : public DataSeriesModule {
         return true;
     }
 
+    // the bloom rows are written in lockstep with the min/max rows
+    void nextBloomRow() {
+        ++bloom_series;
+        if (!bloom_series.morerecords()) {
+            bloom_series.setExtent(bloom_source->getSharedExtent());
+        }
+    }
+
     void processIndex() {
         // prepare the fields
+        if (bloom_source != NULL) {
+            bloom_series.setExtent(bloom_source->getSharedExtent());
+            for (unsigned i = 0; i < bloom_fields.size(); ++i) {
+                blooms.push_back(new Variable32Field(bloom_series, str_bloom + bloom_fields[i]));
+            }
+        }
         for (unsigned i = 0; i < fields.size(); ++i) {
             GeneralField *f = GeneralField::create(NULL, series,
                                                    str_min + fields[i]);
@@ -585,6 +727,18 @@ class OldIndexModule : public DataSeriesModule {
                                        % fields[i] % iv.mins[i] % iv.maxs[i]);
                     }
 
+                    if (bloom_source != NULL) {
+                        INVARIANT(bloom_series.hasExtent()
+                                  && bloom_filename.equal(iv.filename)
+                                  && bloom_extent_offset.val() == iv.offset,
+                                  format("bloom index out of step with min/max index at %s:%d")
+                                  % iv.filename % iv.offset);
+                        iv.bloom_hashes = bloom_hashes.val();
+                        for (unsigned i = 0; i < blooms.size(); ++i) {
+                            iv.blooms.push_back(blooms[i]->stringval());
+                        }
+                    }
+
                     minMaxOutput->add(iv);
                 } while (nextRow() && curName == filename.stringval());
 
@@ -614,6 +768,9 @@ class OldIndexModule : public DataSeriesModule {
         for (vector<BoolField *>::iterator i = hasnulls.begin(); i != hasnulls.end(); ++i) {
             delete *i;
         }
+        for (vector<Variable32Field *>::iterator i = blooms.begin(); i != blooms.end(); ++i) {
+            delete *i;
+        }
     }
 
     void processFile(const std::string &file, int64_t modify_time) {
@@ -631,7 +788,7 @@ class OldIndexModule : public DataSeriesModule {
     }
 
   private:
-    DataSeriesModule *source;
+    DataSeriesModule *source, *bloom_source;
     MinMaxOutput *minMaxOutput;
     ExtentSeries series;
     Variable32Field filename;
@@ -640,6 +797,12 @@ class OldIndexModule : public DataSeriesModule {
     vector<GeneralField *> mins, maxs;
     vector<BoolField *> hasnulls;
 
+    ExtentSeries bloom_series;
+    Variable32Field bloom_filename;
+    Int64Field bloom_extent_offset;
+    ByteField bloom_hashes;
+    vector<Variable32Field *> blooms;
+
     ModifyTimesT &modify;
     string curName;
     unsigned int filePos;
@@ -660,18 +823,26 @@ void MinMaxOutput::indexFiles(const vector<string> &files) {
     // merge with the old index (if it exists)
     string minmax_typename("DSIndex::Extent::MinMax::");
     minmax_typename.append(type_prefix);
-    TypeIndexModule *source = NULL;
+    TypeIndexModule *source = NULL, *bloom_source = NULL;
     if (!old_index.empty()) {
         source = new TypeIndexModule(minmax_typename);
         source->addSource(old_index);
+        if (hasBlooms()) {
+            bloom_source = new TypeIndexModule("DSIndex::Extent::Bloom::" + type_prefix);
+            bloom_source->addSource(old_index);
+        }
     }
 
-    OldIndexModule old(source, this, modify, files);
+    OldIndexModule old(source, bloom_source, this, modify, files);
     old.getAndDeleteShared();
     if (source != NULL) {
         source->close();
         delete source;
     }
+    if (bloom_source != NULL) {
+        bloom_source->close();
+        delete bloom_source;
+    }
 }
 
 
@@ -685,7 +856,7 @@ int main(int argc, char *argv[]) {
 
     INVARIANT(argc >= 3, 
               format("Usage: %s <common-args>"
-                     " [--new type-prefix field,field,field,...]"
+                     " [--new type-prefix field,field,field,... [--bloom field,field,...]]"
                      " index-dataseries input-filename...") % argv[0]);
     int files_start= -1;
     const char *index_filename = NULL;
@@ -695,8 +866,14 @@ int main(int argc, char *argv[]) {
         string fieldlist = argv[3];
         
         split(fieldlist,",",fields);
-        files_start = 5;
-        index_filename = argv[4];
+        int index_pos = 4;
+        if (strcmp(argv[4], "--bloom") == 0) {
+            INVARIANT(argc > 7, "--bloom needs more arguments");
+            split(argv[5], ",", bloom_fields);
+            index_pos = 6;
+        }
+        files_start = index_pos + 1;
+        index_filename = argv[index_pos];
         struct stat statbuf;
         int ret = stat(index_filename,&statbuf);
         INVARIANT(ret == -1 && errno == ENOENT,
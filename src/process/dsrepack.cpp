@@ -273,6 +273,7 @@ void writeRepackInfo(DataSeriesSink &sink, const commonPackingArgs &cpa, int fil
 bool skipType(const ExtentType::Ptr type) {
     return type->getName() == "DataSeries: ExtentIndex"
             || type->getName() == "DataSeries: XmlType"
+            || type->getName() == "DataSeries: ExtentStats"
             || (type->getName() == "Info::DSRepack"
                 && type->getNamespace() == "ssd.hpl.hp.com");
 }
@@ -359,6 +360,7 @@ int main(int argc, char *argv[]) {
     DataSeriesSink *output = 
             new DataSeriesSink(output_path, packing_args.compress_modes,
                                packing_args.compress_level);
+    output->setExtentStats(packing_args.extent_stats);
 
     uint32_t extent_count = 0;
     for (int i = 1; i < (argc-1); ++i) {
@@ -479,6 +481,7 @@ int main(int argc, char *argv[]) {
                             new DataSeriesSink(output_path, 
                                                packing_args.compress_modes,
                                                packing_args.compress_level);
+                    new_output->setExtentStats(packing_args.extent_stats);
                     new_output->writeExtentLibrary(library);
                    
                     for (map<string, PerTypeWork *>::iterator i = per_type_work.begin();
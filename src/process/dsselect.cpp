@@ -43,6 +43,8 @@ dataseries-utils(7)
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <boost/scoped_ptr.hpp>
+
 #include <Lintel/AssertBoost.hpp>
 #include <Lintel/ProgramOptions.hpp>
 #include <Lintel/StringUtil.hpp>
@@ -50,6 +52,7 @@ dataseries-utils(7)
 #include <DataSeries/commonargs.hpp>
 #include <DataSeries/DataSeriesFile.hpp>
 #include <DataSeries/DSExpr.hpp>
+#include <DataSeries/ExtentCopyPlan.hpp>
 #include <DataSeries/GeneralField.hpp>
 #include <DataSeries/DataSeriesModule.hpp>
 #include <DataSeries/TypeIndexModule.hpp>
@@ -105,6 +108,7 @@ int main(int argc, char *argv[]) {
     }
     DataSeriesSink output(extra_args.back(), packing_args.compress_modes, 
                           packing_args.compress_level);
+    output.setExtentStats(packing_args.extent_stats);
 
     // to get the complete typename and type information...
     DataSeriesSource first_file(extra_args[2]);
@@ -117,6 +121,9 @@ int main(int argc, char *argv[]) {
     for (unsigned i=2; i < (extra_args.size()-1); ++i) {
         source.addSource(extra_args[i]);
     }
+    if (where_arg.used()) {
+        source.setPredicate(where_arg.get());
+    }
     source.startPrefetching();
 
     ExtentSeries inputseries(ExtentSeries::typeLoose);
@@ -172,9 +179,11 @@ int main(int argc, char *argv[]) {
     const ExtentType::Ptr outputtype(library.registerTypePtr(xmloutdesc));
     output.writeExtentLibrary(library);
     outputseries.setType(outputtype);
+    ExtentCopyPlan::FieldPairs copy_fields;
     for (vector<string>::iterator i = fields.begin();
         i != fields.end();++i) {
         outfields.push_back(GeneralField::create(NULL,outputseries,*i));
+        copy_fields.push_back(make_pair(*i, *i));
     }
     DSExpr *where = NULL;
     if (where_arg.used()) {
@@ -185,17 +194,38 @@ int main(int argc, char *argv[]) {
     OutputModule outmodule(output,outputseries,outputtype,
                            packing_args.extent_size);
     uint64_t input_row_count = 0, output_row_count = 0;
+    DSExpr::Selection selected;
+    // the input files can have different versions of the type, so the plan is remade whenever
+    // the type changes; NULL if the fields need the conversions done by GeneralField
+    ExtentType::Ptr copy_plan_type;
+    boost::scoped_ptr<ExtentCopyPlan> copy_plan;
     while (true) {
         Extent::Ptr inextent = source.getSharedExtent();
         if (inextent == NULL) 
             break;
-        for (inputseries.setExtent(inextent);inputseries.morerecords(); ++inputseries) {
+        inputseries.setExtent(inextent);
+        if (inextent->getTypePtr() != copy_plan_type) {
+            copy_plan_type = inextent->getTypePtr();
+            copy_plan.reset(new ExtentCopyPlan(copy_plan_type, outputtype, copy_fields));
+            if (!copy_plan->supported()) {
+                copy_plan.reset();
+            }
+        }
+        if (where) {
+            where->selectRows(inputseries, selected);
+        }
+        for (size_t row = 0; inputseries.morerecords(); ++inputseries, ++row) {
             ++input_row_count;
-            if (where && !where->valBool()) {
+            if (where && !selected[row]) {
                 continue;
             }
             ++output_row_count;
             outmodule.newRecord();
+            if (copy_plan != NULL) {
+                copy_plan->copyRow(*inextent, inputseries.getRowOffset(),
+                                   outputseries.getExtentRef(), outputseries.getRowOffset());
+                continue;
+            }
             for (unsigned int i=0;i<infields.size();++i) {
                 outfields[i]->set(infields[i]);
             }
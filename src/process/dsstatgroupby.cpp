@@ -14,13 +14,14 @@ dsstatgroupby - Calculate some derived value from a dataseries and calculate a s
 
 =head1 SYNOPSIS
 
-% dsstatgroupby I<extent-type-match> I<statistic-description>... from file...
+% dsstatgroupby [--threads=I<n>] I<extent-type-match> I<statistic-description>... from file...
 
 =head1 STATISTIC DESCRIPTION
 
 Each statistic is described by a minimum of two arguments -- the statistic type and the expression.
-Two types of statistic types are currently implemented basic (mean, stddev, min, max), and quantile
-(percentile/100).  The expression implements the standard + - * / () and constants.  Two optional
+Three types of statistic types are currently implemented basic (mean, stddev, min, max), quantile
+(percentile/100), and approx-quantile (selected percentiles to within 1%, using a fixed amount of
+memory for each group).  The expression implements the standard + - * / () and constants.  Two optional
 arguments can be added.  where I<expr> adds in a conditional expression so you could calculate
 separate statistics over large and small files.  group by <field> specifies a column that should be
 used for grouping the statistics.
@@ -30,10 +31,23 @@ used for grouping the statistics.
 dsstatgroupby processes one or more input files calculating multiple statistics in a single pass
 over that input file.
 
+=head1 OPTIONS
+
+=over 4
+
+=item --threads=I<n>
+
+Calculate each basic and approx-quantile statistic with I<n> threads, each of which handles
+some of the extents; quantile statistics always use one thread.  Defaults to 1.
+
+=back
+
 */
 
 #include <boost/format.hpp>
 
+#include <Lintel/StringUtil.hpp>
+
 #include <DataSeries/DSStatGroupByModule.hpp>
 #include <DataSeries/TypeIndexModule.hpp>
 #include <DataSeries/PrefetchBufferModule.hpp>
@@ -48,11 +62,11 @@ usage(const std::string &program_name, const std::string &error)
     // TODO: should we make the usage ... from <prefix> in <file...>?
     cerr << error << "\n"
          << "Usage: " << program_name 
-         << " <extent-type-match> (<stat-type> <expr> [where <expr>] [group by <group-by>])+\n"
-         << "  from file...\n"
+         << " [--threads=n] <extent-type-match>\n"
+         << "  (<stat-type> <expr> [where <expr>] [group by <group-by>])+ from file...\n"
          << "\n"
          << "  stat-types include:\n\n"
-         << "    basic, quantile\n\n"
+         << "    basic, quantile, approx-quantile\n\n"
          << DSExpr::usage();
     exit(0);
 }
@@ -67,7 +81,15 @@ main(int argc, char *_argv[])
     for (int i=0; i<argc; ++i) {
         argv.push_back(string(_argv[i]));
     }
-    if (argc <= 5) usage(argv[0], "insufficient arguments");
+    unsigned nthreads = 1;
+    while (argv.size() > 1 && argv[1].compare(0, 10, "--threads=") == 0) {
+        nthreads = stringToInteger<uint32_t>(argv[1].substr(10));
+        if (nthreads == 0) {
+            usage(argv[0], "--threads needs at least one thread");
+        }
+        argv.erase(argv.begin() + 1);
+    }
+    if (argv.size() <= 5) usage(argv[0], "insufficient arguments");
 
     string extent_type_match(argv[1]);
     
@@ -106,8 +128,8 @@ main(int argc, char *_argv[])
             argpos += 3;
         }
 
-        seq.addModule(new DSStatGroupByModule(seq.tail(), expr, group_by, 
-                                              stat_type, where_expr));
+        seq.addModule(new DSStatGroupByModule(seq.tail(), expr, group_by, stat_type, where_expr,
+                                              ExtentSeries::typeExact, nthreads));
     }
 
     if (argpos >= argv.size() || argv[argpos] != "from") {
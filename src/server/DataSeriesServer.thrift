@@ -11,10 +11,32 @@ struct NullableString {
     1: optional string v;
 }
 
+// How getTableData and fetchRows return the values of the rows
+enum DataEncoding {
+    DE_InvalidEnumConst = 0,
+    DE_Strings = 1, // in TableData.rows, each value formatted as a string
+    DE_Columns = 2  // in TableData.column_data, each column as a list of typed values
+}
+
+// The values of one column of a DE_Columns batch, one per row.  Only the list for the column's
+// type is set: bool_values for bool, byte_values for byte, i32_values for int32, i64_values for
+// int64, double_values for double, and the raw bytes in string_values for variable32 and
+// fixedwidth.  nulls is set for nullable columns; the value of a null row is 0, false or empty.
+struct ColumnData {
+    1: optional list<bool> nulls;
+    2: optional list<bool> bool_values;
+    3: optional list<byte> byte_values;
+    4: optional list<i32> i32_values;
+    5: optional list<i64> i64_values;
+    6: optional list<double> double_values;
+    7: optional list<string> string_values;
+}
+
 struct TableData {
-    1: required list<list<NullableString>> rows;
+    1: required list<list<NullableString>> rows; // DE_Strings
     2: optional list<TableColumn> columns;
     3: optional bool more_rows;
+    4: optional list<ColumnData> column_data; // DE_Columns, in the order of columns
 }
 
 struct Dimension {
@@ -69,6 +91,39 @@ struct ExprColumn {
     3: required string expr;
 }
 
+enum PlanOp {
+    PO_InvalidEnumConst = 0;
+    PO_SelectRows = 1;
+    PO_ProjectTable = 2;
+    PO_TransformTable = 3;
+    PO_HashJoin = 4;
+    PO_StarJoin = 5;
+    PO_UnionTables = 6;
+    PO_SortTable = 7;
+}
+
+// One step of a plan.  The arguments are those of the call of the same name; only the ones for
+// op are used.  Input tables can be existing tables or the out_table of an earlier step.
+struct PlanStep {
+    1: required PlanOp op;
+    2: required string out_table;
+    3: optional string in_table; // select, project, transform, sort
+    4: optional string where_expr; // select
+    5: optional list<string> keep_columns; // project
+    6: optional list<ExprColumn> expr_columns; // transform
+    7: optional string a_table; // hash join
+    8: optional string b_table;
+    9: optional map<string, string> eq_columns;
+    10: optional map<string, string> join_keep_columns; // keep_columns of the hash join
+    11: optional i32 max_a_rows = 1000000;
+    12: optional string fact_table; // star join
+    13: optional list<Dimension> dimensions;
+    14: optional map<string, string> fact_columns;
+    15: optional list<DimensionFactJoin> dimension_fact_join;
+    16: optional list<UnionTable> union_tables; // union
+    17: optional list<SortColumn> sort_columns; // order_columns of the union, by of the sort
+}
+
 service DataSeriesServer {
     void ping();
     void shutdown();
@@ -83,10 +138,27 @@ service DataSeriesServer {
 
     void mergeTables(list<string> source_tables, string dest_table);
 
-    TableData getTableData(string source_table, i32 max_rows = 1000000, string where_expr = '');
+    TableData getTableData(string source_table, i32 max_rows = 1000000, string where_expr = '',
+                           DataEncoding encoding = DE_Strings);
+
+    // Cursors return the rows of a table in batches rather than in one response.  openCursor
+    // returns the id of a cursor over the rows of source_table that match where_expr, and each
+    // fetchRows returns the next max_rows of them, with more_rows false in the last batch.  The
+    // cursor is closed once it has returned its last row; closeCursor stops one early, and does
+    // nothing for a cursor that is already closed.  An open cursor holds a read lock on its
+    // table, so writes to the table wait until it is closed; cursors unused for the server's
+    // --cursor-timeout seconds are closed.
+    i64 openCursor(string source_table, string where_expr = '',
+                   DataEncoding encoding = DE_Strings);
+    TableData fetchRows(i64 cursor, i32 max_rows = 10000);
+    void closeCursor(i64 cursor);
 
     // Table a will be loaded into memory; join will be on all column pairs in eq_columns
-    // keep columns sources a.<name> or b.<name> will be mapped to the dest name.
+    // keep columns sources a.<name> or b.<name> will be mapped to the dest name.  At most
+    // max_a_rows rows of a are held in memory; if a is larger, both tables are partitioned on
+    // the join key into temporary files in the working directory and joined a partition at a
+    // time, so the output order differs from the in-memory join.  Both tables are read using the
+    // server's --join-threads threads.
 
     // eq_columns contains the name of columns to be compared and keep_columns keys specfies the
     // columns which will be copied with value as destination column name. e.g.
@@ -131,6 +203,9 @@ service DataSeriesServer {
     // order_columns are from the output names; All output names must share 
     void unionTables(list<UnionTable> in_tables, list<SortColumn> order_columns, string out_table);
 
+    // The sort is stable.  Once the server's --sort-memory-mb of the table has been read, the
+    // sorted rows are spilled to temporary files in the working directory and merged at the end,
+    // so tables larger than memory can be sorted.
     void sortTable(string in_table, string out_table, list<SortColumn> by);
 
     // Replace base table with a merge between base_table and update_from.  The tables are
@@ -149,6 +224,13 @@ service DataSeriesServer {
     //    If base_table.row > update_table.row, advance update_from
     void sortedUpdateTable(string base_table, string update_from, string update_column,
                            list<string> primary_key);
+
+    // Run the steps in order as one pipeline.  The rows of a step's output stream straight into
+    // the step that uses it rather than being written to a table and read back; only the outputs
+    // named in output_tables are stored as tables.  An output used by more than one later step
+    // is written once, uncompressed, to a temporary file that is removed when the plan is done.
+    // Every step's output has to be used by a later step or be in output_tables.
+    void runPlan(list<PlanStep> steps, list<string> output_tables);
 }
 
 exception InvalidTableName {
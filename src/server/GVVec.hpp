@@ -49,7 +49,7 @@ struct GVVec {
     }
 };
 
-inline std::ostream & operator << (std::ostream &to, GVVec &gvvec) {
+inline std::ostream & operator << (std::ostream &to, const GVVec &gvvec) {
     gvvec.print(to);
     return to;
 }
@@ -1,20 +1,150 @@
+#include <unistd.h>
+
+#include <deque>
+
+#include <boost/bind.hpp>
+
+#include <Lintel/HashFns.hpp>
+
+#include <DataSeries/TypeIndexModule.hpp>
+
 #include "ServerModules.hpp"
 #include "DSSModule.hpp"
 #include "JoinModule.hpp"
 
 // TODO: merge common code with StarJoinModule
 
+// At most max_a_rows rows of the a table are held in memory.  If the a table is larger, the join
+// becomes a hybrid hash join: rows are split into partition_fanout partitions by a hash of the
+// join key; partition 0 stays in memory and the others are spilled to temporary files in the
+// working directory, as are the b rows that fall into them.  Once the b input is done, each pair of
+// spilled partitions is joined in turn, partitioning again with a different hash if the a rows
+// still don't fit.  If partition 0 also overflows it is spilled as well.
+//
+// With more than one thread, the rows held in memory are split into radix partitions by the top
+// bits of the key hash, each with its own hash table.  The a rows are read in batches of extents;
+// the threads first hash the rows of the batch, extent by extent, then build the tables, each
+// table by one thread.  The b extents are also read in batches and probed in parallel, each
+// thread producing the output extent for one b extent, and the outputs are returned in the order
+// of the b extents.  Once a level starts spilling, the rest of it is built and probed by the
+// calling thread, since the rows have to be written to the spill files in order.
+
 class HashJoinModule : public JoinModule { 
   public:
     typedef map<string, string> CMap; // column map
 
+    static const uint32_t partition_fanout = 8;
+    // a key with more than max_a_rows rows will never fit; give up on it at this depth
+    static const uint32_t max_partition_level = 6;
+    // radix partitions per thread, so that threads that finish early can take another
+    static const uint32_t radix_partitions_per_thread = 4;
+    // extents per thread read at once when building or probing in parallel
+    static const uint32_t batch_extents_per_thread = 2;
+
     HashJoinModule(DataSeriesModule &a_input, int32_t max_a_rows, DataSeriesModule &b_input,
                    const map<string, string> &eq_columns, const map<string, string> &keep_columns,
-                   const string &output_table_name) 
+                   const string &output_table_name, uint32_t nthreads) 
             : a_input(a_input), b_input(b_input), max_a_rows(max_a_rows), 
               eq_columns(eq_columns), keep_columns(keep_columns), 
-              output_table_name(output_table_name)
-    { }
+              output_table_name(output_table_name), nthreads(max(nthreads, 1U)), radix_bits(0),
+              probe_input(&b_input), probe_done(false), cur_level(0), memory_partition(true),
+              spill_count(0)
+    { 
+        while (this->nthreads > 1
+               && (1U << radix_bits) < this->nthreads * radix_partitions_per_thread) {
+            ++radix_bits;
+        }
+    }
+
+    virtual ~HashJoinModule() {
+        // only left over if we stopped early, e.g. on an error
+        closeSpills(false);
+        BOOST_FOREACH(Partition &p, pending) {
+            p.remove();
+        }
+        partition_b_input.reset();
+        cur_partition.remove();
+    }
+
+    // One partition of spilled rows, in a temporary DataSeries file
+    struct SpillFile {
+        typedef boost::shared_ptr<SpillFile> Ptr;
+
+        SpillFile(const string &path, const ExtentType::Ptr type)
+            : path(path), sink(path, Extent::compression_algs[Extent::compress_mode_lzf].compress_flag, 1),
+              series(type), output(sink, series, type, 96*1024), rows(0) {
+            ExtentTypeLibrary library;
+            library.registerType(type);
+            sink.writeExtentLibrary(library);
+        }
+
+        void close() {
+            output.close();
+            sink.close();
+        }
+
+        const string path;
+        DataSeriesSink sink;
+        ExtentSeries series;
+        OutputModule output;
+        vector<GeneralField::Ptr> key_fields, val_fields; // a spills
+        boost::scoped_ptr<ExtentRecordCopy> copier; // b spills
+        int64_t rows;
+    };
+
+    // A pair of spilled a and b partitions that remain to be joined
+    struct Partition {
+        Partition() : level(0) { }
+        Partition(const string &a_path, const string &b_path, uint32_t level)
+            : a_path(a_path), b_path(b_path), level(level) { }
+
+        void remove() {
+            if (!a_path.empty()) {
+                unlink(a_path.c_str());
+                unlink(b_path.c_str());
+            }
+            a_path.clear();
+            b_path.clear();
+        }
+
+        string a_path, b_path;
+        uint32_t level;
+    };
+
+    // An output column, from one of the a values, or from a b field
+    struct OutputColumn {
+        OutputColumn(const string &into, int32_t a_val_pos, const string &b_field)
+            : into(into), a_val_pos(a_val_pos), b_field(b_field) { }
+
+        string into;
+        int32_t a_val_pos; // -1 if from b_field
+        string b_field;
+    };
+
+    // A thread's fields for building from a batch of extents
+    struct BuildWorker {
+        typedef boost::shared_ptr<BuildWorker> Ptr;
+
+        ExtentSeries series;
+        vector<GeneralField::Ptr> eq_fields, val_fields;
+        vector<uint8_t> key_buf;
+    };
+
+    // A thread's fields for probing with a batch of b extents
+    struct ProbeWorker {
+        typedef boost::shared_ptr<ProbeWorker> Ptr;
+
+        ExtentSeries b_series, output_series;
+        vector<GeneralField::Ptr> b_eq_fields;
+        vector<Extractor::Ptr> extractors;
+        vector<uint8_t> key_buf;
+    };
+
+    // A row of a build batch; the rows of each extent are bucketed by radix partition
+    struct BuildRow {
+        const void *pos;
+        uint32_t hash;
+    };
 
     static const string mapDGet(const map<string, string> &a_map, const string &a_key) {
         map<string, string>::const_iterator i = a_map.find(a_key);
@@ -23,8 +153,6 @@ class HashJoinModule : public JoinModule {
     }
 
     void firstExtent(const Extent &b_e) {
-        ExtentSeries a_series;
-
         a_series.setExtent(a_input.getSharedExtent());
         b_series.setType(b_e.getTypePtr());
         if (a_series.getSharedExtent() == NULL) {
@@ -33,24 +161,22 @@ class HashJoinModule : public JoinModule {
 
         // Three possible sources for values in the output:
         // 
-        // 1) the a value fields, so from the hash-map
+        // 1) the a value fields, so from the hash table
         // 2a) the b fields, as one of the a eq fields.
         // 2b) the b fields, as one of the b values or eq fields
         // 
         // We do not try to optimize the extraction and just create a new general field for each
-        // extraction so if the hash-map has duplicate columns, there will be duplicate fields.
-        vector<GeneralField::Ptr> a_eq_fields;
+        // extraction so if the hash table has duplicate columns, there will be duplicate fields.
         HashUnique<string> known_a_eq_fields;
 
         BOOST_FOREACH(const CMap::value_type &vt, eq_columns) {
-            SINVARIANT(a_series.getTypePtr()->getFieldType(vt.first)
-                       == b_series.getTypePtr()->getFieldType(vt.second));
             a_eq_fields.push_back(GeneralField::make(a_series, vt.first));
             b_eq_fields.push_back(GeneralField::make(b_series, vt.second));
             known_a_eq_fields.add(vt.first);
+            a_eq_names.push_back(vt.first);
+            b_eq_names.push_back(vt.second);
         }
 
-        vector<GeneralField::Ptr> a_val_fields;
         HashMap<string, uint32_t> a_name_to_val_pos;
 
         BOOST_FOREACH(const CMap::value_type &vt, keep_columns) {
@@ -60,6 +186,7 @@ class HashJoinModule : public JoinModule {
                     // access from the b eq fields
                     a_name_to_val_pos[field_name] = a_val_fields.size();
                     a_val_fields.push_back(GeneralField::make(a_series, field_name));
+                    a_val_names.push_back(field_name);
                 }
             }
         }
@@ -74,20 +201,18 @@ class HashJoinModule : public JoinModule {
             if (prefixequal(vt.first, "a.") && a_name_to_val_pos.exists(field_name)) { // case 1
                 TINVARIANT(a_series.getTypePtr()->hasColumn(field_name));
                 output_field_xml = renameField(a_series.getTypePtr(), field_name, vt.second);
-                extractors.push_back
-                        (ExtractorValue::make(vt.second, a_name_to_val_pos[field_name]));
+                output_columns.push_back
+                        (OutputColumn(vt.second, a_name_to_val_pos[field_name], ""));
             } else if (prefixequal(vt.first, "a.") 
                        && eq_columns.find(field_name) != eq_columns.end()) { // case 2a
                 const string b_field_name(eq_columns.find(field_name)->second);
                 TINVARIANT(b_series.getTypePtr()->hasColumn(b_field_name));
                 output_field_xml = renameField(a_series.getTypePtr(), field_name, vt.second);
-                GeneralField::Ptr b_field(GeneralField::make(b_series, b_field_name));
-                extractors.push_back(ExtractorField::make(vt.second, b_field));
+                output_columns.push_back(OutputColumn(vt.second, -1, b_field_name));
             } else if (prefixequal(vt.first, "b.")
                        && b_series.getTypePtr()->hasColumn(field_name)) { // case 2b
                 output_field_xml = renameField(b_series.getTypePtr(), field_name, vt.second);
-                GeneralField::Ptr b_field(GeneralField::make(b_series, field_name));
-                extractors.push_back(ExtractorField::make(vt.second, b_field));
+                output_columns.push_back(OutputColumn(vt.second, -1, field_name));
             } else {
                 requestError("invalid extraction");
             }
@@ -96,45 +221,371 @@ class HashJoinModule : public JoinModule {
 
         output_xml.append("</ExtentType>\n");
                     
-        INVARIANT(!extractors.empty(), "must extract at least one field");
-        int32_t row_count = 0;
-        key.resize(a_eq_fields.size());
-        GVVec val;
-        val.resize(a_val_fields.size());
-        while (1) {
-            if (a_series.getSharedExtent() == NULL) {
-                break;
-            }
-            for (; a_series.more(); a_series.next()) {
-                ++row_count;
-
-                if (row_count >= max_a_rows) {
-                    requestError("a table has too many rows");
-                }
-                key.extract(a_eq_fields);
-                val.extract(a_val_fields);
-                a_hashmap[key].push_back(val);
-            }
-            a_series.setExtent(a_input.getSharedExtent());
+        INVARIANT(!output_columns.empty(), "must extract at least one field");
+        if (max_a_rows <= 0) {
+            requestError("max_a_rows must be > 0");
+        }
+        for (uint32_t i = 0; i < (1U << radix_bits); ++i) {
+            a_tables.push_back(boost::shared_ptr<JoinHashTable>
+                               (new JoinHashTable(a_eq_fields, a_val_fields)));
+        }
+        if (!a_tables[0]->matchesKey(b_eq_fields)) {
+            requestError("b equality columns do not match the types of the a equality columns");
         }
 
         ExtentTypeLibrary lib;
         LintelLog::info(format("output xml: %s") % output_xml);
         output_series.setType(lib.registerTypePtr(output_xml));
         
+        makeExtractors(b_series, extractors);
         Extractor::makeInto(extractors, output_series);
+        for (uint32_t i = 0; nthreads > 1 && i < nthreads; ++i) {
+            ProbeWorker::Ptr w(new ProbeWorker());
+            w->b_series.setType(b_series.getTypePtr());
+            w->output_series.setType(output_series.getTypePtr());
+            BOOST_FOREACH(const string &name, b_eq_names) {
+                w->b_eq_fields.push_back(GeneralField::make(w->b_series, name));
+            }
+            makeExtractors(w->b_series, w->extractors);
+            Extractor::makeInto(w->extractors, w->output_series);
+            probe_workers.push_back(w);
+        }
+
+        build(a_input, a_series, a_eq_fields, a_val_fields, a_eq_names, a_val_names);
+    }
+
+    void makeExtractors(ExtentSeries &from_b, vector<Extractor::Ptr> &into) {
+        BOOST_FOREACH(const OutputColumn &c, output_columns) {
+            if (c.a_val_pos >= 0) {
+                into.push_back(ExtractorValue::make(c.into, c.a_val_pos));
+            } else {
+                into.push_back(ExtractorField::make(c.into, GeneralField::make(from_b, c.b_field)));
+            }
+        }
+    }
+
+    // The a rows are spilled as just the key and the values we keep
+    void makeSpillType() {
+        string spill_xml(str(format("<ExtentType name=\"hash-join spill -> %s\""
+                                    " namespace=\"server.example.com\" version=\"1.0\">\n")
+                             % output_table_name));
+        for (size_t i = 0; i < a_eq_names.size(); ++i) {
+            spill_xml.append(renameField(a_series.getTypePtr(), a_eq_names[i],
+                                         str(format("key:%d") % i)));
+        }
+        for (size_t i = 0; i < a_val_names.size(); ++i) {
+            spill_xml.append(renameField(a_series.getTypePtr(), a_val_names[i],
+                                         str(format("val:%d") % i)));
+        }
+        spill_xml.append("</ExtentType>\n");
+
+        ExtentTypeLibrary lib;
+        spill_type = lib.registerTypePtr(spill_xml);
+        for (size_t i = 0; i < a_eq_names.size(); ++i) {
+            spill_eq_names.push_back(str(format("key:%d") % i));
+        }
+        for (size_t i = 0; i < a_val_names.size(); ++i) {
+            spill_val_names.push_back(str(format("val:%d") % i));
+        }
+        spill_series.setType(spill_type);
+        makeFields(spill_series, spill_eq_names, spill_eq_fields);
+        makeFields(spill_series, spill_val_names, spill_val_fields);
+    }
+
+    static void makeFields(ExtentSeries &series, const vector<string> &names,
+                           vector<GeneralField::Ptr> &fields) {
+        BOOST_FOREACH(const string &name, names) {
+            fields.push_back(GeneralField::make(series, name));
+        }
+    }
+
+    uint32_t radix(uint32_t key_hash) {
+        return radix_bits == 0 ? 0 : key_hash >> (32 - radix_bits);
+    }
+
+    uint32_t partition(uint32_t key_hash) {
+        return lintel::BobJenkinsHashMix3(key_hash, cur_level, 1972) % partition_fanout;
+    }
+
+    bool spilled(uint32_t partition) {
+        return !a_spills.empty() && (partition != 0 || !memory_partition);
+    }
+
+    string spillPath(const char *side) {
+        return str(format("tmp.hash-join.%s.%d.%s") % output_table_name % spill_count % side);
+    }
+
+    // load the a rows of the current level into the hash tables, spilling as necessary; series
+    // has the first extent from source
+    void build(DataSeriesModule &source, ExtentSeries &series, 
+               vector<GeneralField::Ptr> &eq_fields, vector<GeneralField::Ptr> &val_fields,
+               const vector<string> &eq_names, const vector<string> &val_names) {
+        SINVARIANT(rowsInMemory() == 0 && a_spills.empty());
+        memory_partition = true;
+        int32_t row_count = 0;
+        if (nthreads > 1) {
+            row_count = parallelBuild(source, series, eq_names, val_names);
+        }
+        for (; series.hasExtent(); series.setExtent(source.getSharedExtent())) {
+            for (; series.more(); series.next()) {
+                uint32_t hash = a_tables[0]->hashKey(eq_fields);
+                if (!a_spills.empty()) {
+                    uint32_t p = partition(hash);
+                    if (spilled(p)) {
+                        spillA(*a_spills[p], eq_fields, val_fields);
+                        continue;
+                    }
+                }
+                a_tables[radix(hash)]->add(hash, eq_fields, val_fields);
+                ++row_count;
+                if (row_count > max_a_rows) {
+                    row_count = spillMemory();
+                }
+            }
+        }
+
+        if (!a_spills.empty()) {
+            for (uint32_t i = 0; i < partition_fanout; ++i) {
+                SpillFile::Ptr b_spill(new SpillFile(spillPath("b"), b_series.getTypePtr()));
+                ++spill_count;
+                b_spill->copier.reset(new ExtentRecordCopy(b_series, b_spill->series));
+                b_spills.push_back(b_spill);
+            }
+        }
+    }
+
+    // Build from batches of extents in parallel until source is done or this level starts
+    // spilling; leaves series on the first extent not built from.  A batch stops short of
+    // max_a_rows where it can, so the rows in memory overshoot by at most one extent.  Returns
+    // the number of rows in memory.
+    int32_t parallelBuild(DataSeriesModule &source, ExtentSeries &series,
+                          const vector<string> &eq_names, const vector<string> &val_names) {
+        build_workers.clear();
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            BuildWorker::Ptr w(new BuildWorker());
+            w->series.setType(series.getTypePtr());
+            makeFields(w->series, eq_names, w->eq_fields);
+            makeFields(w->series, val_names, w->val_fields);
+            build_workers.push_back(w);
+        }
+        batch_rows.resize(nthreads * batch_extents_per_thread * a_tables.size());
+
+        int32_t row_count = 0;
+        Extent::Ptr e = series.getSharedExtent();
+        while (e != NULL && a_spills.empty()) {
+            int64_t rows = 0;
+            do {
+                batch.push_back(e);
+                rows += e->nRecords();
+                e = source.getSharedExtent();
+            } while (e != NULL && batch.size() < nthreads * batch_extents_per_thread
+                     && row_count + rows + static_cast<int64_t>(e->nRecords()) <= max_a_rows);
+
+            parallelFor(nthreads, batch.size(), boost::bind(&HashJoinModule::hashBatch, this,
+                                                            _1, _2));
+            parallelFor(nthreads, a_tables.size(), boost::bind(&HashJoinModule::buildBatch, this,
+                                                               _1, _2));
+            batch.clear();
+            BOOST_FOREACH(vector<BuildRow> &v, batch_rows) {
+                v.clear();
+            }
+
+            row_count = rowsInMemory();
+            if (row_count > max_a_rows) {
+                row_count = spillMemory();
+                if (row_count > max_a_rows) {
+                    row_count = spillMemory();
+                }
+            }
+        }
+        series.setExtent(e);
+        build_workers.clear();
+        return row_count;
+    }
+
+    // hash the rows of extent i of the batch into radix partitions
+    void hashBatch(uint32_t worker, uint32_t i) {
+        BuildWorker &w(*build_workers[worker]);
+        vector<BuildRow> *buckets = &batch_rows[i * a_tables.size()];
+        for (w.series.setExtent(batch[i]); w.series.more(); w.series.next()) {
+            BuildRow row = { w.series.getCurPos(), a_tables[0]->hashKey(w.eq_fields, w.key_buf) };
+            buckets[radix(row.hash)].push_back(row);
+        }
+        w.series.clearExtent();
+    }
+
+    // add the rows of the batch in radix partition p to its table
+    void buildBatch(uint32_t worker, uint32_t p) {
+        BuildWorker &w(*build_workers[worker]);
+        JoinHashTable &table(*a_tables[p]);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            vector<BuildRow> &rows(batch_rows[i * a_tables.size() + p]);
+            if (rows.empty()) {
+                continue;
+            }
+            w.series.setExtent(batch[i]);
+            BOOST_FOREACH(const BuildRow &row, rows) {
+                w.series.setCurPos(row.pos);
+                table.add(row.hash, w.eq_fields, w.val_fields);
+            }
+        }
+        w.series.clearExtent();
+    }
+
+    int32_t rowsInMemory() {
+        size_t rows = 0;
+        BOOST_FOREACH(boost::shared_ptr<JoinHashTable> &t, a_tables) {
+            rows += t->rowCount();
+        }
+        return rows;
+    }
+
+    // move rows from the hash tables to the spill files; the first time, everything but partition
+    // 0, after that partition 0 too.  Returns the number of rows left in memory.
+    int32_t spillMemory() {
+        if (a_spills.empty()) {
+            if (cur_level >= max_partition_level) {
+                requestError(format("a table has more than %d rows with the same join key"
+                                    " (max_a_rows)") % max_a_rows);
+            }
+            LintelLog::info(format("hash-join -> %s: over %d a rows, partitioning at level %d")
+                            % output_table_name % max_a_rows % cur_level);
+            if (spill_type == NULL) {
+                makeSpillType();
+            }
+            for (uint32_t i = 0; i < partition_fanout; ++i) {
+                SpillFile::Ptr a_spill(new SpillFile(spillPath("a"), spill_type));
+                ++spill_count;
+                makeFields(a_spill->series, spill_eq_names, a_spill->key_fields);
+                makeFields(a_spill->series, spill_val_names, a_spill->val_fields);
+                a_spills.push_back(a_spill);
+            }
+        } else {
+            SINVARIANT(memory_partition);
+            memory_partition = false;
+        }
+
+        int32_t row_count = 0;
+        BOOST_FOREACH(boost::shared_ptr<JoinHashTable> &table, a_tables) {
+            vector<bool> keep(table->entryCount(), true);
+            for (uint32_t i = 0; i < table->entryCount(); ++i) {
+                uint32_t p = partition(table->entryHash(i));
+                if (!spilled(p)) {
+                    continue;
+                }
+                keep[i] = false;
+                SpillFile &spill(*a_spills[p]);
+                for (uint32_t row = table->firstRow(i); row != JoinHashTable::none;
+                     row = table->nextRow(row)) {
+                    spill.output.newRecord();
+                    for (size_t j = 0; j < spill.key_fields.size(); ++j) {
+                        table->getKey(i, j, *spill.key_fields[j]);
+                    }
+                    for (size_t j = 0; j < spill.val_fields.size(); ++j) {
+                        table->getValue(row, j, *spill.val_fields[j]);
+                    }
+                    ++spill.rows;
+                }
+            }
+            row_count += table->retain(keep);
+        }
+        return row_count;
+    }
+
+    void spillA(SpillFile &spill, vector<GeneralField::Ptr> &eq_fields,
+                vector<GeneralField::Ptr> &val_fields) {
+        spill.output.newRecord();
+        for (size_t i = 0; i < spill.key_fields.size(); ++i) {
+            spill.key_fields[i]->set(eq_fields[i]);
+        }
+        for (size_t i = 0; i < spill.val_fields.size(); ++i) {
+            spill.val_fields[i]->set(val_fields[i]);
+        }
+        ++spill.rows;
+    }
+
+    // finish the spill files of the current level, queueing the partitions that could produce
+    // output, i.e. have both a and b rows
+    void closeSpills(bool queue) {
+        SINVARIANT(!queue || a_spills.size() == b_spills.size());
+        vector<bool> queued(a_spills.size(), false);
+        for (size_t i = 0; i < a_spills.size(); ++i) {
+            a_spills[i]->close();
+            if (queue && spilled(i) && a_spills[i]->rows > 0 && b_spills[i]->rows > 0) {
+                queued[i] = true;
+            } else {
+                unlink(a_spills[i]->path.c_str());
+            }
+        }
+        for (size_t i = 0; i < b_spills.size(); ++i) {
+            b_spills[i]->close();
+            if (queued[i]) {
+                pending.push_back(Partition(a_spills[i]->path, b_spills[i]->path, cur_level + 1));
+            } else {
+                unlink(b_spills[i]->path.c_str());
+            }
+        }
+        a_spills.clear();
+        b_spills.clear();
+    }
+
+    // done with the current probe input; returns false once there are no partitions left
+    bool nextPartition() {
+        closeSpills(true);
+        BOOST_FOREACH(boost::shared_ptr<JoinHashTable> &t, a_tables) {
+            t->clear();
+        }
+        partition_b_input.reset();
+        cur_partition.remove();
+        if (pending.empty()) {
+            return false;
+        }
+        cur_partition = pending.front();
+        pending.pop_front();
+        cur_level = cur_partition.level;
+        LintelLogDebug("HashJoinModule", format("joining %s with %s at level %d")
+                       % cur_partition.a_path % cur_partition.b_path % cur_level);
+
+        TypeIndexModule partition_a_input(spill_type->getName());
+        partition_a_input.addSource(cur_partition.a_path);
+        spill_series.setExtent(partition_a_input.getSharedExtent());
+        build(partition_a_input, spill_series, spill_eq_fields, spill_val_fields,
+              spill_eq_names, spill_val_names);
+
+        partition_b_input.reset(new TypeIndexModule(b_series.getTypePtr()->getName()));
+        partition_b_input->addSource(cur_partition.b_path);
+        probe_input = partition_b_input.get();
+        probe_done = false;
+        return true;
+    }
+
+    // returns NULL once the probe input is done, without asking it again
+    Extent::Ptr nextProbeExtent() {
+        Extent::Ptr e;
+        if (!probe_done) {
+            e = probe_input->getSharedExtent();
+            probe_done = e == NULL;
+        }
+        return e;
     }
 
     virtual Extent::Ptr getSharedExtent() {
-        while (true) {
-            Extent::Ptr e = b_input.getSharedExtent();
+        while (ready.empty()) {
+            Extent::Ptr e = nextProbeExtent();
             if (e == NULL) {
+                if (output_series.getTypePtr() != NULL && nextPartition()) {
+                    continue;
+                }
                 break;
             }
             if (output_series.getTypePtr() == NULL) {
                 firstExtent(*e);
             }
-        
+
+            if (nthreads > 1 && b_spills.empty()) {
+                parallelProbe(e);
+                continue;
+            }
             if (output_series.getSharedExtent() == NULL) {
                 SINVARIANT(output_series.getTypePtr() != NULL);
                 output_series.newExtent();
@@ -147,41 +598,123 @@ class HashJoinModule : public JoinModule {
                 break;
             }
         }
+        if (!ready.empty()) {
+            Extent::Ptr ret = ready.front();
+            ready.pop_front();
+            return ret;
+        }
         return returnOutputSeries();
     }
 
+    // probe with a batch of b extents starting with e, queueing the output extents on ready
+    void parallelProbe(Extent::Ptr e) {
+        batch.push_back(e);
+        while (batch.size() < nthreads * batch_extents_per_thread) {
+            e = nextProbeExtent();
+            if (e == NULL) {
+                break;
+            }
+            batch.push_back(e);
+        }
+        batch_output.resize(batch.size());
+        parallelFor(nthreads, batch.size(), boost::bind(&HashJoinModule::probeBatch, this,
+                                                        _1, _2));
+
+        // rows from a level probed by this thread come first
+        if (output_series.hasExtent() && output_series.getSharedExtent()->nRecords() > 0) {
+            ready.push_back(returnOutputSeries());
+        }
+        BOOST_FOREACH(Extent::Ptr &out, batch_output) {
+            if (out->nRecords() > 0) {
+                ready.push_back(out);
+            }
+            out.reset();
+        }
+        batch.clear();
+    }
+
+    // probe with extent i of the batch
+    void probeBatch(uint32_t worker, uint32_t i) {
+        ProbeWorker &w(*probe_workers[worker]);
+        w.output_series.newExtent();
+        for (w.b_series.setExtent(batch[i]); w.b_series.more(); w.b_series.next()) {
+            uint32_t hash = a_tables[0]->hashKey(w.b_eq_fields, w.key_buf);
+            const JoinHashTable &table(*a_tables[radix(hash)]);
+            for (uint32_t row = table.find(hash, w.b_eq_fields, w.key_buf);
+                 row != JoinHashTable::none; row = table.nextRow(row)) {
+                w.output_series.newRecord();
+                Extractor::extractAll(w.extractors, &table, row);
+            }
+        }
+        batch_output[i] = w.output_series.getSharedExtent();
+        w.output_series.clearExtent();
+        w.b_series.clearExtent();
+    }
+
     void processRow() {
-        key.extract(b_eq_fields);
-        vector<GVVec> *v = a_hashmap.lookup(key);
-        if (v != NULL) {
-            cout << format("%d match on %s\n") % v->size() % key;
-            BOOST_FOREACH(const GVVec &a_vals, *v) {
-                output_series.newRecord();
-                BOOST_FOREACH(Extractor::Ptr p, extractors) {
-                    p->extract(a_vals);
-                }
+        uint32_t hash = a_tables[0]->hashKey(b_eq_fields);
+        if (!b_spills.empty()) {
+            uint32_t p = partition(hash);
+            if (spilled(p)) {
+                SpillFile &spill(*b_spills[p]);
+                spill.output.newRecord();
+                spill.copier->copyRecord();
+                ++spill.rows;
+                return;
             }
         }
+        JoinHashTable &table(*a_tables[radix(hash)]);
+        for (uint32_t row = table.find(hash, b_eq_fields); row != JoinHashTable::none;
+             row = table.nextRow(row)) {
+            output_series.newRecord();
+            Extractor::extractAll(extractors, &table, row);
+        }
     }
 
     DataSeriesModule &a_input, &b_input;
     int32_t max_a_rows;
     const CMap eq_columns, keep_columns;
     
-    HashMap< GVVec, vector<GVVec> > a_hashmap;
-    GVVec key;
-    ExtentSeries b_series;
-    vector<GeneralField::Ptr> b_eq_fields;
+    vector< boost::shared_ptr<JoinHashTable> > a_tables; // by radix partition
+    ExtentSeries a_series, b_series;
+    vector<GeneralField::Ptr> a_eq_fields, a_val_fields, b_eq_fields;
+    vector<string> a_eq_names, a_val_names, b_eq_names;
+    vector<OutputColumn> output_columns;
     vector<Extractor::Ptr> extractors;
     const string output_table_name;
-    
+
+    // parallel state
+    const uint32_t nthreads;
+    uint32_t radix_bits;
+    vector<Extent::Ptr> batch, batch_output;
+    vector< vector<BuildRow> > batch_rows; // by extent in the batch, then radix partition
+    vector<BuildWorker::Ptr> build_workers;
+    vector<ProbeWorker::Ptr> probe_workers;
+    deque<Extent::Ptr> ready; // output extents in order
+
+    // partitioning state
+    DataSeriesModule *probe_input;
+    bool probe_done;
+    boost::scoped_ptr<TypeIndexModule> partition_b_input;
+    ExtentType::Ptr spill_type;
+    ExtentSeries spill_series;
+    vector<string> spill_eq_names, spill_val_names;
+    vector<GeneralField::Ptr> spill_eq_fields, spill_val_fields;
+    vector<SpillFile::Ptr> a_spills, b_spills;
+    deque<Partition> pending;
+    Partition cur_partition;
+    uint32_t cur_level;
+    bool memory_partition;
+    uint32_t spill_count;
+
 };
 
 OutputSeriesModule::OSMPtr dataseries::makeHashJoinModule
 (DataSeriesModule &a_input, int32_t max_a_rows, DataSeriesModule &b_input,
  const map<string, string> &eq_columns, const map<string, string> &keep_columns,
- const string &output_table_name) {
+ const string &output_table_name, uint32_t nthreads) {
     return OutputSeriesModule::OSMPtr(new HashJoinModule(a_input, max_a_rows, b_input, eq_columns,
-                                                         keep_columns, output_table_name));
+                                                         keep_columns, output_table_name,
+                                                         nthreads));
 }
 
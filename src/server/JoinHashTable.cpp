@@ -0,0 +1,400 @@
+#include <string.h>
+
+#include <boost/foreach.hpp>
+
+#include <Lintel/HashFns.hpp>
+
+#include "JoinHashTable.hpp"
+
+using namespace std;
+using boost::format;
+
+const uint32_t JoinHashTable::none;
+
+namespace {
+    uint8_t *bytesOf(vector<uint8_t> &v) {
+        return v.empty() ? NULL : &v[0];
+    }
+
+    // pack a non-null value of a fixed size type
+    void packFixed(ExtentType::fieldType type, uint32_t size, GeneralField &from, uint8_t *to) {
+        switch (type)
+            {
+            case ExtentType::ft_bool:
+                *to = static_cast<GF_Bool &>(from).myfield.val() ? 1 : 0;
+                break;
+            case ExtentType::ft_byte:
+                *to = static_cast<GF_Byte &>(from).myfield.val();
+                break;
+            case ExtentType::ft_int32: {
+                int32_t v = static_cast<GF_Int32 &>(from).myfield.val();
+                memcpy(to, &v, sizeof(v));
+                break;
+            }
+            case ExtentType::ft_int64: {
+                int64_t v = static_cast<GF_Int64 &>(from).myfield.val();
+                memcpy(to, &v, sizeof(v));
+                break;
+            }
+            case ExtentType::ft_double: {
+                double v = static_cast<GF_Double &>(from).myfield.val();
+                if (v == 0) {
+                    v = 0; // -0.0 == 0.0, so they have to pack the same
+                }
+                memcpy(to, &v, sizeof(v));
+                break;
+            }
+            case ExtentType::ft_fixedwidth:
+                memcpy(to, static_cast<GF_FixedWidth &>(from).myfield.val(), size);
+                break;
+            default:
+                FATAL_ERROR(format("internal error, unexpected type %s")
+                            % ExtentType::fieldTypeString(type));
+            }
+    }
+}
+
+JoinHashTable::JoinHashTable(const vector<GeneralField::Ptr> &key_fields,
+                             const vector<GeneralField::Ptr> &val_fields)
+    : key_size(makeColumns(key_fields, key_columns)),
+      row_size(makeColumns(val_fields, val_columns))
+{
+    key_buf.resize(key_size);
+    string_offsets.push_back(0);
+}
+
+uint32_t JoinHashTable::makeColumns(const vector<GeneralField::Ptr> &fields,
+                                    vector<Column> &columns) {
+    uint32_t total = 0;
+    BOOST_FOREACH(const GeneralField::Ptr &f, fields) {
+        Column c;
+        c.type = f->getType();
+        c.offset = total + 1;
+        switch (c.type)
+            {
+            case ExtentType::ft_bool: case ExtentType::ft_byte: c.size = 1; break;
+            case ExtentType::ft_int32: c.size = 4; break;
+            case ExtentType::ft_int64: case ExtentType::ft_double: c.size = 8; break;
+            case ExtentType::ft_variable32: c.size = 4; break; // the interned id
+            case ExtentType::ft_fixedwidth:
+                c.size = static_cast<GF_FixedWidth &>(*f).size();
+                break;
+            default:
+                FATAL_ERROR(format("can not join on a field of type %s")
+                            % ExtentType::fieldTypeString(c.type));
+            }
+        columns.push_back(c);
+        total += 1 + c.size;
+    }
+    return total;
+}
+
+bool JoinHashTable::sameTypes(const vector<Column> &columns,
+                              const vector<GeneralField::Ptr> &fields) {
+    if (columns.size() != fields.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (columns[i].type != fields[i]->getType()) {
+            return false;
+        }
+        if (columns[i].type == ExtentType::ft_fixedwidth
+            && columns[i].size != static_cast<uint32_t>
+                   (static_cast<GF_FixedWidth &>(*fields[i]).size())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool JoinHashTable::matchesKey(const vector<GeneralField::Ptr> &fields) const {
+    return sameTypes(key_columns, fields);
+}
+
+uint32_t JoinHashTable::hashKey(const vector<GeneralField::Ptr> &fields,
+                                vector<uint8_t> &scratch) const {
+    DEBUG_SINVARIANT(matchesKey(fields));
+    scratch.resize(key_size);
+    uint32_t hash = 1942;
+    for (size_t i = 0; i < key_columns.size(); ++i) {
+        const Column &c(key_columns[i]);
+        GeneralField &f(*fields[i]);
+        if (f.isNull()) {
+            hash = lintel::BobJenkinsHashMix3(hash, i, 1776);
+        } else if (c.type == ExtentType::ft_variable32) {
+            Variable32Field &v(static_cast<GF_Variable32 &>(f).myfield);
+            hash = lintel::hashBytes(v.val(), v.size(), hash);
+        } else {
+            uint8_t *to = &scratch[c.offset];
+            packFixed(c.type, c.size, f, to);
+            hash = lintel::hashBytes(to, c.size, hash);
+        }
+    }
+    return hash;
+}
+
+void JoinHashTable::encode(const vector<Column> &columns, const vector<GeneralField::Ptr> &fields,
+                           uint8_t *to) {
+    for (size_t i = 0; i < columns.size(); ++i) {
+        const Column &c(columns[i]);
+        GeneralField &f(*fields[i]);
+        uint8_t *p = to + c.offset;
+        if (f.isNull()) {
+            p[-1] = 1;
+            memset(p, 0, c.size);
+        } else if (c.type == ExtentType::ft_variable32) {
+            Variable32Field &v(static_cast<GF_Variable32 &>(f).myfield);
+            uint32_t hash = lintel::hashBytes(v.val(), v.size(), 1972);
+            uint32_t id = internString(v.val(), v.size(), hash);
+            p[-1] = 0;
+            memcpy(p, &id, sizeof(id));
+        } else {
+            p[-1] = 0;
+            packFixed(c.type, c.size, f, p);
+        }
+    }
+}
+
+bool JoinHashTable::encodeKey(const vector<GeneralField::Ptr> &fields, uint8_t *to) const {
+    for (size_t i = 0; i < key_columns.size(); ++i) {
+        const Column &c(key_columns[i]);
+        GeneralField &f(*fields[i]);
+        uint8_t *p = to + c.offset;
+        if (f.isNull()) {
+            p[-1] = 1;
+            memset(p, 0, c.size);
+        } else if (c.type == ExtentType::ft_variable32) {
+            Variable32Field &v(static_cast<GF_Variable32 &>(f).myfield);
+            uint32_t hash = lintel::hashBytes(v.val(), v.size(), 1972);
+            uint32_t id = findString(v.val(), v.size(), hash);
+            if (id == none) {
+                return false;
+            }
+            p[-1] = 0;
+            memcpy(p, &id, sizeof(id));
+        } else {
+            p[-1] = 0;
+            packFixed(c.type, c.size, f, p);
+        }
+    }
+    return true;
+}
+
+void JoinHashTable::decode(const Column &c, const uint8_t *from, GeneralField &into) const {
+    DEBUG_SINVARIANT(into.getType() == c.type);
+    const uint8_t *p = from + c.offset;
+    if (p[-1] != 0) {
+        into.setNull();
+        return;
+    }
+    switch (c.type)
+        {
+        case ExtentType::ft_bool:
+            static_cast<GF_Bool &>(into).myfield.set(*p != 0);
+            break;
+        case ExtentType::ft_byte:
+            static_cast<GF_Byte &>(into).myfield.set(*p);
+            break;
+        case ExtentType::ft_int32: {
+            int32_t v;
+            memcpy(&v, p, sizeof(v));
+            static_cast<GF_Int32 &>(into).myfield.set(v);
+            break;
+        }
+        case ExtentType::ft_int64: {
+            int64_t v;
+            memcpy(&v, p, sizeof(v));
+            static_cast<GF_Int64 &>(into).myfield.set(v);
+            break;
+        }
+        case ExtentType::ft_double: {
+            double v;
+            memcpy(&v, p, sizeof(v));
+            static_cast<GF_Double &>(into).myfield.set(v);
+            break;
+        }
+        case ExtentType::ft_variable32: {
+            uint32_t id;
+            memcpy(&id, p, sizeof(id));
+            uint64_t start = string_offsets[id], size = string_offsets[id + 1] - start;
+            static const uint8_t empty = 0;
+            static_cast<GF_Variable32 &>(into).myfield.set
+                (size == 0 ? &empty : &string_bytes[start], size);
+            break;
+        }
+        case ExtentType::ft_fixedwidth:
+            static_cast<GF_FixedWidth &>(into).myfield.set(p, c.size);
+            break;
+        default:
+            FATAL_ERROR("internal error, unexpected type");
+        }
+}
+
+void JoinHashTable::insertSlot(vector<uint32_t> &slots, uint32_t hash, uint32_t id) const {
+    size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+    while (slots[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    slots[i] = id + 1;
+}
+
+uint32_t JoinHashTable::findEntry(uint32_t hash, const uint8_t *key) const {
+    if (entry_slots.empty()) {
+        return none;
+    }
+    size_t mask = entry_slots.size() - 1;
+    for (size_t i = hash & mask; entry_slots[i] != 0; i = (i + 1) & mask) {
+        uint32_t entry = entry_slots[i] - 1;
+        if (entries[entry].hash == hash
+            && (key_size == 0
+                || memcmp(&keys[static_cast<size_t>(entry) * key_size], key, key_size) == 0)) {
+            return entry;
+        }
+    }
+    return none;
+}
+
+// keep the slots at most half full, counting the entry about to be added
+void JoinHashTable::growEntrySlots() {
+    if ((entries.size() + 1) * 2 <= entry_slots.size()) {
+        return;
+    }
+    size_t nslots = max(static_cast<size_t>(64), entry_slots.size() * 2);
+    while (nslots < (entries.size() + 1) * 2) {
+        nslots *= 2;
+    }
+    entry_slots.assign(nslots, 0);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        insertSlot(entry_slots, entries[i].hash, i);
+    }
+}
+
+uint32_t JoinHashTable::findString(const uint8_t *bytes, uint32_t size, uint32_t hash) const {
+    if (string_slots.empty()) {
+        return none;
+    }
+    size_t mask = string_slots.size() - 1;
+    for (size_t i = hash & mask; string_slots[i] != 0; i = (i + 1) & mask) {
+        uint32_t id = string_slots[i] - 1;
+        uint64_t start = string_offsets[id];
+        if (string_hashes[id] == hash && string_offsets[id + 1] - start == size
+            && (size == 0 || memcmp(&string_bytes[start], bytes, size) == 0)) {
+            return id;
+        }
+    }
+    return none;
+}
+
+uint32_t JoinHashTable::internString(const uint8_t *bytes, uint32_t size, uint32_t hash) {
+    uint32_t id = findString(bytes, size, hash);
+    if (id != none) {
+        return id;
+    }
+    id = string_hashes.size();
+    INVARIANT(id != none, "too many strings in join hash table");
+    string_bytes.insert(string_bytes.end(), bytes, bytes + size);
+    string_offsets.push_back(string_bytes.size());
+    string_hashes.push_back(hash);
+    if (string_hashes.size() * 2 > string_slots.size()) {
+        string_slots.assign(max(static_cast<size_t>(64), string_slots.size() * 2), 0);
+        for (size_t i = 0; i < string_hashes.size(); ++i) {
+            insertSlot(string_slots, string_hashes[i], i);
+        }
+    } else {
+        insertSlot(string_slots, hash, id);
+    }
+    return id;
+}
+
+void JoinHashTable::add(uint32_t hash, const vector<GeneralField::Ptr> &key_fields,
+                        const vector<GeneralField::Ptr> &val_fields, bool replace) {
+    DEBUG_SINVARIANT(sameTypes(val_columns, val_fields));
+    encode(key_columns, key_fields, bytesOf(key_buf));
+    uint32_t entry = findEntry(hash, bytesOf(key_buf));
+    if (entry != none && replace) { // overwrite the only row in place
+        uint32_t row = entries[entry].first_row;
+        encode(val_columns, val_fields, rowData(row));
+        row_next[row] = none;
+        entries[entry].last_row = row;
+        return;
+    }
+
+    uint32_t row = row_next.size();
+    INVARIANT(row != none, "too many rows in join hash table");
+    rows.resize(rows.size() + row_size);
+    encode(val_columns, val_fields, rowData(row));
+    row_next.push_back(none);
+    if (entry == none) {
+        growEntrySlots();
+        Entry e = { hash, row, row };
+        insertSlot(entry_slots, hash, entries.size());
+        entries.push_back(e);
+        keys.insert(keys.end(), key_buf.begin(), key_buf.end());
+    } else {
+        row_next[entries[entry].last_row] = row;
+        entries[entry].last_row = row;
+    }
+}
+
+uint32_t JoinHashTable::find(uint32_t hash, const vector<GeneralField::Ptr> &fields,
+                             vector<uint8_t> &scratch) const {
+    scratch.resize(key_size);
+    if (!encodeKey(fields, bytesOf(scratch))) {
+        return none; // some string was never added, so neither was the key
+    }
+    uint32_t entry = findEntry(hash, bytesOf(scratch));
+    return entry == none ? none : entries[entry].first_row;
+}
+
+size_t JoinHashTable::retain(const vector<bool> &keep) {
+    SINVARIANT(keep.size() == entries.size());
+    vector<Entry> new_entries;
+    vector<uint8_t> new_keys, new_rows;
+    vector<uint32_t> new_next;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (!keep[i]) {
+            continue;
+        }
+        Entry e = entries[i];
+        e.first_row = new_next.size();
+        for (uint32_t row = entries[i].first_row; row != none; row = row_next[row]) {
+            const uint8_t *data = rowData(row);
+            new_rows.insert(new_rows.end(), data, data + row_size);
+            new_next.push_back(new_next.size() + 1);
+        }
+        new_next.back() = none;
+        e.last_row = new_next.size() - 1;
+        new_entries.push_back(e);
+        new_keys.insert(new_keys.end(), keys.begin() + i * key_size,
+                        keys.begin() + (i + 1) * key_size);
+    }
+    entries.swap(new_entries);
+    keys.swap(new_keys);
+    rows.swap(new_rows);
+    row_next.swap(new_next);
+
+    entry_slots.clear();
+    growEntrySlots();
+    return row_next.size();
+}
+
+void JoinHashTable::clear() {
+    entries.clear();
+    keys.clear();
+    entry_slots.clear();
+    rows.clear();
+    row_next.clear();
+    string_bytes.clear();
+    string_offsets.assign(1, 0);
+    string_hashes.clear();
+    string_slots.clear();
+}
+
+size_t JoinHashTable::memoryUsage() const {
+    return entries.capacity() * sizeof(Entry) + keys.capacity()
+        + entry_slots.capacity() * sizeof(uint32_t) + rows.capacity()
+        + row_next.capacity() * sizeof(uint32_t) + string_bytes.capacity()
+        + string_offsets.capacity() * sizeof(uint64_t)
+        + (string_hashes.capacity() + string_slots.capacity()) * sizeof(uint32_t);
+}
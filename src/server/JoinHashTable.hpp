@@ -0,0 +1,155 @@
+#ifndef DATASERIES_JOINHASHTABLE_HPP
+#define DATASERIES_JOINHASHTABLE_HPP
+
+#include <vector>
+
+#include <DataSeries/GeneralField.hpp>
+
+// A hash table from a key of one or more columns to the rows of value columns with that key, for
+// the join modules.  The layout is fixed by the column types when the table is made, so rather
+// than a GVVec per key and per row, each key is packed into a fixed number of bytes, and all the
+// value rows are packed the same way into one row buffer, chained together per key.  A packed
+// column is a null byte followed by the value; variable32 values are interned into a string arena
+// and packed as their id, so equal strings have equal ids and keys compare with memcmp.  Adding or
+// finding a row only allocates when one of the buffers grows.
+//
+// Rows are added and found using fields on the current row of some series; the fields must have
+// the same types as the ones the table was made from, but may be from any series.  Once a table
+// is built, any number of threads can probe it at once using the versions of hashKey and find
+// that take a scratch buffer, one per thread.
+class JoinHashTable {
+  public:
+    /// no row or entry
+    static const uint32_t none = 0xFFFFFFFF;
+
+    JoinHashTable(const std::vector<GeneralField::Ptr> &key_fields,
+                  const std::vector<GeneralField::Ptr> &val_fields);
+
+    /// true if fields have the same types as the key of the table
+    bool matchesKey(const std::vector<GeneralField::Ptr> &fields) const;
+
+    /// hash of the key in the current row of fields; depends only on the values, so it can also
+    /// be used to partition keys.
+    uint32_t hashKey(const std::vector<GeneralField::Ptr> &fields) {
+        return hashKey(fields, key_buf);
+    }
+
+    uint32_t hashKey(const std::vector<GeneralField::Ptr> &fields,
+                     std::vector<uint8_t> &scratch) const;
+
+    /// add the values in the current row of val_fields under the key in key_fields, whose hash
+    /// is hashKey(key_fields).  Rows for a key are kept in the order they were added unless
+    /// replace is true, in which case the new row replaces any earlier ones.
+    void add(uint32_t hash, const std::vector<GeneralField::Ptr> &key_fields,
+             const std::vector<GeneralField::Ptr> &val_fields, bool replace = false);
+
+    /// the first row for the key in fields, whose hash is hashKey(fields), or none
+    uint32_t find(uint32_t hash, const std::vector<GeneralField::Ptr> &fields) {
+        return find(hash, fields, key_buf);
+    }
+
+    uint32_t find(uint32_t hash, const std::vector<GeneralField::Ptr> &fields,
+                  std::vector<uint8_t> &scratch) const;
+
+    /// the row after row for the same key, or none
+    uint32_t nextRow(uint32_t row) const {
+        return row_next[row];
+    }
+
+    /// set into, which must have the type of value column column, to the value in row
+    void getValue(uint32_t row, size_t column, GeneralField &into) const {
+        decode(val_columns[column], rowData(row), into);
+    }
+
+    /// Entries, one per distinct key, are numbered from 0 in the order they were added.
+    size_t entryCount() const {
+        return entries.size();
+    }
+
+    uint32_t entryHash(uint32_t entry) const {
+        return entries[entry].hash;
+    }
+
+    uint32_t firstRow(uint32_t entry) const {
+        return entries[entry].first_row;
+    }
+
+    /// set into, which must have the type of key column column, to the value in the key of entry
+    void getKey(uint32_t entry, size_t column, GeneralField &into) const {
+        decode(key_columns[column], &keys[static_cast<size_t>(entry) * key_size], into);
+    }
+
+    /// drop the entries for which keep is false, along with their rows, renumbering the rest.
+    /// Returns the number of rows left.  The strings of the dropped rows are not freed.
+    size_t retain(const std::vector<bool> &keep);
+
+    size_t rowCount() const {
+        return row_next.size();
+    }
+
+    bool empty() const {
+        return entries.empty();
+    }
+
+    void clear();
+
+    /// approximate bytes used by the table
+    size_t memoryUsage() const;
+
+  private:
+    struct Column {
+        ExtentType::fieldType type;
+        uint32_t offset, size; // of the value, after the null byte
+    };
+
+    struct Entry {
+        uint32_t hash, first_row, last_row;
+    };
+
+    static uint32_t makeColumns(const std::vector<GeneralField::Ptr> &fields,
+                                std::vector<Column> &columns);
+    static bool sameTypes(const std::vector<Column> &columns,
+                          const std::vector<GeneralField::Ptr> &fields);
+
+    // pack the fields into to, interning strings
+    void encode(const std::vector<Column> &columns, const std::vector<GeneralField::Ptr> &fields,
+                uint8_t *to);
+    // pack the key in fields into to; returns false if a string is not in the arena
+    bool encodeKey(const std::vector<GeneralField::Ptr> &fields, uint8_t *to) const;
+    void decode(const Column &column, const uint8_t *from, GeneralField &into) const;
+
+    uint32_t findEntry(uint32_t hash, const uint8_t *key) const;
+    void insertSlot(std::vector<uint32_t> &slots, uint32_t hash, uint32_t id) const;
+    void growEntrySlots();
+
+    uint32_t findString(const uint8_t *bytes, uint32_t size, uint32_t hash) const;
+    uint32_t internString(const uint8_t *bytes, uint32_t size, uint32_t hash);
+
+    const uint8_t *rowData(uint32_t row) const {
+        return row_size == 0 ? NULL : &rows[static_cast<size_t>(row) * row_size];
+    }
+
+    uint8_t *rowData(uint32_t row) {
+        return row_size == 0 ? NULL : &rows[static_cast<size_t>(row) * row_size];
+    }
+
+    std::vector<Column> key_columns, val_columns;
+    uint32_t key_size, row_size;
+
+    std::vector<Entry> entries;
+    std::vector<uint8_t> keys; // key_size bytes for each entry
+    std::vector<uint32_t> entry_slots; // open addressing, entry + 1 or 0 if empty
+
+    std::vector<uint8_t> rows; // row_size bytes for each row
+    std::vector<uint32_t> row_next;
+
+    // interned strings; string i is string_bytes[string_offsets[i] .. string_offsets[i+1])
+    std::vector<uint8_t> string_bytes;
+    std::vector<uint64_t> string_offsets;
+    std::vector<uint32_t> string_hashes;
+    std::vector<uint32_t> string_slots; // open addressing, string + 1 or 0 if empty
+
+    std::vector<uint8_t> key_buf; // scratch for the key being added or found
+};
+
+#endif
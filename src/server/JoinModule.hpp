@@ -1,7 +1,9 @@
 #ifndef DATASERIES_JOINMODULE_HPP
 #define DATASERIES_JOINMODULE_HPP
 
-#include "GVVec.hpp"
+#include <boost/foreach.hpp>
+
+#include "JoinHashTable.hpp"
 #include "ThrowError.hpp"
 #include "OutputSeriesModule.hpp"
 
@@ -14,7 +16,8 @@ class JoinModule : public OutputSeriesModule, public ThrowError {
         Extractor(const std::string &into_field_name) : into_field_name(into_field_name), into() { }
         virtual ~Extractor() { }
 
-        virtual void extract(const GVVec &a_val) = 0;
+        // row is a row of table, or table is NULL if there is no row to extract from
+        virtual void extract(const JoinHashTable *table, uint32_t row) = 0;
 
         const std::string into_field_name; 
         GeneralField::Ptr into;
@@ -26,9 +29,10 @@ class JoinModule : public OutputSeriesModule, public ThrowError {
             }
         }
         
-        static void extractAll(std::vector<Ptr> &extractors, const GVVec &lookup_val) {
+        static void extractAll(std::vector<Ptr> &extractors, const JoinHashTable *table,
+                               uint32_t row) {
             BOOST_FOREACH(Ptr e, extractors) {
-                e->extract(lookup_val);
+                e->extract(table, row);
             }
         }
     };
@@ -47,7 +51,7 @@ class JoinModule : public OutputSeriesModule, public ThrowError {
         static Ptr make(const std::string &field_name, GeneralField::Ptr from) {
             return Ptr(new ExtractorField(field_name, from));
         }
-        virtual void extract(const GVVec &a_val) {
+        virtual void extract(const JoinHashTable *table, uint32_t row) {
             into->set(from);
         }
 
@@ -59,7 +63,7 @@ class JoinModule : public OutputSeriesModule, public ThrowError {
         { }
     };
 
-    // Extract from a value vector and stuff it into a destination field
+    // Extract from a value column of a hash table row and stuff it into a destination field
     class ExtractorValue : public Extractor {
       public:
         virtual ~ExtractorValue() { }
@@ -67,9 +71,9 @@ class JoinModule : public OutputSeriesModule, public ThrowError {
             return Ptr(new ExtractorValue(into_field_name, pos));
         }
         
-        virtual void extract(const GVVec &a_val) {
-            SINVARIANT(pos < a_val.size());
-            into->set(a_val.vec[pos]);
+        virtual void extract(const JoinHashTable *table, uint32_t row) {
+            SINVARIANT(table != NULL);
+            table->getValue(row, pos, *into);
         }
 
       private:
@@ -0,0 +1,44 @@
+#include <boost/bind.hpp>
+
+#include <Lintel/PThread.hpp>
+
+#include "DSSModule.hpp"
+
+namespace {
+    struct ParallelFor {
+        ParallelFor(uint32_t nitems, const WorkFn &fn)
+            : next_item(0), nitems(nitems), fn(fn) { }
+
+        void worker(uint32_t worker) {
+            while (true) {
+                uint32_t item;
+                {
+                    PThreadScopedLock lock(mutex);
+                    if (next_item == nitems) {
+                        return;
+                    }
+                    item = next_item++;
+                }
+                fn(worker, item);
+            }
+        }
+
+        PThreadMutex mutex;
+        uint32_t next_item, nitems;
+        const WorkFn &fn;
+    };
+}
+
+void dataseries::parallelFor(uint32_t nthreads, uint32_t nitems, const WorkFn &fn) {
+    ParallelFor state(nitems, fn);
+    vector<PThread *> threads;
+    for (uint32_t i = 1; i < min(nthreads, nitems); ++i) {
+        threads.push_back(new PThreadFunction(boost::bind(&ParallelFor::worker, &state, i)));
+        threads.back()->start();
+    }
+    state.worker(0);
+    BOOST_FOREACH(PThread *t, threads) {
+        t->join();
+        delete t;
+    }
+}
@@ -1,10 +1,13 @@
+#include <boost/scoped_ptr.hpp>
+
+#include <DataSeries/ExtentCopyPlan.hpp>
+
 #include "DSSModule.hpp"
 
 class ProjectModule : public OutputSeriesModule {
   public:
     ProjectModule(DataSeriesModule &source, const vector<string> &keep_columns)
-            : source(source), keep_columns(keep_columns), copier(input_series, output_series)
-    { }
+            : source(source), keep_columns(keep_columns) { }
 
     virtual ~ProjectModule() { }
 
@@ -31,7 +34,8 @@ class ProjectModule : public OutputSeriesModule {
             
         output_series.setType(output_type);
 
-        copier.prep();
+        copy_plan.reset(new ExtentCopyPlan(t, output_type));
+        SINVARIANT(copy_plan->supported());
     }
 
     virtual Extent::Ptr getSharedExtent() {
@@ -47,11 +51,8 @@ class ProjectModule : public OutputSeriesModule {
             if (!output_series.hasExtent()) {
                 output_series.newExtent();
             }
-        
-            for (input_series.setExtent(in); input_series.more(); input_series.next()) {
-                output_series.newRecord();
-                copier.copyRecord();
-            }
+
+            copy_plan->appendRows(*in, NULL, output_series.getExtentRef());
             if (output_series.getExtentRef().size() > 96*1024) {
                 return returnOutputSeries();
             }
@@ -61,7 +62,7 @@ class ProjectModule : public OutputSeriesModule {
     DataSeriesModule &source;
     ExtentSeries input_series;
     vector<string> keep_columns;
-    ExtentRecordCopy copier;
+    boost::scoped_ptr<ExtentCopyPlan> copy_plan;
 };
 
 OutputSeriesModule::OSMPtr 
@@ -2,9 +2,13 @@
 #define DATASERIES_RENAMECOPIER_HPP
 
 #include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
 
+#include <DataSeries/ExtentCopyPlan.hpp>
 #include <DataSeries/GeneralField.hpp>
 
+// Copies the current record of source to the current record of dest, renaming fields on the way.
+// Uses an ExtentCopyPlan when the renamed fields have the same types, and GeneralField otherwise.
 class RenameCopier {
   public:
     typedef boost::shared_ptr<RenameCopier> Ptr;
@@ -12,7 +16,16 @@ class RenameCopier {
     RenameCopier(ExtentSeries &source, ExtentSeries &dest)
             : source(source), dest(dest) { }
 
+    /// both series must have their types set
     void prep(const std::map<std::string, std::string> &copy_columns) {
+        SINVARIANT(source.getTypePtr() != NULL && dest.getTypePtr() != NULL);
+        plan.reset(new ExtentCopyPlan(source.getTypePtr(), dest.getTypePtr(),
+                                      ExtentCopyPlan::FieldPairs(copy_columns.begin(),
+                                                                 copy_columns.end())));
+        if (plan->supported()) {
+            return;
+        }
+        plan.reset();
         typedef std::map<std::string, std::string>::value_type vt;
         BOOST_FOREACH(const vt &copy_column, copy_columns) {
             source_fields.push_back(GeneralField::make(source, copy_column.first));
@@ -21,6 +34,11 @@ class RenameCopier {
     }
 
     void copyRecord() {
+        if (plan != NULL) {
+            plan->copyRow(source.getExtentRef(), source.getRowOffset(),
+                          dest.getExtentRef(), dest.getRowOffset());
+            return;
+        }
         SINVARIANT(!source_fields.empty() && source_fields.size() == dest_fields.size());
         for (size_t i = 0; i < source_fields.size(); ++i) {
             dest_fields[i]->set(source_fields[i]);
@@ -28,6 +46,7 @@ class RenameCopier {
     }
 
     ExtentSeries &source, &dest;
+    boost::scoped_ptr<ExtentCopyPlan> plan;
     std::vector<GeneralField::Ptr> source_fields;
     std::vector<GeneralField::Ptr> dest_fields;
 };
@@ -1,12 +1,14 @@
+#include <boost/scoped_ptr.hpp>
+
 #include <DataSeries/DSExpr.hpp>
+#include <DataSeries/ExtentCopyPlan.hpp>
 
 #include "DSSModule.hpp"
 
 class SelectModule : public OutputSeriesModule {
   public:
     SelectModule(DataSeriesModule &source, const string &where_expr_str)
-            : source(source), where_expr_str(where_expr_str), copier(input_series, output_series)
-    { }
+            : source(source), where_expr_str(where_expr_str) { }
 
     virtual ~SelectModule() { }
 
@@ -20,20 +22,17 @@ class SelectModule : public OutputSeriesModule {
                 input_series.setType(in->getTypePtr());
                 output_series.setType(in->getTypePtr());
 
-                copier.prep();
+                copy_plan.reset(new ExtentCopyPlan(in->getTypePtr(), in->getTypePtr()));
                 where_expr.reset(DSExpr::make(input_series, where_expr_str));
             }
 
             if (!output_series.hasExtent()) {
                 output_series.newExtent();
             }
-        
-            for (input_series.setExtent(in); input_series.more(); input_series.next()) {
-                if (where_expr->valBool()) {
-                    output_series.newRecord();
-                    copier.copyRecord();
-                }
-            }
+
+            input_series.setExtent(in);
+            where_expr->selectRows(input_series, selected);
+            copy_plan->appendRows(*in, &selected, output_series.getExtentRef());
             if (output_series.getExtentRef().size() > 96*1024) {
                 return returnOutputSeries();
             }
@@ -43,8 +42,9 @@ class SelectModule : public OutputSeriesModule {
     DataSeriesModule &source;
     string where_expr_str;
     ExtentSeries input_series;
-    ExtentRecordCopy copier;
+    boost::scoped_ptr<ExtentCopyPlan> copy_plan;
     boost::shared_ptr<DSExpr> where_expr;
+    DSExpr::Selection selected;
 };
 
 DataSeriesModule::Ptr 
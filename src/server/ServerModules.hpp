@@ -1,6 +1,8 @@
 #ifndef DATASERIES_SERVERMODULES_HPP
 #define DATASERIES_SERVERMODULES_HPP
 
+#include <boost/function.hpp>
+
 #include <DataSeries/DataSeriesModule.hpp>
 
 #include "ThrowError.hpp"
@@ -37,22 +39,30 @@ namespace dataseries {
     };
 
 
+    typedef boost::function<void (uint32_t worker, uint32_t item)> WorkFn;
+
+    /// Calls fn(worker, item) for every item in [0, nitems) on up to nthreads threads, numbered
+    /// from 0, one of which is the calling thread.  Each thread takes the next item until there
+    /// are none left, so items may be of uneven sizes.  Returns once all the calls are done.
+    void parallelFor(uint32_t nthreads, uint32_t nitems, const WorkFn &fn);
+
+    /// writes the rows that pass through it to output_path, compressed with lzf unless
+    /// compress is false
     DataSeriesModule::Ptr makeTeeModule(DataSeriesModule &source_module, 
-                                        const std::string &output_path);
-    DataSeriesModule::Ptr makeTableDataModule(DataSeriesModule &source_module,
-                                              TableData &into, uint32_t max_rows);
+                                        const std::string &output_path, bool compress = true);
     OutputSeriesModule::OSMPtr makeHashJoinModule
     (DataSeriesModule &a_input, int32_t max_a_rows, DataSeriesModule &b_input,
      const std::map<std::string, std::string> &eq_columns,
      const std::map<std::string, std::string> &keep_columns,
-     const std::string &output_table_name);
+     const std::string &output_table_name, uint32_t nthreads);
 
     OutputSeriesModule::OSMPtr makeStarJoinModule
     (DataSeriesModule &fact_input, const std::vector<Dimension> &dimensions,
      const std::string &output_table_name,
      const std::map<std::string, std::string> &fact_columns,
      const std::vector<DimensionFactJoin> &dimension_fact_join_in,
-     const HashMap< std::string, boost::shared_ptr<DataSeriesModule> > &dimension_modules);
+     const HashMap< std::string, boost::shared_ptr<DataSeriesModule> > &dimension_modules,
+     uint32_t nthreads);
 
     DataSeriesModule::Ptr makeSelectModule(DataSeriesModule &source, 
                                            const std::string &where_expr_str);
@@ -68,7 +78,8 @@ namespace dataseries {
      const std::string &output_table_name);
 
     OutputSeriesModule::OSMPtr makeSortModule
-    (DataSeriesModule &source, const std::vector<SortColumn> &sort_by);
+    (DataSeriesModule &source, const std::vector<SortColumn> &sort_by, uint64_t max_memory,
+     const std::string &output_table_name, uint32_t nthreads);
 
     OutputSeriesModule::OSMPtr makeExprTransformModule
     (DataSeriesModule &source, const std::vector<ExprColumn> &expr_columns,
@@ -0,0 +1,132 @@
+#include <string.h>
+
+#include <boost/foreach.hpp>
+
+#include "SortKey.hpp"
+
+using namespace std;
+using namespace dataseries;
+using boost::format;
+
+namespace {
+    // nulls first, values, nulls last
+    const uint8_t marker_null_first = 0, marker_value = 1, marker_null_last = 2;
+
+    void appendBigEndian(uint64_t v, unsigned size, vector<uint8_t> &keys) {
+        for (unsigned shift = size * 8; shift > 0; shift -= 8) {
+            keys.push_back(static_cast<uint8_t>(v >> (shift - 8)));
+        }
+    }
+
+    // size of the encoded value, or 0 for variable32
+    size_t valueSize(const GeneralField &field) {
+        switch (field.getType())
+            {
+            case ExtentType::ft_bool: case ExtentType::ft_byte: return 1;
+            case ExtentType::ft_int32: return 4;
+            case ExtentType::ft_int64: case ExtentType::ft_double: return 8;
+            case ExtentType::ft_fixedwidth:
+                return static_cast<const GF_FixedWidth &>(field).size();
+            case ExtentType::ft_variable32: return 0;
+            default:
+                FATAL_ERROR(format("can not sort on a field of type %s")
+                            % ExtentType::fieldTypeString(field.getType()));
+                return 0;
+            }
+    }
+}
+
+SortKey::SortKey(const vector<SortColumnImpl> &columns)
+    : columns(columns), fixed_size(0)
+{
+    BOOST_FOREACH(const SortColumnImpl &c, columns) {
+        size_t size = valueSize(*c.field);
+        if (size == 0) {
+            fixed_size = 0;
+            break;
+        }
+        fixed_size += 1 + size;
+    }
+}
+
+void SortKey::append(const Extent &e, const SEP_RowOffset &offset, vector<uint8_t> &keys) const {
+    BOOST_FOREACH(const SortColumnImpl &c, columns) {
+        const GeneralField &field(*c.field);
+        if (field.isNull(e, offset)) {
+            keys.push_back(c.null_mode == NM_First ? marker_null_first : marker_null_last);
+            keys.resize(keys.size() + valueSize(field), 0);
+            continue;
+        }
+        keys.push_back(marker_value);
+        size_t start = keys.size();
+        switch (field.getType())
+            {
+            case ExtentType::ft_bool:
+                keys.push_back(static_cast<const GF_Bool &>(field).myfield.val(e, offset) ? 1 : 0);
+                break;
+            case ExtentType::ft_byte:
+                keys.push_back(static_cast<const GF_Byte &>(field).myfield.val(e, offset));
+                break;
+            case ExtentType::ft_int32: {
+                uint32_t v = static_cast<const GF_Int32 &>(field).myfield.val(e, offset);
+                appendBigEndian(v ^ 0x80000000U, 4, keys);
+                break;
+            }
+            case ExtentType::ft_int64: {
+                uint64_t v = static_cast<const GF_Int64 &>(field).myfield.val(e, offset);
+                appendBigEndian(v ^ 0x8000000000000000ULL, 8, keys);
+                break;
+            }
+            case ExtentType::ft_double: {
+                double d = static_cast<const GF_Double &>(field).myfield.val(e, offset);
+                if (d == 0) {
+                    d = 0; // -0.0 == 0.0, so they have to encode the same
+                }
+                uint64_t v;
+                memcpy(&v, &d, sizeof(v));
+                if (d != d) {
+                    v = 0x7FF8000000000000ULL; // all NaNs are the same, after +inf
+                }
+                v = (v & 0x8000000000000000ULL) ? ~v : v ^ 0x8000000000000000ULL;
+                appendBigEndian(v, 8, keys);
+                break;
+            }
+            case ExtentType::ft_variable32: {
+                const Variable32Field &f(static_cast<const GF_Variable32 &>(field).myfield);
+                const uint8_t *v = f.val(e, offset);
+                int32_t size = f.size(e, offset);
+                for (int32_t i = 0; i < size; ++i) {
+                    keys.push_back(v[i]);
+                    if (v[i] == 0) {
+                        keys.push_back(0xFF);
+                    }
+                }
+                keys.push_back(0);
+                keys.push_back(0);
+                break;
+            }
+            case ExtentType::ft_fixedwidth: {
+                const FixedWidthField &f(static_cast<const GF_FixedWidth &>(field).myfield);
+                const uint8_t *v = f.val(e, offset);
+                keys.insert(keys.end(), v, v + f.size());
+                break;
+            }
+            default:
+                FATAL_ERROR("internal error, unexpected type");
+            }
+        if (!c.sort_less) {
+            for (size_t i = start; i < keys.size(); ++i) {
+                keys[i] = ~keys[i];
+            }
+        }
+    }
+}
+
+int SortKey::compare(const uint8_t *a, size_t a_size, const uint8_t *b, size_t b_size) {
+    size_t size = min(a_size, b_size);
+    int ret = size == 0 ? 0 : memcmp(a, b, size);
+    if (ret != 0) {
+        return ret;
+    }
+    return a_size < b_size ? -1 : (a_size > b_size ? 1 : 0);
+}
@@ -0,0 +1,37 @@
+#ifndef DATASERIES_SORTKEY_HPP
+#define DATASERIES_SORTKEY_HPP
+
+#include <vector>
+
+#include "ServerModules.hpp"
+
+// Encodes the sort columns of a row into a normalized key, a string of bytes that compares with
+// memcmp in the order of the sort, so that sorting compares keys rather than building GeneralValues
+// for each column of each comparison.  Each column is a marker byte that puts nulls first or last,
+// followed by the value: integers big-endian with the sign bit flipped, doubles the same but with
+// all the bits flipped if negative, fixed width values as is, and variable32 values with each 0
+// byte escaped as 0 255 and ending with 0 0.  The value of a descending column is inverted.  A null
+// value is all 0s, so keys without variable32 columns are all the same size.  Doubles compare as
+// with <, except that NaNs sort after all other values.  A key is never a prefix of another key.
+class SortKey {
+  public:
+    SortKey(const std::vector<dataseries::SortColumnImpl> &columns);
+
+    /// append the key of the row at offset in e to keys; any number of threads can do this at once
+    void append(const Extent &e, const dataseries::SEP_RowOffset &offset,
+                std::vector<uint8_t> &keys) const;
+
+    /// the size of every key, or 0 if the size varies
+    size_t fixedSize() const {
+        return fixed_size;
+    }
+
+    /// < 0, 0 or > 0 as key a sorts before, with or after key b
+    static int compare(const uint8_t *a, size_t a_size, const uint8_t *b, size_t b_size);
+
+  private:
+    std::vector<dataseries::SortColumnImpl> columns;
+    size_t fixed_size;
+};
+
+#endif
@@ -1,4 +1,11 @@
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+
+#include <DataSeries/TypeIndexModule.hpp>
+
 #include "DSSModule.hpp"
+#include "SortKey.hpp"
 
 #include <new> // losertree.h needs this and forgot to include it.
 #include <parallel/losertree.h>
@@ -11,6 +18,20 @@
    generate C++ source code for specific operations, we don't need the complication of the
    template, and so we create yet another module to be more in the style of the server */
 
+/* The input is read in batches of extents, and the threads sort the extents of a batch, each
+   extent on its own.  Once the sorted extents take more than max_memory bytes, they are split into
+   one contiguous group per thread, and each thread merges its group into a sorted run in a
+   temporary file in the working directory.  At the end of the input, if nothing was spilled the
+   sorted extents are merged in memory.  Otherwise the rest are spilled as well, and the runs are
+   merged merge_fan_in at a time, in parallel, until there are few enough to merge into the output.
+   Runs, and the groups merged into a run, are always consecutive, and ties in a merge go to the
+   earlier source, so the sort stays stable.
+
+   Rows are compared by their normalized keys (see SortKey.hpp), which are made once for each row
+   of an extent when it is sorted, or when it is read back from a run.  An extent is sorted on the
+   first 8 bytes of each key, as an integer, only comparing the rest of the keys on a tie; if the
+   keys are no more than 8 bytes, it is radix sorted instead. */
+
 #if 0
 #include <algorithm>
 #include <vector>
@@ -46,87 +67,232 @@ int main() {
 
 class SortModule : public OutputSeriesModule {
   public:
-    SortModule(DataSeriesModule &source, const vector<SortColumn> &sort_by)
-            : source(source), sort_by(sort_by), copier(input_series, output_series), ercs(),
-              sorted_extents(), merge()
+    // runs merged at once; each run being read buffers up to run_prefetch_bytes of compressed
+    // extents and twice that unpacked
+    static const uint32_t merge_fan_in = 32;
+    static const uint32_t run_prefetch_bytes = 1024 * 1024;
+    // extents per thread read at once
+    static const uint32_t batch_extents_per_thread = 2;
+
+    SortModule(DataSeriesModule &source, const vector<SortColumn> &sort_by, uint64_t max_memory,
+               const string &output_table_name, uint32_t nthreads)
+            : source(source), sort_by(sort_by), max_memory(max_memory),
+              output_table_name(output_table_name), nthreads(max(nthreads, 1U)),
+              copier(input_series, output_series), sort_key(), sorted(), sorted_bytes(0), runs(),
+              merging(), run_count(0), merge()
     { }
 
-    virtual ~SortModule() { }
+    virtual ~SortModule() {
+        merge.reset(); // closes the runs it is reading
+        removeRuns(runs);
+        removeRuns(merging);
+    }
 
-    struct ExtentRowCompareState {
-        ExtentRowCompareState() : extent(), columns() { }
-        Extent::Ptr extent;
-        vector<SortColumnImpl> columns;
-    };
+    // A sorted input to a merge: either an extent sorted in memory, or a run, which is read an
+    // extent at a time.  Each row has its key; the rows are in sorted order.
+    struct MergeSource {
+        typedef boost::shared_ptr<MergeSource> Ptr;
 
-    static bool strictlyLessThan(const Extent::Ptr &ea, const SEP_RowOffset &oa,
-                                 const Extent::Ptr &eb, const SEP_RowOffset &ob,
-                                 const vector<SortColumnImpl> &columns) {
-        BOOST_FOREACH(const SortColumnImpl &c, columns) {
-            bool a_null = c.field->isNull(*ea, oa);
-            bool b_null = c.field->isNull(*eb, ob);
-
-            if (a_null || b_null) {
-                if (a_null && !b_null) { //         a < b : a > b
-                    return c.null_mode == NM_First ? true : false;
-                } else if (!a_null && b_null) { //   a > b : a < b
-                    return c.null_mode == NM_First ? false : true;
-                } else {
-                    // ==; keep going
-                }
-            } else {
-                GeneralValue va(c.field->val(*ea, oa));
-                GeneralValue vb(c.field->val(*eb, ob));
-                if (va < vb) {
-                    return c.sort_less;
-                } else if (vb < va) {
-                    return !c.sort_less;
+        MergeSource(Extent::Ptr e) : e(e), order(), keys(), key_offsets(), pos(0), run() { }
+
+        MergeSource(const string &path, const string &type_name, const SortKey &sort_key)
+            : e(), order(), keys(), key_offsets(), pos(0), run(new TypeIndexModule(type_name)) {
+            run->addSource(path);
+            run->startPrefetching(run_prefetch_bytes, 2 * run_prefetch_bytes, 1);
+            readRun(sort_key);
+        }
+
+        // make the key of every row of the extent, leaving the rows in order
+        void makeKeys(const SortKey &sort_key) {
+            uint32_t record_size = e->getTypePtr()->fixedrecordsize();
+            uint32_t nrecords = e->nRecords();
+            keys.clear();
+            key_offsets.clear();
+            key_offsets.reserve(nrecords + 1);
+            order.clear();
+            order.reserve(nrecords);
+            for (uint32_t i = 0; i < nrecords; ++i) {
+                key_offsets.push_back(keys.size());
+                sort_key.append(*e, SEP_RowOffset(i * record_size, e), keys);
+                order.push_back(i);
+            }
+            key_offsets.push_back(keys.size());
+        }
+
+        size_t memoryUsage() const {
+            return e->size() + keys.size() + (order.size() + key_offsets.size()) * sizeof(uint32_t);
+        }
+
+        bool done() const {
+            return pos == order.size();
+        }
+
+        SEP_RowOffset row() const {
+            return SEP_RowOffset(order[pos] * e->getTypePtr()->fixedrecordsize(), e);
+        }
+
+        const uint8_t *key(uint32_t row) const {
+            return keys.empty() ? NULL : &keys[0] + key_offsets[row];
+        }
+
+        size_t keySize(uint32_t row) const {
+            return key_offsets[row + 1] - key_offsets[row];
+        }
+
+        // true if the current row sorts before the current row of other
+        bool before(const MergeSource &other) const {
+            uint32_t a = order[pos], b = other.order[other.pos];
+            return SortKey::compare(key(a), keySize(a), other.key(b), other.keySize(b)) < 0;
+        }
+
+        // move to the next row; an extent is dropped as soon as all its rows are used
+        void next(const SortKey &sort_key) {
+            ++pos;
+            if (done()) {
+                if (run != NULL) {
+                    readRun(sort_key);
                 } else {
-                    // ==; keep going
+                    e.reset();
+                    vector<uint32_t>().swap(order);
+                    vector<uint8_t>().swap(keys);
+                    vector<uint32_t>().swap(key_offsets);
+                    pos = 0;
                 }
             }
         }
-        return false; // all == so not <
-    }
 
-    class ExtentRowCompare {
-      public:
-        ExtentRowCompare(ExtentRowCompareState *state) : state(state) { }
-        ExtentRowCompare(const ExtentRowCompare &from) : state(from.state) { }
-        ExtentRowCompare &operator =(const ExtentRowCompare &rhs) {
-            state = rhs.state;
-            return *this;
+        void readRun(const SortKey &sort_key) {
+            order.clear();
+            pos = 0;
+            while (order.empty()) {
+                e = run->getSharedExtent();
+                if (e == NULL) {
+                    run.reset();
+                    return;
+                }
+                makeKeys(sort_key);
+            }
         }
 
-        bool operator ()(const SEP_RowOffset &a, const SEP_RowOffset &b) const {
-            return strictlyLessThan(state->extent, a, state->extent, b, state->columns);
-        }
+        Extent::Ptr e;
+        vector<uint32_t> order; // rows in sorted order
+        vector<uint8_t> keys;
+        vector<uint32_t> key_offsets; // key of row i is keys[key_offsets[i] .. key_offsets[i+1])
+        size_t pos;
+        boost::scoped_ptr<TypeIndexModule> run; // NULL for an extent, or once a run is read
+    };
 
-        const ExtentRowCompareState *state;
+    // A row of an extent being sorted
+    struct KeyRow {
+        uint64_t prefix; // the first 8 bytes of the key, big-endian, padded with 0s
+        uint32_t row;
     };
-        
-    struct SortedExtent {
-        SortedExtent(Extent::Ptr e) : e(e), offsets(), pos() { }
-        typedef boost::shared_ptr<SortedExtent> Ptr;
 
-        Extent::Ptr e;
-        vector<SEP_RowOffset> offsets;
-        vector<SEP_RowOffset>::iterator pos;
+    struct KeyRowLess {
+        KeyRowLess(const MergeSource &se) : se(se) { }
+
+        bool operator()(const KeyRow &a, const KeyRow &b) const {
+            if (a.prefix != b.prefix) {
+                return a.prefix < b.prefix;
+            }
+            int ret = SortKey::compare(se.key(a.row), se.keySize(a.row),
+                                       se.key(b.row), se.keySize(b.row));
+            return ret != 0 ? ret < 0 : a.row < b.row;
+        }
+
+        const MergeSource &se;
     };
-    
+
+    // stable sort of rows on the first key_size bytes of their prefixes
+    static void radixSort(vector<KeyRow> &rows, size_t key_size) {
+        vector<KeyRow> tmp(rows.size());
+        for (size_t byte = key_size; byte > 0; --byte) {
+            unsigned shift = 64 - 8 * byte;
+            size_t counts[257];
+            fill(counts, counts + 257, 0);
+            BOOST_FOREACH(const KeyRow &r, rows) {
+                ++counts[((r.prefix >> shift) & 0xFF) + 1];
+            }
+            if (*max_element(counts + 1, counts + 257) == rows.size()) {
+                continue; // every row has the same byte
+            }
+            for (size_t i = 1; i < 257; ++i) {
+                counts[i] += counts[i - 1];
+            }
+            BOOST_FOREACH(const KeyRow &r, rows) {
+                tmp[counts[(r.prefix >> shift) & 0xFF]++] = r;
+            }
+            rows.swap(tmp);
+        }
+    }
+
+    class Merge;
+
     struct LoserTreeCompare {
-        LoserTreeCompare(SortModule *sm) : sm(sm) { }
+        LoserTreeCompare(const Merge *merge) : merge(merge) { }
         bool operator()(uint32_t ia, uint32_t ib) const {
-            const SortedExtent &sea(*sm->sorted_extents[ia]);
-            const SortedExtent &seb(*sm->sorted_extents[ib]);
-            return strictlyLessThan(sea.e, *sea.pos, seb.e, *seb.pos, sm->ercs.columns);
+            return merge->sources[ia]->before(*merge->sources[ib]);
         }
 
-        const SortModule *sm;
-    };        
+        const Merge *merge;
+    };
 
     typedef __gnu_parallel::LoserTree<true, uint32_t, LoserTreeCompare> LoserTree;
 
+    // Merges sorted sources in order; ties go to the earlier source
+    class Merge {
+      public:
+        // sort_key may be NULL if there are no sources
+        Merge(const vector<MergeSource::Ptr> &in_sources, const SortKey *sort_key)
+            : sources(), sort_key(sort_key), tree(), min(0) {
+            BOOST_FOREACH(const MergeSource::Ptr &s, in_sources) {
+                if (!s->done()) {
+                    sources.push_back(s);
+                }
+            }
+            // loser tree gets the single source case wrong, and goes into an infinite loop
+            // (log_2(0) is a bad idea with a check 0 * 2^n > 0), so that case is done without it.
+            if (sources.size() > 1) {
+                tree.reset(new LoserTree(sources.size(), LoserTreeCompare(this)));
+                for (uint32_t i = 0; i < sources.size(); ++i) {
+                    tree->insert_start(i, i, false);
+                }
+                tree->init();
+            }
+        }
+
+        // the source with the next row, or NULL once all the rows are merged
+        MergeSource *top() {
+            if (tree == NULL) {
+                return sources.empty() || sources[0]->done() ? NULL : sources[0].get();
+            }
+            int32_t got = tree->get_min_source();
+            if (got < 0 || static_cast<size_t>(got) >= sources.size()) {
+                return NULL; // loser tree exit path 1
+            }
+            if (sources[got]->done()) {
+                return NULL; // loser tree exit path 2
+            }
+            min = got;
+            return sources[min].get();
+        }
+
+        // move past the row returned by top()
+        void pop() {
+            if (tree == NULL) {
+                sources[0]->next(*sort_key);
+            } else {
+                sources[min]->next(*sort_key);
+                tree->delete_min_insert(min, sources[min]->done());
+            }
+        }
+
+        vector<MergeSource::Ptr> sources;
+        const SortKey *sort_key;
+        boost::scoped_ptr<LoserTree> tree;
+        uint32_t min;
+    };
+
     void firstExtent(Extent &in) {
         const ExtentType::Ptr t(in.getTypePtr());
         input_series.setType(t);
@@ -134,69 +300,209 @@ class SortModule : public OutputSeriesModule {
 
         copier.prep();
 
+        vector<SortColumnImpl> columns;
         BOOST_FOREACH(SortColumn &by, sort_by) {
             TINVARIANT(by.sort_mode == SM_Ascending || by.sort_mode == SM_Decending);
             TINVARIANT(by.null_mode == NM_First || by.null_mode == NM_Last);
-            ercs.columns.push_back(SortColumnImpl(GeneralField::make(input_series, by.column),
-                                                  by.sort_mode == SM_Ascending ? true : false,
-                                                  by.null_mode));
+            columns.push_back(SortColumnImpl(GeneralField::make(input_series, by.column),
+                                             by.sort_mode == SM_Ascending ? true : false,
+                                             by.null_mode));
         }
+        sort_key.reset(new SortKey(columns));
     }
 
-    void sortExtent(Extent::Ptr in) {
-        ercs.extent = in;
-        SortedExtent::Ptr se(new SortedExtent(in));
-        se->offsets.reserve(in->nRecords());
-        for (input_series.setExtent(in); input_series.more(); input_series.next()) {
-            se->offsets.push_back(input_series.getRowOffset());
+    // sort sorted[first + item]; called on the threads
+    void sortExtent(size_t first, uint32_t item) {
+        MergeSource &se(*sorted[first + item]);
+        se.makeKeys(*sort_key);
+
+        vector<KeyRow> rows(se.order.size());
+        for (uint32_t i = 0; i < rows.size(); ++i) {
+            const uint8_t *key = se.key(i);
+            size_t key_size = se.keySize(i);
+            uint64_t prefix = 0;
+            for (size_t j = 0; j < 8; ++j) {
+                prefix = (prefix << 8) | (j < key_size ? key[j] : 0);
+            }
+            rows[i].prefix = prefix;
+            rows[i].row = i;
         }
 
-        stable_sort(se->offsets.begin(), se->offsets.end(), ExtentRowCompare(&ercs));
+        size_t fixed_size = sort_key->fixedSize();
+        if (fixed_size > 0 && fixed_size <= 8) {
+            radixSort(rows, fixed_size);
+        } else {
+            sort(rows.begin(), rows.end(), KeyRowLess(se));
+        }
+        for (uint32_t i = 0; i < rows.size(); ++i) {
+            se.order[i] = rows[i].row;
+        }
+    }
 
-        ercs.extent.reset();
-        sorted_extents.push_back(se);
+    // read and sort all of the input, spilling runs whenever the sorted extents are too big
+    void sortInput() {
+        vector<Extent::Ptr> batch;
+        bool input_done = false;
+        while (!input_done) {
+            batch.clear();
+            while (batch.size() < nthreads * batch_extents_per_thread) {
+                Extent::Ptr in = source.getSharedExtent();
+                if (in == NULL) {
+                    input_done = true;
+                    break;
+                }
+                if (input_series.getTypePtr() == NULL) {
+                    firstExtent(*in);
+                }
+                if (in->nRecords() > 0) {
+                    batch.push_back(in);
+                }
+            }
+
+            size_t first = sorted.size();
+            BOOST_FOREACH(Extent::Ptr &in, batch) {
+                sorted.push_back(MergeSource::Ptr(new MergeSource(in)));
+            }
+            parallelFor(nthreads, batch.size(),
+                        boost::bind(&SortModule::sortExtent, this, first, _2));
+            for (size_t i = first; i < sorted.size(); ++i) {
+                sorted_bytes += sorted[i]->memoryUsage();
+            }
+            if (sorted_bytes > max_memory) {
+                spillSorted();
+            }
+        }
     }
 
-    Extent::Ptr processSingleMerge() {
-        output_series.newExtent();
-        // loser tree gets this case wrong, and goes into an infinite loop (log_2(0) is a bad
-        // idea with a check 0 * 2^n > 0.
-        SortedExtent &se(*sorted_extents[0]);
-        for (se.pos = se.offsets.begin(); se.pos != se.offsets.end(); ++se.pos) {
-            output_series.newRecord();
-            copier.copyRecord(*se.e, *se.pos);
+    string runPath() {
+        return str(format("tmp.sort.%s.%d") % output_table_name % run_count++);
+    }
+
+    static void removeRuns(vector<string> &paths) {
+        BOOST_FOREACH(const string &path, paths) {
+            unlink(path.c_str());
         }
-        sorted_extents.clear();
-        return returnOutputSeries();
+        paths.clear();
     }
 
-    Extent::Ptr cleanupMultiMerge() {
-        BOOST_FOREACH(SortedExtent::Ptr p, sorted_extents) {
-            SINVARIANT(p->pos == p->offsets.end());
+    // merge sources into a new run in path; called on the threads
+    void writeRun(const vector<MergeSource::Ptr> &sources, const string &path) {
+        const ExtentType::Ptr type(input_series.getTypePtr());
+        ExtentSeries run_input(type), run_series(type);
+        ExtentRecordCopy run_copier(run_input, run_series);
+        DataSeriesSink sink(path, Extent::compression_algs[Extent::compress_mode_lzf].compress_flag,
+                            1);
+        ExtentTypeLibrary library;
+        library.registerType(type);
+        sink.writeExtentLibrary(library);
+        OutputModule output(sink, run_series, type, 96*1024);
+
+        Merge run_merge(sources, sort_key.get());
+        for (MergeSource *s = run_merge.top(); s != NULL; s = run_merge.top()) {
+            output.newRecord();
+            run_copier.copyRecord(*s->e, s->row());
+            run_merge.pop();
         }
-        sorted_extents.clear();
-        return returnOutputSeries();
+        output.close();
+        sink.close();
     }
 
-    Extent::Ptr processMerge() {
-        LintelLogDebug("SortModule", "doing multi-extent-merge");
-        output_series.newExtent();
-        while (true) {
-            int min = merge->get_min_source();
-            if (min < 0 || static_cast<size_t>(min) >= sorted_extents.size()) {
-                // loser tree exit path 1
-                return cleanupMultiMerge();
+    void writeSortedRun(const vector< vector<MergeSource::Ptr> > &groups,
+                        const vector<string> &paths, uint32_t item) {
+        writeRun(groups[item], paths[item]);
+    }
+
+    // merge the sorted extents into runs, one group of consecutive extents per thread
+    void spillSorted() {
+        SINVARIANT(!sorted.empty());
+        uint32_t ngroups = min(nthreads, static_cast<uint32_t>(sorted.size()));
+        vector< vector<MergeSource::Ptr> > groups(ngroups);
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            groups[i * ngroups / sorted.size()].push_back(sorted[i]);
+        }
+        vector<string> paths;
+        for (uint32_t i = 0; i < ngroups; ++i) {
+            paths.push_back(runPath());
+        }
+        LintelLogDebug("SortModule", format("spilling %d bytes of %d extents to %d runs")
+                       % sorted_bytes % sorted.size() % ngroups);
+        runs.insert(runs.end(), paths.begin(), paths.end());
+        parallelFor(nthreads, ngroups, boost::bind(&SortModule::writeSortedRun, this,
+                                                   boost::cref(groups), boost::cref(paths), _2));
+        sorted.clear();
+        sorted_bytes = 0;
+    }
+
+    void mergeRunGroup(const vector<string> &paths, uint32_t item) {
+        vector<MergeSource::Ptr> sources;
+        for (size_t i = item * merge_fan_in; i < merging.size() && i < (item + 1) * merge_fan_in;
+             ++i) {
+            sources.push_back(MergeSource::Ptr
+                              (new MergeSource(merging[i], input_series.getTypePtr()->getName(),
+                                               *sort_key)));
+        }
+        writeRun(sources, paths[item]);
+    }
+
+    // merge consecutive runs merge_fan_in at a time until they can all be merged at once; each
+    // merge reads merge_fan_in runs, so fewer of them run at once with a small max_memory
+    void mergeRuns() {
+        uint64_t merge_memory = static_cast<uint64_t>(merge_fan_in) * 3 * run_prefetch_bytes;
+        uint32_t merge_threads = max(static_cast<uint64_t>(1),
+                                     min(static_cast<uint64_t>(nthreads),
+                                         max_memory / merge_memory));
+        while (runs.size() > merge_fan_in) {
+            SINVARIANT(merging.empty());
+            merging.swap(runs);
+            uint32_t nmerges = (merging.size() + merge_fan_in - 1) / merge_fan_in;
+            for (uint32_t i = 0; i < nmerges; ++i) {
+                runs.push_back(runPath());
+            }
+            LintelLogDebug("SortModule", format("merging %d runs into %d")
+                           % merging.size() % nmerges);
+            parallelFor(merge_threads, nmerges, boost::bind(&SortModule::mergeRunGroup, this,
+                                                            boost::cref(runs), _2));
+            removeRuns(merging);
+        }
+    }
+
+    void startMerge() {
+        vector<MergeSource::Ptr> sources;
+        if (runs.empty()) {
+            LintelLogDebug("SortModule", format("merging %d extents in memory") % sorted.size());
+            sources.swap(sorted);
+        } else {
+            if (!sorted.empty()) {
+                spillSorted();
             }
-            SortedExtent &se(*sorted_extents[min]);
-            if (se.pos == se.offsets.end()) {
-                // loser tree exit path 2
-                return cleanupMultiMerge();
+            mergeRuns();
+            LintelLogDebug("SortModule", format("merging %d runs") % runs.size());
+            BOOST_FOREACH(const string &path, runs) {
+                sources.push_back(MergeSource::Ptr
+                                  (new MergeSource(path, input_series.getTypePtr()->getName(),
+                                                   *sort_key)));
             }
+        }
+        sorted_bytes = 0;
+        merge.reset(new Merge(sources, sort_key.get()));
+    }
+
+    virtual Extent::Ptr getSharedExtent() {
+        if (merge == NULL) {
+            sortInput();
+            startMerge();
+        }
 
+        MergeSource *s = merge->top();
+        if (s == NULL) {
+            removeRuns(runs);
+            return Extent::Ptr();
+        }
+        output_series.newExtent();
+        for (; s != NULL; s = merge->top()) {
             output_series.newRecord();
-            copier.copyRecord(*se.e, *se.pos);
-            ++se.pos;
-            merge->delete_min_insert(min, se.pos == se.offsets.end());
+            copier.copyRecord(*s->e, s->row());
+            merge->pop();
             if (output_series.getExtentRef().size() > 96*1024) {
                 break;
             }
@@ -204,49 +510,24 @@ class SortModule : public OutputSeriesModule {
         return returnOutputSeries();
     }
 
-    virtual Extent::Ptr getSharedExtent() {
-        if (sorted_extents.empty()) {
-            while (true) {
-                Extent::Ptr in = source.getSharedExtent();
-                if (in == NULL) {
-                    break;
-                }
-                if (input_series.getTypePtr() == NULL) {
-                    firstExtent(*in);
-                }
-                
-                sortExtent(in);
-            }
-
-            if (sorted_extents.empty()) {
-                return Extent::Ptr();
-            } else if (sorted_extents.size() == 1) {
-                return processSingleMerge();
-            } else {
-                merge = new LoserTree(sorted_extents.size(), LoserTreeCompare(this));
-
-                for (uint32_t i = 0; i < sorted_extents.size(); ++i) {
-                    merge->insert_start(i, i, false);
-                    sorted_extents[i]->pos = sorted_extents[i]->offsets.begin();
-                }
-                merge->init();
-            }
-        } 
-
-        return processMerge();
-    }
-        
     DataSeriesModule &source;
     vector<SortColumn> sort_by;
+    const uint64_t max_memory;
+    const string output_table_name;
+    const uint32_t nthreads;
     ExtentSeries input_series;
     ExtentRecordCopy copier;
-    ExtentRowCompareState ercs;
-    vector<SortedExtent::Ptr> sorted_extents;
-    LoserTree *merge;
+    boost::scoped_ptr<SortKey> sort_key;
+    vector<MergeSource::Ptr> sorted; // sorted extents that have not been spilled
+    uint64_t sorted_bytes;
+    vector<string> runs, merging;
+    uint32_t run_count;
+    boost::scoped_ptr<Merge> merge;
 };
 
 OutputSeriesModule::OSMPtr dataseries::makeSortModule
-(DataSeriesModule &source, const vector<SortColumn> &sort_by) {
-    return OutputSeriesModule::OSMPtr(new SortModule(source, sort_by));
+(DataSeriesModule &source, const vector<SortColumn> &sort_by, uint64_t max_memory,
+ const string &output_table_name, uint32_t nthreads) {
+    return OutputSeriesModule::OSMPtr(new SortModule(source, sort_by, max_memory,
+                                                     output_table_name, nthreads));
 }
-
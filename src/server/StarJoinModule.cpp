@@ -1,3 +1,7 @@
+#include <deque>
+
+#include <boost/bind.hpp>
+
 #include "DSSModule.hpp"
 #include "JoinModule.hpp"
 
@@ -14,14 +18,23 @@
 // If the lookup is missing, it can either cause us to skip that row in the fact table, leave the
 // output values unchanged, or set it to a specified value.  The middle option allows for lookups
 // in multiple tables to select the last set value.
+//
+// Once the dimensions are loaded they are only read, so the fact table is read in batches of
+// extents which are joined in parallel, each by one of nthreads threads; the output extents are
+// returned in the order of the fact extents.
 class StarJoinModule : public JoinModule {
   public:
+    // extents per thread read at once
+    static const uint32_t batch_extents_per_thread = 2;
+
     StarJoinModule(DataSeriesModule &fact_input, const vector<Dimension> &dimensions,
                    const string &output_table_name, const map<string, string> &fact_columns,
                    const vector<DimensionFactJoin> &dimension_fact_join_in,
-                   const HashMap< string, shared_ptr<DataSeriesModule> > &dimension_modules) 
+                   const HashMap< string, shared_ptr<DataSeriesModule> > &dimension_modules,
+                   uint32_t nthreads) 
             : fact_input(fact_input), dimensions(dimensions), output_table_name(output_table_name),
-              fact_column_names(fact_columns), dimension_modules(dimension_modules)
+              fact_column_names(fact_columns), dimension_modules(dimension_modules),
+              nthreads(max(nthreads, 1U)), fact_done(false)
     { 
         BOOST_FOREACH(const DimensionFactJoin &dfj, dimension_fact_join_in) {
             SJM_Join::Ptr p(new SJM_Join(dfj));
@@ -32,7 +45,7 @@ class StarJoinModule : public JoinModule {
     struct SJM_Dimension : public Dimension {
         typedef boost::shared_ptr<SJM_Dimension> Ptr;
 
-        SJM_Dimension(Dimension &d) : Dimension(d), dimension_type() { }
+        SJM_Dimension(Dimension &d) : Dimension(d), dimension_type(), dimension_data() { }
         ~SJM_Dimension() throw () { }
 
         size_t valuePos(const string &source_field_name) {
@@ -45,19 +58,29 @@ class StarJoinModule : public JoinModule {
         }
 
         ExtentType::Ptr dimension_type;
-        HashMap<GVVec, GVVec> dimension_data; // map dimension key to dimension values
+        // map dimension key to dimension values, one row per key
+        boost::shared_ptr<JoinHashTable> dimension_data;
     };
 
     struct SJM_Join : public DimensionFactJoin {
         typedef boost::shared_ptr<SJM_Join> Ptr;
         
-        SJM_Join(const DimensionFactJoin &d) : DimensionFactJoin(d), dimension(), join_data() { }
+        SJM_Join(const DimensionFactJoin &d) : DimensionFactJoin(d), dimension() { }
         virtual ~SJM_Join() throw () { }
         SJM_Dimension::Ptr dimension;
-        vector<GeneralField::Ptr> fact_fields;
-        vector<Extractor::Ptr> extractors;
-        GVVec join_key; // avoid constant resizes, just overwrite
-        GVVec *join_data; // temporary for the two-phase join
+        vector< pair<string, uint32_t> > value_columns; // output column, dimension value pos
+    };
+
+    // A thread's fields for joining fact rows
+    struct FactWorker {
+        typedef boost::shared_ptr<FactWorker> Ptr;
+
+        ExtentSeries fact_series, output_series;
+        vector<Extractor::Ptr> fact_fields;
+        vector< vector<GeneralField::Ptr> > join_keys; // by dimension_fact_join
+        vector< vector<Extractor::Ptr> > join_extractors;
+        vector<uint32_t> join_rows; // temporary for the two-phase join
+        vector<uint8_t> key_buf;
     };
 
     class DimensionModule : public RowAnalysisModule {
@@ -72,8 +95,6 @@ class StarJoinModule : public JoinModule {
         void firstExtent(const Extent &e) {
             LintelLogDebug("StarJoinModule/DimensionModule", format("first extent for %s via %s")
                            % dim.dimension_name % dim.source_table);
-            key_gv.resize(dim.key_columns.size());
-            value_gv.resize(dim.value_columns.size());
             series.setType(e.getTypePtr());
             BOOST_FOREACH(string key, dim.key_columns) {
                 key_gf.push_back(GeneralField::make(series, key));
@@ -83,13 +104,12 @@ class StarJoinModule : public JoinModule {
             }
             SINVARIANT(dim.dimension_type == NULL);
             dim.dimension_type = series.getTypePtr();
+            dim.dimension_data.reset(new JoinHashTable(key_gf, value_gf));
         }
 
         void processRow() {
-            key_gv.extract(key_gf);
-            value_gv.extract(value_gf);
-            dim.dimension_data[key_gv] = value_gv;
-            LintelLogDebug("StarJoinModule/Dimension", format("[%d] -> [%d]") % key_gv % value_gv);
+            // as with a map, the last row for a key wins
+            dim.dimension_data->add(dim.dimension_data->hashKey(key_gf), key_gf, value_gf, true);
         }
 
       protected:
@@ -100,7 +120,6 @@ class StarJoinModule : public JoinModule {
         SJM_Dimension &dim;
 
         vector<GeneralField::Ptr> key_gf, value_gf;
-        GVVec key_gv, value_gv;
     };
             
     void processDimensions() {
@@ -158,22 +177,17 @@ class StarJoinModule : public JoinModule {
         BOOST_FOREACH(ss_pair &v, fact_column_names) {
             TINVARIANT(fact_series.getTypePtr()->hasColumn(v.first));
             output_xml.append(renameField(fact_series.getTypePtr(), v.first, v.second));
-            fact_fields.push_back(ExtractorField::make(fact_series, v.first, v.second));
         }
         BOOST_FOREACH(const SJM_Join::Ptr dfj, dimension_fact_join) {
             SJM_Dimension::Ptr dim = name_to_sjm_dim[dfj->dimension_name];
             SINVARIANT(dim->dimension_type != NULL);
 
-            dfj->join_key.resize(dfj->fact_key_columns.size());
-            BOOST_FOREACH(const string &fact_col_name, dfj->fact_key_columns) {
-                dfj->fact_fields.push_back(GeneralField::make(fact_series, fact_col_name));
-            }
             BOOST_FOREACH(ss_pair &ev, dfj->extract_values) {
                 TINVARIANT(dim->dimension_type->hasColumn(ev.first));
                 size_t value_pos = dim->valuePos(ev.first);
                 TINVARIANT(value_pos != numeric_limits<size_t>::max());
                 output_xml.append(renameField(dim->dimension_type, ev.first, ev.second));
-                dfj->extractors.push_back(ExtractorValue::make(ev.second, value_pos));
+                dfj->value_columns.push_back(make_pair(ev.second, value_pos));
             }
         }
         output_xml.append("</ExtentType>\n");
@@ -182,10 +196,41 @@ class StarJoinModule : public JoinModule {
         ExtentTypeLibrary lib;
         output_series.setType(lib.registerTypePtr(output_xml));
 
-        Extractor::makeInto(fact_fields, output_series);
-        BOOST_FOREACH(const SJM_Join::Ptr dfj, dimension_fact_join) {
-            Extractor::makeInto(dfj->extractors, output_series);
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            workers.push_back(makeWorker());
+        }
+    }
+
+    FactWorker::Ptr makeWorker() {
+        FactWorker::Ptr w(new FactWorker());
+        w->fact_series.setType(fact_series.getTypePtr());
+        w->output_series.setType(output_series.getTypePtr());
+
+        typedef map<string, string>::value_type ss_pair;
+        BOOST_FOREACH(const ss_pair &v, fact_column_names) {
+            w->fact_fields.push_back(ExtractorField::make(w->fact_series, v.first, v.second));
+        }
+        Extractor::makeInto(w->fact_fields, w->output_series);
+
+        w->join_keys.resize(dimension_fact_join.size());
+        w->join_extractors.resize(dimension_fact_join.size());
+        w->join_rows.resize(dimension_fact_join.size(), JoinHashTable::none);
+        for (size_t i = 0; i < dimension_fact_join.size(); ++i) {
+            SJM_Join &dfj(*dimension_fact_join[i]);
+            BOOST_FOREACH(const string &fact_col_name, dfj.fact_key_columns) {
+                w->join_keys[i].push_back(GeneralField::make(w->fact_series, fact_col_name));
+            }
+            if (!dfj.dimension->dimension_data->matchesKey(w->join_keys[i])) {
+                requestError(format("fact key columns for dimension %s do not match the types"
+                                    " of its key columns") % dfj.dimension_name);
+            }
+            typedef pair<string, uint32_t> su_pair;
+            BOOST_FOREACH(const su_pair &c, dfj.value_columns) {
+                w->join_extractors[i].push_back(ExtractorValue::make(c.first, c.second));
+            }
+            Extractor::makeInto(w->join_extractors[i], w->output_series);
         }
+        return w;
     }
 
     void firstExtent(const Extent &fact_extent) {
@@ -195,48 +240,74 @@ class StarJoinModule : public JoinModule {
     }
 
     virtual Extent::Ptr getSharedExtent() {
-        Extent::Ptr e(fact_input.getSharedExtent());
-        if (e == NULL) {
-            return e;
-        }
-        if (output_series.getTypePtr() == NULL) {
-            firstExtent(*e);
+        if (ready.empty()) {
+            while (!fact_done && batch.size() < nthreads * batch_extents_per_thread) {
+                Extent::Ptr e(fact_input.getSharedExtent());
+                fact_done = e == NULL;
+                if (e != NULL) {
+                    batch.push_back(e);
+                }
+            }
+            if (batch.empty()) {
+                return Extent::Ptr();
+            }
+            if (output_series.getTypePtr() == NULL) {
+                firstExtent(*batch[0]);
+            }
+
+            batch_output.resize(batch.size());
+            parallelFor(nthreads, batch.size(), boost::bind(&StarJoinModule::joinExtent, this,
+                                                            _1, _2));
+            ready.assign(batch_output.begin(), batch_output.end());
+            batch.clear();
+            batch_output.clear();
         }
-        
-        output_series.newExtent();
+        Extent::Ptr ret = ready.front();
+        ready.pop_front();
+        return ret;
+    }
+
+    // join extent i of the batch
+    void joinExtent(uint32_t worker, uint32_t i) {
+        FactWorker &w(*workers[worker]);
+        w.output_series.newExtent();
         // TODO: do the resize to ~64-96k trick here rather than one in one out.
-        for (fact_series.setExtent(e); fact_series.more(); fact_series.next()) {
-            processRow();
+        for (w.fact_series.setExtent(batch[i]); w.fact_series.more(); w.fact_series.next()) {
+            processRow(w);
         }
-
-        return returnOutputSeries();
+        batch_output[i] = w.output_series.getSharedExtent();
+        w.output_series.clearExtent();
+        w.fact_series.clearExtent();
     }
 
-    void processRow() {
+    void processRow(FactWorker &w) {
         // Two phases, in the first phase we look up everything and verify that we're going
         // to generate an output row.   In the second phase we generate the output row.
 
-        BOOST_FOREACH(SJM_Join::Ptr join, dimension_fact_join) {
-            join->join_key.extract(join->fact_fields);
-            HashMap<GVVec, GVVec>::iterator i 
-                    = join->dimension->dimension_data.find(join->join_key);
-            if (i == join->dimension->dimension_data.end()) {
+        for (size_t i = 0; i < dimension_fact_join.size(); ++i) {
+            const JoinHashTable &data(*dimension_fact_join[i]->dimension->dimension_data);
+            vector<GeneralField::Ptr> &key(w.join_keys[i]);
+            SINVARIANT(w.join_rows[i] == JoinHashTable::none);
+            w.join_rows[i] = data.find(data.hashKey(key, w.key_buf), key, w.key_buf);
+            if (w.join_rows[i] == JoinHashTable::none) {
+                ostringstream key_str;
+                BOOST_FOREACH(GeneralField::Ptr f, key) {
+                    key_str << f->val();
+                }
                 FATAL_ERROR(format("unimplemented; unable to find key '%s' in dimension '%s'")
-                            % join->join_key % join->dimension->dimension_name);
-            } else {
-                SINVARIANT(join->join_data == NULL);
-                join->join_data = &i->second;
+                            % key_str.str() % dimension_fact_join[i]->dimension->dimension_name);
             }
         }
 
         // All dimensions exist, make an output row.
-        GVVec empty;
-        output_series.newRecord();
-        Extractor::extractAll(fact_fields, empty);
-        BOOST_FOREACH(SJM_Join::Ptr join, dimension_fact_join) {
-            SINVARIANT(join->join_data != NULL);
-            Extractor::extractAll(join->extractors, *join->join_data);
-            join->join_data = NULL;
+        w.output_series.newRecord();
+        Extractor::extractAll(w.fact_fields, NULL, 0);
+        for (size_t i = 0; i < dimension_fact_join.size(); ++i) {
+            SINVARIANT(w.join_rows[i] != JoinHashTable::none);
+            Extractor::extractAll(w.join_extractors[i],
+                                  dimension_fact_join[i]->dimension->dimension_data.get(),
+                                  w.join_rows[i]);
+            w.join_rows[i] = JoinHashTable::none;
         }
     }
 
@@ -248,7 +319,12 @@ class StarJoinModule : public JoinModule {
     vector<SJM_Join::Ptr> dimension_fact_join;
     HashMap< string, shared_ptr<DataSeriesModule> > dimension_modules; // source table to typeindexmodule
     HashMap<string, SJM_Dimension::Ptr> name_to_sjm_dim; // dimension name to SJM dimension
-    vector<Extractor::Ptr> fact_fields;
+
+    const uint32_t nthreads;
+    vector<FactWorker::Ptr> workers;
+    vector<Extent::Ptr> batch, batch_output;
+    deque<Extent::Ptr> ready; // output extents in order
+    bool fact_done;
 };    
 
 OutputSeriesModule::OSMPtr dataseries::makeStarJoinModule
@@ -256,8 +332,9 @@ OutputSeriesModule::OSMPtr dataseries::makeStarJoinModule
  const string &output_table_name,
  const map<string, string> &fact_columns,
  const vector<DimensionFactJoin> &dimension_fact_join_in,
- const HashMap< string, boost::shared_ptr<DataSeriesModule> > &dimension_modules) {
+ const HashMap< string, boost::shared_ptr<DataSeriesModule> > &dimension_modules,
+ uint32_t nthreads) {
     return OutputSeriesModule::OSMPtr(new StarJoinModule(fact_input, dimensions, output_table_name,
                                                          fact_columns, dimension_fact_join_in,
-                                                         dimension_modules));
+                                                         dimension_modules, nthreads));
 }
@@ -0,0 +1,126 @@
+#include <DataSeries/TypeIndexModule.hpp>
+
+#include "DSSModule.hpp"
+#include "TableCache.hpp"
+
+namespace {
+    // serves the extents of a cached table
+    class CachedTableModule : public DataSeriesModule {
+      public:
+        CachedTableModule(const TableCache::ExtentsPtr &extents) : extents(extents), next(0) { }
+
+        virtual Extent::Ptr getSharedExtent() {
+            if (next == extents->size()) {
+                return Extent::Ptr();
+            }
+            return (*extents)[next++];
+        }
+
+        TableCache::ExtentsPtr extents;
+        size_t next;
+    };
+
+    // passes through the extents of a table that is not cached, keeping them to add to the cache
+    // once the last one has been read
+    class CachingModule : public DataSeriesModule {
+      public:
+        CachingModule(TableCache &cache, const string &table, Clock::Tfrac last_update,
+                      const DataSeriesModule::Ptr &source)
+            : cache(cache), table(table), last_update(last_update), source(source),
+              extents(new TableCache::Extents()), bytes(0) { }
+
+        virtual Extent::Ptr getSharedExtent() {
+            Extent::Ptr e = source->getSharedExtent();
+            if (extents == NULL) {
+                return e;
+            }
+            if (e == NULL) {
+                cache.insert(table, last_update, extents, bytes);
+                extents.reset();
+                return e;
+            }
+            bytes += e->size();
+            if (bytes > cache.maxTableBytes()) {
+                extents.reset();
+            } else {
+                extents->push_back(e);
+            }
+            return e;
+        }
+
+        TableCache &cache;
+        const string table;
+        const Clock::Tfrac last_update;
+        DataSeriesModule::Ptr source;
+        boost::shared_ptr<TableCache::Extents> extents; // NULL once the table is too big
+        uint64_t bytes;
+    };
+}
+
+TableCache::TableCache(uint64_t max_bytes) : max_bytes(max_bytes), cached_bytes(0) { }
+
+TableCache::ExtentsPtr TableCache::lookup(const string &table, Clock::Tfrac last_update) {
+    PThreadScopedLock lock(mutex);
+    Entries::iterator i = entries.find(table);
+    if (i == entries.end() || i->second.last_update != last_update) {
+        LintelLogDebug("table-cache", format("miss on %s") % table);
+        return ExtentsPtr();
+    }
+    LintelLogDebug("table-cache", format("hit on %s") % table);
+    lru.splice(lru.begin(), lru, i->second.lru_position);
+    return i->second.extents;
+}
+
+void TableCache::insert(const string &table, Clock::Tfrac last_update, const ExtentsPtr &extents,
+                        uint64_t bytes) {
+    if (bytes > maxTableBytes()) {
+        return;
+    }
+    PThreadScopedLock lock(mutex);
+    Entries::iterator i = entries.find(table);
+    if (i != entries.end()) {
+        remove(i);
+    }
+    while (cached_bytes + bytes > max_bytes) {
+        SINVARIANT(!lru.empty());
+        remove(entries.find(lru.back()));
+    }
+    Entry &entry(entries[table]);
+    entry.last_update = last_update;
+    entry.extents = extents;
+    entry.bytes = bytes;
+    entry.lru_position = lru.insert(lru.begin(), table);
+    cached_bytes += bytes;
+    LintelLogDebug("table-cache", format("cached %s, %d bytes in %d extents; %d bytes total")
+                   % table % bytes % extents->size() % cached_bytes);
+}
+
+void TableCache::invalidate(const string &table) {
+    PThreadScopedLock lock(mutex);
+    Entries::iterator i = entries.find(table);
+    if (i != entries.end()) {
+        remove(i);
+    }
+}
+
+DataSeriesModule::Ptr TableCache::makeSource(const string &table, Clock::Tfrac last_update,
+                                             const string &type_name, const string &path) {
+    ExtentsPtr extents(lookup(table, last_update));
+    if (extents != NULL) {
+        return DataSeriesModule::Ptr(new CachedTableModule(extents));
+    }
+    TypeIndexModule::Ptr source(TypeIndexModule::make(type_name));
+    source->addSource(path);
+    if (maxTableBytes() == 0) {
+        return source;
+    } else {
+        return DataSeriesModule::Ptr(new CachingModule(*this, table, last_update, source));
+    }
+}
+
+void TableCache::remove(Entries::iterator i) {
+    SINVARIANT(i != entries.end() && cached_bytes >= i->second.bytes);
+    cached_bytes -= i->second.bytes;
+    lru.erase(i->second.lru_position);
+    entries.erase(i);
+}
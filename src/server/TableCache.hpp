@@ -0,0 +1,70 @@
+#ifndef DATASERIES_TABLECACHE_HPP
+#define DATASERIES_TABLECACHE_HPP
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <Lintel/Clock.hpp>
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/DataSeriesModule.hpp>
+
+// A memory-bounded LRU cache of the unpacked extents of the server's tables, so that tables read
+// by many requests, e.g. the dimensions of star joins, are not read and decompressed every time.
+// Entries are tagged with the last_update of the table they were read from, and a lookup for any
+// other version misses.  A table is only cached if it takes at most a quarter of the cache, so
+// that one scan of a large table can't push out all the small hot ones.  Cached extents are
+// shared by every request reading the table, so they must not be modified.
+class TableCache : boost::noncopyable {
+  public:
+    typedef std::vector<Extent::Ptr> Extents;
+    typedef boost::shared_ptr<const Extents> ExtentsPtr;
+
+    /// max_bytes of 0 disables the cache
+    TableCache(uint64_t max_bytes);
+
+    /// the extents of table as of last_update, or NULL if they are not cached
+    ExtentsPtr lookup(const std::string &table, Clock::Tfrac last_update);
+
+    /// add the extents of table as of last_update, replacing any other version
+    void insert(const std::string &table, Clock::Tfrac last_update, const ExtentsPtr &extents,
+                uint64_t bytes);
+
+    void invalidate(const std::string &table);
+
+    /// a source module returning the extents of table as of last_update.  Serves them from the
+    /// cache if it can; otherwise reads the extents of type_name from path, adding them to the
+    /// cache if all of them are read and they fit.
+    DataSeriesModule::Ptr makeSource(const std::string &table, Clock::Tfrac last_update,
+                                     const std::string &type_name, const std::string &path);
+
+    /// the most bytes of extents one table can have and still be cached
+    uint64_t maxTableBytes() const {
+        return max_bytes / 4;
+    }
+
+  private:
+    struct Entry {
+        Clock::Tfrac last_update;
+        ExtentsPtr extents;
+        uint64_t bytes;
+        std::list<std::string>::iterator lru_position;
+    };
+
+    typedef std::map<std::string, Entry> Entries;
+
+    void remove(Entries::iterator i);
+
+    const uint64_t max_bytes;
+    PThreadMutex mutex;
+    Entries entries;
+    std::list<std::string> lru; // most recently used first
+    uint64_t cached_bytes;
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "DSSModule.hpp"
+#include "TableDataReader.hpp"
+
+TableDataReader::TableDataReader(DataSeriesModule &source, DataEncoding encoding)
+    : source(source), encoding(encoding), done(false)
+{
+    if (encoding != DE_Strings && encoding != DE_Columns) {
+        ThrowError().requestError(format("invalid data encoding %d") % encoding);
+    }
+}
+
+void TableDataReader::read(TableData &into, uint32_t max_rows) {
+    into.rows.clear();
+    into.column_data.clear();
+    into.__isset.column_data = false;
+    if (encoding == DE_Strings) {
+        into.rows.reserve(max_rows < 4096 ? max_rows : 4096);
+    }
+
+    uint32_t nrows = 0;
+    for (; nrows < max_rows && haveRow(); ++series) {
+        if (nrows == 0 && encoding == DE_Columns) {
+            into.column_data.resize(fields.size());
+            into.__isset.column_data = true;
+        }
+        appendRow(into);
+        ++nrows;
+    }
+
+    if (!fields.empty()) {
+        into.columns = columns;
+        into.__isset.columns = true;
+    }
+    into.more_rows = haveRow();
+    into.__isset.more_rows = true;
+}
+
+bool TableDataReader::haveRow() {
+    while (!series.hasExtent() || !series.morerecords()) {
+        if (done) {
+            return false;
+        }
+        Extent::Ptr e = source.getSharedExtent();
+        if (e == NULL) {
+            done = true;
+            series.clearExtent();
+            return false;
+        }
+        if (fields.empty()) {
+            firstExtent(*e);
+        }
+        series.setExtent(e);
+    }
+    return true;
+}
+
+void TableDataReader::firstExtent(const Extent &e) {
+    series.setType(e.getTypePtr());
+    const ExtentType::Ptr extent_type(e.getTypePtr());
+    fields.reserve(extent_type->getNFields());
+    for (uint32_t i = 0; i < extent_type->getNFields(); ++i) {
+        string field_name(extent_type->getFieldName(i));
+        fields.push_back(GeneralField::make(series, field_name));
+        nullable.push_back(extent_type->getNullable(field_name));
+        columns.push_back(TableColumn(field_name, extent_type->getFieldTypeStr(field_name)));
+    }
+}
+
+void TableDataReader::appendRow(TableData &into) {
+    if (encoding == DE_Strings) {
+        into.rows.resize(into.rows.size() + 1);
+        vector<NullableString> &row(into.rows.back());
+        row.reserve(fields.size());
+        BOOST_FOREACH(GeneralField::Ptr g, fields) {
+            if (g->isNull()) {
+                row.push_back(NullableString());
+            } else {
+                row.push_back(NullableString(g->val().valString()));
+            }
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < fields.size(); ++i) {
+        GeneralField &g(*fields[i]);
+        ColumnData &to(into.column_data[i]);
+        bool null = g.isNull();
+        if (nullable[i]) {
+            to.nulls.push_back(null);
+            to.__isset.nulls = true;
+        }
+        switch (g.getType())
+            {
+            case ExtentType::ft_bool:
+                to.bool_values.push_back(!null && static_cast<GF_Bool &>(g).val());
+                to.__isset.bool_values = true;
+                break;
+            case ExtentType::ft_byte:
+                to.byte_values.push_back(null ? 0 : static_cast<GF_Byte &>(g).val());
+                to.__isset.byte_values = true;
+                break;
+            case ExtentType::ft_int32:
+                to.i32_values.push_back(null ? 0 : static_cast<GF_Int32 &>(g).val());
+                to.__isset.i32_values = true;
+                break;
+            case ExtentType::ft_int64:
+                to.i64_values.push_back(null ? 0 : static_cast<GF_Int64 &>(g).val());
+                to.__isset.i64_values = true;
+                break;
+            case ExtentType::ft_double:
+                to.double_values.push_back(null ? 0 : static_cast<GF_Double &>(g).val());
+                to.__isset.double_values = true;
+                break;
+            case ExtentType::ft_variable32: {
+                GF_Variable32 &v(static_cast<GF_Variable32 &>(g));
+                to.string_values.push_back(null ? string()
+                                           : string(reinterpret_cast<const char *>
+                                                    (v.myfield.val()), v.myfield.size()));
+                to.__isset.string_values = true;
+                break;
+            }
+            case ExtentType::ft_fixedwidth: {
+                GF_FixedWidth &v(static_cast<GF_FixedWidth &>(g));
+                to.string_values.push_back(null ? string()
+                                           : string(reinterpret_cast<const char *>(v.val()),
+                                                    v.size()));
+                to.__isset.string_values = true;
+                break;
+            }
+            default:
+                FATAL_ERROR(format("unexpected field type %d") % g.getType());
+            }
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef DATASERIES_TABLEDATAREADER_HPP
+#define DATASERIES_TABLEDATAREADER_HPP
+
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/GeneralField.hpp>
+
+#include "gen-cpp/DataSeriesServer.h"
+
+// Reads the rows of a source into TableData a batch at a time, each batch starting where the
+// last one stopped, for getTableData and the cursors.  With DE_Columns the values are copied
+// straight from the typed fields into per-column lists, rather than formatted as strings.
+class TableDataReader : boost::noncopyable {
+  public:
+    TableDataReader(DataSeriesModule &source, dataseries::DataEncoding encoding);
+
+    /// replace the rows in into with up to max_rows more; into.more_rows is true if there are
+    /// rows after them
+    void read(dataseries::TableData &into, uint32_t max_rows);
+
+  private:
+    // true if series is on a row, reading the next extent if the current one is done
+    bool haveRow();
+    void firstExtent(const Extent &e);
+    void appendRow(dataseries::TableData &into);
+
+    DataSeriesModule &source;
+    const dataseries::DataEncoding encoding;
+    ExtentSeries series;
+    std::vector<GeneralField::Ptr> fields;
+    std::vector<bool> nullable;
+    std::vector<dataseries::TableColumn> columns;
+    bool done;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include <algorithm>
+
+#include "DSSModule.hpp"
+#include "TableLocks.hpp"
+
+TableLocks::Hold::Hold(TableLocks &locks, const vector<string> &reads,
+                       const vector<string> &writes)
+    : locks(locks)
+{
+    init(reads, writes);
+}
+
+TableLocks::Hold::Hold(TableLocks &locks, const string &read, const string &write)
+    : locks(locks)
+{
+    init(vector<string>(1, read), vector<string>(1, write));
+}
+
+void TableLocks::Hold::init(const vector<string> &in_reads, const vector<string> &in_writes) {
+    writes = in_writes;
+    sort(writes.begin(), writes.end());
+    writes.erase(unique(writes.begin(), writes.end()), writes.end());
+    vector<string> tmp(in_reads);
+    sort(tmp.begin(), tmp.end());
+    set_difference(tmp.begin(), tmp.end(), writes.begin(), writes.end(), back_inserter(reads));
+    reads.erase(unique(reads.begin(), reads.end()), reads.end());
+
+    PThreadScopedLock lock(locks.mutex);
+    list<Hold *>::iterator me = locks.waiting.insert(locks.waiting.end(), this);
+    while (!locks.grantable(*this)) {
+        locks.cond.wait(locks.mutex);
+    }
+    locks.waiting.erase(me);
+    BOOST_FOREACH(const string &table, writes) {
+        locks.states[table].writer = true;
+    }
+    BOOST_FOREACH(const string &table, reads) {
+        ++locks.states[table].readers;
+    }
+    // requests that were waiting behind this one may be able to go now
+    locks.cond.broadcast();
+}
+
+TableLocks::Hold::~Hold() {
+    PThreadScopedLock lock(locks.mutex);
+    BOOST_FOREACH(const string &table, writes) {
+        locks.states.erase(table);
+    }
+    BOOST_FOREACH(const string &table, reads) {
+        map<string, State>::iterator i = locks.states.find(table);
+        SINVARIANT(i != locks.states.end() && i->second.readers > 0);
+        if (--i->second.readers == 0) {
+            locks.states.erase(i);
+        }
+    }
+    locks.cond.broadcast();
+}
+
+static bool intersects(const vector<string> &a, const vector<string> &b) {
+    vector<string>::const_iterator i = a.begin(), j = b.begin();
+    while (i != a.end() && j != b.end()) {
+        if (*i < *j) {
+            ++i;
+        } else if (*j < *i) {
+            ++j;
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TableLocks::Hold::conflicts(const Hold &with) const {
+    return intersects(writes, with.writes) || intersects(writes, with.reads)
+        || intersects(reads, with.writes);
+}
+
+bool TableLocks::grantable(const Hold &hold) {
+    BOOST_FOREACH(const string &table, hold.writes) {
+        if (states.find(table) != states.end()) {
+            return false;
+        }
+    }
+    BOOST_FOREACH(const string &table, hold.reads) {
+        map<string, State>::iterator i = states.find(table);
+        if (i != states.end() && i->second.writer) {
+            return false;
+        }
+    }
+    // the earliest waiting request only waits for held locks, so everything eventually goes
+    BOOST_FOREACH(const Hold *earlier, waiting) {
+        if (earlier == &hold) {
+            return true;
+        }
+        if (earlier->conflicts(hold)) {
+            return false;
+        }
+    }
+    FATAL_ERROR("internal error, hold is not waiting");
+}
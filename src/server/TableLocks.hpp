@@ -0,0 +1,57 @@
+#ifndef DATASERIES_TABLELOCKS_HPP
+#define DATASERIES_TABLELOCKS_HPP
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include <Lintel/PThread.hpp>
+
+// Reader/writer locks on the tables of the server, so that requests on different tables, or
+// that only read the same ones, run at once.  A request takes all of its locks together, so it
+// never holds some while waiting for others, and requests are granted in the order they arrive,
+// so a stream of readers can not starve a writer.  A table need not exist to be locked; a
+// request that creates a table locks it for writing.
+class TableLocks : boost::noncopyable {
+  public:
+    TableLocks() { }
+
+    /// Holds the locks for one request until it is destroyed; a table that is both read and
+    /// written is locked for writing.
+    class Hold : boost::noncopyable {
+      public:
+        Hold(TableLocks &locks, const std::vector<std::string> &reads,
+             const std::vector<std::string> &writes);
+        /// lock read for reading and write for writing
+        Hold(TableLocks &locks, const std::string &read, const std::string &write);
+        ~Hold();
+
+      private:
+        friend class TableLocks;
+
+        void init(const std::vector<std::string> &reads, const std::vector<std::string> &writes);
+        bool conflicts(const Hold &with) const;
+
+        TableLocks &locks;
+        std::vector<std::string> reads, writes; // sorted, no table in both
+    };
+
+  private:
+    struct State {
+        State() : readers(0), writer(false) { }
+        uint32_t readers;
+        bool writer;
+    };
+
+    bool grantable(const Hold &hold);
+
+    PThreadMutex mutex;
+    PThreadCond cond;
+    std::map<std::string, State> states; // tables that are locked
+    std::list<Hold *> waiting; // in the order they arrived
+};
+
+#endif
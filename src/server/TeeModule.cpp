@@ -2,10 +2,12 @@
 
 class TeeModule : public RowAnalysisModule {
   public:
-    TeeModule(DataSeriesModule &source_module, const string &output_path)
+    TeeModule(DataSeriesModule &source_module, const string &output_path, bool compress)
             : RowAnalysisModule(source_module), output_path(output_path), 
               output_series(), output(output_path, 
-                                      Extent::compression_algs[Extent::compress_mode_lzf].compress_flag, 1),
+                                      Extent::compression_algs[compress ? Extent::compress_mode_lzf
+                                                               : Extent::compress_mode_none]
+                                      .compress_flag, 1),
               output_module(NULL), copier(series, output_series), row_count(0), first_extent(false)
     { }
 
@@ -56,7 +58,7 @@ class TeeModule : public RowAnalysisModule {
 };
 
 DataSeriesModule::Ptr dataseries::makeTeeModule(DataSeriesModule &source_module, 
-                                                const string &output_path) {
-    return DataSeriesModule::Ptr(new TeeModule(source_module, output_path));
+                                                const string &output_path, bool compress) {
+    return DataSeriesModule::Ptr(new TeeModule(source_module, output_path, compress));
 }
 
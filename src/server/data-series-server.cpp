@@ -10,10 +10,13 @@
 #include <concurrency/ThreadManager.h>
 #include <concurrency/PosixThreadFactory.h>
 #include <protocol/TBinaryProtocol.h>
-#include <server/TSimpleServer.h>
+#include <server/TThreadPoolServer.h>
 #include <transport/TServerSocket.h>
 #include <transport/TTransportUtils.h>
 
+#include <set>
+
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -22,6 +25,7 @@
 #include <Lintel/LintelLog.hpp>
 #include <Lintel/PriorityQueue.hpp>
 #include <Lintel/ProgramOptions.hpp>
+#include <Lintel/PThread.hpp>
 #include <Lintel/STLUtility.hpp>
 
 #include <DataSeries/DSExpr.hpp>
@@ -33,10 +37,14 @@
 
 #include "GVVec.hpp"
 #include "ServerModules.hpp"
+#include "TableCache.hpp"
+#include "TableDataReader.hpp"
+#include "TableLocks.hpp"
 #include "ThrowError.hpp"
 
 using namespace std;
 using namespace facebook::thrift;
+using namespace facebook::thrift::concurrency;
 using namespace facebook::thrift::protocol;
 using namespace facebook::thrift::transport;
 using namespace facebook::thrift::server;
@@ -57,6 +65,97 @@ namespace std {
     }
 }
 
+lintel::ProgramOption<int32_t> po_server_threads
+("server-threads", "Number of requests to handle at once", 8);
+
+lintel::ProgramOption<int32_t> po_worker_threads
+("worker-threads", "Number of threads shared by the joins and sorts of all the requests; 0 to use"
+ " one per cpu, up to 32", 0);
+
+lintel::ProgramOption<double> po_table_cache_mb
+("table-cache-mb", "MiB of unpacked extents of recently read tables to keep in memory; a table is"
+ " only kept if it fits in a quarter of this", 256);
+
+lintel::ProgramOption<int32_t> po_cursor_timeout
+("cursor-timeout", "Seconds a cursor can go unused before it is closed", 600);
+
+lintel::ProgramOption<int32_t> po_join_threads
+("join-threads", "Number of threads for each join; 0 to use one per cpu, up to 32", 0);
+
+lintel::ProgramOption<int32_t> po_sort_threads
+("sort-threads", "Number of threads for each sort; 0 to use one per cpu, up to 32", 0);
+
+lintel::ProgramOption<double> po_sort_memory_mb
+("sort-memory-mb", "MiB of sorted extents a sort holds in memory before spilling them to disk",
+ 1024);
+
+// the threads for an option where 0 means one per cpu
+uint32_t optionThreads(lintel::ProgramOption<int32_t> &option, const char *name) {
+    INVARIANT(option.get() >= 0, format("--%s must be >= 0") % name);
+    if (option.get() > 0) {
+        return option.get();
+    }
+    return min(PThreadMisc::getNCpus(), 32);
+}
+
+uint32_t joinThreads() {
+    return optionThreads(po_join_threads, "join-threads");
+}
+
+uint32_t sortThreads() {
+    return optionThreads(po_sort_threads, "sort-threads");
+}
+
+// A source with no extents, for a plan step output with no rows
+class EmptyModule : public DataSeriesModule {
+  public:
+    virtual Extent::Ptr getSharedExtent() {
+        return Extent::Ptr();
+    }
+};
+
+uint64_t sortMemory() {
+    INVARIANT(po_sort_memory_mb.get() > 0, "--sort-memory-mb must be > 0");
+    return static_cast<uint64_t>(po_sort_memory_mb.get() * 1024 * 1024);
+}
+
+// The threads that joins and sorts use beyond the one handling the request are shared by all the
+// requests, so that concurrent requests don't each start one per cpu.  A request gets what it
+// wants of the ones that are free, but always at least one so it never waits.
+class WorkerBudget : boost::noncopyable {
+  public:
+    WorkerBudget(uint32_t threads) : free_threads(threads) {
+        SINVARIANT(threads > 0);
+    }
+
+    class Grant : boost::noncopyable {
+      public:
+        Grant(WorkerBudget &budget, uint32_t wanted) : budget(budget), taken(0) {
+            SINVARIANT(wanted > 0);
+            PThreadScopedLock lock(budget.mutex);
+            taken = min(wanted, budget.free_threads);
+            budget.free_threads -= taken;
+        }
+
+        ~Grant() {
+            PThreadScopedLock lock(budget.mutex);
+            budget.free_threads += taken;
+        }
+
+        uint32_t threads() const {
+            return max(taken, static_cast<uint32_t>(1));
+        }
+
+      private:
+        WorkerBudget &budget;
+        uint32_t taken;
+    };
+
+  private:
+    PThreadMutex mutex;
+    uint32_t free_threads;
+};
+
 class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
   public:
     struct TableInfo {
@@ -68,7 +167,15 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
 
     typedef HashMap<string, TableInfo> NameToInfo;
 
-    DataSeriesServerHandler() { };
+    DataSeriesServerHandler()
+        : worker_budget(optionThreads(po_worker_threads, "worker-threads")),
+          table_cache(static_cast<uint64_t>(po_table_cache_mb.get() * 1024 * 1024)),
+          next_cursor_id(1),
+          cursor_reaper(boost::bind(&DataSeriesServerHandler::reapCursors, this)) {
+        INVARIANT(po_table_cache_mb.get() >= 0, "--table-cache-mb must be >= 0");
+        INVARIANT(po_cursor_timeout.get() > 0, "--cursor-timeout must be > 0");
+        cursor_reaper.start();
+    }
 
     void ping() {
         LintelLog::info("ping()");
@@ -91,19 +198,8 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
     void importDataSeriesFiles(const vector<string> &source_paths, const string &extent_type, 
                                const string &dest_table) {
         verifyTableName(dest_table);
-        if (extent_type.empty()) {
-            requestError("extent type empty");
-        }
-
-        TypeIndexModule input(extent_type);
-        DataSeriesModule::Ptr output_module = makeTeeModule(input, tableToPath(dest_table));
-        BOOST_FOREACH(const string &path, source_paths) {
-            input.addSource(path);
-        }
-        output_module->getAndDeleteShared();
-        TableInfo &ti(table_info[dest_table]);
-        ti.extent_type = input.getTypePtr();
-        ti.last_update = Clock::todTfrac();
+        TableLocks::Hold hold(table_locks, vector<string>(), vector<string>(1, dest_table));
+        importFiles(source_paths, extent_type, dest_table, vector<string>());
     }
 
     void importCSVFiles(const vector<string> &source_paths, const string &xml_desc, 
@@ -116,67 +212,54 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
             requestError("only supporting single insert");
         }
         verifyTableName(dest_table);
-        pid_t pid = fork();
-        if (pid < 0) {
-            requestError("fork failed");
-        } else if (pid == 0) {
-            string xml_desc_path(str(format("xmldesc.%s") % dest_table));
-            ofstream xml_desc_output(xml_desc_path.c_str());
-            xml_desc_output << xml_desc;
-            xml_desc_output.close();
-            SINVARIANT(xml_desc_output.good());
-
-            vector<string> args;
-            args.push_back("csv2ds");
-            args.push_back(str(format("--xml-desc-file=%s") % xml_desc_path));
-            args.push_back(str(format("--field-separator=%s") % field_separator));
-            args.push_back(str(format("--comment-prefix=%s") % comment_prefix));
-            SINVARIANT(source_paths.size() == 1);
-            copy(source_paths.begin(), source_paths.end(), back_inserter(args));
-            args.push_back(tableToPath(dest_table));
-            unlink(tableToPath(dest_table).c_str()); // ignore errors
-
-            LintelLogDebug("child", format("pid %d running: %s") % getpid() % args);
-            exec(args);
-        } else {
-            waitForSuccessfulChild(pid);
+        TableLocks::Hold hold(table_locks, vector<string>(), vector<string>(1, dest_table));
+
+        // the child only execs, other threads may hold locks it would need for anything else
+        string xml_desc_path(str(format("xmldesc.%s") % dest_table));
+        ofstream xml_desc_output(xml_desc_path.c_str());
+        xml_desc_output << xml_desc;
+        xml_desc_output.close();
+        SINVARIANT(xml_desc_output.good());
+
+        vector<string> args;
+        args.push_back("csv2ds");
+        args.push_back(str(format("--xml-desc-file=%s") % xml_desc_path));
+        args.push_back(str(format("--field-separator=%s") % field_separator));
+        args.push_back(str(format("--comment-prefix=%s") % comment_prefix));
+        SINVARIANT(source_paths.size() == 1);
+        copy(source_paths.begin(), source_paths.end(), back_inserter(args));
+        args.push_back(tableToPath(dest_table));
+        unlink(tableToPath(dest_table).c_str()); // ignore errors
+
+        waitForSuccessfulChild(spawn(args, false));
 
-            ExtentTypeLibrary lib;
-            const ExtentType::Ptr type(lib.registerTypePtr(xml_desc));
-            updateTableInfo(dest_table, type);
-        }
+        ExtentTypeLibrary lib;
+        const ExtentType::Ptr type(lib.registerTypePtr(xml_desc));
+        updateTableInfo(dest_table, type, vector<string>());
     }
 
     void importSQLTable(const string &dsn, const string &src_table, const string &dest_table) {
         verifyTableName(dest_table);
+        TableLocks::Hold hold(table_locks, vector<string>(), vector<string>(1, dest_table));
 
-        pid_t pid = fork();
-        if (pid < 0) {
-            requestError("fork failed");
-        } else if (pid == 0) {
-            for (int i = 3; i < 100; ++i) {
-                close(i);
-            }
-            vector<string> args;
+        vector<string> args;
+        args.push_back("sql2ds");
+        if (!dsn.empty()) {
+            args.push_back(str(format("--dsn=%s") % dsn));
+        }
+        args.push_back(src_table);
+        args.push_back(tableToPath(dest_table));
 
-            args.push_back("sql2ds");
-            if (!dsn.empty()) {
-                args.push_back(str(format("--dsn=%s") % dsn));
-            }
-            args.push_back(src_table);
-            args.push_back(tableToPath(dest_table));
-            exec(args);
-        } else {
-            waitForSuccessfulChild(pid);
-            DataSeriesSource source(tableToPath(dest_table));
-            const ExtentType::Ptr t = source.getLibrary().getTypeByNamePtr(src_table);
+        waitForSuccessfulChild(spawn(args, true));
+        DataSeriesSource source(tableToPath(dest_table));
+        const ExtentType::Ptr t = source.getLibrary().getTypeByNamePtr(src_table);
 
-            updateTableInfo(dest_table, t); 
-        }
+        updateTableInfo(dest_table, t, vector<string>());
     }
         
     void importData(const string &dest_table, const string &xml_desc, const TableData &data) {
         verifyTableName(dest_table);
+        TableLocks::Hold hold(table_locks, vector<string>(), vector<string>(1, dest_table));
 
         if (data.more_rows) {
             requestError("can not handle more rows");
@@ -211,7 +294,7 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
             }
         }
 
-        updateTableInfo(dest_table, type);
+        updateTableInfo(dest_table, type, vector<string>());
     }
 
     void mergeTables(const vector<string> &source_tables, const string &dest_table) {
@@ -219,24 +302,24 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
             requestError("missing source tables");
         }
         verifyTableName(dest_table);
-        vector<string> input_paths;
-        input_paths.reserve(source_tables.size());
-        string source_extent_type;
         BOOST_FOREACH(const string &table, source_tables) {
             if (table == dest_table) {
                 invalidTableName(table, "duplicated with destination table");
             }
-            TableInfo *ti = table_info.lookup(table);
-            if (ti == NULL) {
-                invalidTableName(table, "table not present");
-            }
+        }
+        TableLocks::Hold hold(table_locks, source_tables, vector<string>(1, dest_table));
+        vector<string> input_paths;
+        input_paths.reserve(source_tables.size());
+        string source_extent_type;
+        BOOST_FOREACH(const string &table, source_tables) {
+            TableInfo ti(getTableInfo(table));
             if (source_extent_type.empty()) {
-                source_extent_type = ti->extent_type->getName();
+                source_extent_type = ti.extent_type->getName();
             }
-            if (source_extent_type != ti->extent_type->getName()) {
+            if (source_extent_type != ti.extent_type->getName()) {
                 invalidTableName(table, str(format("extent type '%s' does not match earlier table"
                                                    " types of '%s'")
-                                            % ti->extent_type % source_extent_type));
+                                            % ti.extent_type % source_extent_type));
             }
                                        
             input_paths.push_back(tableToPath(table));
@@ -244,97 +327,141 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         if (source_extent_type.empty()) {
             requestError("internal: extent type is missing?");
         }
-        importDataSeriesFiles(input_paths, source_extent_type, dest_table);
+        importFiles(input_paths, source_extent_type, dest_table, source_tables);
     }
 
     void getTableData(TableData &ret, const string &source_table, int32_t max_rows, 
-                      const string &where_expr) {
+                      const string &where_expr, const DataEncoding encoding) {
         verifyTableName(source_table);
         if (max_rows <= 0) {
             requestError("max_rows must be > 0");
         }
-        NameToInfo::iterator i = getTableInfo(source_table);
+        Cursor cursor(table_locks, source_table);
+        openCursor(cursor, source_table, where_expr, encoding);
+        cursor.reader->read(ret, max_rows);
+    }
 
-        TypeIndexModule input(i->second.extent_type->getName());
-        input.addSource(tableToPath(source_table));
-        DataSeriesModule *mod = &input;
-        DataSeriesModule::Ptr select_module;
-        if (!where_expr.empty()) {
-            select_module = makeSelectModule(input, where_expr);
-            mod = select_module.get();
-        }
+    int64_t openCursor(const string &source_table, const string &where_expr,
+                       const DataEncoding encoding) {
+        verifyTableName(source_table);
+        shared_ptr<Cursor> cursor(new Cursor(table_locks, source_table));
+        openCursor(*cursor, source_table, where_expr, encoding);
+
+        PThreadScopedLock lock(cursors_mutex);
+        int64_t id = next_cursor_id++;
+        cursors[id] = cursor;
+        LintelLogDebug("cursor", format("opened cursor %d on %s") % id % source_table);
+        return id;
+    }
 
-        DataSeriesModule::Ptr sink(makeTableDataModule(*mod, ret, max_rows));
+    void fetchRows(TableData &ret, const int64_t cursor_id, const int32_t max_rows) {
+        if (max_rows <= 0) {
+            requestError("max_rows must be > 0");
+        }
+        shared_ptr<Cursor> cursor;
+        {
+            PThreadScopedLock lock(cursors_mutex);
+            Cursors::iterator i = cursors.find(cursor_id);
+            if (i == cursors.end()) {
+                requestError(format("cursor %d is not open") % cursor_id);
+            }
+            cursor = i->second;
+            ++cursor->users;
+        }
+        {
+            PThreadScopedLock lock(cursor->mutex);
+            try {
+                cursor->reader->read(ret, max_rows);
+            } catch (...) {
+                endFetch(cursor_id, *cursor, true);
+                throw;
+            }
+        }
+        endFetch(cursor_id, *cursor, !ret.more_rows);
+    }
 
-        sink->getAndDeleteShared();
+    void closeCursor(const int64_t cursor_id) {
+        shared_ptr<Cursor> cursor; // closed once the lock is dropped
+        PThreadScopedLock lock(cursors_mutex);
+        Cursors::iterator i = cursors.find(cursor_id);
+        if (i != cursors.end()) {
+            cursor = i->second;
+            cursors.erase(i);
+        }
     }
 
     void hashJoin(const string &a_table, const string &b_table, const string &out_table,
                   const map<string, string> &eq_columns, 
                   const map<string, string> &keep_columns, int32_t max_a_rows) { 
-        NameToInfo::iterator a_info = getTableInfo(a_table);
-        NameToInfo::iterator b_info = getTableInfo(b_table);
-
         verifyTableName(out_table);
+        vector<string> inputs;
+        inputs.push_back(a_table);
+        inputs.push_back(b_table);
+        TableLocks::Hold hold(table_locks, inputs, vector<string>(1, out_table));
+        TableInfo a_info(getTableInfo(a_table));
+        TableInfo b_info(getTableInfo(b_table));
 
-        TypeIndexModule a_input(a_info->second.extent_type->getName());
-        a_input.addSource(tableToPath(a_table));
-        TypeIndexModule b_input(b_info->second.extent_type->getName());
-        b_input.addSource(tableToPath(b_table));
+        DataSeriesModule::Ptr a_input(openTable(a_table, a_info));
+        DataSeriesModule::Ptr b_input(openTable(b_table, b_info));
 
+        WorkerBudget::Grant workers(worker_budget, joinThreads());
         OutputSeriesModule::OSMPtr 
-                hj_module(makeHashJoinModule(a_input, max_a_rows, b_input,
-                                             eq_columns, keep_columns, out_table));
+                hj_module(makeHashJoinModule(*a_input, max_a_rows, *b_input,
+                                             eq_columns, keep_columns, out_table,
+                                             workers.threads()));
 
         DataSeriesModule::Ptr output_module = makeTeeModule(*hj_module, tableToPath(out_table));
         
         output_module->getAndDeleteShared();
-        updateTableInfo(out_table, hj_module->output_series.getTypePtr());
+        updateTableInfo(out_table, hj_module->output_series.getTypePtr(), inputs);
     }
 
     void starJoin(const string &fact_table, const vector<Dimension> &dimensions, 
                   const string &out_table, const map<string, string> &fact_columns,
                   const vector<DimensionFactJoin> &dimension_columns, int32_t max_dimension_rows) {
-        NameToInfo::iterator fact_info = getTableInfo(fact_table);
         verifyTableName(out_table);
+        vector<string> inputs(1, fact_table);
+        BOOST_FOREACH(const Dimension &dim, dimensions) {
+            inputs.push_back(dim.source_table);
+        }
+        TableLocks::Hold hold(table_locks, inputs, vector<string>(1, out_table));
+        TableInfo fact_info(getTableInfo(fact_table));
         
         HashMap< string, shared_ptr<DataSeriesModule> > dimension_modules;
         
         BOOST_FOREACH(const Dimension &dim, dimensions) {
             if (!dimension_modules.exists(dim.source_table)) {
-                NameToInfo::iterator dim_info = getTableInfo(dim.source_table);
-                shared_ptr<TypeIndexModule> 
-                        ptr(new TypeIndexModule(dim_info->second.extent_type->getName()));
-                ptr->addSource(tableToPath(dim.source_table));
-                dimension_modules[dim.source_table] = ptr;
+                dimension_modules[dim.source_table]
+                    = openTable(dim.source_table, getTableInfo(dim.source_table));
             }
         }
         
-        TypeIndexModule fact_input(fact_info->second.extent_type->getName());
-        fact_input.addSource(tableToPath(fact_table));
+        DataSeriesModule::Ptr fact_input(openTable(fact_table, fact_info));
 
         // TODO: use and check max_dimension_rows
+        WorkerBudget::Grant workers(worker_budget, joinThreads());
         OutputSeriesModule::OSMPtr
-                sj_module(makeStarJoinModule(fact_input, dimensions, out_table,
-                                             fact_columns, dimension_columns, dimension_modules));
+                sj_module(makeStarJoinModule(*fact_input, dimensions, out_table,
+                                             fact_columns, dimension_columns, dimension_modules,
+                                             workers.threads()));
 
         DataSeriesModule::Ptr output_module = makeTeeModule(*sj_module, tableToPath(out_table));
 
         output_module->getAndDeleteShared();
-        updateTableInfo(out_table, sj_module->output_series.getTypePtr());
+        updateTableInfo(out_table, sj_module->output_series.getTypePtr(), inputs);
     }
     
     void selectRows(const string &in_table, const string &out_table, const string &where_expr) {
         verifyTableName(in_table);
         verifyTableName(out_table);
-        NameToInfo::iterator info = getTableInfo(in_table);
-        TypeIndexModule input(info->second.extent_type->getName());
-        input.addSource(tableToPath(in_table));
-        DataSeriesModule::Ptr select(makeSelectModule(input, where_expr));
+        TableLocks::Hold hold(table_locks, in_table, out_table);
+        TableInfo info(getTableInfo(in_table));
+        DataSeriesModule::Ptr input(openTable(in_table, info));
+        DataSeriesModule::Ptr select(makeSelectModule(*input, where_expr));
         DataSeriesModule::Ptr output_module = makeTeeModule(*select, tableToPath(out_table));
 
         output_module->getAndDeleteShared();
-        updateTableInfo(out_table, info->second.extent_type);
+        updateTableInfo(out_table, info.extent_type, vector<string>(1, in_table));
     }
 
     void projectTable(const string &in_table, const string &out_table, 
@@ -342,13 +469,14 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         verifyTableName(in_table);
         verifyTableName(out_table);
 
-        NameToInfo::iterator info = getTableInfo(in_table);
-        TypeIndexModule input(info->second.extent_type->getName());
-        input.addSource(tableToPath(in_table));
-        OutputSeriesModule::OSMPtr project(makeProjectModule(input, keep_columns));
+        TableLocks::Hold hold(table_locks, in_table, out_table);
+        TableInfo info(getTableInfo(in_table));
+        DataSeriesModule::Ptr input(openTable(in_table, info));
+        OutputSeriesModule::OSMPtr project(makeProjectModule(*input, keep_columns));
         DataSeriesModule::Ptr output_module = makeTeeModule(*project, tableToPath(out_table));
         output_module->getAndDeleteShared();
-        updateTableInfo(out_table, project->output_series.getTypePtr());
+        updateTableInfo(out_table, project->output_series.getTypePtr(),
+                        vector<string>(1, in_table));
     }
 
     void transformTable(const string &in_table, const string &out_table,
@@ -356,34 +484,33 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         verifyTableName(in_table);
         verifyTableName(out_table);
 
-        NameToInfo::iterator info = getTableInfo(in_table);
-        TypeIndexModule input(info->second.extent_type->getName());
-        input.addSource(tableToPath(in_table));
+        TableLocks::Hold hold(table_locks, in_table, out_table);
+        TableInfo info(getTableInfo(in_table));
+        DataSeriesModule::Ptr input(openTable(in_table, info));
         OutputSeriesModule::OSMPtr transform
-                (makeExprTransformModule(input, expr_columns, out_table));
+                (makeExprTransformModule(*input, expr_columns, out_table));
         DataSeriesModule::Ptr output_module = makeTeeModule(*transform, tableToPath(out_table));
         output_module->getAndDeleteShared();
-        updateTableInfo(out_table, transform->output_series.getTypePtr());
+        updateTableInfo(out_table, transform->output_series.getTypePtr(),
+                        vector<string>(1, in_table));
     }
     
     void sortedUpdateTable(const string &base_table, const string &update_from, 
                            const string &update_column, const vector<string> &primary_key) {
         verifyTableName(base_table);
         verifyTableName(update_from);
+        TableLocks::Hold hold(table_locks, update_from, base_table);
 
-        NameToInfo::iterator update_info(getTableInfo(update_from));
-        NameToInfo::iterator base_info = table_info.find(base_table);
-        if (base_info == table_info.end()) {
+        TableInfo update_info(getTableInfo(update_from));
+        TableInfo base_info;
+        if (!lookupTableInfo(base_table, base_info)) {
             base_info = createTable(base_table, update_info, update_column);
         }
 
-        TypeIndexModule base_input(base_info->second.extent_type->getName());
-        base_input.addSource(tableToPath(base_table));
-
-        TypeIndexModule update_input(update_info->second.extent_type->getName());
-        update_input.addSource(tableToPath(update_from));
+        DataSeriesModule::Ptr base_input(openTable(base_table, base_info));
+        DataSeriesModule::Ptr update_input(openTable(update_from, update_info));
 
-        DataSeriesModule::Ptr updater(makeSortedUpdateModule(base_input, update_input, 
+        DataSeriesModule::Ptr updater(makeSortedUpdateModule(*base_input, *update_input, 
                                                              update_column, primary_key));
 
         DataSeriesModule::Ptr output_module 
@@ -393,42 +520,362 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         string from(tableToPath(base_table, "tmp.")), to(tableToPath(base_table));
         int ret = rename(from.c_str(), to.c_str());
         INVARIANT(ret == 0, format("rename %s -> %s failed: %s") % from % to % strerror(errno));
+        base_info.depends_on.push_back(update_from);
+        updateTableInfo(base_table, base_info.extent_type, base_info.depends_on);
     }
 
     void unionTables(const vector<UnionTable> &in_tables, const vector<SortColumn> &order_columns,
                      const string &out_table) {
-        vector<UM_UnionTable> tables;
+        verifyTableName(out_table);
+        vector<string> inputs;
         BOOST_FOREACH(const UnionTable &table, in_tables) {
             verifyTableName(table.table_name);
-            NameToInfo::iterator table_info(getTableInfo(table.table_name));
+            inputs.push_back(table.table_name);
+        }
+        TableLocks::Hold hold(table_locks, inputs, vector<string>(1, out_table));
+
+        vector<UM_UnionTable> tables;
+        BOOST_FOREACH(const UnionTable &table, in_tables) {
+            TableInfo info(getTableInfo(table.table_name));
 
-            TypeIndexModule::Ptr p =
-                    TypeIndexModule::make(table_info->second.extent_type->getName());
-            p->addSource(tableToPath(table_info->first));
-            tables.push_back(UM_UnionTable(table, p));
+            tables.push_back(UM_UnionTable(table, openTable(table.table_name, info)));
         }
         
         OutputSeriesModule::OSMPtr union_mod(makeUnionModule(tables, order_columns, out_table));
         DataSeriesModule::Ptr output_module = makeTeeModule(*union_mod, tableToPath(out_table));
 
         output_module->getAndDeleteShared();
-        updateTableInfo(out_table, union_mod->output_series.getTypePtr());
+        updateTableInfo(out_table, union_mod->output_series.getTypePtr(), inputs);
     }
 
     void sortTable(const string &in_table, const string &out_table, const vector<SortColumn> &by) {
-        NameToInfo::iterator table_info(getTableInfo(in_table));
+        verifyTableName(in_table);
+        verifyTableName(out_table);
+        TableLocks::Hold hold(table_locks, in_table, out_table);
+        TableInfo info(getTableInfo(in_table));
         
-        TypeIndexModule::Ptr p(TypeIndexModule::make(table_info->second.extent_type->getName()));
-        p->addSource(tableToPath(table_info->first));
+        DataSeriesModule::Ptr p(openTable(in_table, info));
 
-        OutputSeriesModule::OSMPtr sorter(makeSortModule(*p, by));
+        WorkerBudget::Grant workers(worker_budget, sortThreads());
+        OutputSeriesModule::OSMPtr sorter(makeSortModule(*p, by, sortMemory(), out_table,
+                                                         workers.threads()));
         
         DataSeriesModule::Ptr output_module = makeTeeModule(*sorter, tableToPath(out_table));
         output_module->getAndDeleteShared();
-        updateTableInfo(out_table, sorter->output_series.getTypePtr());
+        updateTableInfo(out_table, sorter->output_series.getTypePtr(),
+                        vector<string>(1, in_table));
+    }
+
+    void runPlan(const vector<PlanStep> &steps, const vector<string> &output_tables) {
+        // the locks cover the plan's temporary files, so they go after it
+        scoped_ptr<TableLocks::Hold> hold;
+        PlanState plan;
+        BOOST_FOREACH(const string &table, output_tables) {
+            verifyTableName(table);
+            plan.outputs.insert(table);
+        }
+        // count the uses of each step's output, to know which can be streamed to their use
+        BOOST_FOREACH(const PlanStep &step, steps) {
+            verifyTableName(step.out_table);
+            if (plan.tables.find(step.out_table) != plan.tables.end()) {
+                requestError(format("more than one step has out_table %s") % step.out_table);
+            }
+            BOOST_FOREACH(const string &in, planStepInputs(step)) {
+                map<string, PlanTable>::iterator i = plan.tables.find(in);
+                if (i != plan.tables.end()) {
+                    ++i->second.uses;
+                } else {
+                    verifyTableName(in);
+                    plan.read_tables.insert(in);
+                }
+            }
+            plan.tables[step.out_table].output = plan.outputs.count(step.out_table) > 0;
+        }
+        BOOST_FOREACH(const string &table, output_tables) {
+            if (plan.tables.find(table) == plan.tables.end()) {
+                requestError(format("output table %s is not the out_table of a step") % table);
+            }
+        }
+        typedef map<string, PlanTable>::value_type PT_vt;
+        BOOST_FOREACH(const PT_vt &v, plan.tables) {
+            if (plan.read_tables.count(v.first) > 0) {
+                requestError(format("plan both reads and writes table %s") % v.first);
+            }
+            if (v.second.uses == 0 && !v.second.output) {
+                requestError(format("the output of step %s is not used") % v.first);
+            }
+        }
+
+        vector<string> reads(plan.read_tables.begin(), plan.read_tables.end()), writes;
+        BOOST_FOREACH(const PT_vt &v, plan.tables) {
+            writes.push_back(v.first);
+        }
+        hold.reset(new TableLocks::Hold(table_locks, reads, writes));
+        BOOST_FOREACH(const string &table, reads) {
+            getTableInfo(table);
+        }
+        WorkerBudget::Grant workers(worker_budget, max(joinThreads(), sortThreads()));
+        plan.threads = workers.threads();
+
+        BOOST_FOREACH(const PlanStep &step, steps) {
+            PlanTable &out(plan.tables[step.out_table]);
+            DataSeriesModule::Ptr module(makePlanStep(plan, step, out.type));
+            plan.modules.push_back(module);
+            if (out.uses <= 1) {
+                if (out.output) {
+                    module = makeTeeModule(*module, tableToPath(step.out_table));
+                    plan.modules.push_back(module);
+                }
+                out.module = module;
+            } else {
+                // read by more than one step, so write it out now; the tee closes the file
+                // when it goes away
+                if (out.output) {
+                    out.path = tableToPath(step.out_table);
+                } else {
+                    out.path = tableToPath(step.out_table, "tmp.plan.");
+                    plan.temp_paths.push_back(out.path);
+                }
+                DataSeriesModule::Ptr tee(makeTeeModule(*module, out.path, out.output));
+                tee->getAndDeleteShared();
+            }
+        }
+
+        BOOST_FOREACH(const PlanStep &step, steps) {
+            PlanTable &out(plan.tables[step.out_table]);
+            if (out.uses == 0) {
+                out.module->getAndDeleteShared();
+            }
+        }
+        BOOST_FOREACH(const string &table, output_tables) {
+            updateTableInfo(table, plan.tables[table].type(), reads);
+        }
     }
 
   private:
+    // An open cursor; also used for the one batch of getTableData
+    struct Cursor {
+        Cursor(TableLocks &locks, const string &table)
+            : hold(locks, vector<string>(1, table), vector<string>()), users(0),
+              last_use(time(NULL)) { }
+
+        TableLocks::Hold hold;
+        DataSeriesModule::Ptr input, select;
+        scoped_ptr<TableDataReader> reader;
+        PThreadMutex mutex; // serializes fetches
+        uint32_t users; // fetches in progress; protected by cursors_mutex
+        time_t last_use; // protected by cursors_mutex
+    };
+
+    typedef map<int64_t, shared_ptr<Cursor> > Cursors;
+
+    // caller holds the read lock on source_table through cursor
+    void openCursor(Cursor &cursor, const string &source_table, const string &where_expr,
+                    const DataEncoding encoding) {
+        TableInfo info(getTableInfo(source_table));
+        cursor.input = openTable(source_table, info);
+        DataSeriesModule *mod = cursor.input.get();
+        if (!where_expr.empty()) {
+            cursor.select = makeSelectModule(*mod, where_expr);
+            mod = cursor.select.get();
+        }
+        cursor.reader.reset(new TableDataReader(*mod, encoding));
+    }
+
+    void endFetch(int64_t cursor_id, Cursor &cursor, bool close) {
+        shared_ptr<Cursor> closed; // closed once the lock is dropped
+        PThreadScopedLock lock(cursors_mutex);
+        --cursor.users;
+        cursor.last_use = time(NULL);
+        Cursors::iterator i = cursors.find(cursor_id);
+        if (close && i != cursors.end()) {
+            closed = i->second;
+            cursors.erase(i);
+        }
+    }
+
+    // runs until the server exits, closing cursors that have not been used for --cursor-timeout
+    void reapCursors() {
+        while (true) {
+            sleep(1);
+            vector< shared_ptr<Cursor> > idle; // closed outside the lock
+            {
+                PThreadScopedLock lock(cursors_mutex);
+                time_t now = time(NULL);
+                for (Cursors::iterator i = cursors.begin(); i != cursors.end(); ) {
+                    if (i->second->users == 0
+                        && now - i->second->last_use >= po_cursor_timeout.get()) {
+                        LintelLog::info(format("closing idle cursor %d") % i->first);
+                        idle.push_back(i->second);
+                        cursors.erase(i++);
+                    } else {
+                        ++i;
+                    }
+                }
+            }
+        }
+    }
+
+    // The output of a step of a plan
+    struct PlanTable {
+        PlanTable() : uses(0), output(false), module(), type(), path() { }
+
+        uint32_t uses; // by later steps
+        bool output; // stored as a table
+        DataSeriesModule::Ptr module; // the rows, until they are streamed to their one use
+        boost::function<ExtentType::Ptr ()> type; // valid once the rows have been read
+        string path; // where the rows were written if they have more than one use
+    };
+
+    struct PlanState {
+        PlanState() : threads(1) { }
+
+        ~PlanState() {
+            // modules hold references to their inputs, so remove them from last to first
+            tables.clear();
+            while (!modules.empty()) {
+                modules.pop_back();
+            }
+            BOOST_FOREACH(const string &path, temp_paths) {
+                unlink(path.c_str());
+            }
+        }
+
+        map<string, PlanTable> tables;
+        set<string> outputs, read_tables;
+        vector<DataSeriesModule::Ptr> modules;
+        vector<string> temp_paths;
+        uint32_t threads; // for the joins and sorts
+    };
+
+    static ExtentType::Ptr fixedType(const ExtentType::Ptr type) {
+        return type;
+    }
+
+    static ExtentType::Ptr outputSeriesType(OutputSeriesModule *module) {
+        return module->output_series.getTypePtr();
+    }
+
+    vector<string> planStepInputs(const PlanStep &step) {
+        vector<string> ret;
+        switch (step.op)
+            {
+            case PO_SelectRows: case PO_ProjectTable: case PO_TransformTable: case PO_SortTable:
+                ret.push_back(step.in_table);
+                break;
+            case PO_HashJoin:
+                ret.push_back(step.a_table);
+                ret.push_back(step.b_table);
+                break;
+            case PO_StarJoin:
+                ret.push_back(step.fact_table);
+                BOOST_FOREACH(const Dimension &dim, step.dimensions) {
+                    if (find(ret.begin() + 1, ret.end(), dim.source_table) == ret.end()) {
+                        ret.push_back(dim.source_table);
+                    }
+                }
+                break;
+            case PO_UnionTables:
+                BOOST_FOREACH(const UnionTable &table, step.union_tables) {
+                    ret.push_back(table.table_name);
+                }
+                break;
+            default:
+                requestError(format("invalid op %d for plan step %s")
+                             % static_cast<int>(step.op) % step.out_table);
+            }
+        return ret;
+    }
+
+    // the rows of an existing table or an earlier step's output; sets type if it is not NULL
+    DataSeriesModule::Ptr planInput(PlanState &plan, const string &name,
+                                    boost::function<ExtentType::Ptr ()> *type = NULL) {
+        DataSeriesModule::Ptr ret;
+        map<string, PlanTable>::iterator i = plan.tables.find(name);
+        if (i == plan.tables.end()) {
+            TableInfo info(getTableInfo(name));
+            ret = openTable(name, info);
+            if (type != NULL) {
+                *type = boost::bind(&fixedType, info.extent_type);
+            }
+        } else if (i->second.path.empty()) {
+            SINVARIANT(i->second.module != NULL);
+            ret.swap(i->second.module);
+        } else {
+            ExtentType::Ptr t(i->second.type());
+            if (t == NULL) {
+                ret.reset(new EmptyModule());
+            } else {
+                TypeIndexModule::Ptr input(TypeIndexModule::make(t->getName()));
+                input->addSource(i->second.path);
+                ret = input;
+            }
+        }
+        if (i != plan.tables.end() && type != NULL) {
+            *type = i->second.type;
+        }
+        plan.modules.push_back(ret);
+        return ret;
+    }
+
+    // the module for a step; sets type to get the type of its output once it has been read
+    DataSeriesModule::Ptr makePlanStep(PlanState &plan, const PlanStep &step,
+                                       boost::function<ExtentType::Ptr ()> &type) {
+        OutputSeriesModule::OSMPtr osm;
+        switch (step.op)
+            {
+            case PO_SelectRows: {
+                DataSeriesModule::Ptr input(planInput(plan, step.in_table, &type));
+                return makeSelectModule(*input, step.where_expr);
+            }
+            case PO_ProjectTable:
+                osm = makeProjectModule(*planInput(plan, step.in_table), step.keep_columns);
+                break;
+            case PO_TransformTable:
+                osm = makeExprTransformModule(*planInput(plan, step.in_table), step.expr_columns,
+                                              step.out_table);
+                break;
+            case PO_HashJoin: {
+                DataSeriesModule::Ptr a_input(planInput(plan, step.a_table));
+                DataSeriesModule::Ptr b_input(planInput(plan, step.b_table));
+                osm = makeHashJoinModule(*a_input, step.max_a_rows, *b_input, step.eq_columns,
+                                         step.join_keep_columns, step.out_table,
+                                         min(joinThreads(), plan.threads));
+                break;
+            }
+            case PO_StarJoin: {
+                DataSeriesModule::Ptr fact_input(planInput(plan, step.fact_table));
+                HashMap< string, shared_ptr<DataSeriesModule> > dimension_modules;
+                BOOST_FOREACH(const Dimension &dim, step.dimensions) {
+                    if (!dimension_modules.exists(dim.source_table)) {
+                        dimension_modules[dim.source_table] = planInput(plan, dim.source_table);
+                    }
+                }
+                osm = makeStarJoinModule(*fact_input, step.dimensions, step.out_table,
+                                         step.fact_columns, step.dimension_fact_join,
+                                         dimension_modules, min(joinThreads(), plan.threads));
+                break;
+            }
+            case PO_UnionTables: {
+                vector<UM_UnionTable> tables;
+                BOOST_FOREACH(const UnionTable &table, step.union_tables) {
+                    tables.push_back(UM_UnionTable(table, planInput(plan, table.table_name)));
+                }
+                osm = makeUnionModule(tables, step.sort_columns, step.out_table);
+                break;
+            }
+            case PO_SortTable:
+                osm = makeSortModule(*planInput(plan, step.in_table), step.sort_columns,
+                                     sortMemory(), step.out_table,
+                                     min(sortThreads(), plan.threads));
+                break;
+            default:
+                FATAL_ERROR("internal error, planStepInputs checks the op");
+            }
+        type = boost::bind(&outputSeriesType, osm.get());
+        return osm;
+    }
+
     void verifyTableName(const string &name) {
         if (name.size() >= 200) {
             invalidTableName(name, "name too long");
@@ -443,9 +890,37 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         return prefix + table_name;
     }
 
-    void updateTableInfo(const string &table, const ExtentType::Ptr extent_type) {
+    // caller holds the write lock on dest_table
+    void importFiles(const vector<string> &source_paths, const string &extent_type,
+                     const string &dest_table, const vector<string> &depends_on) {
+        if (extent_type.empty()) {
+            requestError("extent type empty");
+        }
+
+        TypeIndexModule input(extent_type);
+        DataSeriesModule::Ptr output_module = makeTeeModule(input, tableToPath(dest_table));
+        BOOST_FOREACH(const string &path, source_paths) {
+            input.addSource(path);
+        }
+        output_module->getAndDeleteShared();
+        output_module.reset();
+        updateTableInfo(dest_table, input.getTypePtr(), depends_on);
+    }
+
+    void updateTableInfo(const string &table, const ExtentType::Ptr extent_type,
+                         const vector<string> &depends_on) {
+        PThreadScopedLock lock(table_info_mutex);
         TableInfo &info(table_info[table]);
         info.extent_type = extent_type;
+        info.depends_on = depends_on;
+        info.last_update = Clock::todTfrac();
+        table_cache.invalidate(table);
+    }
+
+    // the rows of a table; caller holds at least the read lock on it
+    DataSeriesModule::Ptr openTable(const string &table, const TableInfo &info) {
+        return table_cache.makeSource(table, info.last_update, info.extent_type->getName(),
+                                      tableToPath(table));
     }
 
     void waitForSuccessfulChild(pid_t pid) {
@@ -459,10 +934,9 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         }
     }
 
-    NameToInfo::iterator 
-    createTable(const string &table_name, NameToInfo::iterator update_table, 
-                const std::string &update_column) {
-        const ExtentType::Ptr from_type = update_table->second.extent_type;
+    TableInfo createTable(const string &table_name, const TableInfo &update_table,
+                          const std::string &update_column) {
+        const ExtentType::Ptr from_type = update_table.extent_type;
         string extent_type = str(format("<ExtentType name=\"%s\" namespace=\"%s\""
                                         " version=\"%d.%d\">") % table_name 
                                  % from_type->getNamespace() % from_type->majorVersion()
@@ -485,30 +959,68 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         Extent tmp(type);
         output.writeExtent(tmp, NULL);
         output.close();
-        updateTableInfo(table_name, library.getTypeByNamePtr(table_name));
+        updateTableInfo(table_name, library.getTypeByNamePtr(table_name), vector<string>());
         return getTableInfo(table_name);
     }
 
-    void exec(vector<string> &args) {
-        char **argv = new char *[args.size() + 1];
-        const char *tmp;
+    // run args in a child process, optionally closing the files inherited from the server.
+    // Other threads may hold locks in the server, e.g. in malloc, so the child only calls
+    // functions that are safe after fork in a threaded process.
+    pid_t spawn(vector<string> &args, bool close_files) {
+        vector<char *> argv;
         for (uint32_t i = 0; i < args.size(); ++i) {
-            tmp = args[i].c_str(); // force null termination
-            argv[i] = &args[i][0]; // couldn't figure out how to directly use c_str()
+            args[i].c_str(); // force null termination
+            argv.push_back(&args[i][0]); // couldn't figure out how to directly use c_str()
         }
-        argv[args.size()] = NULL;
-        execvp(args[0].c_str(), argv);
-        FATAL_ERROR(format("exec of %s failed: %s") % args[0] % strerror(errno));
+        argv.push_back(NULL);
+        LintelLogDebug("child", format("running: %s") % args);
+        pid_t pid = fork();
+        if (pid < 0) {
+            requestError("fork failed");
+        } else if (pid == 0) {
+            if (close_files) {
+                for (int i = 3; i < 100; ++i) {
+                    close(i);
+                }
+            }
+            execvp(argv[0], &argv[0]);
+            static const char msg[] = "data-series-server: exec failed\n";
+            ssize_t ignore = write(2, msg, sizeof(msg) - 1);
+            (void)ignore;
+            _exit(1);
+        }
+        return pid;
+    }
+
+    bool lookupTableInfo(const string &table_name, TableInfo &info) {
+        PThreadScopedLock lock(table_info_mutex);
+        TableInfo *ret = table_info.lookup(table_name);
+        if (ret == NULL) {
+            return false;
+        }
+        info = *ret;
+        return true;
     }
 
-    NameToInfo::iterator getTableInfo(const string &table_name) {
-        NameToInfo::iterator ret = table_info.find(table_name);
-        if (ret == table_info.end()) {
+    // returns a copy since other requests may change table_info once the lock is dropped
+    TableInfo getTableInfo(const string &table_name) {
+        TableInfo ret;
+        if (!lookupTableInfo(table_name, ret)) {
             invalidTableName(table_name, "table missing");
         }
         return ret;
     }
 
+    TableLocks table_locks;
+    WorkerBudget worker_budget;
+    TableCache table_cache;
+
+    PThreadMutex cursors_mutex;
+    Cursors cursors;
+    int64_t next_cursor_id;
+    PThreadFunction cursor_reaper;
+
+    PThreadMutex table_info_mutex;
     NameToInfo table_info;
 };
 
@@ -539,13 +1051,21 @@ void setupWorkingDirectory() {
 
 int main(int argc, char *argv[]) {
     LintelLog::parseEnv();
+    lintel::parseCommandLine(argc, argv);
     shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
     shared_ptr<DataSeriesServerHandler> handler(new DataSeriesServerHandler());
     shared_ptr<TProcessor> processor(new DataSeriesServerProcessor(handler));
     shared_ptr<TServerTransport> serverTransport(new TServerSocket(49476));
     shared_ptr<TTransportFactory> transportFactory(new TBufferedTransportFactory());
 
-    TSimpleServer server(processor, serverTransport, transportFactory, protocolFactory);
+    INVARIANT(po_server_threads.get() > 0, "--server-threads must be > 0");
+    shared_ptr<ThreadManager>
+        threadManager(ThreadManager::newSimpleThreadManager(po_server_threads.get()));
+    threadManager->threadFactory(shared_ptr<PosixThreadFactory>(new PosixThreadFactory()));
+    threadManager->start();
+
+    TThreadPoolServer server(processor, serverTransport, transportFactory, protocolFactory,
+                             threadManager);
 
     setupWorkingDirectory();
 
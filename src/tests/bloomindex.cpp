@@ -0,0 +1,152 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    test program for BloomIndexModule; generates a file with values spread
+    across all of the extents, and checks that lookups through the index
+    built by run-check-bloomindex.sh find every row with a value while
+    reading only a few of the extents
+*/
+
+#include <iostream>
+
+#include <Lintel/HashFns.hpp>
+
+#include <DataSeries/BloomIndexModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+
+const string type_xml(
+    "<ExtentType name=\"Test::Bloom\" namespace=\"ssd.hpl.hp.com\" version=\"1.0\">\n"
+    "  <field type=\"int64\" name=\"time\" />\n"
+    "  <field type=\"variable32\" name=\"fh\" />\n"
+    "  <field type=\"int32\" name=\"id\" />\n"
+    "</ExtentType>\n");
+
+const unsigned nrecords = 200000;
+const unsigned nfhs = 50000;
+
+// each handle shows up in about 4 rows scattered over the file
+string fhFor(unsigned row) {
+    uint32_t h = lintel::BobJenkinsHashMix3(row, 1861, 1776) % nfhs;
+    return (boost::format("fh-%08x") % lintel::BobJenkinsHashMix3(h, 1492, 1941)).str();
+}
+
+void generate(const string &filename) {
+    DataSeriesSink sink(filename);
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type(library.registerTypePtr(type_xml));
+    sink.writeExtentLibrary(library);
+
+    ExtentSeries series(type);
+    OutputModule output(sink, series, type, 64 * 1024);
+    Int64Field time(series, "time");
+    Variable32Field fh(series, "fh");
+    Int32Field id(series, "id");
+    for (unsigned i = 0; i < nrecords; ++i) {
+        output.newRecord();
+        time.set(i);
+        fh.set(fhFor(i));
+        id.set(lintel::BobJenkinsHashMix3(i, 1941, 1861) % 100000);
+    }
+    output.close();
+    sink.close();
+}
+
+// returns the number of rows with fieldname equal to one of values, and in
+// extents the number of extents read
+unsigned countRows(DataSeriesModule &source, const string &fieldname,
+                   const vector<GeneralValue> &values, unsigned &extents) {
+    ExtentSeries series;
+    GeneralField *field = NULL;
+    unsigned rows = 0;
+    extents = 0;
+    while (true) {
+        Extent::Ptr e = source.getSharedExtent();
+        if (e == NULL) {
+            break;
+        }
+        ++extents;
+        series.setExtent(e);
+        if (field == NULL) {
+            field = GeneralField::create(NULL, series, fieldname);
+        }
+        for (; series.morerecords(); ++series) {
+            for (vector<GeneralValue>::const_iterator i = values.begin(); i != values.end(); ++i) {
+                if (field->val().valString() == i->valString()) {
+                    ++rows;
+                    break;
+                }
+            }
+        }
+    }
+    delete field;
+    return rows;
+}
+
+// returns the number of extents read
+unsigned check(const string &index, const string &data, const string &fieldname,
+               const vector<GeneralValue> &values) {
+    TypeIndexModule all("Test::Bloom");
+    all.addSource(data);
+    unsigned all_extents = 0;
+    unsigned expect = countRows(all, fieldname, values, all_extents);
+
+    BloomIndexModule module(index, "Test::Bloom", fieldname, values);
+    SINVARIANT(module.getIndexedExtents() == all_extents);
+    unsigned extents = 0;
+    unsigned rows = countRows(module, fieldname, values, extents);
+    INVARIANT(rows == expect && extents == module.getKeptExtents(),
+              boost::format("%s: found %d rows in %d extents, expected %d")
+              % fieldname % rows % extents % expect);
+    return extents;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 3 && string(argv[1]) == "generate") {
+        generate(argv[2]);
+        return 0;
+    }
+    INVARIANT(argc == 3, "Usage: bloomindex generate data.ds | bloomindex index.ds data.ds");
+
+    TypeIndexModule all("Test::Bloom");
+    all.addSource(argv[2]);
+    unsigned total_extents = 0;
+    while (all.getSharedExtent() != NULL) {
+        ++total_extents;
+    }
+    SINVARIANT(total_extents > 20);
+
+    unsigned lookups = 0, read_extents = 0;
+    vector<GeneralValue> some_fhs;
+    for (unsigned i = 0; i < nrecords; i += nrecords / 50, ++lookups) {
+        GeneralValue fh;
+        fh.setVariable32(fhFor(i));
+        read_extents += check(argv[1], argv[2], "fh", vector<GeneralValue>(1, fh));
+        if (some_fhs.size() < 5) {
+            some_fhs.push_back(fh);
+        }
+    }
+    // a handle that isn't there, several at once, and an int64 lookup of an int32 field
+    GeneralValue missing;
+    missing.setVariable32("no-such-fh");
+    read_extents += check(argv[1], argv[2], "fh", vector<GeneralValue>(1, missing));
+    check(argv[1], argv[2], "fh", some_fhs);
+    GeneralValue id;
+    id.setInt64(lintel::BobJenkinsHashMix3(17, 1941, 1861) % 100000);
+    read_extents += check(argv[1], argv[2], "id", vector<GeneralValue>(1, id));
+    lookups += 2;
+
+    // each value is in a few extents, plus ~1% false positives
+    INVARIANT(read_extents < lookups * (10 + total_extents / 20),
+              boost::format("read %d extents for %d lookups over %d extents")
+              % read_extents % lookups % total_extents);
+    cout << boost::format("%d lookups read %d of %d extents\n")
+        % lookups % read_extents % (lookups * total_extents);
+    return 0;
+}
@@ -0,0 +1,101 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    test that adaptive compression selection packs extents that unpack to the
+    original, and that it does not give up much space over trying everything;
+    also that running the trials out of order through a CompressRunner gives
+    the same bytes as running them in turn
+*/
+
+#include <iostream>
+#include <vector>
+
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+
+size_t packAll(vector<Extent::Ptr> &extents, unsigned rounds) {
+    size_t total = 0;
+    for (unsigned round = 0; round < rounds; ++round) {
+        for (vector<Extent::Ptr>::iterator i = extents.begin(); i != extents.end(); ++i) {
+            Extent::ByteArray packed;
+            (*i)->packData(packed);
+            total += packed.size();
+
+            Extent unpacked((*i)->getTypePtr());
+            unpacked.unpackData(packed, false);
+            SINVARIANT(unpacked.fixeddata.size() == (*i)->fixeddata.size());
+            SINVARIANT(memcmp(unpacked.fixeddata.begin(), (*i)->fixeddata.begin(),
+                              unpacked.fixeddata.size()) == 0);
+            SINVARIANT(unpacked.variabledata.size() == (*i)->variabledata.size());
+            SINVARIANT(memcmp(unpacked.variabledata.begin(), (*i)->variabledata.begin(),
+                              unpacked.variabledata.size()) == 0);
+        }
+    }
+    return total;
+}
+
+// Runs the trials backwards, i.e. slowest first, so the size limits passed
+// between trials differ from the in-order run.
+class ReverseRunner : public Extent::CompressRunner {
+  public:
+    virtual void runAll(const vector<Extent::CompressTask *> &tasks) {
+        for (vector<Extent::CompressTask *>::const_reverse_iterator i = tasks.rbegin();
+             i != tasks.rend(); ++i) {
+            (**i).run();
+        }
+    }
+};
+
+void checkRunner(vector<Extent::Ptr> &extents) {
+    ReverseRunner runner;
+    for (vector<Extent::Ptr>::iterator i = extents.begin(); i != extents.end(); ++i) {
+        Extent::ByteArray in_order, reversed;
+        (*i)->packData(in_order);
+        (*i)->packData(reversed, Extent::compress_all, 9, NULL, NULL, NULL, &runner);
+        SINVARIANT(in_order.size() == reversed.size());
+        SINVARIANT(memcmp(in_order.begin(), reversed.begin(), in_order.size()) == 0);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    SINVARIANT(argc == 2);
+
+    TypeIndexModule source("Trace::NFS::common");
+    source.addSource(argv[1]);
+    vector<Extent::Ptr> extents;
+    while (true) {
+        Extent::Ptr e = source.getSharedExtent();
+        if (e == NULL) {
+            break;
+        }
+        extents.push_back(e);
+    }
+    SINVARIANT(!extents.empty());
+
+    // enough rounds to go through warmup and several sample intervals
+    unsigned rounds = 16;
+    Extent::setCompressSelect(Extent::CompressSelectExhaustive);
+    Extent::setCompressCost(Extent::CompressCostSize);
+    size_t exhaustive = packAll(extents, rounds);
+    checkRunner(extents);
+
+    Extent::setCompressSelect(Extent::CompressSelectAdaptive, 4);
+    size_t adaptive = packAll(extents, rounds);
+    INVARIANT(adaptive <= exhaustive * 1.05,
+              boost::format("adaptive %d bytes vs exhaustive %d") % adaptive % exhaustive);
+
+    Extent::setCompressCost(Extent::CompressCostWeighted);
+    packAll(extents, rounds);
+    Extent::setCompressCost(Extent::CompressCostTimeSize);
+    packAll(extents, rounds);
+
+    cout << "adaptive compression packed " << extents.size() << " extents * " << rounds
+         << " rounds into " << adaptive << " bytes, exhaustive " << exhaustive << "\n";
+    return 0;
+}
@@ -155,9 +155,83 @@ void testNullExpr() {
     cout << "Null Expr passed.\n";
 }
 
+// selectRows has to agree with valBool on every row, whether or not the expression compiles
+void testSelectRows() {
+    static string extent_type_xml(
+        "<ExtentType name=\"Test1\" namespace=\"ssd.hpl.hp.com\" version=\"1.0\" >"
+        "  <field type=\"bool\" name=\"flag\" />"
+        "  <field type=\"byte\" name=\"small\" />"
+        "  <field type=\"int32\" name=\"a\" opt_nullable=\"yes\" />"
+        "  <field type=\"int64\" name=\"time\" />"
+        "  <field type=\"double\" name=\"x\" />"
+        "  <field type=\"variable32\" name=\"name\" opt_nullable=\"yes\" />"
+        "  <field type=\"variable32\" name=\"num\" />"
+        "</ExtentType>");
+
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr extent_type(library.registerTypePtr(extent_type_xml));
+
+    ExtentSeries series(extent_type);
+    series.newExtent();
+    BoolField flag(series, "flag");
+    ByteField small(series, "small");
+    Int32Field a(series, "a", Field::flag_nullable);
+    Int64Field time(series, "time");
+    DoubleField x(series, "x");
+    Variable32Field name(series, "name", Field::flag_nullable);
+    Variable32Field num(series, "num");
+
+    const char *names[] = { "", "abc", "abd", "ab", "b" };
+    for (int i = 0; i < 3000; ++i) { // more than one block of rows
+        series.newRecord();
+        flag.set(i % 3 == 0);
+        small.set(i % 200);
+        if (i % 7 == 0) {
+            a.setNull();
+        } else {
+            a.set(i - 1500);
+        }
+        time.set((static_cast<int64_t>(i) << 32) + i);
+        x.set(i * 0.1);
+        if (i % 11 == 0) {
+            name.setNull();
+        } else {
+            name.set(names[i % 5]);
+        }
+        num.set((boost::format("%d") % (i % 13)).str());
+    }
+
+    const char *exprs[] = {
+        "flag", "!flag", "a", "a > 0", "a == 0 || flag", "small >= 100 && !(x < 50)",
+        "x * 2 - a / 3 > small + 1", "-a <= x", "fn.TfracToSeconds(time) > 1000.5",
+        "x == 0.3", "x != 0.3", "name == \"abc\"", "name < \"abd\"", "\"ab\" >= name",
+        "name != \"b\" && a < 0", "num > \"5\"", "1", "0",
+        // these have no compiled form
+        "fn.TfracToSeconds(x * 1) > 1", "fn.TfracToSeconds(time + a) < 2000",
+    };
+    series.setCurPos(series.getExtentRef().fixeddata.begin() + 5 * extent_type->fixedrecordsize());
+    const void *pos = series.getCurPos();
+    for (unsigned i = 0; i < sizeof(exprs) / sizeof(exprs[0]); ++i) {
+        boost::scoped_ptr<DSExpr> expr(DSExpr::make(series, exprs[i]));
+        DSExpr::Selection selected;
+        expr->selectRows(series, selected);
+        SINVARIANT(series.getCurPos() == pos);
+        SINVARIANT(selected.size() == 3000);
+
+        ExtentSeries check(series.getSharedExtent());
+        boost::scoped_ptr<DSExpr> check_expr(DSExpr::make(check, exprs[i]));
+        for (size_t row = 0; check.more(); check.next(), ++row) {
+            INVARIANT(selected[row] == check_expr->valBool(),
+                      boost::format("mismatch on '%s' row %d") % exprs[i] % row);
+        }
+    }
+    cout << "Select Rows passed.\n";
+}
+
 int main(int argc, char **argv) {
     testSeriesSelect();
     testNullExpr();
+    testSelectRows();
     makeFile();
 
     return 0;
@@ -0,0 +1,209 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+// Check that ExtentCopyPlan copies the same values as GeneralField would, including renamed,
+// reordered and nullable fields, and that it refuses fields that need conversions.
+
+#include <boost/format.hpp>
+
+#include <DataSeries/BoolField.hpp>
+#include <DataSeries/DoubleField.hpp>
+#include <DataSeries/ExtentCopyPlan.hpp>
+#include <DataSeries/GeneralField.hpp>
+#include <DataSeries/Int32Field.hpp>
+#include <DataSeries/Int64Field.hpp>
+#include <DataSeries/Variable32Field.hpp>
+
+using namespace std;
+using boost::format;
+
+const string source_xml
+("<ExtentType name=\"copy-plan-source\" namespace=\"example.com\" version=\"1.0\" >\n"
+ "  <field type=\"bool\" name=\"flag\" />\n"
+ "  <field type=\"int32\" name=\"i32\" opt_nullable=\"yes\" />\n"
+ "  <field type=\"int64\" name=\"i64\" />\n"
+ "  <field type=\"double\" name=\"dbl\" />\n"
+ "  <field type=\"variable32\" name=\"str\" opt_nullable=\"yes\" />\n"
+ "  <field type=\"variable32\" name=\"other\" />\n"
+ "</ExtentType>\n");
+
+// renamed and reordered; i64 becomes nullable, other and flag2 are not copied
+const string dest_xml
+("<ExtentType name=\"copy-plan-dest\" namespace=\"example.com\" version=\"1.0\" >\n"
+ "  <field type=\"variable32\" name=\"s\" opt_nullable=\"yes\" />\n"
+ "  <field type=\"bool\" name=\"flag2\" />\n"
+ "  <field type=\"double\" name=\"d\" />\n"
+ "  <field type=\"int64\" name=\"l\" opt_nullable=\"yes\" />\n"
+ "  <field type=\"bool\" name=\"f\" />\n"
+ "  <field type=\"int32\" name=\"i\" opt_nullable=\"yes\" />\n"
+ "</ExtentType>\n");
+
+const int nrows = 1000;
+
+string rowString(int row) {
+    return string(row % 37, 'a' + row % 26);
+}
+
+void fillSource(ExtentSeries &series) {
+    BoolField flag(series, "flag");
+    Int32Field i32(series, "i32", Field::flag_nullable);
+    Int64Field i64(series, "i64");
+    DoubleField dbl(series, "dbl");
+    Variable32Field str(series, "str", Field::flag_nullable);
+    Variable32Field other(series, "other");
+
+    series.newExtent();
+    for (int row = 0; row < nrows; ++row) {
+        series.newRecord();
+        flag.set(row % 3 == 0);
+        if (row % 5 == 0) {
+            i32.setNull();
+        } else {
+            i32.set(row * 7);
+        }
+        i64.set(row * 1000000007LL);
+        dbl.set(row / 3.0);
+        if (row % 7 == 0) {
+            str.setNull();
+        } else {
+            str.set(rowString(row));
+        }
+        other.set(rowString(row + 1));
+    }
+}
+
+ExtentCopyPlan::FieldPairs destFields() {
+    ExtentCopyPlan::FieldPairs ret;
+    ret.push_back(make_pair("flag", "f"));
+    ret.push_back(make_pair("i32", "i"));
+    ret.push_back(make_pair("i64", "l"));
+    ret.push_back(make_pair("dbl", "d"));
+    ret.push_back(make_pair("str", "s"));
+    return ret;
+}
+
+// every row of dest has to match the row of source it was copied from
+void checkRows(ExtentSeries &source, ExtentSeries &dest, const vector<bool> *selected) {
+    ExtentCopyPlan::FieldPairs fields(destFields());
+    vector<GeneralField::Ptr> from, to;
+    for (ExtentCopyPlan::FieldPairs::iterator i = fields.begin(); i != fields.end(); ++i) {
+        from.push_back(GeneralField::make(source, i->first));
+        to.push_back(GeneralField::make(dest, i->second));
+    }
+    BoolField flag2(dest, "flag2");
+
+    int copied = 0;
+    source.setExtent(source.getSharedExtent());
+    dest.setExtent(dest.getSharedExtent());
+    for (int row = 0; source.more(); source.next(), ++row) {
+        if (selected != NULL && !(*selected)[row]) {
+            continue;
+        }
+        SINVARIANT(dest.more());
+        for (size_t i = 0; i < from.size(); ++i) {
+            INVARIANT(from[i]->isNull() == to[i]->isNull()
+                      && (from[i]->isNull() || from[i]->val() == to[i]->val()),
+                      format("row %d field %s: %s != %s") % row % fields[i].second
+                      % from[i]->val() % to[i]->val());
+        }
+        SINVARIANT(!flag2.val());
+        dest.next();
+        ++copied;
+    }
+    SINVARIANT(!dest.more());
+    SINVARIANT(copied == (selected == NULL ? nrows : nrows / 2));
+}
+
+void checkAppendRows(const ExtentType::Ptr &source_type, const ExtentType::Ptr &dest_type,
+                     const vector<bool> *selected) {
+    ExtentSeries source(source_type), dest(dest_type);
+    fillSource(source);
+
+    ExtentCopyPlan plan(source_type, dest_type, destFields());
+    SINVARIANT(plan.supported());
+    dest.newExtent();
+    size_t copied = plan.appendRows(source.getExtentRef(), selected, dest.getExtentRef());
+    SINVARIANT(copied == (selected == NULL ? nrows : nrows / 2));
+    checkRows(source, dest, selected);
+    cout << format("appendRows %s selection ok\n") % (selected == NULL ? "without" : "with");
+}
+
+void checkCopyRow(const ExtentType::Ptr &source_type, const ExtentType::Ptr &dest_type) {
+    ExtentSeries source(source_type), dest(dest_type);
+    fillSource(source);
+
+    ExtentCopyPlan plan(source_type, dest_type, destFields());
+    dest.newExtent();
+    for (source.setExtent(source.getSharedExtent()); source.more(); source.next()) {
+        dest.newRecord();
+        plan.copyRow(source.getExtentRef(), source.getRowOffset(),
+                     dest.getExtentRef(), dest.getRowOffset());
+    }
+    checkRows(source, dest, NULL);
+    cout << "copyRow ok\n";
+}
+
+void checkSameType(const ExtentType::Ptr &type) {
+    ExtentSeries source(type), dest(type);
+    fillSource(source);
+
+    ExtentCopyPlan plan(type, type);
+    SINVARIANT(plan.supported());
+    dest.newExtent();
+    plan.appendRows(source.getExtentRef(), NULL, dest.getExtentRef());
+    plan.appendRows(source.getExtentRef(), NULL, dest.getExtentRef());
+
+    vector<GeneralField::Ptr> from, to;
+    for (uint32_t i = 0; i < type->getNFields(); ++i) {
+        from.push_back(GeneralField::make(source, type->getFieldName(i)));
+        to.push_back(GeneralField::make(dest, type->getFieldName(i)));
+    }
+    dest.setExtent(dest.getSharedExtent());
+    for (int pass = 0; pass < 2; ++pass) {
+        for (source.setExtent(source.getSharedExtent()); source.more(); source.next()) {
+            SINVARIANT(dest.more());
+            for (size_t i = 0; i < from.size(); ++i) {
+                SINVARIANT(from[i]->isNull() == to[i]->isNull());
+                SINVARIANT(from[i]->isNull() || from[i]->val() == to[i]->val());
+            }
+            dest.next();
+        }
+    }
+    SINVARIANT(!dest.more());
+    cout << "same type ok\n";
+}
+
+void checkUnsupported(const ExtentType::Ptr &source_type, const ExtentType::Ptr &dest_type) {
+    ExtentCopyPlan::FieldPairs fields;
+    fields.push_back(make_pair("i32", "l")); // int32 -> int64 needs a conversion
+    ExtentCopyPlan conversion(source_type, dest_type, fields);
+    SINVARIANT(!conversion.supported() && conversion.unsupportedField() == "l");
+
+    fields.clear();
+    fields.push_back(make_pair("l", "i64"));
+    ExtentCopyPlan nullable(dest_type, source_type, fields);
+    SINVARIANT(!nullable.supported()); // nullable to non-nullable
+    cout << "unsupported ok\n";
+}
+
+int main(int argc, char **argv) {
+    ExtentTypeLibrary lib;
+    const ExtentType::Ptr source_type(lib.registerTypePtr(source_xml));
+    const ExtentType::Ptr dest_type(lib.registerTypePtr(dest_xml));
+
+    vector<bool> selected;
+    for (int row = 0; row < nrows; ++row) {
+        selected.push_back(row % 2 == 1);
+    }
+
+    checkAppendRows(source_type, dest_type, NULL);
+    checkAppendRows(source_type, dest_type, &selected);
+    checkCopyRow(source_type, dest_type);
+    checkSameType(source_type);
+    checkUnsupported(source_type, dest_type);
+    return 0;
+}
@@ -0,0 +1,126 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test that the extent stats written by DataSeriesSink let TypeIndexModule
+    skip extents, and that it never skips an extent with a matching row.
+*/
+
+#include <iostream>
+
+#include <boost/scoped_ptr.hpp>
+
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/DSExpr.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+
+const string extent_type_xml(
+    "<ExtentType name=\"Test::ExtentStats\" namespace=\"ssd.hpl.hp.com\" version=\"1.0\">\n"
+    "  <field type=\"int64\" name=\"time\" />\n"
+    "  <field type=\"int32\" name=\"a\" opt_nullable=\"yes\" />\n"
+    "  <field type=\"double\" name=\"x\" />\n"
+    "  <field type=\"variable32\" name=\"name\" />\n"
+    "</ExtentType>\n");
+
+const unsigned nrecords = 100000;
+
+void makeFile(const string &filename, bool extent_stats) {
+    DataSeriesSink sink(filename);
+    sink.setExtentStats(extent_stats);
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type(library.registerTypePtr(extent_type_xml));
+    sink.writeExtentLibrary(library);
+
+    ExtentSeries series(type);
+    OutputModule output(sink, series, type, 16 * 1024);
+    Int64Field time(series, "time");
+    Int32Field a(series, "a", Field::flag_nullable);
+    DoubleField x(series, "x");
+    Variable32Field name(series, "name");
+    for (unsigned i = 0; i < nrecords; ++i) {
+        output.newRecord();
+        time.set(1000000LL * i);
+        // a is null for the second half, so extents there must match a == 0
+        if (i < nrecords / 2) {
+            a.set(i % 1000 + 1);
+        } else {
+            a.setNull();
+        }
+        // NaNs leave the range of x unknown in the early extents
+        x.set(i % 7 == 0 && i < 10000 ? Double::NaN : i * 0.5);
+        name.set(i % 2 == 0 ? "even" : "odd");
+    }
+    output.close();
+    sink.close();
+}
+
+// returns the number of matching rows; the number of skipped extents is in skipped
+unsigned countMatches(const string &filename, const string &where, bool predicate,
+                      uint64_t &skipped) {
+    TypeIndexModule source("Test::ExtentStats");
+    source.addSource(filename);
+    if (predicate) {
+        source.setPredicate(where);
+    }
+    ExtentSeries series;
+    boost::scoped_ptr<DSExpr> expr;
+    DSExpr::Selection selected;
+    unsigned matches = 0;
+    while (true) {
+        Extent::Ptr e = source.getSharedExtent();
+        if (e == NULL) {
+            break;
+        }
+        series.setExtent(e);
+        if (expr == NULL) {
+            expr.reset(DSExpr::make(series, where));
+        }
+        expr->selectRows(series, selected);
+        for (size_t i = 0; i < selected.size(); ++i) {
+            matches += selected[i] ? 1 : 0;
+        }
+    }
+    skipped = source.getSkippedExtents();
+    return matches;
+}
+
+int main() {
+    makeFile("extent-stats.ds", true);
+    makeFile("extent-stats-none.ds", false);
+
+    struct {
+        const char *where;
+        bool expect_skips;
+    } tests[] = {
+        { "time >= 20000000000 && time < 21000000000", true },
+        { "fn.TfracToSeconds(time) < 1", true },
+        { "!(time > 1000000000)", true },
+        { "a > 900", true }, // early extents only reach a = 500
+        { "a == 0", true }, // skips the first half, which has no nulls
+        { "a * 2 - 1 < 0", true },
+        { "x > 49000 || time < 5000000", true },
+        { "name == \"odd\" && time > 99000000000", true },
+        { "time > -1", false },
+    };
+    for (unsigned i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+        uint64_t skipped = 0, none_skipped = 0, all_skipped = 0;
+        unsigned expect = countMatches("extent-stats.ds", tests[i].where, false, all_skipped);
+        unsigned got = countMatches("extent-stats.ds", tests[i].where, true, skipped);
+        unsigned got_none = countMatches("extent-stats-none.ds", tests[i].where, true,
+                                         none_skipped);
+        INVARIANT(got == expect && got_none == expect,
+                  boost::format("'%s' matched %d rows with stats, %d without, expected %d")
+                  % tests[i].where % got % got_none % expect);
+        INVARIANT((skipped > 0) == tests[i].expect_skips && all_skipped == 0 && none_skipped == 0,
+                  boost::format("'%s' skipped %d extents") % tests[i].where % skipped);
+        cout << boost::format("'%s': %d matching rows, skipped %d extents\n")
+            % tests[i].where % got % skipped;
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    test that the different ways IndexSourceModule can read compressed
+    extents (pread, memory mapped, parallel readers) give the same extents in
+    the same order
+*/
+
+#include <iostream>
+
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+
+void sameBytes(const Extent::ByteArray &a, const Extent::ByteArray &b) {
+    SINVARIANT(a.size() == b.size());
+    SINVARIANT(memcmp(a.begin(), b.begin(), a.size()) == 0);
+}
+
+void sameExtent(Extent::Ptr a, Extent::Ptr b) {
+    SINVARIANT(a->getTypePtr() == b->getTypePtr());
+    SINVARIANT(a->extent_source_offset == b->extent_source_offset);
+    sameBytes(a->fixeddata, b->fixeddata);
+    sameBytes(a->variabledata, b->variabledata);
+}
+
+// Run after the other checks; the shared pool can only be set up once per
+// process.  The budgets are deliberately tiny so that the sources have
+// to take turns.
+void checkSharedPool(const string &filename) {
+    IndexSourceModule::useSharedUnpackPool(1024*1024, 1024*1024, 2);
+    TypeIndexModule reference, pool_a, pool_b;
+    reference.addSource(filename);
+    pool_a.addSource(filename);
+    pool_b.addSource(filename);
+    pool_b.setUnpackPriority(1);
+    pool_b.setCompressedReaders(2);
+
+    unsigned nextents = 0;
+    while (true) {
+        Extent::Ptr a = reference.getSharedExtent();
+        Extent::Ptr b = pool_a.getSharedExtent();
+        Extent::Ptr c = pool_b.getSharedExtent();
+        if (a == NULL) {
+            SINVARIANT(b == NULL && c == NULL);
+            break;
+        }
+        SINVARIANT(b != NULL && c != NULL);
+        sameExtent(a, b);
+        sameExtent(a, c);
+        ++nextents;
+    }
+    SINVARIANT(nextents > 0);
+    cout << "shared unpack pool gave identical results for " << nextents << " extents\n";
+}
+
+int main(int argc, char *argv[]) {
+    SINVARIANT(argc == 2);
+
+    TypeIndexModule pread_source, mmap_source, parallel_source;
+    pread_source.addSource(argv[1]);
+    pread_source.setUseMmap(false);
+    mmap_source.addSource(argv[1]);
+    mmap_source.setUseMmap(true);
+    parallel_source.addSource(argv[1]);
+    parallel_source.setUseMmap(false);
+    parallel_source.setCompressedReaders(4);
+
+    unsigned nextents = 0;
+    while (true) {
+        Extent::Ptr a = pread_source.getSharedExtent();
+        Extent::Ptr b = mmap_source.getSharedExtent();
+        Extent::Ptr c = parallel_source.getSharedExtent();
+        if (a == NULL) {
+            SINVARIANT(b == NULL && c == NULL);
+            break;
+        }
+        SINVARIANT(b != NULL && c != NULL);
+        SINVARIANT(a->getTypePtr() == b->getTypePtr() && a->getTypePtr() == c->getTypePtr());
+        SINVARIANT(a->extent_source_offset == b->extent_source_offset);
+        SINVARIANT(a->extent_source_offset == c->extent_source_offset);
+        sameBytes(a->fixeddata, b->fixeddata);
+        sameBytes(a->variabledata, b->variabledata);
+        sameBytes(a->fixeddata, c->fixeddata);
+        sameBytes(a->variabledata, c->variabledata);
+        ++nextents;
+    }
+    SINVARIANT(nextents > 0);
+    SINVARIANT(pread_source.total_compressed_bytes == mmap_source.total_compressed_bytes);
+    SINVARIANT(pread_source.total_compressed_bytes == parallel_source.total_compressed_bytes);
+    cout << "pread, mmap and parallel reads gave identical results for "
+         << nextents << " extents\n";
+    checkSharedPool(argv[1]);
+    return 0;
+}
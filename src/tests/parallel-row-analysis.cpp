@@ -0,0 +1,137 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+// Check that ParallelRowAnalysisModule sees every row exactly once across its workers, that
+// merging gives the serial result, and that the extents are passed on unchanged and in order.
+
+#include <boost/format.hpp>
+
+#include <Lintel/Stats.hpp>
+
+#include <DataSeries/Int64Field.hpp>
+#include <DataSeries/ParallelRowAnalysisModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string type_xml
+("<ExtentType name=\"parallel-row-analysis\" namespace=\"example.com\" version=\"1.0\" >\n"
+ "  <field type=\"int64\" name=\"value\" />\n"
+ "</ExtentType>\n");
+
+const int64_t nextents = 200;
+const int64_t rows_per_extent = 1000;
+
+class GenerateModule : public DataSeriesModule {
+  public:
+    GenerateModule(const ExtentType::Ptr &type)
+        : series(type), value(series, "value"), next_extent(0) { }
+
+    virtual Extent::Ptr getSharedExtent() {
+        if (next_extent == nextents) {
+            return Extent::Ptr();
+        }
+        series.newExtent();
+        for (int64_t row = 0; row < rows_per_extent; ++row) {
+            series.newRecord();
+            value.set(next_extent * rows_per_extent + row);
+        }
+        ++next_extent;
+        Extent::Ptr ret = series.getSharedExtent();
+        series.clearExtent();
+        return ret;
+    }
+
+    ExtentSeries series;
+    Int64Field value;
+    int64_t next_extent;
+};
+
+class SumAnalysis : public ParallelRowAnalysisModule {
+  public:
+    SumAnalysis(DataSeriesModule &source, unsigned nthreads)
+        : ParallelRowAnalysisModule(source, nthreads), quantiles(0.001, nextents * rows_per_extent),
+          nmerged(0) { }
+
+    class Worker : public ParallelRowAnalysisModule::Worker {
+      public:
+        Worker(SharedStatsQuantile &quantiles) : value(series, "value"), quantile_buffer(quantiles) { }
+
+        virtual void processRow() {
+            stats.add(value.val());
+            quantile_buffer.add(value.val());
+        }
+
+        Int64Field value;
+        Stats stats;
+        SharedStatsQuantile::Buffer quantile_buffer;
+    };
+
+    virtual Worker *makeWorker() {
+        return new Worker(quantiles);
+    }
+
+    virtual void merge(ParallelRowAnalysisModule::Worker &from) {
+        Worker &worker(static_cast<Worker &>(from));
+        stats.add(worker.stats);
+        worker.quantile_buffer.flush();
+        ++nmerged;
+    }
+
+    Stats stats;
+    SharedStatsQuantile quantiles;
+    unsigned nmerged;
+};
+
+void checkAnalysis(const ExtentType::Ptr &type, unsigned nthreads, const string &where) {
+    GenerateModule source(type);
+    SumAnalysis analysis(source, nthreads);
+    if (!where.empty()) {
+        analysis.setWhereExpr(where);
+    }
+
+    ExtentSeries series(type);
+    Int64Field value(series, "value");
+    int64_t expected = 0;
+    while (true) {
+        Extent::Ptr e = analysis.getSharedExtent();
+        if (e == NULL) {
+            break;
+        }
+        for (series.setExtent(e); series.more(); series.next()) {
+            SINVARIANT(value.val() == expected);
+            ++expected;
+        }
+    }
+    SINVARIANT(expected == nextents * rows_per_extent);
+    SINVARIANT(analysis.getSharedExtent() == NULL); // only merges once
+    SINVARIANT(analysis.nmerged == (nthreads == 0 ? static_cast<unsigned>(PThreadMisc::getNCpus())
+                                    : nthreads));
+
+    int64_t nrows = where.empty() ? expected : expected / 2;
+    INVARIANT(analysis.stats.count() == nrows,
+              format("%d != %d") % analysis.stats.count() % nrows);
+    SINVARIANT(analysis.processed_rows == static_cast<uint64_t>(nrows));
+    SINVARIANT(analysis.ignored_rows == static_cast<uint64_t>(expected - nrows));
+    SINVARIANT(analysis.quantiles.stats.count() == nrows);
+    SINVARIANT(analysis.stats.min() == 0);
+    SINVARIANT(analysis.stats.max() == (where.empty() ? expected - 1 : nrows - 1));
+    double median = analysis.quantiles.stats.getQuantile(0.5);
+    SINVARIANT(median > 0.49 * analysis.stats.max() && median < 0.51 * analysis.stats.max());
+    cout << format("%d threads, where '%s' ok\n") % nthreads % where;
+}
+
+int main(int argc, char **argv) {
+    ExtentTypeLibrary lib;
+    const ExtentType::Ptr type(lib.registerTypePtr(type_xml));
+
+    checkAnalysis(type, 1, "");
+    checkAnalysis(type, 4, "");
+    checkAnalysis(type, 0, "");
+    checkAnalysis(type, 3, str(format("value < %d") % (nextents * rows_per_extent / 2)));
+    return 0;
+}
@@ -0,0 +1,78 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+// Check that QuantileSketch stays within its relative error, that merging sketches gives the
+// same answer as adding everything to one, and that the number of buckets stays bounded.
+
+#include <math.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include <Lintel/AssertBoost.hpp>
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/QuantileSketch.hpp>
+
+using namespace std;
+using boost::format;
+
+void checkAccuracy(MersenneTwisterRandom &rng, unsigned nvalues) {
+    vector<double> values;
+    QuantileSketch all, part_a, part_b;
+    for (unsigned i = 0; i < nvalues; ++i) {
+        double v;
+        switch (rng.randInt(4)) {
+            case 0: v = exp(rng.randDouble() * 40 - 20); break;
+            case 1: v = -exp(rng.randDouble() * 20 - 10); break;
+            case 2: v = rng.randInt(1000); break;
+            default: v = 0;
+        }
+        values.push_back(v);
+        all.add(v);
+        (i % 3 == 0 ? part_a : part_b).add(v);
+    }
+    part_a.merge(part_b);
+    SINVARIANT(part_a.count() == all.count());
+    sort(values.begin(), values.end());
+
+    for (unsigned i = 0; i <= 100; ++i) {
+        double quantile = i / 100.0;
+        double exact = values[static_cast<size_t>(quantile * (nvalues - 1))];
+        double estimate = all.getQuantile(quantile);
+        SINVARIANT(part_a.getQuantile(quantile) == estimate);
+        double error = exact == 0 ? fabs(estimate) : fabs(estimate - exact) / fabs(exact);
+        INVARIANT(error <= 0.01 + 1.0e-9, format("quantile %g of %d values: %g vs %g")
+                  % quantile % nvalues % estimate % exact);
+    }
+}
+
+void checkBound() {
+    QuantileSketch sketch(0.01, 64);
+    for (unsigned i = 1; i <= 1000000; ++i) {
+        sketch.add(i);
+    }
+    SINVARIANT(sketch.nBuckets() == 64);
+    // only the low end has been combined
+    double p99 = sketch.getQuantile(0.99);
+    SINVARIANT(fabs(p99 - 990000) / 990000 <= 0.01);
+    SINVARIANT(sketch.count() == 1000000 && sketch.getQuantile(1) <= 1000000);
+}
+
+int main(int argc, char **argv) {
+    MersenneTwisterRandom rng;
+    cout << format("seed %d\n") % rng.seed_used;
+    for (unsigned i = 0; i < 100; ++i) {
+        checkAccuracy(rng, 1 + rng.randInt(5000));
+    }
+    checkBound();
+    cout << "quantile sketch ok\n";
+    return 0;
+}
@@ -0,0 +1,28 @@
+#!/bin/sh -x
+#
+# (c) Copyright 2013, Hewlett-Packard Development Company, LP
+#
+#  See the file named COPYING for license details
+#
+# test script for BloomIndexModule; also checks that updating the index
+# keeps the bloom filters
+
+set -e
+
+rm -f bloomindex.ds bloomindex-data.ds
+
+./bloomindex generate bloomindex-data.ds
+../process/dsextentindex --compress-lzf --new Test::Bloom time --bloom fh,id bloomindex.ds bloomindex-data.ds
+./bloomindex bloomindex.ds bloomindex-data.ds
+
+# rewrite the data so the update re-indexes it, then check an update that
+# only copies the old index
+./bloomindex generate bloomindex-data.ds
+../process/dsextentindex --compress-lzf bloomindex.ds bloomindex-data.ds
+./bloomindex bloomindex.ds bloomindex-data.ds
+../process/dsextentindex --compress-lzf bloomindex.ds bloomindex-data.ds
+./bloomindex bloomindex.ds bloomindex-data.ds
+
+rm -f bloomindex.ds bloomindex-data.ds
+
+exit 0
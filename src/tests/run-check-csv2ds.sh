@@ -10,3 +10,27 @@ echo "Trying with different prefix/separator"
 ../process/csv2ds --compress-lzf --comment-prefix='CCC ' --field-separator=ZZZ --xml-desc-file=$SRC/check-data/csv2ds-1.xml $SRC/check-data/csv2ds-2.csv csv2ds-2.ds
 ../process/ds2txt --skip-index csv2ds-2.ds >csv2ds-2.txt
 cmp csv2ds-2.txt $SRC/check-data/csv2ds-1.txt.ref
+echo "Trying with a chunk and thread for each record"
+../process/csv2ds --compress-lzf --threads=3 --chunk-size=1 --xml-desc-file=$SRC/check-data/csv2ds-1.xml $SRC/check-data/csv2ds-1.csv csv2ds-3.ds
+../process/ds2txt --skip-all csv2ds-1.ds >csv2ds-1.rows
+../process/ds2txt --skip-all csv2ds-3.ds >csv2ds-3.rows
+cmp csv2ds-1.rows csv2ds-3.rows
+echo "Trying with newlines in quoted fields"
+awk 'BEGIN { for (i = 0; i < 2000; ++i) { printf "true,%d,%d,%d,%d.5,\"line %d\nand\r\n\"\"more\"\"\"\r\n", i % 256, i, i * 1000000, i, i } }' >csv2ds-4.csv
+../process/csv2ds --compress-lzf --threads=1 --xml-desc-file=$SRC/check-data/csv2ds-1.xml csv2ds-4.csv csv2ds-4a.ds
+../process/csv2ds --compress-lzf --threads=4 --chunk-size=1000 --xml-desc-file=$SRC/check-data/csv2ds-1.xml - csv2ds-4b.ds <csv2ds-4.csv
+../process/ds2txt --skip-all csv2ds-4a.ds >csv2ds-4a.rows
+../process/ds2txt --skip-all csv2ds-4b.ds >csv2ds-4b.rows
+cmp csv2ds-4a.rows csv2ds-4b.rows
+# the strings have to come out with the newline, carriage return and single quotes, not just the
+# same way both times
+awk 'BEGIN { for (i = 0; i < 2000; ++i) { printf "line %d\nand\r\n\"more\"\n", i } }' >csv2ds-4.ref
+../process/ds2txt --skip-all --select test-csv2ds variable32 --printSpec='type="test-csv2ds" name="variable32" print_style="text"' csv2ds-4b.ds >csv2ds-4b.strings
+cmp csv2ds-4b.strings csv2ds-4.ref
+echo "Trying with a separator that overlaps itself"
+# each string field is a"<n>, which stays unquoted since the quote is not at the start of a field
+awk 'BEGIN { for (i = 0; i < 2000; ++i) { printf "trueaa%daa%daa%daa%d.5aaa\"%d\n", i % 256, i, i * 1000000, i, i } }' >csv2ds-5.csv
+../process/csv2ds --compress-lzf --threads=4 --chunk-size=1000 --field-separator=aa --xml-desc-file=$SRC/check-data/csv2ds-1.xml csv2ds-5.csv csv2ds-5.ds
+awk 'BEGIN { for (i = 0; i < 2000; ++i) { printf "a\"%d\n", i } }' >csv2ds-5.ref
+../process/ds2txt --skip-all --select test-csv2ds variable32 --printSpec='type="test-csv2ds" name="variable32" print_style="text"' csv2ds-5.ds >csv2ds-5.strings
+cmp csv2ds-5.strings csv2ds-5.ref
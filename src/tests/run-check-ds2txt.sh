@@ -20,3 +20,13 @@ rm -f ds2txt.test.tmp ds2txt.test.txt
 cmp ds2txt-where.test.txt $1/check-data/ds2txt-where.test.ref
 rm -f ds2txt-where.test.tmp
 
+
+# formatting on threads has to give exactly the same output
+../process/ds2txt --threads=4 --skip-all --select common record_id,packet_at,dest --printSpec='type="Trace::NFS::common" name="packet_at" print_format="sec.nsec" units="2^-32 seconds" epoch="unix"' --printSpec='type="Trace::NFS::common" name="dest" print_format="ipv4"' --where Trace::NFS::common 'record_id < 38549988050' $SRC/check-data/nfs-2.set-1.20k.ds >ds2txt-where.test.txt
+cmp ds2txt-where.test.txt $1/check-data/ds2txt-where.test.ref
+rm -f ds2txt-where.test.txt
+
+../process/ds2txt $SRC/check-data/nfs-2.set-1.20k.ds >ds2txt-threads-1.test.txt
+../process/ds2txt --threads=4 $SRC/check-data/nfs-2.set-1.20k.ds >ds2txt-threads-4.test.txt
+cmp ds2txt-threads-1.test.txt ds2txt-threads-4.test.txt
+rm -f ds2txt-threads-1.test.txt ds2txt-threads-4.test.txt
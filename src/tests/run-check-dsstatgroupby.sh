@@ -16,6 +16,17 @@ perl $1/check-data/unordered-file-equality.pl test.dsstatgroupby.1 $1/check-data
 perl $1/check-data/clean-timing.pl <test.dsstatgroupby.tmp >test.dsstatgroupby.2
 perl $1/check-data/unordered-file-equality.pl test.dsstatgroupby.2 $1/check-data/test.dsstatgroupby.2.ref
 
-rm test.dsstatgroupby.tmp
+# statistics calculated on several threads and merged
+../process/dsstatgroupby --threads=4 'Batch::LSF' basic 'start_time - submit_time' where 'start_time - submit_time > 50000' group by 'production' basic 'cpu_time/(end_time-start_time)' group by production quantile 'start_time - submit_time' where 'start_time - submit_time > 50000' group by production from $1/check-data/lsb.acct.2007-01-01-p1.ds >test.dsstatgroupby.tmp
+perl $1/check-data/clean-timing.pl <test.dsstatgroupby.tmp >test.dsstatgroupby.3
+perl $1/check-data/unordered-file-equality.pl test.dsstatgroupby.3 $1/check-data/test.dsstatgroupby.2.ref
+
+# approximate quantiles don't depend on how the rows were split up
+for threads in 1 4; do
+    ../process/dsstatgroupby --threads=$threads 'I/O' approx-quantile '1000*(return_to_driver - leave_driver)' group by 'device_number' from $1/check-data/h03126.ds-littleend | grep 'quantiles within' >test.dsstatgroupby.approx-$threads
+done
+cmp test.dsstatgroupby.approx-1 test.dsstatgroupby.approx-4
+
+rm test.dsstatgroupby.tmp test.dsstatgroupby.approx-1 test.dsstatgroupby.approx-4
 
 exit 0
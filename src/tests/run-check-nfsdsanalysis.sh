@@ -46,6 +46,29 @@ do_check nfs-2.set-0.20k
     $SRC/check-data/nfs-2.set-1.20k.ds >nfs-2.set-1.20k.tmp 
 do_check nfs-2.set-1.20k
 
+# Same as the first check, but with each of the common analyses on its own thread.
+../analysis/nfs/nfsdsanalysis -P 1 -a -c 1 -c 2,no_cube_time,no_print_rates -b '' \
+    -d 64000000c20f0300200000000127ef590364240c4fdf0058400000009a871600 \
+    -d a63c6021c20f0300200000000117721df1e3040064000000400000009a871600 \
+    -d e8535201c2cca305200000000079de25139fc708d6390035400000006bfc0800 \
+    -e e8535201c2cca3052000000000393dcb82c6fc08d6390035400000006bfc0800 \
+    -e $SRC/check-data/nfs.set6.20k.testfhs \
+    -f -g -i reply_order -i request_order -i overlapping_reorder -i overlapping_reorder=0.01 -j \
+    $SRC/check-data/nfs.set6.20k.ds >check.nfsdsanalysis.tmp
+do_check check.nfsdsanalysis
+
+# And with the rows of the -g analysis split over four threads, so that UniqueFileHandles
+# merges the state of several workers.
+../analysis/nfs/nfsdsanalysis -T 4 -a -c 1 -c 2,no_cube_time,no_print_rates -b '' \
+    -d 64000000c20f0300200000000127ef590364240c4fdf0058400000009a871600 \
+    -d a63c6021c20f0300200000000117721df1e3040064000000400000009a871600 \
+    -d e8535201c2cca305200000000079de25139fc708d6390035400000006bfc0800 \
+    -e e8535201c2cca3052000000000393dcb82c6fc08d6390035400000006bfc0800 \
+    -e $SRC/check-data/nfs.set6.20k.testfhs \
+    -f -g -i reply_order -i request_order -i overlapping_reorder -i overlapping_reorder=0.01 -j \
+    $SRC/check-data/nfs.set6.20k.ds >check.nfsdsanalysis.tmp
+do_check check.nfsdsanalysis
+
 if [ `whoami` = anderse -a -f ../analysis/nfs/set-5/cqracks.00000-00049.ds ]; then
     ../analysis/nfs/nfsdsanalysis -i ignore_server,ignore_client -i ignore_server -i ignore_client -i '' ../analysis/nfs/set-5/cqracks.000*ds | perl $SRC/check-data/clean-timing.pl >sequentiality.out
     cmp sequentiality.out ../analysis/nfs/set-5/sequentiality.out